@@ -0,0 +1,1418 @@
+/* bench.c
+
+   Copyright (c) 2003-2014 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*
+ * libhb throughput benchmark.
+ *
+ * Generates deterministic synthetic sources (progressive, interlaced,
+ * telecined and grainy video, multichannel audio, text subtitles) and
+ * times every video filter, the video and audio encoders in isolation, a
+ * scan and full transcode of a generated transport stream and the encoder
+ * option handling.  Results are written as JSON so that runs from
+ * different releases can be compared.
+ *
+ * Only the calls into libhb are timed; generating the input frames is not.
+ * Peak RSS is per case on Linux (VmHWM is reset before each case) and
+ * process wide elsewhere.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <math.h>
+
+#if !defined( __MINGW32__ )
+#include <sys/resource.h>
+#endif
+
+#include "hb.h"
+#include "hbffmpeg.h"
+#include "decsrtsub.h"
+
+#define BENCH_RATE        27000000
+#define BENCH_RATE_BASE   900900     // 29.97 fps
+#define BENCH_FRAME_TICKS 3003       // frame duration in 90kHz ticks
+#define BENCH_SUB_PERIOD  60         // frames between subtitle events
+#define BENCH_SAMPLERATE  48000
+
+enum
+{
+    SRC_PROGRESSIVE,
+    SRC_INTERLACED,
+    SRC_TELECINE,
+    SRC_GRAIN,
+};
+
+static const char * source_names[] =
+{
+    "progressive", "interlaced", "telecine", "grain"
+};
+
+enum
+{
+    KIND_FILTER,
+    KIND_VIDEO_ENCODER,
+    KIND_AUDIO_ENCODER,
+    KIND_SCAN,
+    KIND_PIPELINE,
+    KIND_OPTIONS,
+};
+
+static const char * kind_names[] =
+{
+    "filter", "encoder", "encoder", "stage", "pipeline", "options"
+};
+
+typedef struct
+{
+    const char * name;
+    int          kind;
+    int          id;        // filter id, video or audio codec
+    const char * settings;  // filter settings or encoder preset
+    int          source;
+    int          mixdown;   // audio only
+    int          bitrate;   // audio only
+} bench_case_t;
+
+static bench_case_t bench_cases[] =
+{
+    { "decomb",       KIND_FILTER, HB_FILTER_DECOMB,      NULL,                SRC_INTERLACED  },
+    { "deinterlace",  KIND_FILTER, HB_FILTER_DEINTERLACE, "1",                 SRC_INTERLACED  },
+    { "denoise",      KIND_FILTER, HB_FILTER_DENOISE,     "3:2:2:2:3:3",       SRC_GRAIN       },
+    { "deblock",      KIND_FILTER, HB_FILTER_DEBLOCK,     NULL,                SRC_GRAIN       },
+    { "detelecine",   KIND_FILTER, HB_FILTER_DETELECINE,  NULL,                SRC_TELECINE    },
+    { "rotate",       KIND_FILTER, HB_FILTER_ROTATE,      "4",                 SRC_PROGRESSIVE },
+    { "cropscale",    KIND_FILTER, HB_FILTER_CROP_SCALE,  NULL,                SRC_PROGRESSIVE },
+    { "rendersub",    KIND_FILTER, HB_FILTER_RENDER_SUB,  "0:0:0:0",           SRC_PROGRESSIVE },
+    { "vfr",          KIND_FILTER, HB_FILTER_VFR,         NULL,                SRC_TELECINE    },
+    { "enc-mpeg4",    KIND_VIDEO_ENCODER, HB_VCODEC_FFMPEG_MPEG4, NULL,        SRC_GRAIN       },
+    { "enc-x264",     KIND_VIDEO_ENCODER, HB_VCODEC_X264,  "veryfast",         SRC_GRAIN       },
+    { "enc-ac3-5.1",  KIND_AUDIO_ENCODER, HB_ACODEC_AC3,   NULL, 0, HB_AMIXDOWN_5POINT1, 448 },
+    { "enc-aac-2.0",  KIND_AUDIO_ENCODER, HB_ACODEC_FFAAC, NULL, 0, HB_AMIXDOWN_STEREO,  160 },
+    { "scan",         KIND_SCAN,     0, NULL, SRC_TELECINE },
+    { "transcode",    KIND_PIPELINE, 0, NULL, SRC_TELECINE },
+    { "encopts",      KIND_OPTIONS, HB_VCODEC_X264, NULL, 0 },
+    { NULL }
+};
+
+typedef struct
+{
+    const bench_case_t * c;
+    int       failed;
+    int       width;
+    int       height;
+    int       channels;
+    int       frames;       // input frames (or audio frames)
+    int       out_frames;
+    int64_t   units;        // pixels, samples or option operations
+    double    duration;     // media duration in seconds
+    uint64_t  usec;         // time spent in libhb
+    long      peak_rss;     // kB, -1 if unknown
+} bench_result_t;
+
+typedef struct
+{
+    hb_handle_t  * h;
+    int            width;
+    int            height;
+    int            frames;
+    uint32_t       seed;
+    volatile int   done;
+    hb_title_t   * title;
+    char           source[1024];
+    char           srt[1024];
+    char           output[1024];
+    int            have_source;
+} bench_t;
+
+static int    frames   = 240;
+static int    width    = 720;
+static int    height   = 480;
+static int    seed     = 1;
+static int    verbose  = 0;
+static char * only     = NULL;
+static char * report   = NULL;
+static int    list     = 0;
+
+static void ShowHelp( void );
+static int  ParseOptions( int argc, char ** argv );
+
+/****************************************************************************
+ * Peak RSS
+ ***************************************************************************/
+static void rss_reset( void )
+{
+#if defined( __linux__ )
+    // Writing 5 resets VmHWM to the current RSS (Linux 4.0+)
+    FILE * file = fopen( "/proc/self/clear_refs", "w" );
+    if( file != NULL )
+    {
+        fputs( "5", file );
+        fclose( file );
+    }
+#endif
+}
+
+static long rss_peak( void )
+{
+#if defined( __linux__ )
+    FILE * file = fopen( "/proc/self/status", "r" );
+    char   line[256];
+    long   kb = -1;
+
+    if( file != NULL )
+    {
+        while( fgets( line, sizeof( line ), file ) )
+        {
+            if( sscanf( line, "VmHWM: %ld", &kb ) == 1 )
+                break;
+        }
+        fclose( file );
+        if( kb >= 0 )
+            return kb;
+    }
+#endif
+#if !defined( __MINGW32__ )
+    struct rusage ru;
+
+    if( getrusage( RUSAGE_SELF, &ru ) == 0 )
+    {
+#if defined( __APPLE__ )
+        return ru.ru_maxrss / 1024;
+#else
+        return ru.ru_maxrss;
+#endif
+    }
+#endif
+    return -1;
+}
+
+/****************************************************************************
+ * Synthetic sources
+ ***************************************************************************/
+static uint32_t xorshift( uint32_t * state )
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+
+    return x;
+}
+
+/*
+ * Draws the scene at time t (seconds) into the given field of buf (0 top,
+ * 1 bottom, -1 both).  A moving gradient with a fast box and a block of
+ * fine detail, optionally with film grain.
+ */
+static void draw_scene( hb_buffer_t * buf, double t, int field,
+                        int grain, uint32_t grain_seed )
+{
+    int       first = field < 0 ? 0 : field;
+    int       step  = field < 0 ? 1 : 2;
+    int       pan   = (int)( t * 90 );
+    int       box_w = buf->f.width / 8;
+    int       box_h = buf->f.height / 6;
+    int       box_x = (int)( t * 480 ) % ( buf->f.width - box_w );
+    int       box_y = buf->f.height / 3;
+    uint32_t  state = grain_seed | 1;
+    int       pp, xx, yy;
+
+    for( yy = first; yy < buf->plane[0].height; yy += step )
+    {
+        uint8_t * line = buf->plane[0].data + yy * buf->plane[0].stride;
+
+        for( xx = 0; xx < buf->plane[0].width; xx++ )
+        {
+            int v = 16 + ( ( xx + yy / 2 + pan ) % 220 );
+
+            if( xx >= box_x && xx < box_x + box_w &&
+                yy >= box_y && yy < box_y + box_h )
+            {
+                v = 235;
+            }
+            else if( yy > buf->f.height * 3 / 4 &&
+                     xx > buf->f.width / 4 && xx < buf->f.width * 3 / 4 )
+            {
+                // fine detail, a worst case for denoise and deblock
+                v = ( ( xx + pan ) & 4 ) ^ ( yy & 4 ) ? 200 : 40;
+            }
+            if( grain )
+            {
+                v += (int)( xorshift( &state ) % ( 2 * grain + 1 ) ) - grain;
+                v = v < 16 ? 16 : v > 235 ? 235 : v;
+            }
+            line[xx] = v;
+        }
+    }
+    for( pp = 1; pp < 3; pp++ )
+    {
+        // chroma rows of a field are the even/odd chroma rows
+        for( yy = first; yy < buf->plane[pp].height; yy += step )
+        {
+            uint8_t * line = buf->plane[pp].data + yy * buf->plane[pp].stride;
+
+            for( xx = 0; xx < buf->plane[pp].width; xx++ )
+            {
+                line[xx] = pp == 1 ? 64 + ( ( xx + pan / 2 ) & 127 )
+                                   : 64 + ( ( yy * 2 + pan / 4 ) & 127 );
+            }
+        }
+    }
+}
+
+/* 3:2 pulldown field pattern: film frame shown in each field */
+static const int telecine_top[5]    = { 0, 1, 1, 2, 3 };
+static const int telecine_bottom[5] = { 0, 1, 2, 3, 3 };
+
+static hb_buffer_t * source_frame( bench_t * b, int source, int n )
+{
+    hb_buffer_t * buf;
+    double        frame_time = (double)BENCH_RATE_BASE / BENCH_RATE;
+    double        film_time  = 1001. / 24000;
+    uint32_t      grain_seed = b->seed ^ ( (uint32_t)n * 0x9e3779b9u );
+
+    buf = hb_frame_buffer_init( AV_PIX_FMT_YUV420P, b->width, b->height );
+    switch( source )
+    {
+        case SRC_PROGRESSIVE:
+            draw_scene( buf, n * frame_time, -1, 0, 0 );
+            buf->s.flags = PIC_FLAG_PROGRESSIVE_FRAME;
+            break;
+
+        case SRC_INTERLACED:
+            draw_scene( buf, n * frame_time, 0, 0, 0 );
+            draw_scene( buf, ( n + 0.5 ) * frame_time, 1, 0, 0 );
+            buf->s.flags = PIC_FLAG_TOP_FIELD_FIRST;
+            break;
+
+        case SRC_TELECINE:
+        {
+            int cycle = n / 5, pos = n % 5;
+
+            draw_scene( buf, ( cycle * 4 + telecine_top[pos] ) * film_time,
+                        0, 4, grain_seed );
+            draw_scene( buf, ( cycle * 4 + telecine_bottom[pos] ) * film_time,
+                        1, 4, grain_seed );
+            buf->s.flags = PIC_FLAG_TOP_FIELD_FIRST;
+        } break;
+
+        case SRC_GRAIN:
+            draw_scene( buf, n * frame_time, -1, 12, grain_seed );
+            buf->s.flags = PIC_FLAG_PROGRESSIVE_FRAME;
+            break;
+    }
+    buf->s.start    = (int64_t)n * BENCH_FRAME_TICKS;
+    buf->s.stop     = buf->s.start + BENCH_FRAME_TICKS;
+    buf->s.duration = BENCH_FRAME_TICKS;
+    buf->s.new_chap = n == 0;
+
+    return buf;
+}
+
+/* Interleaved float samples, a different tone on every channel */
+static void audio_samples( float * samples, int channels, int count,
+                           int64_t first, uint32_t * state )
+{
+    int ii, cc;
+
+    for( ii = 0; ii < count; ii++ )
+    {
+        double t = (double)( first + ii ) / BENCH_SAMPLERATE;
+
+        for( cc = 0; cc < channels; cc++ )
+        {
+            float noise = (float)( xorshift( state ) & 0xffff ) / 65536.f;
+
+            samples[ii * channels + cc] =
+                0.3 * sin( 2 * M_PI * 110 * ( cc + 1 ) * t ) +
+                0.02 * ( noise - 0.5f );
+        }
+    }
+}
+
+static hb_buffer_t * source_audio( int channels, int count, int n,
+                                   uint32_t * state )
+{
+    hb_buffer_t * buf = hb_buffer_init( count * channels * sizeof( float ) );
+    int64_t       first = (int64_t)n * count;
+
+    audio_samples( (float*)buf->data, channels, count, first, state );
+    buf->s.type  = AUDIO_BUF;
+    buf->s.start = first * 90000 / BENCH_SAMPLERATE;
+    buf->s.stop  = ( first + count ) * 90000 / BENCH_SAMPLERATE;
+
+    return buf;
+}
+
+static hb_buffer_t * source_subtitle( int n )
+{
+    char          text[128];
+    hb_buffer_t * buf;
+    int           len;
+
+    len = snprintf( text, sizeof( text ),
+                    "Benchmark subtitle %d\nwith <i>a second</i> line",
+                    n / BENCH_SUB_PERIOD + 1 );
+    buf = hb_buffer_init( len + 1 );
+    memcpy( buf->data, text, len + 1 );
+    buf->s.type  = SUBTITLE_BUF;
+    buf->s.start = (int64_t)n * BENCH_FRAME_TICKS;
+    buf->s.stop  = buf->s.start + BENCH_SUB_PERIOD * BENCH_FRAME_TICKS * 3 / 4;
+    hb_srt_to_ssa( buf, n / BENCH_SUB_PERIOD + 1 );
+
+    return buf;
+}
+
+/****************************************************************************
+ * Transport stream writer for the end-to-end source
+ ***************************************************************************/
+#define TS_PMT_PID   0x1000
+#define TS_VIDEO_PID 0x100
+#define TS_AUDIO_PID 0x101
+#define TS_PTS_BASE  90000
+
+typedef struct
+{
+    FILE    * file;
+    uint8_t   cc[0x2000];
+} ts_writer_t;
+
+static uint32_t crc32_mpeg( const uint8_t * data, int len )
+{
+    uint32_t crc = 0xffffffff;
+    int      ii;
+
+    while( len-- )
+    {
+        crc ^= (uint32_t)*data++ << 24;
+        for( ii = 0; ii < 8; ii++ )
+            crc = crc & 0x80000000 ? ( crc << 1 ) ^ 0x04c11db7 : crc << 1;
+    }
+    return crc;
+}
+
+/* Writes one TS packet, returns the number of payload bytes consumed */
+static int ts_packet( ts_writer_t * ts, int pid, int pusi, int64_t pcr,
+                      const uint8_t * data, int size )
+{
+    uint8_t pkt[188];
+    int     af  = pcr >= 0 ? 8 : 0;  // adaptation field incl. length byte
+    int     len = MIN( size, 184 - af );
+    int     pos = 4;
+
+    if( af + len < 184 )
+        af = 184 - len;
+
+    pkt[0] = 0x47;
+    pkt[1] = ( pusi ? 0x40 : 0 ) | ( pid >> 8 );
+    pkt[2] = pid & 0xff;
+    pkt[3] = ( af ? 0x30 : 0x10 ) | ( ts->cc[pid]++ & 0x0f );
+    if( af )
+    {
+        pkt[pos++] = af - 1;
+        if( af > 1 )
+        {
+            pkt[pos++] = pcr >= 0 ? 0x10 : 0x00;
+            if( pcr >= 0 )
+            {
+                pkt[pos++] = pcr >> 25;
+                pkt[pos++] = pcr >> 17;
+                pkt[pos++] = pcr >> 9;
+                pkt[pos++] = pcr >> 1;
+                pkt[pos++] = ( ( pcr & 1 ) << 7 ) | 0x7e;
+                pkt[pos++] = 0;
+            }
+            memset( pkt + pos, 0xff, 4 + af - pos );
+            pos = 4 + af;
+        }
+    }
+    memcpy( pkt + pos, data, len );
+    fwrite( pkt, 1, 188, ts->file );
+
+    return len;
+}
+
+static void ts_section( ts_writer_t * ts, int pid, uint8_t * section, int len )
+{
+    uint8_t  payload[184];
+    uint32_t crc = crc32_mpeg( section, len - 4 );
+
+    section[len - 4] = crc >> 24;
+    section[len - 3] = crc >> 16;
+    section[len - 2] = crc >> 8;
+    section[len - 1] = crc;
+
+    memset( payload, 0xff, sizeof( payload ) );
+    payload[0] = 0; // pointer field
+    memcpy( payload + 1, section, len );
+    ts_packet( ts, pid, 1, -1, payload, sizeof( payload ) );
+}
+
+static void ts_tables( ts_writer_t * ts )
+{
+    uint8_t pat[] =
+    {
+        0x00, 0xb0, 13, 0x00, 0x01, 0xc1, 0x00, 0x00,
+        0x00, 0x01, 0xe0 | ( TS_PMT_PID >> 8 ), TS_PMT_PID & 0xff,
+        0, 0, 0, 0
+    };
+    uint8_t pmt[] =
+    {
+        0x02, 0xb0, 23, 0x00, 0x01, 0xc1, 0x00, 0x00,
+        0xe0 | ( TS_VIDEO_PID >> 8 ), TS_VIDEO_PID & 0xff, 0xf0, 0x00,
+        0x02, 0xe0 | ( TS_VIDEO_PID >> 8 ), TS_VIDEO_PID & 0xff, 0xf0, 0x00,
+        0x81, 0xe0 | ( TS_AUDIO_PID >> 8 ), TS_AUDIO_PID & 0xff, 0xf0, 0x00,
+        0, 0, 0, 0
+    };
+
+    ts_section( ts, 0, pat, sizeof( pat ) );
+    ts_section( ts, TS_PMT_PID, pmt, sizeof( pmt ) );
+}
+
+static void ts_pes( ts_writer_t * ts, int pid, int stream_id, int64_t pts,
+                    const uint8_t * data, int size, int pcr )
+{
+    uint8_t * pes = malloc( size + 14 );
+    int       len = size + 8;
+    int       pos;
+
+    pes[0]  = 0;
+    pes[1]  = 0;
+    pes[2]  = 1;
+    pes[3]  = stream_id;
+    pes[4]  = len > 0xffff ? 0 : len >> 8;
+    pes[5]  = len > 0xffff ? 0 : len & 0xff;
+    pes[6]  = 0x80;
+    pes[7]  = 0x80; // PTS only
+    pes[8]  = 5;
+    pes[9]  = 0x21 | ( ( pts >> 29 ) & 0x0e );
+    pes[10] = pts >> 22;
+    pes[11] = ( ( pts >> 14 ) & 0xfe ) | 1;
+    pes[12] = pts >> 7;
+    pes[13] = ( ( pts << 1 ) & 0xfe ) | 1;
+    memcpy( pes + 14, data, size );
+
+    pos = ts_packet( ts, pid, 1, pcr ? pts - 9000 : -1, pes, size + 14 );
+    while( pos < size + 14 )
+    {
+        pos += ts_packet( ts, pid, 0, -1, pes + pos, size + 14 - pos );
+    }
+    free( pes );
+}
+
+static AVCodecContext * source_video_encoder( bench_t * b )
+{
+    AVCodec        * codec = avcodec_find_encoder( AV_CODEC_ID_MPEG2VIDEO );
+    AVCodecContext * context;
+
+    if( codec == NULL )
+        return NULL;
+    context = avcodec_alloc_context3( codec );
+    context->width        = b->width;
+    context->height       = b->height;
+    context->time_base    = (AVRational){ BENCH_RATE_BASE, BENCH_RATE };
+    context->pix_fmt      = AV_PIX_FMT_YUV420P;
+    context->gop_size     = 15;
+    context->max_b_frames = 0;
+    context->bit_rate     = 8000000;
+    context->flags       |= CODEC_FLAG_INTERLACED_DCT | CODEC_FLAG_INTERLACED_ME;
+    if( hb_avcodec_open( context, codec, NULL, 0 ) )
+    {
+        av_free( context );
+        return NULL;
+    }
+    return context;
+}
+
+static AVCodecContext * source_audio_encoder( void )
+{
+    AVCodec        * codec = avcodec_find_encoder( AV_CODEC_ID_AC3 );
+    AVCodecContext * context;
+
+    if( codec == NULL )
+        return NULL;
+    context = avcodec_alloc_context3( codec );
+    context->sample_fmt     = AV_SAMPLE_FMT_FLTP;
+    context->sample_rate    = BENCH_SAMPLERATE;
+    context->channels       = 6;
+    context->channel_layout = AV_CH_LAYOUT_5POINT1;
+    context->bit_rate       = 448000;
+    if( hb_avcodec_open( context, codec, NULL, 0 ) )
+    {
+        av_free( context );
+        return NULL;
+    }
+    return context;
+}
+
+static void write_srt( bench_t * b )
+{
+    FILE * file = fopen( b->srt, "w" );
+    int    n, cue = 1;
+
+    if( file == NULL )
+        return;
+    for( n = 0; n < b->frames; n += BENCH_SUB_PERIOD )
+    {
+        int64_t start = (int64_t)n * BENCH_FRAME_TICKS / 90;
+        int64_t stop  = start + BENCH_SUB_PERIOD * BENCH_FRAME_TICKS * 3 / 4 / 90;
+
+        fprintf( file, "%d\n", cue );
+        fprintf( file, "%02d:%02d:%02d,%03d --> %02d:%02d:%02d,%03d\n",
+                 (int)( start / 3600000 ), (int)( start / 60000 % 60 ),
+                 (int)( start / 1000 % 60 ), (int)( start % 1000 ),
+                 (int)( stop / 3600000 ), (int)( stop / 60000 % 60 ),
+                 (int)( stop / 1000 % 60 ), (int)( stop % 1000 ) );
+        fprintf( file, "Benchmark subtitle %d\nwith <i>a second</i> line\n\n",
+                 cue++ );
+    }
+    fclose( file );
+}
+
+/*
+ * Telecined, grainy MPEG-2 video with 5.1 AC-3 audio in a transport
+ * stream, plus an SRT file to burn in.
+ */
+static int write_source( bench_t * b )
+{
+    ts_writer_t      ts;
+    AVCodecContext * vcontext, * acontext;
+    AVFrame        * vframe, * aframe;
+    AVPacket         pkt;
+    float          * samples, * planar;
+    uint32_t         state = b->seed;
+    int              n, ii, cc, got, anum = 0;
+
+    if( b->have_source )
+        return 0;
+
+    vcontext = source_video_encoder( b );
+    acontext = source_audio_encoder();
+    if( vcontext == NULL || acontext == NULL )
+    {
+        fprintf( stderr, "bench: MPEG-2 or AC-3 encoder not available\n" );
+        return -1;
+    }
+    memset( &ts, 0, sizeof( ts ) );
+    ts.file = fopen( b->source, "wb" );
+    if( ts.file == NULL )
+    {
+        fprintf( stderr, "bench: cannot write %s\n", b->source );
+        return -1;
+    }
+
+    vframe  = av_frame_alloc();
+    aframe  = av_frame_alloc();
+    samples = malloc( acontext->frame_size * 6 * sizeof( float ) );
+    planar  = malloc( acontext->frame_size * 6 * sizeof( float ) );
+
+    for( n = 0; n < b->frames; n++ )
+    {
+        hb_buffer_t * buf = source_frame( b, SRC_TELECINE, n );
+
+        if( n % vcontext->gop_size == 0 )
+            ts_tables( &ts );
+
+        for( ii = 0; ii < 3; ii++ )
+        {
+            vframe->data[ii]     = buf->plane[ii].data;
+            vframe->linesize[ii] = buf->plane[ii].stride;
+        }
+        vframe->width            = b->width;
+        vframe->height           = b->height;
+        vframe->format           = AV_PIX_FMT_YUV420P;
+        vframe->pts              = n;
+        vframe->interlaced_frame = 1;
+        vframe->top_field_first  = 1;
+
+        av_init_packet( &pkt );
+        pkt.data = NULL;
+        pkt.size = 0;
+        if( avcodec_encode_video2( vcontext, &pkt, vframe, &got ) == 0 && got )
+        {
+            ts_pes( &ts, TS_VIDEO_PID, 0xe0,
+                    TS_PTS_BASE + pkt.pts * BENCH_FRAME_TICKS,
+                    pkt.data, pkt.size, 1 );
+            av_free_packet( &pkt );
+        }
+        hb_buffer_close( &buf );
+
+        // Audio up to the end of this video frame
+        while( (int64_t)anum * acontext->frame_size * 90000 / BENCH_SAMPLERATE <
+               (int64_t)( n + 1 ) * BENCH_FRAME_TICKS )
+        {
+            int64_t first = (int64_t)anum * acontext->frame_size;
+
+            audio_samples( samples, 6, acontext->frame_size, first, &state );
+            for( ii = 0; ii < acontext->frame_size; ii++ )
+                for( cc = 0; cc < 6; cc++ )
+                    planar[cc * acontext->frame_size + ii] = samples[ii * 6 + cc];
+
+            aframe->nb_samples     = acontext->frame_size;
+            aframe->format         = AV_SAMPLE_FMT_FLTP;
+            aframe->channel_layout = AV_CH_LAYOUT_5POINT1;
+            aframe->pts            = first;
+            avcodec_fill_audio_frame( aframe, 6, AV_SAMPLE_FMT_FLTP,
+                                      (uint8_t*)planar,
+                                      acontext->frame_size * 6 * sizeof( float ),
+                                      0 );
+            av_init_packet( &pkt );
+            pkt.data = NULL;
+            pkt.size = 0;
+            if( avcodec_encode_audio2( acontext, &pkt, aframe, &got ) == 0 && got )
+            {
+                ts_pes( &ts, TS_AUDIO_PID, 0xbd,
+                        TS_PTS_BASE + first * 90000 / BENCH_SAMPLERATE,
+                        pkt.data, pkt.size, 0 );
+                av_free_packet( &pkt );
+            }
+            anum++;
+        }
+    }
+
+    free( samples );
+    free( planar );
+    av_frame_free( &vframe );
+    av_frame_free( &aframe );
+    hb_avcodec_close( vcontext );
+    av_free( vcontext );
+    hb_avcodec_close( acontext );
+    av_free( acontext );
+    fclose( ts.file );
+
+    write_srt( b );
+    b->have_source = 1;
+
+    return 0;
+}
+
+/****************************************************************************
+ * Cases
+ ***************************************************************************/
+static hb_job_t * bench_job_init( bench_t * b )
+{
+    hb_job_t * job = hb_job_init( b->title );
+
+    // vfr stores its frame count in the handle's interjob data
+    job->h = b->h;
+
+    return job;
+}
+
+static int drain( hb_buffer_t ** buf )
+{
+    hb_buffer_t * b;
+    int           count = 0;
+
+    for( b = *buf; b != NULL; b = b->next )
+    {
+        count += b->size > 0;
+    }
+    hb_buffer_close( buf );
+
+    return count;
+}
+
+static hb_subtitle_t * bench_subtitle_init( hb_job_t * job )
+{
+    hb_subtitle_t * subtitle = calloc( 1, sizeof( hb_subtitle_t ) );
+
+    subtitle->source      = UTF8SUB;
+    subtitle->format      = TEXTSUB;
+    subtitle->config.dest = RENDERSUB;
+    subtitle->fifo_out    = hb_fifo_init( BENCH_SUB_PERIOD, 1 );
+    hb_list_add( job->list_subtitle, subtitle );
+
+    return subtitle;
+}
+
+static void run_filter( bench_t * b, bench_result_t * r )
+{
+    hb_job_t           * job = bench_job_init( b );
+    hb_filter_object_t * filter = hb_filter_init( r->c->id );
+    hb_subtitle_t      * subtitle = NULL;
+    hb_filter_init_t     init;
+    hb_buffer_t        * in, * out;
+    uint64_t             start;
+    int                  n;
+
+    if( r->c->id == HB_FILTER_RENDER_SUB )
+    {
+        subtitle = bench_subtitle_init( job );
+    }
+    if( r->c->id == HB_FILTER_CROP_SCALE )
+    {
+        // downscale by half, the common case for big sources
+        filter->settings = hb_strdup_printf( "%d:%d:0:0:0:0",
+                                             ( b->width / 2 ) & ~1,
+                                             ( b->height / 2 ) & ~1 );
+    }
+    else if( r->c->id == HB_FILTER_VFR )
+    {
+        // constant 23.976 fps from a telecined source
+        filter->settings = hb_strdup_printf( "1:%d:%d", BENCH_RATE, 1126125 );
+    }
+    else if( r->c->settings != NULL )
+    {
+        filter->settings = strdup( r->c->settings );
+    }
+    filter->done = &b->done;
+
+    memset( &init, 0, sizeof( init ) );
+    init.job        = job;
+    init.pix_fmt    = AV_PIX_FMT_YUV420P;
+    init.width      = b->width;
+    init.height     = b->height;
+    init.par_width  = 1;
+    init.par_height = 1;
+    init.vrate      = BENCH_RATE;
+    init.vrate_base = BENCH_RATE_BASE;
+    if( filter->init( filter, &init ) )
+    {
+        fprintf( stderr, "bench: %s failed to initialize\n", r->c->name );
+        r->failed = 1;
+        hb_filter_close( &filter );
+        goto done;
+    }
+
+    rss_reset();
+    for( n = 0; n <= b->frames; n++ )
+    {
+        // the last buffer is the end of stream
+        in = n < b->frames ? source_frame( b, r->c->source, n )
+                           : hb_buffer_init( 0 );
+        out = NULL;
+        if( subtitle != NULL && n < b->frames && n % BENCH_SUB_PERIOD == 0 )
+        {
+            hb_fifo_push( subtitle->fifo_out, source_subtitle( n ) );
+        }
+
+        start = hb_get_time_us();
+        filter->work( filter, &in, &out );
+        r->usec += hb_get_time_us() - start;
+
+        hb_buffer_close( &in );
+        r->out_frames += drain( &out );
+    }
+    r->peak_rss = rss_peak();
+
+    filter->close( filter );
+    hb_filter_close( &filter );
+
+done:
+    if( subtitle != NULL )
+    {
+        hb_fifo_close( &subtitle->fifo_out );
+    }
+    hb_job_close( &job );
+
+    r->width  = b->width;
+    r->height = b->height;
+    r->frames = b->frames;
+    r->units  = (int64_t)b->frames * b->width * b->height;
+    r->duration = (double)b->frames * BENCH_RATE_BASE / BENCH_RATE;
+}
+
+static void run_video_encoder( bench_t * b, bench_result_t * r )
+{
+    hb_job_t         * job = bench_job_init( b );
+    hb_work_object_t * w;
+    hb_buffer_t      * in, * out;
+    uint64_t           start;
+    int                n;
+
+    job->vcodec     = r->c->id;
+    job->vquality   = -1.0;
+    job->vbitrate   = 2500;
+    if( r->c->settings != NULL )
+    {
+        job->encoder_preset = strdup( r->c->settings );
+    }
+
+    switch( r->c->id )
+    {
+        case HB_VCODEC_X264:
+            w = hb_get_work( WORK_ENCX264 );
+            break;
+        default:
+            w = hb_get_work( WORK_ENCAVCODEC );
+            w->codec_param = AV_CODEC_ID_MPEG4;
+            break;
+    }
+    w->done   = &b->done;
+    w->config = &job->config;
+
+    if( w->init( w, job ) )
+    {
+        fprintf( stderr, "bench: %s failed to initialize\n", r->c->name );
+        r->failed = 1;
+        goto done;
+    }
+
+    rss_reset();
+    for( n = 0; n <= b->frames; n++ )
+    {
+        in  = n < b->frames ? source_frame( b, r->c->source, n )
+                            : hb_buffer_init( 0 );
+        out = NULL;
+
+        start = hb_get_time_us();
+        w->work( w, &in, &out );
+        r->usec += hb_get_time_us() - start;
+
+        hb_buffer_close( &in );
+        r->out_frames += drain( &out );
+    }
+    r->peak_rss = rss_peak();
+    w->close( w );
+
+done:
+    free( w );
+    hb_job_close( &job );
+
+    r->width  = b->width;
+    r->height = b->height;
+    r->frames = b->frames;
+    r->units  = (int64_t)b->frames * b->width * b->height;
+    r->duration = (double)b->frames * BENCH_RATE_BASE / BENCH_RATE;
+}
+
+static void run_audio_encoder( bench_t * b, bench_result_t * r )
+{
+    hb_job_t         * job = bench_job_init( b );
+    hb_audio_t       * audio = calloc( 1, sizeof( hb_audio_t ) );
+    hb_work_object_t * w = hb_codec_encoder( r->c->id );
+    hb_buffer_t      * in, * out;
+    uint32_t           state = b->seed;
+    uint64_t           start;
+    int                channels, count = 0, n;
+    double             seconds;
+
+    hb_audio_config_init( &audio->config );
+    audio->config.in.samplerate          = BENCH_SAMPLERATE;
+    audio->config.in.channel_layout      = AV_CH_LAYOUT_5POINT1;
+    audio->config.out.codec              = r->c->id;
+    audio->config.out.mixdown            = r->c->mixdown;
+    audio->config.out.samplerate         = BENCH_SAMPLERATE;
+    audio->config.out.bitrate            = r->c->bitrate;
+    audio->config.out.quality            = HB_INVALID_AUDIO_QUALITY;
+    audio->config.out.compression_level  = -1;
+    hb_list_add( job->list_audio, audio );
+    channels = hb_mixdown_get_discrete_channel_count( r->c->mixdown );
+
+    w->done   = &b->done;
+    w->audio  = audio;
+    w->config = &audio->priv.config;
+    if( w->init( w, job ) )
+    {
+        fprintf( stderr, "bench: %s failed to initialize\n", r->c->name );
+        r->failed = 1;
+        goto done;
+    }
+
+    // As much audio as the video cases have frames
+    seconds = (double)b->frames * BENCH_RATE_BASE / BENCH_RATE;
+    count   = seconds * BENCH_SAMPLERATE / audio->config.out.samples_per_frame;
+
+    rss_reset();
+    for( n = 0; n <= count; n++ )
+    {
+        in  = n < count ? source_audio( channels,
+                                        audio->config.out.samples_per_frame,
+                                        n, &state )
+                        : hb_buffer_init( 0 );
+        out = NULL;
+
+        start = hb_get_time_us();
+        w->work( w, &in, &out );
+        r->usec += hb_get_time_us() - start;
+
+        hb_buffer_close( &in );
+        r->out_frames += drain( &out );
+    }
+    r->peak_rss = rss_peak();
+    w->close( w );
+
+    r->channels = channels;
+    r->frames   = count;
+    r->units    = (int64_t)count * audio->config.out.samples_per_frame *
+                  channels;
+    r->duration = (double)count * audio->config.out.samples_per_frame /
+                  BENCH_SAMPLERATE;
+
+done:
+    free( w );
+    hb_job_close( &job );
+}
+
+static int wait_state( bench_t * b, int state, hb_state_t * s )
+{
+    for( ;; )
+    {
+        hb_get_state( b->h, s );
+        if( s->state == state )
+            return 0;
+        hb_snooze( 10 );
+    }
+}
+
+static hb_title_t * scan_source( bench_t * b, bench_result_t * r )
+{
+    hb_state_t s;
+    uint64_t   start;
+
+    if( write_source( b ) )
+    {
+        r->failed = 1;
+        return NULL;
+    }
+
+    rss_reset();
+    start = hb_get_time_us();
+    hb_scan( b->h, b->source, 0, 10, 0, 0 );
+    wait_state( b, HB_STATE_SCANDONE, &s );
+    if( r != NULL )
+    {
+        r->usec     = hb_get_time_us() - start;
+        r->peak_rss = rss_peak();
+        r->width    = b->width;
+        r->height   = b->height;
+        r->frames   = 10; // previews decoded by the scan
+        r->units    = (int64_t)r->frames * b->width * b->height;
+    }
+
+    return hb_list_item( hb_get_titles( b->h ), 0 );
+}
+
+static void run_scan( bench_t * b, bench_result_t * r )
+{
+    if( scan_source( b, r ) == NULL )
+    {
+        fprintf( stderr, "bench: no title found in %s\n", b->source );
+        r->failed = 1;
+    }
+}
+
+/*
+ * The whole pipeline as the CLI would set it up: read, decode, sync,
+ * detelecine, decomb, denoise, burned in subtitles, scale, pfr, x264,
+ * AAC stereo and AC-3 5.1 encodes and the mp4 muxer.
+ */
+static void run_pipeline( bench_t * b, bench_result_t * r )
+{
+    hb_title_t           * title = scan_source( b, NULL );
+    hb_job_t             * job;
+    hb_audio_config_t      audio;
+    hb_subtitle_config_t   sub;
+    hb_state_t             s;
+    char                 * settings;
+    uint64_t               start;
+
+    if( title == NULL )
+    {
+        fprintf( stderr, "bench: no title found in %s\n", b->source );
+        r->failed = 1;
+        return;
+    }
+    job = hb_job_init( title );
+
+    memset( job->crop, 0, sizeof( job->crop ) );
+    job->width  = title->width;
+    job->height = title->height;
+    job->vcodec = HB_VCODEC_X264;
+    job->vquality = 22;
+    job->vbitrate = 0;
+    job->encoder_preset = strdup( "veryfast" );
+    job->file = strdup( b->output );
+
+    hb_add_filter( job, hb_filter_init( HB_FILTER_DETELECINE ), NULL );
+    hb_add_filter( job, hb_filter_init( HB_FILTER_DECOMB ), NULL );
+    hb_add_filter( job, hb_filter_init( HB_FILTER_DENOISE ), "3:2:2:2:3:3" );
+
+    memset( &sub, 0, sizeof( sub ) );
+    sub.dest = RENDERSUB;
+    strncpy( sub.src_filename, b->srt, sizeof( sub.src_filename ) - 1 );
+    strcpy( sub.src_codeset, "UTF-8" );
+    hb_srt_add( job, &sub, "eng" );
+    hb_add_filter( job, hb_filter_init( HB_FILTER_RENDER_SUB ), "0:0:0:0" );
+
+    settings = hb_strdup_printf( "%d:%d:0:0:0:0", job->width, job->height );
+    hb_add_filter( job, hb_filter_init( HB_FILTER_CROP_SCALE ), settings );
+    free( settings );
+    settings = hb_strdup_printf( "2:%d:%d", title->rate, title->rate_base );
+    hb_add_filter( job, hb_filter_init( HB_FILTER_VFR ), settings );
+    free( settings );
+
+    hb_audio_config_init( &audio );
+    audio.in.track          = 0;
+    audio.out.codec         = HB_ACODEC_FFAAC;
+    audio.out.mixdown       = HB_AMIXDOWN_STEREO;
+    audio.out.samplerate    = BENCH_SAMPLERATE;
+    audio.out.bitrate       = 160;
+    hb_audio_add( job, &audio );
+    audio.out.codec         = HB_ACODEC_AC3;
+    audio.out.mixdown       = HB_AMIXDOWN_5POINT1;
+    audio.out.bitrate       = 448;
+    hb_audio_add( job, &audio );
+
+    hb_add( b->h, job );
+    hb_job_close( &job );
+
+    rss_reset();
+    start = hb_get_time_us();
+    hb_start( b->h );
+    wait_state( b, HB_STATE_WORKDONE, &s );
+    r->usec     = hb_get_time_us() - start;
+    r->peak_rss = rss_peak();
+    r->failed   = s.param.workdone.error != HB_ERROR_NONE;
+
+    r->width  = b->width;
+    r->height = b->height;
+    r->frames = b->frames;
+    r->units  = (int64_t)b->frames * b->width * b->height;
+    r->duration = (double)b->frames * BENCH_RATE_BASE / BENCH_RATE;
+}
+
+/*
+ * Encoder option handling as it is done for every job: parse an option
+ * string into a dictionary, look up, override and unset options and turn
+ * the dictionary back into a string.  One "frame" is one option string.
+ */
+static const char * bench_opts[] =
+{
+    "ref", "bframes", "b-adapt", "b-pyramid", "direct", "weightb",
+    "weightp", "me", "merange", "subme", "trellis", "analyse", "8x8dct",
+    "cabac", "deblock", "psy-rd", "aq-mode", "aq-strength", "rc-lookahead",
+    "mbtree", "scenecut", "keyint", "min-keyint", "vbv-maxrate",
+    "vbv-bufsize", "qcomp", "ipratio", "pbratio", "chroma-qp-offset",
+    "fast-pskip", "dct-decimate", "mixed-refs", "no-dct-decimate",
+    "nal-hrd", "open-gop", "sliced-threads", "threads", "lookahead-threads",
+    "level", "profile", NULL
+};
+
+static void run_options( bench_t * b, bench_result_t * r )
+{
+    char      encopts[2048];
+    char    * out;
+    uint64_t  start;
+    int       count, n, ii, len = 0;
+
+    for( count = 0; bench_opts[count] != NULL; count++ )
+    {
+        len += snprintf( encopts + len, sizeof( encopts ) - len, "%s%s=%d",
+                         count ? ":" : "", bench_opts[count], count );
+    }
+
+    rss_reset();
+    start = hb_get_time_us();
+    for( n = 0; n < b->frames * 100; n++ )
+    {
+        hb_dict_t * dict = hb_encopts_to_dict( encopts, r->c->id );
+
+        for( ii = 0; ii < count; ii++ )
+        {
+            hb_dict_get( dict, bench_opts[ii] );
+        }
+        for( ii = 0; ii < count; ii++ )
+        {
+            if( ii & 1 )
+                hb_dict_set( &dict, bench_opts[ii], "1" );
+            else
+                hb_dict_unset( &dict, bench_opts[ii] );
+        }
+        out = hb_dict_to_encopts( dict );
+        free( out );
+        hb_dict_free( &dict );
+    }
+    r->usec     = hb_get_time_us() - start;
+    r->peak_rss = rss_peak();
+
+    r->frames = b->frames * 100;
+    r->units  = (int64_t)r->frames * count * 3;
+}
+
+/****************************************************************************
+ * Report
+ ***************************************************************************/
+static void print_result( FILE * file, bench_result_t * r, int last )
+{
+    double       seconds = r->usec / 1e6;
+    int          audio   = r->c->kind == KIND_AUDIO_ENCODER;
+    int          options = r->c->kind == KIND_OPTIONS;
+    const char * unit    = audio   ? "ns_per_sample" :
+                           options ? "ns_per_op" : "ns_per_pixel";
+
+    fprintf( file, "    {\n" );
+    fprintf( file, "      \"name\": \"%s\",\n", r->c->name );
+    fprintf( file, "      \"kind\": \"%s\",\n", kind_names[r->c->kind] );
+    if( options )
+    {
+        fprintf( file, "      \"encoder\": \"%s\",\n",
+                 hb_video_encoder_get_short_name( r->c->id ) );
+    }
+    else if( !audio )
+    {
+        fprintf( file, "      \"source\": \"%s\",\n",
+                 source_names[r->c->source] );
+        fprintf( file, "      \"width\": %d,\n", r->width );
+        fprintf( file, "      \"height\": %d,\n", r->height );
+    }
+    else
+    {
+        fprintf( file, "      \"samplerate\": %d,\n", BENCH_SAMPLERATE );
+        fprintf( file, "      \"channels\": %d,\n", r->channels );
+    }
+    fprintf( file, "      \"status\": \"%s\",\n", r->failed ? "failed" : "ok" );
+    fprintf( file, "      \"frames\": %d,\n", r->frames );
+    fprintf( file, "      \"frames_out\": %d,\n", r->out_frames );
+    fprintf( file, "      \"seconds\": %.6f,\n", seconds );
+    if( r->failed || seconds <= 0 || r->units <= 0 )
+    {
+        fprintf( file, "      \"fps\": null,\n" );
+        fprintf( file, "      \"%s\": null,\n", unit );
+        fprintf( file, "      \"speed\": null,\n" );
+    }
+    else
+    {
+        fprintf( file, "      \"fps\": %.3f,\n", r->frames / seconds );
+        fprintf( file, "      \"%s\": %.4f,\n", unit,
+                 seconds * 1e9 / r->units );
+        if( r->duration > 0 )
+            fprintf( file, "      \"speed\": %.3f,\n", r->duration / seconds );
+        else
+            fprintf( file, "      \"speed\": null,\n" );
+    }
+    if( r->peak_rss >= 0 )
+        fprintf( file, "      \"peak_rss_kb\": %ld\n", r->peak_rss );
+    else
+        fprintf( file, "      \"peak_rss_kb\": null\n" );
+    fprintf( file, "    }%s\n", last ? "" : "," );
+}
+
+static int case_selected( const char * name )
+{
+    char * copy, * tok, * save = NULL;
+    int    found = 0;
+
+    if( only == NULL )
+        return 1;
+    copy = strdup( only );
+    for( tok = strtok_r( copy, ",", &save ); tok != NULL && !found;
+         tok = strtok_r( NULL, ",", &save ) )
+    {
+        found = !strcmp( tok, name );
+    }
+    free( copy );
+
+    return found;
+}
+
+int main( int argc, char ** argv )
+{
+    bench_t          b;
+    bench_result_t * results;
+    FILE           * file = stdout;
+    char             dirname[1024];
+    int              count = 0, failed = 0, ii;
+
+    if( ParseOptions( argc, argv ) )
+    {
+        return 1;
+    }
+    if( list )
+    {
+        for( ii = 0; bench_cases[ii].name != NULL; ii++ )
+        {
+            fprintf( stdout, "%-14s %s\n", bench_cases[ii].name,
+                     kind_names[bench_cases[ii].kind] );
+        }
+        return 0;
+    }
+
+    memset( &b, 0, sizeof( b ) );
+    b.width  = width & ~1;
+    b.height = height & ~1;
+    b.frames = frames;
+    b.seed   = seed;
+
+    hb_global_init();
+    b.h = hb_init( verbose, 0 );
+
+    memset( dirname, 0, sizeof( dirname ) );
+    hb_get_temporary_directory( dirname );
+    hb_mkdir( dirname );
+    hb_get_tempory_filename( b.h, b.source, "bench.ts" );
+    hb_get_tempory_filename( b.h, b.srt, "bench.srt" );
+    hb_get_tempory_filename( b.h, b.output, "bench.mp4" );
+
+    // A fake title for the cases that don't read a file
+    b.title = hb_title_init( "bench", 1 );
+    b.title->width     = b.width;
+    b.title->height    = b.height;
+    b.title->rate      = BENCH_RATE;
+    b.title->rate_base = BENCH_RATE_BASE;
+    b.title->aspect    = (double)b.width / b.height;
+
+    results = calloc( sizeof( bench_result_t ),
+                      sizeof( bench_cases ) / sizeof( bench_cases[0] ) );
+    for( ii = 0; bench_cases[ii].name != NULL; ii++ )
+    {
+        bench_result_t * r = &results[count];
+
+        if( !case_selected( bench_cases[ii].name ) )
+            continue;
+        r->c        = &bench_cases[ii];
+        r->peak_rss = -1;
+
+        fprintf( stderr, "bench: %s\n", r->c->name );
+        switch( r->c->kind )
+        {
+            case KIND_FILTER:        run_filter( &b, r );        break;
+            case KIND_VIDEO_ENCODER: run_video_encoder( &b, r ); break;
+            case KIND_AUDIO_ENCODER: run_audio_encoder( &b, r ); break;
+            case KIND_SCAN:          run_scan( &b, r );          break;
+            case KIND_PIPELINE:      run_pipeline( &b, r );      break;
+            case KIND_OPTIONS:       run_options( &b, r );       break;
+        }
+        failed += r->failed;
+        count++;
+    }
+
+    if( report != NULL && ( file = fopen( report, "w" ) ) == NULL )
+    {
+        fprintf( stderr, "bench: cannot write %s\n", report );
+        file = stdout;
+    }
+    fprintf( file, "{\n" );
+    fprintf( file, "  \"version\": \"%s\",\n", hb_get_version( b.h ) );
+    fprintf( file, "  \"build\": %d,\n", hb_get_build( b.h ) );
+    fprintf( file, "  \"cpu_count\": %d,\n", hb_get_cpu_count() );
+    fprintf( file, "  \"width\": %d,\n", b.width );
+    fprintf( file, "  \"height\": %d,\n", b.height );
+    fprintf( file, "  \"frames\": %d,\n", b.frames );
+    fprintf( file, "  \"seed\": %u,\n", b.seed );
+    fprintf( file, "  \"cases\": [\n" );
+    for( ii = 0; ii < count; ii++ )
+    {
+        print_result( file, &results[ii], ii == count - 1 );
+    }
+    fprintf( file, "  ]\n}\n" );
+    if( file != stdout )
+        fclose( file );
+
+    free( results );
+    hb_title_close( &b.title );
+    hb_close( &b.h );
+    hb_global_close();
+
+    return failed ? 1 : 0;
+}
+
+/****************************************************************************
+ * ShowHelp:
+ ****************************************************************************/
+static void ShowHelp( void )
+{
+    FILE * const out = stdout;
+
+    fprintf( out,
+    "Syntax: HandBrakeBench [options]\n"
+    "\n"
+    "Times libhb filters, encoders and the full pipeline on generated\n"
+    "sources and writes a JSON report.\n"
+    "\n"
+    "    -h, --help              Print help\n"
+    "    -l, --list              List the benchmark cases\n"
+    "    -c, --case <string>     Only run these cases (comma separated)\n"
+    "    -o, --output <file>     Write the report to <file> (default stdout)\n"
+    "    -f, --frames <number>   Frames per case (default 240)\n"
+    "    -W, --width <number>    Source width (default 720)\n"
+    "    -H, --height <number>   Source height (default 480)\n"
+    "    -s, --seed <number>     Seed for the generated grain and noise\n"
+    "    -v, --verbose           Show libhb log output\n"
+    "\n" );
+}
+
+/****************************************************************************
+ * ParseOptions:
+ ****************************************************************************/
+static int ParseOptions( int argc, char ** argv )
+{
+    static struct option long_options[] =
+    {
+        { "help",    no_argument,       NULL, 'h' },
+        { "list",    no_argument,       NULL, 'l' },
+        { "case",    required_argument, NULL, 'c' },
+        { "output",  required_argument, NULL, 'o' },
+        { "frames",  required_argument, NULL, 'f' },
+        { "width",   required_argument, NULL, 'W' },
+        { "height",  required_argument, NULL, 'H' },
+        { "seed",    required_argument, NULL, 's' },
+        { "verbose", no_argument,       NULL, 'v' },
+        { 0, 0, 0, 0 }
+    };
+    int c;
+
+    for( ;; )
+    {
+        int option_index = 0;
+
+        c = getopt_long( argc, argv, "hlc:o:f:W:H:s:v",
+                         long_options, &option_index );
+        if( c < 0 )
+            break;
+
+        switch( c )
+        {
+            case 'h':
+                ShowHelp();
+                exit( 0 );
+            case 'l':
+                list = 1;
+                break;
+            case 'c':
+                only = strdup( optarg );
+                break;
+            case 'o':
+                report = strdup( optarg );
+                break;
+            case 'f':
+                frames = atoi( optarg );
+                break;
+            case 'W':
+                width = atoi( optarg );
+                break;
+            case 'H':
+                height = atoi( optarg );
+                break;
+            case 's':
+                seed = atoi( optarg );
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                fprintf( stderr, "unknown option (%s)\n", argv[optind-1] );
+                return -1;
+        }
+    }
+    if( frames < 1 || width < 64 || height < 64 )
+    {
+        fprintf( stderr, "invalid frame count or size\n" );
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,454 @@
+/* analyze.c
+
+   Copyright (c) 2003-2014 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*
+ * Frame analysis filter.
+ *
+ * Runs after all other filters and computes per-frame statistics of the
+ * frames the encoder will actually see: spatial complexity, motion
+ * relative to the previous frame and scene changes.  The results are
+ * stored in the buffer settings (buf->s.complexity, buf->s.motion,
+ * buf->s.scenecut) so that encoders can use them for keyframe placement
+ * instead of running their own scene-cut analysis.
+ *
+ * Each frame is split into horizontal bands of 16x16 blocks which are
+ * analyzed in parallel, one band per CPU.
+ *
+ * The gamma weighted block SSE kernel is shared with the VFR filter's
+ * duplicate frame detection.
+ */
+
+#include "hb.h"
+#include "taskset.h"
+
+#define SCENECUT_DEFAULT   50   // % of blocks that must change for a cut
+#define SCENECUT_RATIO     3.0  // motion must exceed this * running average
+#define BLOCK_CHANGE_SSE   (10000 * 256) // per block, gamma weighted
+
+typedef struct analyze_segment_s {
+    uint64_t sse;       // gamma weighted sum of squared errors
+    uint64_t activity;  // sum of absolute luma gradients
+    int      changed;   // blocks whose SSE exceeds BLOCK_CHANGE_SSE
+} analyze_segment_t;
+
+typedef struct analyze_thread_arg_s {
+    hb_filter_private_t *pv;
+    int segment;
+} analyze_thread_arg_t;
+
+struct hb_filter_private_s
+{
+    int                 scenecut;
+    int                 width;
+    int                 height;
+
+    int                 cpu_count;
+    taskset_t           analyze_taskset;  // Threads for analysis - one per CPU
+    analyze_segment_t * segments;         // Per thread results
+
+    hb_buffer_t       * cur;        // frame being analyzed
+    uint8_t           * ref;        // luma of the previous frame
+    int                 ref_width;
+    int                 ref_height;
+    int                 have_ref;
+    unsigned            gamma_lut[256];
+
+    double              avg_motion; // running average of motion
+
+    int                 frames;
+    int                 scenecuts;
+    double              total_complexity;
+};
+
+static int hb_analyze_init( hb_filter_object_t * filter,
+                            hb_filter_init_t * init );
+
+static int hb_analyze_work( hb_filter_object_t * filter,
+                            hb_buffer_t ** buf_in,
+                            hb_buffer_t ** buf_out );
+
+static void hb_analyze_close( hb_filter_object_t * filter );
+
+static int hb_analyze_info( hb_filter_object_t * filter,
+                            hb_filter_info_t * info );
+
+hb_filter_object_t hb_filter_analyze =
+{
+    .id            = HB_FILTER_ANALYZE,
+    .enforce_order = 1,
+    .name          = "Frame Analysis (complexity & scene changes)",
+    .settings      = NULL,
+    .init          = hb_analyze_init,
+    .work          = hb_analyze_work,
+    .close         = hb_analyze_close,
+    .info          = hb_analyze_info
+};
+
+// Create gamma lookup table.
+// Note that we are creating a scaled integer lookup table that will
+// not cause overflows in sse_block16() below.  This results in
+// small values being truncated to 0 which is ok for this usage.
+void hb_motion_gamma_lut( unsigned gamma_lut[256] )
+{
+    int i;
+    for( i = 0; i < 256; i++ )
+    {
+        gamma_lut[i] = 4095 * pow( ( (float)i / (float)255 ), 2.2f );
+    }
+}
+
+// Compute ths sum of squared errors for a 16x16 block
+// Gamma adjusts pixel values so that less visible diffreences
+// count less.
+static inline unsigned sse_block16( const unsigned *g,
+                                    const uint8_t *a, int a_stride,
+                                    const uint8_t *b, int b_stride )
+{
+    int x, y;
+    unsigned sum = 0;
+    int diff;
+
+    for( y = 0; y < 16; y++ )
+    {
+        for( x = 0; x < 16; x++ )
+        {
+            diff =  g[a[x]] - g[b[x]];
+            sum += diff * diff;
+        }
+        a += a_stride;
+        b += b_stride;
+    }
+    return sum;
+}
+
+// Sum of absolute horizontal and vertical luma gradients inside
+// a 16x16 block.  A cheap measure of spatial detail.
+static inline unsigned activity_block16( const uint8_t *a, int stride )
+{
+    int x, y;
+    unsigned sum = 0;
+
+    for( y = 0; y < 15; y++ )
+    {
+        for( x = 0; x < 15; x++ )
+        {
+            sum += abs( a[x] - a[x + 1] ) + abs( a[x] - a[x + stride] );
+        }
+        a += stride;
+    }
+    return sum;
+}
+
+// Sum of squared errors.  Computes and sums the SSEs for all
+// 16x16 blocks in the images.  Only checks the Y component.
+float hb_motion_metric( const unsigned * gamma_lut,
+                        hb_buffer_t * a, hb_buffer_t * b )
+{
+    int bw = a->f.width / 16;
+    int bh = a->f.height / 16;
+    int stride = a->plane[0].stride;
+    uint8_t * pa = a->plane[0].data;
+    uint8_t * pb = b->plane[0].data;
+    int x, y;
+    uint64_t sum = 0;
+
+    for( y = 0; y < bh; y++ )
+    {
+        for( x = 0; x < bw; x++ )
+        {
+            sum +=  sse_block16( gamma_lut,
+                                 pa + y * 16 * stride + x * 16, stride,
+                                 pb + y * 16 * stride + x * 16, stride );
+        }
+    }
+    return (float)sum / ( a->f.width * a->f.height );
+}
+
+/*
+ * Analyze this band of blocks of the luma plane in a single thread
+ * and save its rows as the reference for the next frame.
+ */
+void analyze_filter_thread( void *thread_args_v )
+{
+    hb_filter_private_t * pv;
+    analyze_thread_arg_t *thread_args = thread_args_v;
+    analyze_segment_t * result;
+    int run = 1;
+    int segment;
+
+    pv = thread_args->pv;
+    segment = thread_args->segment;
+    result = &pv->segments[segment];
+
+    hb_log("Analyze thread started for segment %d", segment);
+
+    while( run )
+    {
+        /*
+         * Wait here until there is work to do.
+         */
+        taskset_thread_wait4start( &pv->analyze_taskset, segment );
+
+        if( taskset_thread_stop( &pv->analyze_taskset, segment ) )
+        {
+            /*
+             * No more work to do, exit this thread.
+             */
+            run = 0;
+            goto report_completion;
+        }
+
+        hb_buffer_t * buf = pv->cur;
+        if( buf == NULL )
+        {
+            hb_error( "Thread started when no work available" );
+            hb_snooze(500);
+            goto report_completion;
+        }
+
+        int stride = buf->plane[0].stride;
+        int width  = buf->plane[0].width;
+        int height = buf->plane[0].height;
+        int bw = width / 16;
+        int bh = height / 16;
+        int bstart = ( bh / pv->cpu_count ) * segment;
+        int bstop;
+        int x, y;
+
+        if( segment == pv->cpu_count - 1 )
+        {
+            /*
+             * Final segment
+             */
+            bstop = bh;
+        } else {
+            bstop = ( bh / pv->cpu_count ) * ( segment + 1 );
+        }
+
+        result->sse      = 0;
+        result->activity = 0;
+        result->changed  = 0;
+        for( y = bstart; y < bstop; y++ )
+        {
+            uint8_t * cur = buf->plane[0].data + y * 16 * stride;
+            uint8_t * ref = pv->ref + y * 16 * width;
+
+            for( x = 0; x < bw; x++ )
+            {
+                result->activity += activity_block16( cur + x * 16, stride );
+                if( pv->have_ref )
+                {
+                    unsigned sse = sse_block16( pv->gamma_lut,
+                                                cur + x * 16, stride,
+                                                ref + x * 16, width );
+                    result->sse += sse;
+                    if( sse > BLOCK_CHANGE_SSE )
+                        result->changed++;
+                }
+            }
+        }
+
+        /*
+         * Keep this band of the luma plane for the next frame.  The
+         * final segment also takes the rows below the last full block.
+         */
+        int row_start = bstart * 16;
+        int row_stop  = segment == pv->cpu_count - 1 ? height : bstop * 16;
+        for( y = row_start; y < row_stop; y++ )
+        {
+            memcpy( pv->ref + y * width,
+                    buf->plane[0].data + y * stride, width );
+        }
+
+report_completion:
+        /*
+         * Finished this segment, let everyone know.
+         */
+        taskset_thread_complete( &pv->analyze_taskset, segment );
+    }
+}
+
+static int hb_analyze_init( hb_filter_object_t * filter,
+                            hb_filter_init_t * init )
+{
+    filter->private_data = calloc( 1, sizeof(struct hb_filter_private_s) );
+    hb_filter_private_t * pv = filter->private_data;
+
+    pv->scenecut = SCENECUT_DEFAULT;
+    if( filter->settings )
+    {
+        sscanf( filter->settings, "%d", &pv->scenecut );
+    }
+    pv->width  = init->width;
+    pv->height = init->height;
+    hb_motion_gamma_lut( pv->gamma_lut );
+
+    pv->cpu_count = hb_get_cpu_count();
+
+    /*
+     * Create analyze taskset.
+     */
+    pv->segments = calloc( pv->cpu_count, sizeof( analyze_segment_t ) );
+    if( pv->segments == NULL ||
+        taskset_init( &pv->analyze_taskset, /*thread_count*/pv->cpu_count,
+                      sizeof( analyze_thread_arg_t ) ) == 0 )
+    {
+        hb_error( "analyze could not initialize taskset" );
+        return 1;
+    }
+
+    int i;
+    for( i = 0; i < pv->cpu_count; i++ )
+    {
+        analyze_thread_arg_t *thread_args;
+
+        thread_args = taskset_thread_args( &pv->analyze_taskset, i );
+
+        thread_args->pv = pv;
+        thread_args->segment = i;
+
+        if( taskset_thread_spawn( &pv->analyze_taskset, i,
+                                  "analyze_filter_segment",
+                                  analyze_filter_thread,
+                                  HB_NORMAL_PRIORITY ) == 0 )
+        {
+            hb_error( "analyze could not spawn thread" );
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int hb_analyze_info( hb_filter_object_t * filter,
+                            hb_filter_info_t * info )
+{
+    hb_filter_private_t * pv = filter->private_data;
+    if( !pv )
+        return 1;
+
+    memset( info, 0, sizeof( hb_filter_info_t ) );
+    info->out.width = pv->width;
+    info->out.height = pv->height;
+    sprintf( info->human_readable_desc,
+             "scene change when %d%% of blocks change", pv->scenecut );
+    return 0;
+}
+
+static void hb_analyze_close( hb_filter_object_t * filter )
+{
+    hb_filter_private_t * pv = filter->private_data;
+
+    if( !pv )
+    {
+        return;
+    }
+
+    if( pv->frames )
+    {
+        hb_log( "analyze: %d frames, %d scene changes, average complexity %.2f",
+                pv->frames, pv->scenecuts, pv->total_complexity / pv->frames );
+    }
+
+    taskset_fini( &pv->analyze_taskset );
+
+    free( pv->segments );
+    free( pv->ref );
+    free( pv );
+    filter->private_data = NULL;
+}
+
+static int hb_analyze_work( hb_filter_object_t * filter,
+                            hb_buffer_t ** buf_in,
+                            hb_buffer_t ** buf_out )
+{
+    hb_filter_private_t * pv = filter->private_data;
+    hb_buffer_t * in = *buf_in;
+
+    *buf_in = NULL;
+    *buf_out = in;
+    if ( in->size <= 0 )
+    {
+        return HB_FILTER_DONE;
+    }
+
+    int width  = in->plane[0].width;
+    int height = in->plane[0].height;
+    if( pv->ref == NULL || width != pv->ref_width || height != pv->ref_height )
+    {
+        free( pv->ref );
+        pv->ref = malloc( width * height );
+        pv->ref_width  = width;
+        pv->ref_height = height;
+        pv->have_ref   = 0;
+        if( pv->ref == NULL )
+        {
+            return HB_FILTER_OK;
+        }
+    }
+
+    pv->cur = in;
+    taskset_cycle( &pv->analyze_taskset );
+    pv->cur = NULL;
+
+    uint64_t sse = 0, activity = 0;
+    int changed = 0, i;
+    for( i = 0; i < pv->cpu_count; i++ )
+    {
+        sse      += pv->segments[i].sse;
+        activity += pv->segments[i].activity;
+        changed  += pv->segments[i].changed;
+    }
+
+    int blocks = ( width / 16 ) * ( height / 16 );
+    float motion = blocks ? (float)sse / ( blocks * 256 ) : 0;
+    float complexity = blocks ? (float)activity / ( blocks * 15 * 15 * 2 ) : 0;
+    int scenecut;
+
+    if( !pv->have_ref )
+    {
+        scenecut = 1;
+        pv->avg_motion = motion;
+    }
+    else
+    {
+        scenecut = blocks && changed * 100 >= pv->scenecut * blocks &&
+                   motion > SCENECUT_RATIO * pv->avg_motion;
+        pv->avg_motion += ( motion - pv->avg_motion ) / 8;
+    }
+    pv->have_ref = 1;
+
+    in->s.complexity = complexity;
+    in->s.motion     = motion;
+    in->s.scenecut   = scenecut;
+
+    pv->frames++;
+    pv->scenecuts += scenecut;
+    pv->total_complexity += complexity;
+
+    return HB_FILTER_OK;
+}
+
+/*
+ * Returns non-zero when the frame analysis filter is part of this job.
+ */
+int hb_analyze_enabled( hb_job_t * job )
+{
+    int i;
+
+    if( job->list_filter == NULL )
+        return 0;
+    for( i = 0; i < hb_list_count( job->list_filter ); i++ )
+    {
+        hb_filter_object_t * filter = hb_list_item( job->list_filter, i );
+        if( filter->id == HB_FILTER_ANALYZE )
+            return 1;
+    }
+    return 0;
+}
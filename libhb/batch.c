@@ -111,8 +111,10 @@ int hb_batch_title_count( hb_batch_t * d )
 
 /***********************************************************************
  * hb_batch_title_scan
+ ***********************************************************************
+ * flags are the HBTF_ flags the title is scanned with
  **********************************************************************/
-hb_title_t * hb_batch_title_scan( hb_batch_t * d, int t )
+hb_title_t * hb_batch_title_scan( hb_batch_t * d, int t, uint32_t flags )
 {
 
     hb_title_t   * title;
@@ -128,6 +130,7 @@ hb_title_t * hb_batch_title_scan( hb_batch_t * d, int t )
 
     hb_log( "batch: scanning %s", filename );
     title = hb_title_init( filename, 0 );
+    title->flags |= flags;
     stream = hb_stream_open( filename, title, 1 );
     if ( stream == NULL )
     {
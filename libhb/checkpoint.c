@@ -0,0 +1,629 @@
+/* checkpoint.c
+
+   Copyright (c) 2003-2014 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*
+ * Checkpoints for resumable encodes.
+ *
+ * With job->checkpoint set, the muxer writes the output as a series of
+ * segment files and starts a new one at the first video keyframe after
+ * every job->checkpoint seconds.  Each completed segment is appended to
+ * a manifest next to the output file, together with the chapter marks
+ * it contains.  At the end of the job the segments are stitched into the
+ * output file and removed.
+ *
+ * If the job is interrupted, the manifest and the segments stay behind.
+ * Running the same job again picks them up: the job starts at the end of
+ * the last completed segment (the reader seeks there with
+ * hb_stream_seek_ts or hb_bd_seek_pts) and the segments it writes are
+ * numbered after the existing ones.
+ *
+ * The manifest starts with a fingerprint of the job: the source, the
+ * range, the video and the tracks.  A manifest left by a different job
+ * writing to the same file is discarded, with its segments.
+ *
+ * Times in the manifest are output times in 90 kHz ticks, counted from
+ * the start of the first run of the job.
+ *
+ * The segments are joined with libavformat, so only jobs that use the
+ * libavformat muxers are checkpointed.
+ */
+
+#include "hb.h"
+#include "libavformat/avformat.h"
+#include "libavutil/avstring.h"
+
+typedef struct
+{
+    int64_t start;
+    int64_t stop;
+} checkpoint_segment_t;
+
+typedef struct
+{
+    int     chapter;
+    int64_t pts;
+} checkpoint_chapter_t;
+
+struct hb_checkpoint_s
+{
+    char                   manifest[1024];
+    char                   path[1024];      // segment being written
+    FILE                 * file;
+    int64_t                resume;          // output time this run starts at
+
+    checkpoint_segment_t * segments;
+    int                    segment_count;
+    int                    segment_alloc;
+
+    checkpoint_chapter_t * chapters;
+    int                    chapter_count;
+    int                    chapter_alloc;
+    int                    chapter_written; // chapters in the manifest
+};
+
+static char * segment_path( hb_checkpoint_t * cp, int index, char * path )
+{
+    snprintf( path, 1024, "%s.%03d", cp->manifest, index );
+    return path;
+}
+
+static void add_segment( hb_checkpoint_t * cp, int64_t start, int64_t stop )
+{
+    if( cp->segment_count == cp->segment_alloc )
+    {
+        cp->segment_alloc = cp->segment_alloc ? cp->segment_alloc * 2 : 16;
+        cp->segments = realloc( cp->segments, cp->segment_alloc *
+                                sizeof( checkpoint_segment_t ) );
+    }
+    cp->segments[cp->segment_count].start = start;
+    cp->segments[cp->segment_count].stop  = stop;
+    cp->segment_count++;
+}
+
+static void add_chapter( hb_checkpoint_t * cp, int chapter, int64_t pts )
+{
+    if( cp->chapter_count == cp->chapter_alloc )
+    {
+        cp->chapter_alloc = cp->chapter_alloc ? cp->chapter_alloc * 2 : 16;
+        cp->chapters = realloc( cp->chapters, cp->chapter_alloc *
+                                sizeof( checkpoint_chapter_t ) );
+    }
+    cp->chapters[cp->chapter_count].chapter = chapter;
+    cp->chapters[cp->chapter_count].pts     = pts;
+    cp->chapter_count++;
+}
+
+/* FNV-1a hash of a formatted string, continued from hash */
+static uint64_t fingerprint_add( uint64_t hash, const char * fmt, ... )
+{
+    va_list  args;
+    char     str[1024];
+    int      ii;
+
+    va_start( args, fmt );
+    vsnprintf( str, sizeof( str ), fmt, args );
+    va_end( args );
+    for( ii = 0; str[ii]; ii++ )
+    {
+        hash ^= (uint8_t)str[ii];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/* Everything that changes what ends up in the output, before resuming
+ * moves the start of the job */
+static uint64_t job_fingerprint( hb_job_t * job )
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    int      ii;
+
+    hash = fingerprint_add( hash, "%s|%d|%d|%d|%d|%"PRId64"|%"PRId64"|",
+                            job->title->path, job->title->index, job->angle,
+                            job->chapter_start, job->chapter_end,
+                            job->pts_to_start, job->pts_to_stop );
+    hash = fingerprint_add( hash, "%d|%f|%d|%d|%d|%d:%d:%d:%d|%d:%d|%d/%d|%d|",
+                            job->vcodec, job->vquality, job->vbitrate,
+                            job->width, job->height,
+                            job->crop[0], job->crop[1], job->crop[2],
+                            job->crop[3], job->anamorphic.par_width,
+                            job->anamorphic.par_height,
+                            job->vrate, job->vrate_base, job->cfr );
+    hash = fingerprint_add( hash, "%s|%s|%s|%s|%s|%d|%d|",
+                            job->encoder_preset  ? job->encoder_preset  : "",
+                            job->encoder_tune    ? job->encoder_tune    : "",
+                            job->encoder_options ? job->encoder_options : "",
+                            job->encoder_profile ? job->encoder_profile : "",
+                            job->encoder_level   ? job->encoder_level   : "",
+                            job->mux, job->chapter_markers );
+    for( ii = 0; ii < hb_list_count( job->list_filter ); ii++ )
+    {
+        hb_filter_object_t * filter = hb_list_item( job->list_filter, ii );
+
+        hash = fingerprint_add( hash, "f%d:%s|", filter->id,
+                                filter->settings ? filter->settings : "" );
+    }
+    for( ii = 0; ii < hb_list_count( job->list_audio ); ii++ )
+    {
+        hb_audio_t * audio = hb_list_item( job->list_audio, ii );
+
+        hash = fingerprint_add( hash, "a%d:%x:%d:%d:%f:%d|",
+                                audio->config.in.track, audio->config.out.codec,
+                                audio->config.out.mixdown,
+                                audio->config.out.bitrate,
+                                audio->config.out.quality,
+                                audio->config.out.samplerate );
+    }
+    for( ii = 0; ii < hb_list_count( job->list_subtitle ); ii++ )
+    {
+        hb_subtitle_t * subtitle = hb_list_item( job->list_subtitle, ii );
+
+        hash = fingerprint_add( hash, "s%x:%d:%d|", subtitle->id,
+                                subtitle->config.dest, subtitle->config.force );
+    }
+    return hash;
+}
+
+/* Chapter marks go in before the segment that contains them, so that a
+ * manifest cut short never lists marks of a segment that isn't there */
+static void manifest_write_segment( hb_checkpoint_t * cp, int index )
+{
+    checkpoint_segment_t * seg = &cp->segments[index];
+
+    while( cp->chapter_written < cp->chapter_count &&
+           cp->chapters[cp->chapter_written].pts < seg->stop )
+    {
+        checkpoint_chapter_t * chap = &cp->chapters[cp->chapter_written++];
+        fprintf( cp->file, "chapter %d %"PRId64"\n", chap->chapter, chap->pts );
+    }
+    fprintf( cp->file, "segment %"PRId64" %"PRId64"\n", seg->start, seg->stop );
+    fflush( cp->file );
+}
+
+/*
+ * Reads the manifest of an earlier run of the job, if there is one, and
+ * keeps the segments that are complete and still on disk.  Returns NULL
+ * if the manifest can't be written.
+ */
+hb_checkpoint_t * hb_checkpoint_init( hb_job_t * job )
+{
+    hb_checkpoint_t * cp = calloc( 1, sizeof( hb_checkpoint_t ) );
+    FILE            * file;
+    char              line[256], path[1024];
+    int               ii, chapters = 0;
+    uint64_t          fingerprint = job_fingerprint( job ), found;
+
+    snprintf( cp->manifest, sizeof( cp->manifest ), "%s.hbcp", job->file );
+
+    file = hb_fopen( cp->manifest, "r" );
+    if( file != NULL )
+    {
+        if( fgets( line, sizeof( line ), file ) == NULL ||
+            sscanf( line, "job %"SCNx64, &found ) != 1 ||
+            found != fingerprint )
+        {
+            // Another job's, its segments are of no use
+            hb_log( "checkpoint: %s is from a different job, starting over",
+                    cp->manifest );
+            for( ii = 0; !unlink( segment_path( cp, ii, path ) ); ii++ )
+            {
+            }
+            fclose( file );
+            file = NULL;
+        }
+    }
+    if( file != NULL )
+    {
+        while( fgets( line, sizeof( line ), file ) != NULL &&
+               strchr( line, '\n' ) != NULL )
+        {
+            int64_t    start, stop, pts;
+            int        chapter;
+            hb_stat_t  sb;
+
+            if( sscanf( line, "segment %"SCNd64" %"SCNd64,
+                        &start, &stop ) == 2 )
+            {
+                if( start < cp->resume || stop <= start ||
+                    hb_stat( segment_path( cp, cp->segment_count, path ),
+                             &sb ) )
+                {
+                    break;
+                }
+                add_segment( cp, start, stop );
+                cp->resume = stop;
+                chapters   = cp->chapter_count;
+            }
+            else if( sscanf( line, "chapter %d %"SCNd64,
+                             &chapter, &pts ) == 2 )
+            {
+                add_chapter( cp, chapter, pts );
+            }
+        }
+        fclose( file );
+        // Drop the marks of a segment that didn't complete
+        cp->chapter_count = chapters;
+    }
+
+    // Rewrite the manifest with what is usable
+    cp->file = hb_fopen( cp->manifest, "w" );
+    if( cp->file == NULL )
+    {
+        hb_error( "checkpoint: can't write %s", cp->manifest );
+        hb_checkpoint_close( &cp );
+        return NULL;
+    }
+    fprintf( cp->file, "job %016"PRIx64"\n", fingerprint );
+    for( ii = 0; ii < cp->segment_count; ii++ )
+    {
+        manifest_write_segment( cp, ii );
+    }
+
+    return cp;
+}
+
+/* Output time already in completed segments, where this run starts */
+int64_t hb_checkpoint_resume( hb_checkpoint_t * cp )
+{
+    return cp->resume;
+}
+
+int hb_checkpoint_segments( hb_checkpoint_t * cp )
+{
+    return cp->segment_count;
+}
+
+/* File name the muxer writes the current segment to */
+char * hb_checkpoint_segment( hb_checkpoint_t * cp )
+{
+    return segment_path( cp, cp->segment_count, cp->path );
+}
+
+/* Times passed in by the muxer count from the start of this run */
+void hb_checkpoint_chapter( hb_checkpoint_t * cp, int chapter, int64_t pts )
+{
+    // The first frame of a resumed run marks the chapter it is in
+    if( cp->chapter_count > 0 &&
+        cp->chapters[cp->chapter_count - 1].chapter == chapter )
+    {
+        return;
+    }
+    add_chapter( cp, chapter, cp->resume + pts );
+}
+
+void hb_checkpoint_done( hb_checkpoint_t * cp, int64_t start, int64_t stop )
+{
+    add_segment( cp, cp->resume + start, cp->resume + stop );
+    manifest_write_segment( cp, cp->segment_count - 1 );
+    hb_deep_log( 2, "checkpoint: segment %d done at %"PRId64" ms",
+                 cp->segment_count, ( cp->resume + stop ) / 90 );
+}
+
+static int stitch_add_chapter( AVFormatContext * oc, int64_t start,
+                               int64_t end, const char * title )
+{
+    AVChapter  * chap;
+    AVChapter ** chapters;
+    int          nchap = oc->nb_chapters + 1;
+
+    chapters = av_realloc( oc->chapters, nchap * sizeof( AVChapter * ) );
+    if( chapters == NULL )
+    {
+        return -1;
+    }
+    oc->chapters = chapters;
+
+    chap = av_mallocz( sizeof( AVChapter ) );
+    if( chap == NULL )
+    {
+        return -1;
+    }
+    chap->id        = nchap;
+    chap->time_base = (AVRational){ 1, 90000 };
+    chap->start     = start;
+    chap->end       = end;
+    av_dict_set( &chap->metadata, "title", title, 0 );
+
+    oc->chapters[nchap - 1] = chap;
+    oc->nb_chapters = nchap;
+
+    return 0;
+}
+
+static void stitch_chapters( hb_checkpoint_t * cp, hb_job_t * job,
+                             AVFormatContext * oc )
+{
+    int64_t duration = cp->segments[cp->segment_count - 1].stop;
+    int     ii;
+
+    // The first chapter starts with the output, marked or not
+    for( ii = -1; ii < cp->chapter_count; ii++ )
+    {
+        hb_chapter_t * chapter;
+        char           title[1024];
+        int            number;
+        int64_t        start, end;
+
+        if( ii < 0 )
+        {
+            if( cp->chapter_count > 0 && cp->chapters[0].pts <= 0 )
+                continue;
+            number = job->chapter_start;
+            start  = 0;
+        }
+        else
+        {
+            number = cp->chapters[ii].chapter;
+            start  = cp->chapters[ii].pts;
+        }
+        end = ii + 1 < cp->chapter_count ? cp->chapters[ii + 1].pts : duration;
+        if( end <= start )
+            continue;
+
+        chapter = hb_list_item( job->list_chapter, number - 1 );
+        if( chapter != NULL && chapter->title != NULL )
+        {
+            snprintf( title, sizeof( title ), "%s", chapter->title );
+        }
+        else
+        {
+            snprintf( title, sizeof( title ), "Chapter %d", number );
+        }
+        stitch_add_chapter( oc, start, end, title );
+    }
+}
+
+/* Creates the output with the streams of the first segment */
+static AVFormatContext * stitch_open( hb_checkpoint_t * cp, hb_job_t * job,
+                                      AVFormatContext * ic )
+{
+    AVFormatContext * oc;
+    AVDictionary    * av_opts = NULL;
+    const char      * muxer_name;
+    int               ii;
+
+    if( job->mux & HB_MUX_MASK_MP4 )
+    {
+        muxer_name = job->ipod_atom ? "ipod" : "mp4";
+        av_dict_set( &av_opts, "brand", "mp42", 0 );
+        if( job->mp4_optimize )
+            av_dict_set( &av_opts, "movflags", "faststart", 0 );
+    }
+    else
+    {
+        muxer_name = "matroska";
+    }
+
+    oc = avformat_alloc_context();
+    if( oc == NULL )
+    {
+        av_dict_free( &av_opts );
+        return NULL;
+    }
+    oc->oformat = av_guess_format( muxer_name, NULL, NULL );
+    if( oc->oformat == NULL )
+    {
+        hb_error( "checkpoint: could not guess output format %s", muxer_name );
+        goto error;
+    }
+    av_dict_copy( &oc->metadata, ic->metadata, 0 );
+
+    for( ii = 0; ii < ic->nb_streams; ii++ )
+    {
+        AVStream * ist = ic->streams[ii];
+        AVStream * st  = avformat_new_stream( oc, NULL );
+
+        if( st == NULL || avcodec_copy_context( st->codec, ist->codec ) < 0 )
+        {
+            hb_error( "checkpoint: could not copy stream %d", ii );
+            goto error;
+        }
+        st->codec->codec_tag   = 0;
+        st->time_base          = ist->time_base;
+        st->avg_frame_rate     = ist->avg_frame_rate;
+        st->sample_aspect_ratio = ist->sample_aspect_ratio;
+        st->disposition        = ist->disposition;
+        av_dict_copy( &st->metadata, ist->metadata, 0 );
+        if( oc->oformat->flags & AVFMT_GLOBALHEADER )
+            st->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    if( job->chapter_markers )
+    {
+        stitch_chapters( cp, job, oc );
+    }
+
+    av_strlcpy( oc->filename, job->file, sizeof( oc->filename ) );
+    if( avio_open2( &oc->pb, job->file, AVIO_FLAG_WRITE,
+                    &oc->interrupt_callback, NULL ) < 0 )
+    {
+        hb_error( "checkpoint: could not create %s", job->file );
+        goto error;
+    }
+    if( avformat_write_header( oc, &av_opts ) < 0 )
+    {
+        hb_error( "checkpoint: avformat_write_header failed" );
+        avio_close( oc->pb );
+        goto error;
+    }
+    av_dict_free( &av_opts );
+
+    return oc;
+
+error:
+    av_dict_free( &av_opts );
+    avformat_free_context( oc );
+    return NULL;
+}
+
+static int stitch_segment( AVFormatContext * oc, AVFormatContext * ic,
+                           int64_t offset, int64_t * last_dts )
+{
+    AVPacket pkt;
+    int      ii;
+
+    // Segments start with a keyframe, line that up with the place of
+    // the segment in the output
+    for( ii = 0; ii < ic->nb_streams; ii++ )
+    {
+        AVStream * ist = ic->streams[ii];
+
+        if( ist->codec->codec_type == AVMEDIA_TYPE_VIDEO )
+        {
+            if( ist->start_time != AV_NOPTS_VALUE )
+                offset -= av_rescale_q( ist->start_time, ist->time_base,
+                                        (AVRational){ 1, 90000 } );
+            break;
+        }
+    }
+
+    while( av_read_frame( ic, &pkt ) >= 0 )
+    {
+        AVStream * ist = ic->streams[pkt.stream_index];
+        AVStream * ost = oc->streams[pkt.stream_index];
+        int64_t    off = av_rescale_q( offset, (AVRational){ 1, 90000 },
+                                       ist->time_base );
+
+        if( pkt.pts != AV_NOPTS_VALUE )
+            pkt.pts = av_rescale_q( pkt.pts + off, ist->time_base,
+                                    ost->time_base );
+        if( pkt.dts != AV_NOPTS_VALUE )
+            pkt.dts = av_rescale_q( pkt.dts + off, ist->time_base,
+                                    ost->time_base );
+        pkt.duration = av_rescale_q( pkt.duration, ist->time_base,
+                                     ost->time_base );
+
+        // Rounding at the joins must not make dts go backwards
+        if( pkt.dts != AV_NOPTS_VALUE )
+        {
+            if( last_dts[pkt.stream_index] != AV_NOPTS_VALUE &&
+                pkt.dts <= last_dts[pkt.stream_index] )
+            {
+                pkt.dts = last_dts[pkt.stream_index] + 1;
+                if( pkt.pts != AV_NOPTS_VALUE && pkt.pts < pkt.dts )
+                    pkt.pts = pkt.dts;
+            }
+            last_dts[pkt.stream_index] = pkt.dts;
+        }
+
+        if( av_interleaved_write_frame( oc, &pkt ) < 0 )
+        {
+            av_free_packet( &pkt );
+            return -1;
+        }
+        av_free_packet( &pkt );
+    }
+    return 0;
+}
+
+/*
+ * Joins the segments into job->file.  start and stop are the times of
+ * the last segment, which isn't in the manifest yet.  On success the
+ * segments and the manifest are removed, on failure they are kept so
+ * that running the job again only needs to redo the last segment.
+ */
+int hb_checkpoint_stitch( hb_checkpoint_t * cp, hb_job_t * job,
+                          int64_t start, int64_t stop )
+{
+    AVFormatContext * oc = NULL, * ic = NULL;
+    int64_t         * last_dts = NULL;
+    char              path[1024];
+    int               ii, jj, count, ret = -1;
+
+    count = cp->segment_count;
+    add_segment( cp, cp->resume + start, cp->resume + stop );
+
+    hb_log( "checkpoint: joining %d segment(s) into %s",
+            cp->segment_count, job->file );
+    for( ii = 0; ii < cp->segment_count; ii++ )
+    {
+        hb_state_t state;
+
+        segment_path( cp, ii, path );
+        if( avformat_open_input( &ic, path, NULL, NULL ) < 0 )
+        {
+            hb_error( "checkpoint: could not open segment %s", path );
+            goto done;
+        }
+        if( avformat_find_stream_info( ic, NULL ) < 0 )
+        {
+            hb_error( "checkpoint: could not read segment %s", path );
+            goto done;
+        }
+        if( oc == NULL )
+        {
+            oc = stitch_open( cp, job, ic );
+            if( oc == NULL )
+                goto done;
+            last_dts = malloc( oc->nb_streams * sizeof( int64_t ) );
+            for( jj = 0; jj < oc->nb_streams; jj++ )
+                last_dts[jj] = AV_NOPTS_VALUE;
+        }
+        else if( ic->nb_streams != oc->nb_streams )
+        {
+            hb_error( "checkpoint: segment %s has %d streams, expected %d",
+                      path, ic->nb_streams, oc->nb_streams );
+            goto done;
+        }
+        if( stitch_segment( oc, ic, cp->segments[ii].start, last_dts ) < 0 )
+        {
+            hb_error( "checkpoint: writing %s failed", job->file );
+            goto done;
+        }
+        avformat_close_input( &ic );
+
+        state.state = HB_STATE_MUXING;
+        state.param.muxing.progress = (float)( ii + 1 ) / cp->segment_count;
+        hb_set_state( job->h, &state );
+    }
+    av_write_trailer( oc );
+    ret = 0;
+
+done:
+    if( ic != NULL )
+    {
+        avformat_close_input( &ic );
+    }
+    if( oc != NULL )
+    {
+        avio_close( oc->pb );
+        avformat_free_context( oc );
+    }
+    free( last_dts );
+    cp->segment_count = count;
+
+    if( ret == 0 )
+    {
+        for( ii = 0; ii <= count; ii++ )
+        {
+            unlink( segment_path( cp, ii, path ) );
+        }
+        fclose( cp->file );
+        cp->file = NULL;
+        unlink( cp->manifest );
+    }
+    return ret;
+}
+
+void hb_checkpoint_close( hb_checkpoint_t ** _cp )
+{
+    hb_checkpoint_t * cp = *_cp;
+
+    if( cp == NULL )
+        return;
+
+    if( cp->file != NULL )
+    {
+        fclose( cp->file );
+    }
+    free( cp->segments );
+    free( cp->chapters );
+    free( cp );
+    *_cp = NULL;
+}
@@ -2961,6 +2961,7 @@ void hb_title_close( hb_title_t ** _t )
 
     free( t->video_codec_name );
     free(t->container_name);
+    hb_stream_index_close( &t->seek_index );
 
 #if defined(HB_TITLE_JOBS)
     hb_job_close( &t->job );
@@ -3000,24 +3001,18 @@ static void job_reset_for_mac_ui( hb_job_t * job, hb_title_t * title )
     job->list_audio = hb_list_init();
     job->list_subtitle = hb_list_init();
     job->list_filter = hb_list_init();
+    job->list_rendition = hb_list_init();
 
     job->list_attachment = hb_attachment_list_copy( title->list_attachment );
     job->metadata = hb_metadata_copy( title->metadata );
 }
 
 
-static void job_setup( hb_job_t * job, hb_title_t * title )
+/*
+ * Sets the crop, pixel aspect and size of the job from the title.
+ */
+static void job_setup_picture( hb_job_t * job, hb_title_t * title )
 {
-    if ( job == NULL || title == NULL )
-        return;
-
-    job->title = title;
-
-    /* Set defaults settings */
-    job->chapter_start = 1;
-    job->chapter_end   = hb_list_count( title->list_chapter );
-    job->list_chapter = hb_chapter_list_copy( title->list_chapter );
-
     /* Autocrop by default. Gnark gnark */
     memcpy( job->crop, title->crop, 4 * sizeof( int ) );
 
@@ -3042,6 +3037,41 @@ static void job_setup( hb_job_t * job, hb_title_t * title )
         job->height = title->height - job->crop[0] - job->crop[1];
         hb_fix_aspect( job, HB_KEEP_HEIGHT );
     }
+}
+
+/*
+ * Updates a job in place after the previews of its fast probed title were
+ * decoded.  Only the values that come from the video are set again, the
+ * job may be held by the caller.
+ */
+void hb_job_update_video( hb_job_t * job )
+{
+    hb_title_t * title;
+
+    if ( job == NULL || job->title == NULL )
+        return;
+
+    title = job->title;
+    job->anamorphic.par_width  = 0;
+    job->anamorphic.par_height = 0;
+    job_setup_picture( job, title );
+    job->vrate      = title->rate;
+    job->vrate_base = title->rate_base;
+}
+
+static void job_setup( hb_job_t * job, hb_title_t * title )
+{
+    if ( job == NULL || title == NULL )
+        return;
+
+    job->title = title;
+
+    /* Set defaults settings */
+    job->chapter_start = 1;
+    job->chapter_end   = hb_list_count( title->list_chapter );
+    job->list_chapter = hb_chapter_list_copy( title->list_chapter );
+
+    job_setup_picture( job, title );
 
     job->keep_ratio = 1;
 
@@ -3054,9 +3084,12 @@ static void job_setup( hb_job_t * job, hb_title_t * title )
 
     job->mux = HB_MUX_MP4;
 
+    job->read_ahead = HB_READ_AHEAD_DEFAULT;
+
     job->list_audio = hb_list_init();
     job->list_subtitle = hb_list_init();
     job->list_filter = hb_list_init();
+    job->list_rendition = hb_list_init();
 
     job->list_attachment = hb_attachment_list_copy( title->list_attachment );
     job->metadata = hb_metadata_copy( title->metadata );
@@ -3078,6 +3111,7 @@ static void job_clean( hb_job_t * job )
         hb_subtitle_t *subtitle;
         hb_filter_object_t *filter;
         hb_attachment_t *attachment;
+        hb_rendition_t *rendition;
 
         free(job->encoder_preset);
         job->encoder_preset = NULL;
@@ -3132,6 +3166,14 @@ static void job_clean( hb_job_t * job )
         }
         hb_list_close( &job->list_attachment );
 
+        // clean up rendition list
+        while( ( rendition = hb_list_item( job->list_rendition, 0 ) ) )
+        {
+            hb_list_rem( job->list_rendition, rendition );
+            hb_rendition_close( &rendition );
+        }
+        hb_list_close( &job->list_rendition );
+
         // clean up metadata
         hb_metadata_close( &job->metadata );
     }
@@ -3146,6 +3188,11 @@ hb_job_t * hb_job_init_by_index( hb_handle_t * h, int title_index )
     hb_title_set_t *title_set = hb_get_title_set( h );
     hb_title_t * title = hb_list_item( title_set->list_title,
                                        title_index - 1 );
+    if ( title != NULL )
+    {
+        // crop and interlace detection of fast probed titles
+        hb_scan_previews( h, title );
+    }
     return hb_job_init( title );
 }
 
@@ -3196,6 +3243,45 @@ void hb_job_close( hb_job_t ** _j )
     }
 }
 
+/**********************************************************************
+ * hb_job_copy
+ **********************************************************************
+ * Deep copy of the job's lists and strings, the title is shared.
+ *********************************************************************/
+hb_job_t * hb_job_copy( const hb_job_t * job )
+{
+    hb_job_t * job_copy;
+
+    if ( job == NULL )
+        return NULL;
+
+    job_copy = calloc( sizeof( hb_job_t ), 1 );
+    memcpy( job_copy, job, sizeof( hb_job_t ) );
+
+    job_copy->list_subtitle = hb_subtitle_list_copy( job->list_subtitle );
+    job_copy->list_chapter = hb_chapter_list_copy( job->list_chapter );
+    job_copy->list_audio = hb_audio_list_copy( job->list_audio );
+    job_copy->list_attachment = hb_attachment_list_copy( job->list_attachment );
+    job_copy->list_rendition = hb_rendition_list_copy( job->list_rendition );
+    job_copy->list_filter = hb_filter_list_copy( job->list_filter );
+    job_copy->metadata = hb_metadata_copy( job->metadata );
+
+    if (job->encoder_preset != NULL)
+        job_copy->encoder_preset = strdup(job->encoder_preset);
+    if (job->encoder_tune != NULL)
+        job_copy->encoder_tune = strdup(job->encoder_tune);
+    if (job->encoder_options != NULL)
+        job_copy->encoder_options = strdup(job->encoder_options);
+    if (job->encoder_profile != NULL)
+        job_copy->encoder_profile = strdup(job->encoder_profile);
+    if (job->encoder_level != NULL)
+        job_copy->encoder_level = strdup(job->encoder_level);
+    if (job->file != NULL)
+        job_copy->file = strdup(job->file);
+
+    return job_copy;
+}
+
 void hb_job_set_encoder_preset(hb_job_t *job, const char *preset)
 {
     if (job != NULL)
@@ -3326,6 +3412,10 @@ hb_filter_object_t * hb_filter_init( int filter_id )
             filter = &hb_filter_rotate;
             break;
 
+        case HB_FILTER_ANALYZE:
+            filter = &hb_filter_analyze;
+            break;
+
 #ifdef USE_QSV
         case HB_FILTER_QSV:
             filter = &hb_filter_qsv;
@@ -3549,6 +3639,7 @@ void hb_audio_config_init(hb_audio_config_t * audiocfg)
     audiocfg->out.gain = 0;
     audiocfg->out.normalize_mix_level = 0;
     audiocfg->out.dither_method = hb_audio_dither_get_default();
+    audiocfg->out.resample_quality = HB_RESAMPLE_MEDIUM;
     audiocfg->out.name = NULL;
 }
 
@@ -3614,6 +3705,7 @@ int hb_audio_add(const hb_job_t * job, const hb_audio_config_t * audiocfg)
         audio->config.out.gain = audiocfg->out.gain;
         audio->config.out.normalize_mix_level = audiocfg->out.normalize_mix_level;
         audio->config.out.dither_method = audiocfg->out.dither_method;
+        audio->config.out.resample_quality = audiocfg->out.resample_quality;
     }
     if (audiocfg->out.name && *audiocfg->out.name)
     {
@@ -4232,6 +4324,98 @@ void hb_attachment_close( hb_attachment_t **attachment )
     }
 }
 
+/**********************************************************************
+ * hb_job_add_rendition
+ **********************************************************************
+ * Adds an output rendition to the job.  Bitrate/quality default to the
+ * job's current settings, the caller may change them in the returned
+ * structure.
+ *********************************************************************/
+hb_rendition_t *hb_job_add_rendition(hb_job_t *job, const char *file,
+                                     int width, int height)
+{
+    hb_rendition_t *rendition;
+
+    if (job == NULL || file == NULL || width <= 0)
+        return NULL;
+
+    rendition = calloc(1, sizeof(*rendition));
+    rendition->width    = width;
+    rendition->height   = height;
+    rendition->vbitrate = job->vquality >= 0 ? 0 : job->vbitrate;
+    rendition->vquality = job->vquality;
+    rendition->file     = strdup(file);
+
+    hb_list_add(job->list_rendition, rendition);
+
+    return rendition;
+}
+
+/**********************************************************************
+ * hb_rendition_copy
+ **********************************************************************
+ *
+ *********************************************************************/
+hb_rendition_t *hb_rendition_copy(const hb_rendition_t *src)
+{
+    hb_rendition_t *rendition = NULL;
+
+    if( src )
+    {
+        rendition = calloc(1, sizeof(*rendition));
+        memcpy(rendition, src, sizeof(*rendition));
+        if ( src->encoder_options )
+        {
+            rendition->encoder_options = strdup( src->encoder_options );
+        }
+        if ( src->file )
+        {
+            rendition->file = strdup( src->file );
+        }
+    }
+    return rendition;
+}
+
+/**********************************************************************
+ * hb_rendition_list_copy
+ **********************************************************************
+ *
+ *********************************************************************/
+hb_list_t *hb_rendition_list_copy(const hb_list_t *src)
+{
+    hb_list_t *list = hb_list_init();
+    hb_rendition_t *rendition = NULL;
+    int i;
+
+    if( src )
+    {
+        for( i = 0; i < hb_list_count(src); i++ )
+        {
+            if( ( rendition = hb_list_item( src, i ) ) )
+            {
+                hb_list_add( list, hb_rendition_copy(rendition) );
+            }
+        }
+    }
+    return list;
+}
+
+/**********************************************************************
+ * hb_rendition_close
+ **********************************************************************
+ *
+ *********************************************************************/
+void hb_rendition_close( hb_rendition_t **rendition )
+{
+    if ( rendition && *rendition )
+    {
+        free((*rendition)->encoder_options);
+        free((*rendition)->file);
+        free(*rendition);
+        *rendition = NULL;
+    }
+}
+
 /**********************************************************************
  * hb_yuv2rgb
  **********************************************************************
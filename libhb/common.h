@@ -81,23 +81,29 @@ typedef struct hb_container_s hb_container_t;
 typedef struct hb_job_s  hb_job_t;
 typedef struct hb_title_set_s hb_title_set_t;
 typedef struct hb_title_s hb_title_t;
+typedef struct hb_stream_index_s hb_stream_index_t;
 typedef struct hb_chapter_s hb_chapter_t;
 typedef struct hb_audio_s hb_audio_t;
 typedef struct hb_audio_config_s hb_audio_config_t;
 typedef struct hb_subtitle_s hb_subtitle_t;
 typedef struct hb_subtitle_config_s hb_subtitle_config_t;
 typedef struct hb_attachment_s hb_attachment_t;
+typedef struct hb_rendition_s hb_rendition_t;
 typedef struct hb_metadata_s hb_metadata_t;
 typedef struct hb_coverart_s hb_coverart_t;
 typedef struct hb_state_s hb_state_t;
 typedef union  hb_esconfig_u     hb_esconfig_t;
 typedef struct hb_work_private_s hb_work_private_t;
 typedef struct hb_work_object_s  hb_work_object_t;
+typedef struct hb_work_info_s    hb_work_info_t;
 typedef struct hb_filter_private_s hb_filter_private_t;
 typedef struct hb_filter_object_s  hb_filter_object_t;
 typedef struct hb_buffer_s hb_buffer_t;
 typedef struct hb_fifo_s hb_fifo_t;
 typedef struct hb_lock_s hb_lock_t;
+typedef struct hb_mem_account_s hb_mem_account_t;
+typedef struct hb_checkpoint_s hb_checkpoint_t;
+typedef struct hb_stream_share_s hb_stream_share_t;
 typedef enum
 {
      HB_ERROR_NONE    = 0,
@@ -169,6 +175,12 @@ hb_attachment_t *hb_attachment_copy(const hb_attachment_t *src);
 hb_list_t *hb_attachment_list_copy(const hb_list_t *src);
 void hb_attachment_close(hb_attachment_t **attachment);
 
+hb_rendition_t *hb_job_add_rendition(hb_job_t *job, const char *file,
+                                     int width, int height);
+hb_rendition_t *hb_rendition_copy(const hb_rendition_t *src);
+hb_list_t *hb_rendition_list_copy(const hb_list_t *src);
+void hb_rendition_close(hb_rendition_t **rendition);
+
 hb_metadata_t * hb_metadata_init();
 hb_metadata_t * hb_metadata_copy(const hb_metadata_t *src);
 void hb_metadata_close(hb_metadata_t **metadata);
@@ -463,6 +475,12 @@ struct hb_job_s
     int             cfr;
     int             pass;
     int             fastfirstpass;
+    /* pass_spool: keep the filtered frames of the first pass and
+     * encode the second pass from them instead of filtering again */
+#define HB_SPOOL_NONE    0
+#define HB_SPOOL_RAW     1
+#define HB_SPOOL_DEFLATE 2
+    int             pass_spool;
     char           *encoder_preset;
     char           *encoder_tune;
     char           *encoder_options;
@@ -502,6 +520,10 @@ struct hb_job_s
 
     hb_list_t     * list_attachment;
 
+    /* Additional renditions (hb_rendition_t) encoded from the same
+     * decode and filter chain, e.g. for an adaptive bitrate ladder */
+    hb_list_t     * list_rendition;
+
     hb_metadata_t * metadata;
 
     /*
@@ -549,6 +571,14 @@ struct hb_job_s
     int use_hwd;
     int use_decomb;
     int use_detelecine;
+    int mem_limit;                      // cap on the buffer memory held by
+                                        //  the job in MiB, 0 for no cap
+#define HB_READ_AHEAD_DEFAULT 4096
+    int read_ahead;                     // KiB of DVD/Blu-ray data to read
+                                        //  ahead of demux, 0 to read inline
+    int checkpoint;                     // seconds between checkpoints of the
+                                        //  output that an interrupted job
+                                        //  resumes from, 0 for none
 
 #ifdef USE_QSV
     // QSV-specific settings
@@ -588,6 +618,10 @@ struct hb_job_s
     hb_fifo_t     * fifo_mpeg4;   /* MPEG-4 video ES */
 
     hb_list_t     * list_work;
+    hb_mem_account_t * mem;       /* Buffer memory held by the job */
+    hb_checkpoint_t  * checkpoint_state; /* Segments of a checkpointed job */
+    hb_stream_share_t * stream_share; /* Source reads shared with the jobs
+                                         of other programs, see work.c */
 
     hb_esconfig_t config;
 
@@ -632,6 +666,12 @@ struct hb_job_s
 /* define an invalid VBR quality compatible with all VBR-capable codecs */
 #define HB_INVALID_AUDIO_QUALITY (-3.)
 
+/* sample rate conversion quality, the default must stay 0 */
+#define HB_RESAMPLE_MEDIUM  0
+#define HB_RESAMPLE_BEST    1
+#define HB_RESAMPLE_FAST    2
+#define HB_RESAMPLE_LINEAR  3
+
 // Update win/CS/HandBrake.Interop/HandBrakeInterop/HbLib/hb_audio_config_s.cs when changing this struct
 struct hb_audio_config_s
 {
@@ -665,6 +705,7 @@ struct hb_audio_config_s
         double   gain; /* Gain (in dB), negative is quieter */
         int      normalize_mix_level; /* mix level normalization (boolean) */
         int      dither_method; /* dither algorithm */
+        int      resample_quality; /* sample rate conversion quality (HB_RESAMPLE_*) */
         char *   name; /* Output track name */
         int      delay;
     } out;
@@ -829,6 +870,21 @@ struct hb_attachment_s
     int     size;
 };
 
+/*
+ * An additional output of a job.  Its frames come from the end of the
+ * job's filter chain, scaled to width x height, encoded with the job's
+ * video encoder and muxed with the job's audio tracks into 'file'.
+ */
+struct hb_rendition_s
+{
+    int     width;
+    int     height;           // 0: keep the aspect ratio of the job
+    int     vbitrate;         // kbps, 0: use vquality
+    float   vquality;
+    char  * encoder_options;  // NULL: same as the job
+    char  * file;
+};
+
 struct hb_coverart_s
 {
     uint8_t *data;
@@ -875,6 +931,8 @@ struct hb_title_s
     uint64_t    block_count;
     int         angle_count;
     void        *opaque_priv;
+    hb_stream_index_t *seek_index;  // keyframe index of a stream, built at
+                                    // scan, see HBTF_SEEK_INDEX
 
     /* Visual-friendly duration */
     int         hours;
@@ -900,6 +958,8 @@ struct hb_title_s
     enum {HB_DVD_DEMUXER, HB_TS_DEMUXER, HB_PS_DEMUXER, HB_NULL_DEMUXER} demuxer;
     int         detected_interlacing;
     int         pcr_pid;                /* PCR PID for TS streams */
+    int         ts_program;             /* TS program number, 0 for the
+                                           first program with video */
     int         video_id;               /* demuxer stream id for video */
     int         video_codec;            /* worker object id of video codec */
     uint32_t    video_stream_type;      /* stream type from source stream */
@@ -930,6 +990,15 @@ struct hb_title_s
                 // set if video stream doesn't have IDR frames
 #define         HBTF_NO_IDR (1 << 0)
 #define         HBTF_SCAN_COMPLETE (1 << 0)
+                // set if a fast scan left out crop and comb detection,
+                // see hb_scan_previews
+#define         HBTF_PREVIEWS_PENDING (1 << 1)
+                // read the numbered files that follow the title's path
+                // as part of it, see hb_scan_set_join_segments
+#define         HBTF_JOIN_SEGMENTS (1 << 2)
+                // index the keyframes of the stream while scanning,
+                // see hb_scan_set_seek_index
+#define         HBTF_SEEK_INDEX (1 << 3)
 
     // whether OpenCL scaling is supported for this source
     int opencl_support;
@@ -949,6 +1018,16 @@ struct hb_state_s
 #define HB_STATE_SEARCHING 128
     int state;
 
+/* Pipeline stages that job memory is attributed to, see mem_stage */
+#define HB_MEM_STAGE_OTHER  0
+#define HB_MEM_STAGE_READER 1
+#define HB_MEM_STAGE_DECODE 2
+#define HB_MEM_STAGE_SYNC   3
+#define HB_MEM_STAGE_FILTER 4
+#define HB_MEM_STAGE_ENCODE 5
+#define HB_MEM_STAGE_MUX    6
+#define HB_MEM_STAGE_COUNT  7
+
     union
     {
         struct
@@ -973,6 +1052,14 @@ struct hb_state_s
             int   minutes;
             int   seconds;
             int   sequence_id;
+            int64_t mem_bytes;  // buffer memory held by the job
+            int64_t mem_peak;
+            int64_t mem_limit;  // 0 if the job has no memory cap
+            int64_t mem_stage[HB_MEM_STAGE_COUNT]; // mem_bytes by stage
+            int     queue_depth[HB_MEM_STAGE_COUNT]; // buffers waiting at
+                                                     // the input of a stage
+            int64_t pool_bytes; // allocated for buffers, all jobs
+            int64_t pool_idle;  // part of pool_bytes waiting to be reused
         } working;
 
         struct
@@ -989,7 +1076,7 @@ struct hb_state_s
     } param;
 };
 
-typedef struct hb_work_info_s
+struct hb_work_info_s
 {
     const char * name;
     int          profile;
@@ -1021,7 +1108,7 @@ typedef struct hb_work_info_s
             int matrix_encoding;
         };
     };
-} hb_work_info_t;
+};
 
 struct hb_work_object_s
 {
@@ -1095,6 +1182,9 @@ extern hb_work_object_t hb_encca_aac;
 extern hb_work_object_t hb_encca_haac;
 extern hb_work_object_t hb_encavcodeca;
 extern hb_work_object_t hb_reader;
+extern hb_work_object_t hb_spool_write;
+extern hb_work_object_t hb_spool_read;
+extern hb_work_object_t hb_tee;
 
 #define HB_FILTER_OK      0
 #define HB_FILTER_DELAY   1
@@ -1179,6 +1269,8 @@ enum
     // Finally filters that don't care what order they are in,
     // except that they must be after the above filters
     HB_FILTER_ROTATE,
+    // Must see the frames exactly as the encoder will
+    HB_FILTER_ANALYZE,
 
     // for QSV - important to have as a last one
     HB_FILTER_QSV_POST,
@@ -1208,6 +1300,11 @@ char * hb_x264_param_unparse(const char *x264_preset,  const char *x264_tune,
                              const char *x264_encopts, const char *h264_profile,
                              const char *h264_level, int width, int height);
 
+// check a set of x264 settings the way encx264 applies them, 0 if valid
+int hb_x264_param_check(const char *x264_preset,  const char *x264_tune,
+                        const char *x264_encopts, const char *h264_profile,
+                        const char *h264_level, int width, int height);
+
 #define HB_API_OLD_PRESET_GETTERS
 #ifdef  HB_API_OLD_PRESET_GETTERS
 // x264 preset/tune, qsv preset & h264 profile/level helpers
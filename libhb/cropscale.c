@@ -11,6 +11,30 @@
 #include "hbffmpeg.h"
 #include "common.h"
 #include "opencl.h"
+#include "taskset.h"
+
+/*
+ * The CPU scaler splits the output into horizontal bands that are scaled
+ * in parallel, each by its own swscale context.  A band's context sees
+ * only the source rows it needs plus a margin for the filter taps, and
+ * band edges are placed where source and output rows line up exactly so
+ * that the result matches scaling the whole frame at once.
+ */
+typedef struct crop_scale_band_s
+{
+    struct SwsContext * context;
+    hb_buffer_t       * tmp;    // scaled band, including margins
+    int                 src_y;  // first (cropped) source row used
+    int                 src_h;
+    int                 dst_y;  // output row of the first row in tmp
+    int                 out_y;  // first output row owned by this band
+    int                 out_h;
+} crop_scale_band_t;
+
+typedef struct crop_scale_thread_arg_s {
+    hb_filter_private_t *pv;
+    int segment;
+} crop_scale_thread_arg_t;
 
 struct hb_filter_private_s
 {
@@ -30,6 +54,14 @@ struct hb_filter_private_s
     hb_oclscale_t      *os; //ocl scaler handler
 
     struct SwsContext * context;
+    int                 sws_flags;
+
+    int                 cpu_count;
+    int                 band_count;
+    crop_scale_band_t * bands;
+    taskset_t           scale_taskset;  // Threads for scaling - one per band
+    AVPicture           pic_crop;       // current cropped source
+    hb_buffer_t       * out;            // current output frame
 };
 
 static int hb_crop_scale_init( hb_filter_object_t * filter,
@@ -67,6 +99,7 @@ static int hb_crop_scale_init( hb_filter_object_t * filter,
     pv->pix_fmt_out = init->pix_fmt;
     pv->width_in = init->width;
     pv->height_in = init->height;
+    pv->cpu_count = hb_get_cpu_count();
     pv->width_out = init->width - (init->crop[2] + init->crop[3]);
     pv->height_out = init->height - (init->crop[0] + init->crop[1]);
 
@@ -126,6 +159,253 @@ static int hb_crop_scale_info( hb_filter_object_t * filter,
     return 0;
 }
 
+/*
+ * scale this band of the output frame in a single thread.
+ */
+void crop_scale_thread( void *thread_args_v )
+{
+    hb_filter_private_t * pv;
+    crop_scale_thread_arg_t *thread_args = thread_args_v;
+    crop_scale_band_t * band;
+    int run = 1;
+    int segment;
+
+    pv = thread_args->pv;
+    segment = thread_args->segment;
+    band = &pv->bands[segment];
+
+    while( run )
+    {
+        /*
+         * Wait here until there is work to do.
+         */
+        taskset_thread_wait4start( &pv->scale_taskset, segment );
+
+        if( taskset_thread_stop( &pv->scale_taskset, segment ) )
+        {
+            /*
+             * No more work to do, exit this thread.
+             */
+            run = 0;
+            goto report_completion;
+        }
+
+        hb_buffer_t * out = pv->out;
+        AVPicture     pic_tmp;
+        uint8_t     * src[4];
+        int           pp, yy;
+
+        if( out == NULL )
+        {
+            hb_error( "Thread started when no work available" );
+            hb_snooze(500);
+            goto report_completion;
+        }
+
+        // Chroma rows are half the luma rows, band edges are always even
+        src[0] = pv->pic_crop.data[0] + band->src_y * pv->pic_crop.linesize[0];
+        src[1] = pv->pic_crop.data[1] + band->src_y / 2 * pv->pic_crop.linesize[1];
+        src[2] = pv->pic_crop.data[2] + band->src_y / 2 * pv->pic_crop.linesize[2];
+        src[3] = NULL;
+
+        hb_avpicture_fill( &pic_tmp, band->tmp );
+        sws_scale( band->context,
+                   (const uint8_t* const*)src, pv->pic_crop.linesize,
+                   0, band->src_h, pic_tmp.data, pic_tmp.linesize );
+
+        // Keep only the rows this band owns, the rest is filter margin
+        for( pp = 0; pp < 3; pp++ )
+        {
+            int shift = pp ? 1 : 0;
+            int start = band->out_y >> shift;
+            int stop  = segment == pv->band_count - 1 ?
+                        out->plane[pp].height :
+                        ( band->out_y + band->out_h ) >> shift;
+            uint8_t * dst = out->plane[pp].data + start * out->plane[pp].stride;
+            uint8_t * tmp = band->tmp->plane[pp].data +
+                            ( start - ( band->dst_y >> shift ) ) *
+                            band->tmp->plane[pp].stride;
+
+            for( yy = start; yy < stop; yy++ )
+            {
+                memcpy( dst, tmp, out->plane[pp].width );
+                dst += out->plane[pp].stride;
+                tmp += band->tmp->plane[pp].stride;
+            }
+        }
+
+report_completion:
+        /*
+         * Finished this segment, let everyone know.
+         */
+        taskset_thread_complete( &pv->scale_taskset, segment );
+    }
+}
+
+static void crop_scale_free_bands( hb_filter_private_t * pv )
+{
+    int ii;
+
+    if( pv->bands == NULL )
+        return;
+
+    taskset_fini( &pv->scale_taskset );
+    for( ii = 0; ii < pv->band_count; ii++ )
+    {
+        if( pv->bands[ii].context )
+            sws_freeContext( pv->bands[ii].context );
+        hb_buffer_close( &pv->bands[ii].tmp );
+    }
+    free( pv->bands );
+    pv->bands = NULL;
+    pv->band_count = 0;
+}
+
+static int gcd( int a, int b )
+{
+    while( b )
+    {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/*
+ * (Re)create the scaler for the current input geometry.
+ */
+static void crop_scale_setup( hb_filter_private_t * pv,
+                              hb_buffer_t * in, hb_buffer_t * out )
+{
+    int src_w = in->f.width  - ( pv->crop[2] + pv->crop[3] );
+    int src_h = in->f.height - ( pv->crop[0] + pv->crop[1] );
+    int dst_w = out->f.width;
+    int dst_h = out->f.height;
+    int ii;
+
+    if( pv->context != NULL )
+    {
+        sws_freeContext( pv->context );
+        pv->context = NULL;
+    }
+    crop_scale_free_bands( pv );
+
+    // When downscaling by 2:1 or more the extra lobes of Lanczos are
+    // not visible, bicubic needs fewer taps for the same result.
+    if( src_w >= 2 * dst_w && src_h >= 2 * dst_h )
+    {
+        pv->sws_flags = SWS_BICUBIC|SWS_ACCURATE_RND;
+        hb_log( "crop_scale: %dx%d -> %dx%d, using bicubic scaling",
+                src_w, src_h, dst_w, dst_h );
+    }
+    else
+    {
+        pv->sws_flags = SWS_LANCZOS|SWS_ACCURATE_RND;
+    }
+
+    /*
+     * Band edges must fall on output rows that map exactly onto a source
+     * row, and both must be even so that 4:2:0 chroma rows line up too.
+     */
+    int g        = gcd( src_h, dst_h );
+    int unit_out = dst_h / g;
+    int unit_in  = src_h / g;
+    if( ( unit_out | unit_in ) & 1 )
+    {
+        unit_out *= 2;
+        unit_in  *= 2;
+    }
+    int units = dst_h / unit_out;
+
+    // Source rows the vertical filter can reach past a band edge.  The
+    // chroma filter has as many taps over rows half as dense, so it
+    // reaches twice as many luma rows.
+    int support = 2 * ( 3 * ( src_h + dst_h - 1 ) / dst_h + 2 );
+    int margin  = ( support + unit_in - 1 ) / unit_in;
+
+    int count = pv->cpu_count;
+    if( count > units )
+        count = units;
+    // Don't bother when the margins would cost more than the threads gain
+    while( count > 1 && units / count < 2 * margin )
+        count--;
+
+    if( count < 2 ||
+        in->f.fmt != AV_PIX_FMT_YUV420P || out->f.fmt != AV_PIX_FMT_YUV420P )
+    {
+        pv->context = hb_sws_get_context( src_w, src_h, in->f.fmt,
+                                          dst_w, dst_h, out->f.fmt,
+                                          pv->sws_flags );
+        return;
+    }
+
+    pv->bands = calloc( count, sizeof( crop_scale_band_t ) );
+    if( pv->bands == NULL ||
+        taskset_init( &pv->scale_taskset, count,
+                      sizeof( crop_scale_thread_arg_t ) ) == 0 )
+    {
+        hb_error( "crop_scale could not initialize taskset" );
+        free( pv->bands );
+        pv->bands = NULL;
+        pv->context = hb_sws_get_context( src_w, src_h, in->f.fmt,
+                                          dst_w, dst_h, out->f.fmt,
+                                          pv->sws_flags );
+        return;
+    }
+    pv->band_count = count;
+
+    for( ii = 0; ii < count; ii++ )
+    {
+        crop_scale_band_t * band = &pv->bands[ii];
+        int u0 = units * ii / count;
+        int u1 = units * ( ii + 1 ) / count;
+        int m0 = u0 - margin > 0 ? u0 - margin : 0;
+        int m1 = u1 + margin;
+        int dst_stop, src_stop;
+
+        band->out_y = u0 * unit_out;
+        band->out_h = ( ii == count - 1 ? dst_h : u1 * unit_out ) - band->out_y;
+        band->dst_y = m0 * unit_out;
+        band->src_y = m0 * unit_in;
+        if( ii == count - 1 || m1 >= units )
+        {
+            dst_stop = dst_h;
+            src_stop = src_h;
+        }
+        else
+        {
+            dst_stop = m1 * unit_out;
+            src_stop = m1 * unit_in;
+        }
+        band->src_h   = src_stop - band->src_y;
+        band->tmp     = hb_frame_buffer_init( out->f.fmt, dst_w,
+                                              dst_stop - band->dst_y );
+        band->context = hb_sws_get_context( src_w, band->src_h, in->f.fmt,
+                                            dst_w, dst_stop - band->dst_y,
+                                            out->f.fmt, pv->sws_flags );
+
+        crop_scale_thread_arg_t *thread_args;
+        thread_args = taskset_thread_args( &pv->scale_taskset, ii );
+        thread_args->pv = pv;
+        thread_args->segment = ii;
+        if( taskset_thread_spawn( &pv->scale_taskset, ii,
+                                  "crop_scale_segment",
+                                  crop_scale_thread,
+                                  HB_NORMAL_PRIORITY ) == 0 )
+        {
+            // taskset_cycle would wait for this band forever
+            hb_error( "crop_scale could not spawn thread" );
+            crop_scale_free_bands( pv );
+            pv->context = hb_sws_get_context( src_w, src_h, in->f.fmt,
+                                              dst_w, dst_h, out->f.fmt,
+                                              pv->sws_flags );
+            return;
+        }
+    }
+    hb_log( "crop_scale: scaling in %d bands", count );
+}
+
 static void hb_crop_scale_close( hb_filter_object_t * filter )
 {
     hb_filter_private_t * pv = filter->private_data;
@@ -150,6 +430,7 @@ static void hb_crop_scale_close( hb_filter_object_t * filter )
     {
         sws_freeContext( pv->context );
     }
+    crop_scale_free_bands( pv );
 
     free( pv );
     filter->private_data = NULL;
@@ -182,32 +463,35 @@ static hb_buffer_t* crop_scale( hb_filter_private_t * pv, hb_buffer_t * in )
     }
     else
     {
-        if (pv->context   == NULL         ||
+        if ((pv->context == NULL && pv->bands == NULL) ||
             pv->width_in  != in->f.width  ||
             pv->height_in != in->f.height ||
             pv->pix_fmt   != in->f.fmt)
         {
             // Something changed, need a new scaling context.
-            if (pv->context != NULL)
-            {
-                sws_freeContext(pv->context);
-            }
-            
-            pv->context = hb_sws_get_context(in->f.width  - (pv->crop[2] + pv->crop[3]),
-                                             in->f.height - (pv->crop[0] + pv->crop[1]),
-                                             in->f.fmt, out->f.width, out->f.height,
-                                             out->f.fmt, SWS_LANCZOS|SWS_ACCURATE_RND);
+            crop_scale_setup(pv, in, out);
             pv->width_in  = in->f.width;
             pv->height_in = in->f.height;
             pv->pix_fmt   = in->f.fmt;
         }
-        
-        // Scale pic_crop into pic_render according to the
-        // context set up above
-        sws_scale(pv->context,
-                  (const uint8_t* const*)pic_crop.data, pic_crop.linesize,
-                  0, in->f.height - (pv->crop[0] + pv->crop[1]),
-                  pic_out.data, pic_out.linesize);
+
+        if (pv->bands != NULL)
+        {
+            // Let the taskset threads scale one band each
+            pv->pic_crop = pic_crop;
+            pv->out      = out;
+            taskset_cycle(&pv->scale_taskset);
+            pv->out      = NULL;
+        }
+        else
+        {
+            // Scale pic_crop into pic_render according to the
+            // context set up above
+            sws_scale(pv->context,
+                      (const uint8_t* const*)pic_crop.data, pic_crop.linesize,
+                      0, in->f.height - (pv->crop[0] + pv->crop[1]),
+                      pic_out.data, pic_out.linesize);
+        }
     }
 
     out->s = in->s;
@@ -1998,34 +1998,14 @@ static void compute_frame_duration( hb_work_private_t *pv )
     }
 }
 
-static int decavcodecvInfo( hb_work_object_t *w, hb_work_info_t *info )
+/*
+ * Fills the color fields of info from a video codec context.  info->width,
+ * info->height and info->rate_base must be set, they pick the colors of
+ * streams that don't signal them.
+ */
+void hb_ff_color_info( AVCodecContext *context, hb_work_info_t *info )
 {
-    hb_work_private_t *pv = w->private_data;
-
-    memset( info, 0, sizeof(*info) );
-
-    if (pv->context == NULL)
-        return 0;
-
-    info->bitrate = pv->context->bit_rate;
-    // HandBrake's video pipeline uses yuv420 color.  This means all
-    // dimensions must be even.  So we must adjust the dimensions
-    // of incoming video if not even.
-    info->width = pv->context->width & ~1;
-    info->height = pv->context->height & ~1;
-
-    info->pixel_aspect_width = pv->context->sample_aspect_ratio.num;
-    info->pixel_aspect_height = pv->context->sample_aspect_ratio.den;
-
-    compute_frame_duration( pv );
-    info->rate = 27000000;
-    info->rate_base = pv->duration * 300.;
-
-    info->profile = pv->context->profile;
-    info->level = pv->context->level;
-    info->name = pv->context->codec->name;
-
-    switch( pv->context->color_primaries )
+    switch( context->color_primaries )
     {
         case AVCOL_PRI_BT709:
             info->color_prim = HB_COLR_PRI_BT709;
@@ -2054,7 +2034,7 @@ static int decavcodecvInfo( hb_work_object_t *w, hb_work_info_t *info )
         }
     }
 
-    switch( pv->context->color_trc )
+    switch( context->color_trc )
     {
         case AVCOL_TRC_SMPTE240M:
             info->color_transfer = HB_COLR_TRA_SMPTE240M;
@@ -2065,7 +2045,7 @@ static int decavcodecvInfo( hb_work_object_t *w, hb_work_info_t *info )
             break;
     }
 
-    switch( pv->context->colorspace )
+    switch( context->colorspace )
     {
         case AVCOL_SPC_BT709:
             info->color_matrix = HB_COLR_MAT_BT709;
@@ -2092,6 +2072,36 @@ static int decavcodecvInfo( hb_work_object_t *w, hb_work_info_t *info )
             break;
         }
     }
+}
+
+static int decavcodecvInfo( hb_work_object_t *w, hb_work_info_t *info )
+{
+    hb_work_private_t *pv = w->private_data;
+
+    memset( info, 0, sizeof(*info) );
+
+    if (pv->context == NULL)
+        return 0;
+
+    info->bitrate = pv->context->bit_rate;
+    // HandBrake's video pipeline uses yuv420 color.  This means all
+    // dimensions must be even.  So we must adjust the dimensions
+    // of incoming video if not even.
+    info->width = pv->context->width & ~1;
+    info->height = pv->context->height & ~1;
+
+    info->pixel_aspect_width = pv->context->sample_aspect_ratio.num;
+    info->pixel_aspect_height = pv->context->sample_aspect_ratio.den;
+
+    compute_frame_duration( pv );
+    info->rate = 27000000;
+    info->rate_base = pv->duration * 300.;
+
+    info->profile = pv->context->profile;
+    info->level = pv->context->level;
+    info->name = pv->context->codec->name;
+
+    hb_ff_color_info( pv->context, info );
 
     info->video_decode_support = HB_DECODE_SUPPORT_SW;
     switch (pv->context->codec_id)
@@ -30,9 +30,9 @@ static int64_t get_last_pts(struct s_write *wb)
 int rowdata[] = {11,-1,1,2,3,4,12,13,14,15,5,6,7,8,9,10};
 // Relationship between the first PAC byte and the row number
 
-// The following enc_buffer is not used at the moment, if it does get used
-// we need to bring it into the swrite struct. Same for "str".
-#define INITIAL_ENC_BUFFER_CAPACITY     2048
+// Holds the SSA of a whole screen: position, then up to 15 rows
+// separated by "\\N"
+#define INITIAL_ENC_BUFFER_CAPACITY     (64 + 15 * (CC608_ROW_SSA_SIZE + 2))
 
 static const unsigned char pac2_attribs[][3]= // Color, font, ident
 {
@@ -121,6 +121,14 @@ static int general_608_init (struct s_write *wb)
         wb->enc_buffer_capacity=INITIAL_ENC_BUFFER_CAPACITY;
     }
 
+    if( !wb->last_ssa )
+    {
+        wb->last_ssa = malloc(INITIAL_ENC_BUFFER_CAPACITY);
+        if (wb->last_ssa == NULL)
+            return -1;
+    }
+    wb->last_ssa_len = 0;
+
     if( !wb->subline) {
         wb->subline = malloc(2048);
 
@@ -155,6 +163,7 @@ static void general_608_close (struct s_write *wb)
     if( wb->subline ) {
         free(wb->subline);
     }
+    free(wb->last_ssa);
 
     if( wb->hb_buffer ) {
         hb_buffer_close( &wb->hb_buffer );
@@ -589,6 +598,8 @@ static unsigned get_decoder_line_encoded(unsigned char *buffer, int line_num,
     int first = 0, last = 31;
 
     find_limit_characters(line, &first, &last);
+    data->row_first[line_num] = first;
+    data->row_last[line_num] = last;
     for (i = first; i <= last; i++)
     {
         // Handle color
@@ -657,6 +668,37 @@ static unsigned get_decoder_line_encoded(unsigned char *buffer, int line_num,
     return (unsigned) (buffer - orig); // Return length
 }
 
+static void mark_row_changed(struct eia608_screen *data, int row)
+{
+    data->row_ssa_len[row] = -1;
+}
+
+// Encodes the row if it changed since the last time
+static void encode_row(struct eia608_screen *data, int row)
+{
+    if (data->row_ssa_len[row] < 0)
+    {
+        data->row_ssa_len[row] = get_decoder_line_encoded(data->row_ssa[row],
+                                                          row, data);
+    }
+}
+
+static void copy_row(struct eia608_screen *data, int dst, int src)
+{
+    memcpy(data->characters[dst], data->characters[src], CC608_SCREEN_WIDTH+1);
+    memcpy(data->colors[dst], data->colors[src], CC608_SCREEN_WIDTH+1);
+    memcpy(data->fonts[dst], data->fonts[src], CC608_SCREEN_WIDTH+1);
+    data->row_used[dst] = data->row_used[src];
+    data->row_ssa_len[dst] = data->row_ssa_len[src];
+    if (data->row_ssa_len[src] >= 0)
+    {
+        memcpy(data->row_ssa[dst], data->row_ssa[src],
+               data->row_ssa_len[src] + 1);
+        data->row_first[dst] = data->row_first[src];
+        data->row_last[dst] = data->row_last[src];
+    }
+}
+
 
 static void delete_all_lines_but_current (struct eia608_screen *data, int row)
 {
@@ -670,6 +712,7 @@ static void delete_all_lines_but_current (struct eia608_screen *data, int row)
             memset (data->colors[i],default_color,CC608_SCREEN_WIDTH+1);
             memset (data->fonts[i],FONT_REGULAR,CC608_SCREEN_WIDTH+1);
             data->row_used[i]=0;
+            mark_row_changed(data, i);
         }
     }
 }
@@ -685,6 +728,7 @@ static void clear_eia608_cc_buffer (struct eia608_screen *data)
         memset (data->colors[i],default_color,CC608_SCREEN_WIDTH+1);
         memset (data->fonts[i],FONT_REGULAR,CC608_SCREEN_WIDTH+1);
         data->row_used[i]=0;
+        mark_row_changed(data, i);
     }
     data->empty=1;
 }
@@ -765,6 +809,7 @@ static void write_char(const unsigned char c, struct s_write *wb)
         use_buffer->fonts[wb->data608->cursor_row][wb->data608->cursor_column] = wb->data608->font;
         use_buffer->row_used[wb->data608->cursor_row] = 1;
         use_buffer->empty = 0;
+        mark_row_changed(use_buffer, wb->data608->cursor_row);
         if (wb->data608->cursor_column < 31)
             wb->data608->cursor_column++;
     }
@@ -833,12 +878,10 @@ static int write_cc_buffer_as_ssa(struct eia608_screen *data,
     {
         if (data->row_used[i])
         {
-            int first, last;
-
             rows++;
-            find_limit_characters(data->characters[i], &first, &last);
-            if (last - first + 1 > columns)
-                columns = last - first + 1;
+            encode_row(data, i);
+            if (data->row_last[i] - data->row_first[i] + 1 > columns)
+                columns = data->row_last[i] - data->row_first[i] + 1;
         }
     }
 
@@ -851,12 +894,11 @@ static int write_cc_buffer_as_ssa(struct eia608_screen *data,
             // Get position for this CC
             if (row == -1)
             {
-                int last, x, y, top, safe_zone, cell_width, cell_height;
+                int x, y, top, safe_zone, cell_width, cell_height;
                 int cropped_width, cropped_height, font_size;
-                char *pos;
 
                 row = i;
-                find_limit_characters(data->characters[i], &col, &last);
+                col = data->row_first[i];
 
                 // CC grid is 16 rows by 62 colums
                 // Our SSA resolution is the title resolution
@@ -885,10 +927,9 @@ static int write_cc_buffer_as_ssa(struct eia608_screen *data,
                     x = cropped_width - columns * cell_width - safe_zone;
                 if (x < safe_zone)
                     x = safe_zone;
-                pos = hb_strdup_printf("{\\a1\\pos(%d,%d)}", x, y);
-                wb->enc_buffer_used += encode_line(
-                        wb->enc_buffer + wb->enc_buffer_used, (uint8_t*)pos);
-                free(pos);
+                wb->enc_buffer_used += sprintf(
+                        (char*)wb->enc_buffer + wb->enc_buffer_used,
+                        "{\\a1\\pos(%d,%d)}", x, y);
             }
 
             /*
@@ -896,22 +937,34 @@ static int write_cc_buffer_as_ssa(struct eia608_screen *data,
              * old code still here just in case..
              */
             if (line == 1) {
-                wb->enc_buffer_used += get_decoder_line_encoded(
-                        wb->enc_buffer + wb->enc_buffer_used, i, data);
                 line = 2;
             } else {
                 wb->enc_buffer_used += encode_line(
                         wb->enc_buffer + wb->enc_buffer_used, (uint8_t*)"\\N");
-                wb->enc_buffer_used += get_decoder_line_encoded(
-                        wb->enc_buffer + wb->enc_buffer_used, i, data);
             }
+            memcpy(wb->enc_buffer + wb->enc_buffer_used, data->row_ssa[i],
+                   data->row_ssa_len[i]);
+            wb->enc_buffer_used += data->row_ssa_len[i];
         }
     }
+    wb->enc_buffer[wb->enc_buffer_used] = 0;
+
+    // Nothing to do if the screen on display looks the same
+    if (wb->clear_sub_needed && wb->enc_buffer_used &&
+        wb->enc_buffer_used == wb->last_ssa_len &&
+        !memcmp(wb->enc_buffer, wb->last_ssa, wb->enc_buffer_used))
+    {
+        return 0;
+    }
+
     if (wb->enc_buffer_used && wb->enc_buffer[0] != 0)
     {
         hb_buffer_t *buffer;
         int len;
 
+        memcpy(wb->last_ssa, wb->enc_buffer, wb->enc_buffer_used);
+        wb->last_ssa_len = wb->enc_buffer_used;
+
         // bump past null terminator
         wb->enc_buffer_used++;
         buffer = hb_buffer_init(wb->enc_buffer_used + SSA_PREAMBLE_LEN);
@@ -1015,10 +1068,8 @@ static void roll_up(struct s_write *wb)
     {
         if (j >= 0)
         {
-            memcpy(use_buffer->characters[j], use_buffer->characters[j+1], CC608_SCREEN_WIDTH+1);
-            memcpy(use_buffer->colors[j], use_buffer->colors[j+1], CC608_SCREEN_WIDTH+1);
-            memcpy(use_buffer->fonts[j], use_buffer->fonts[j+1], CC608_SCREEN_WIDTH+1);
-            use_buffer->row_used[j] = use_buffer->row_used[j+1];
+            // Rows move up with their SSA, only the new row gets encoded
+            copy_row(use_buffer, j, j+1);
         }
     }
     for (j = 0; j < (1 + wb->data608->cursor_row - keep_lines); j++)
@@ -1028,6 +1079,7 @@ static void roll_up(struct s_write *wb)
         memset(use_buffer->fonts[j], FONT_REGULAR, CC608_SCREEN_WIDTH);
         use_buffer->characters[j][CC608_SCREEN_WIDTH] = 0;
         use_buffer->row_used[j] = 0;
+        mark_row_changed(use_buffer, j);
     }
     memset(use_buffer->characters[lastrow], ' ', CC608_SCREEN_WIDTH);
     memset(use_buffer->colors[lastrow], COL_WHITE, CC608_SCREEN_WIDTH);
@@ -1035,6 +1087,7 @@ static void roll_up(struct s_write *wb)
 
     use_buffer->characters[lastrow][CC608_SCREEN_WIDTH] = 0;
     use_buffer->row_used[lastrow] = 0;
+    mark_row_changed(use_buffer, lastrow);
 
     // Sanity check
     rows_now = 0;
@@ -1119,10 +1172,13 @@ static void handle_command(unsigned char c1, const unsigned char c2,
     switch (command)
     {
         case COM_BACKSPACE:
-            if (wb->data608->cursor_column>0)
+            // There is no screen to write to in text mode
+            if (wb->data608->cursor_column>0 && wb->data608->mode != MODE_TEXT)
             {
+                struct eia608_screen *use_buffer = get_writing_buffer(wb);
                 wb->data608->cursor_column--;
-                get_writing_buffer(wb)->characters[wb->data608->cursor_row][wb->data608->cursor_column] = ' ';
+                use_buffer->characters[wb->data608->cursor_row][wb->data608->cursor_column] = ' ';
+                mark_row_changed(use_buffer, wb->data608->cursor_row);
             }
             break;
         case COM_TABOFFSET1:
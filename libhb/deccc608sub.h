@@ -10,6 +10,10 @@ struct s_write;
 
 #define CC608_SCREEN_WIDTH  32
 
+// Worst case SSA for a row: every character changes style and color
+// ("{\\u1\\i1\\1c&HFFFFFF&}") and takes 3 bytes of UTF-8
+#define CC608_ROW_SSA_SIZE  (CC608_SCREEN_WIDTH * 23 + 1)
+
 enum cc_modes
 {
     MODE_POPUP = 0,
@@ -49,6 +53,11 @@ struct eia608_screen // A CC buffer
     unsigned char fonts[15][33]; // Extra char at the end for a 0
     int row_used[15]; // Any data in row?
     int empty; // Buffer completely empty?
+
+    // SSA encoding of each row, kept until the row changes
+    unsigned char row_ssa[15][CC608_ROW_SSA_SIZE];
+    int row_ssa_len[15]; // -1 if the row changed since it was encoded
+    int row_first[15], row_last[15]; // First and last non-blank column
 };
 
 struct eia608
@@ -81,6 +90,8 @@ struct s_write {
     unsigned char *enc_buffer; // Generic general purpose buffer
     unsigned enc_buffer_used;
     unsigned enc_buffer_capacity;
+    unsigned char *last_ssa; // Text of the screen on display
+    unsigned last_ssa_len;
 
     int clear_sub_needed;   // Indicates that we need to send a null
                             // subtitle to clear the current subtitle
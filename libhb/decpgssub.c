@@ -408,22 +408,29 @@ static int decsubWork( hb_work_object_t * w, hb_buffer_t ** buf_in,
                         uint8_t *chromaV = out->plane[2].data;
                         uint8_t *alpha   = out->plane[3].data;
 
+                        // Convert the palette once rather than every pixel
+                        uint32_t palette[256];
+                        uint8_t  palette_alpha[256];
                         int xx, yy;
+                        memset(palette, 0, sizeof(palette));
+                        memset(palette_alpha, 0, sizeof(palette_alpha));
+                        for (xx = 0; xx < rect->nb_colors && xx < 256; xx++)
+                        {
+                            uint32_t argb = ((uint32_t*)rect->pict.data[1])[xx];
+                            palette[xx] = hb_rgb2yuv(argb);
+                            palette_alpha[xx] = (argb >> 24) & 0xff;
+                        }
+
                         for (yy = 0; yy < rect->h; yy++)
                         {
+                            const uint8_t *color = rect->pict.data[0] +
+                                                   yy * rect->w;
                             for (xx = 0; xx < rect->w; xx++)
                             {
-                                uint32_t argb, yuv;
-                                int pixel;
-                                uint8_t color;
-
-                                pixel = yy * rect->w + xx;
-                                color = rect->pict.data[0][pixel];
-                                argb = ((uint32_t*)rect->pict.data[1])[color];
-                                yuv = hb_rgb2yuv(argb);
+                                uint32_t yuv = palette[color[xx]];
 
                                 lum[xx] = (yuv >> 16) & 0xff;
-                                alpha[xx] = (argb >> 24) & 0xff;
+                                alpha[xx] = palette_alpha[color[xx]];
                                 if ((xx & 1) == 0 && (yy & 1) == 0)
                                 {
                                     chromaV[xx>>1] = (yuv >> 8) & 0xff;
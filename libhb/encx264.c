@@ -152,6 +152,13 @@ int encx264Init( hb_work_object_t * w, hb_job_t * job )
     param.i_keyint_min = (int)( (double)job->vrate / (double)job->vrate_base + 0.5 );
     param.i_keyint_max = 10 * param.i_keyint_min;
 
+    /* The frame analysis filter already found the scene changes,
+     * don't let x264 look for them again (unless the user says so). */
+    if( hb_analyze_enabled( job ) )
+    {
+        param.i_scenecut_threshold = 0;
+    }
+
     param.i_log_level  = X264_LOG_INFO;
 
     /* set up the VUI color model & gamma to match what the COLR atom
@@ -610,6 +617,11 @@ static hb_buffer_t *x264_encode( hb_work_object_t *w, hb_buffer_t *in )
         /* don't let 'work_loop' put a chapter mark on the wrong buffer */
         in->s.new_chap = 0;
     }
+    else if( in->s.scenecut )
+    {
+        /* scene change detected by the frame analysis filter */
+        pv->pic_in.i_type = X264_TYPE_KEYFRAME;
+    }
     else
     {
         pv->pic_in.i_type = X264_TYPE_AUTO;
@@ -1047,6 +1059,65 @@ int hb_apply_h264_level(x264_param_t *param, const char *h264_level,
     return ret;
 }
 
+/*
+ * Applies preset, tune, options, profile and level to an x264_param_t as
+ * encx264Init does, without opening an encoder.  Returns 0 if x264 took
+ * all of them; what it didn't take is logged.  Unlike encx264Init, an
+ * unknown option or a bad value is an error here.
+ */
+int hb_x264_param_check(const char *x264_preset,  const char *x264_tune,
+                        const char *x264_encopts, const char *h264_profile,
+                        const char *h264_level, int width, int height)
+{
+    int ret = 0;
+    hb_dict_t *x264_opts;
+    hb_dict_entry_t *entry = NULL;
+    x264_param_t param;
+
+    if (x264_param_default_preset(&param, x264_preset, x264_tune) < 0)
+    {
+        hb_log("x264 options: invalid preset %s or tune %s",
+               x264_preset ? x264_preset : "(null)",
+               x264_tune   ? x264_tune   : "(null)");
+        return 1;
+    }
+
+    x264_opts = hb_encopts_to_dict(x264_encopts, HB_VCODEC_X264);
+    while ((entry = hb_dict_next(x264_opts, entry)) != NULL)
+    {
+        switch (x264_param_parse(&param, entry->key, entry->value))
+        {
+            case X264_PARAM_BAD_NAME:
+                hb_log("x264 options: Unknown suboption %s", entry->key);
+                ret = 1;
+                break;
+            case X264_PARAM_BAD_VALUE:
+                hb_log("x264 options: Bad argument %s=%s", entry->key,
+                       entry->value ? entry->value : "(null)");
+                ret = 1;
+                break;
+        }
+    }
+    hb_dict_free(&x264_opts);
+
+    param.i_width  = width;
+    param.i_height = height;
+    if (h264_profile != NULL && *h264_profile &&
+        hb_apply_h264_profile(&param, h264_profile, 1))
+    {
+        hb_log("x264 options: invalid profile %s", h264_profile);
+        ret = 1;
+    }
+    if (h264_level != NULL && *h264_level &&
+        hb_apply_h264_level(&param, h264_level, h264_profile, 1) < 0)
+    {
+        hb_log("x264 options: invalid level %s", h264_level);
+        ret = 1;
+    }
+
+    return ret;
+}
+
 char * hb_x264_param_unparse(const char *x264_preset,  const char *x264_tune,
                              const char *x264_encopts, const char *h264_profile,
                              const char *h264_level, int width, int height)
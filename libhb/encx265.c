@@ -121,6 +121,15 @@ int encx265Init(hb_work_object_t *w, hb_job_t *job)
     param->keyframeMin = (int)((double)vrate / (double)vrate_base + 0.5);
     param->keyframeMax = param->keyframeMin * 10;
 
+    /*
+     * The frame analysis filter already found the scene changes,
+     * don't let x265 look for them again (unless the user says so).
+     */
+    if (hb_analyze_enabled(job))
+    {
+        param->scenecutThreshold = 0;
+    }
+
     /*
      * Video Signal Type (color description only).
      *
@@ -472,6 +481,11 @@ static hb_buffer_t* x265_encode(hb_work_object_t *w, hb_buffer_t *in)
          */
         pic_in.sliceType = X265_TYPE_IDR;
     }
+    else if (in->s.scenecut)
+    {
+        /* scene change detected by the frame analysis filter */
+        pic_in.sliceType = X265_TYPE_I;
+    }
     else
     {
         pic_in.sliceType = X265_TYPE_AUTO;
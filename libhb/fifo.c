@@ -14,7 +14,12 @@
 #include <malloc.h>
 #endif
 
+#if defined( USE_PTHREAD )
+#include <pthread.h>
+#endif
+
 #define FIFO_TIMEOUT 200
+#define FIFO_ADAPT_INTERVAL 1000 // ms between capacity adjustments
 //#define HB_FIFO_DEBUG 1
 
 /* Fifo */
@@ -31,6 +36,24 @@ struct hb_fifo_s
     uint32_t       buffer_size;
     hb_buffer_t  * first;
     hb_buffer_t  * last;
+    hb_mem_account_t * mem;     // shrinks the fifo under memory pressure
+
+    // Optional bound on the bytes held, in addition to capacity
+    uint64_t       bytes;
+    uint64_t       max_bytes;
+
+    // Adaptive capacity, see fifo_adapt
+    uint32_t       min_capacity;
+    uint32_t       max_capacity;
+    uint32_t       peak;
+    int            full_waits;
+    int            empty_waits;
+    uint32_t       gets;
+    uint64_t       adapt_date;
+
+    // Also signalled when buffers come and go, see hb_fifo_set_wake
+    hb_lock_t    * wake_lock;
+    hb_cond_t    * wake_cond;
 
 #if defined(HB_FIFO_DEBUG)
     // Fifo list for debugging
@@ -67,6 +90,214 @@ struct hb_buffer_pools_s
 } buffers;
 
 
+/*
+ * Per-job memory accounting.
+ *
+ * Every buffer is charged to the account and pipeline stage that the
+ * allocating thread runs with (see hb_mem_set_context, threads started
+ * with hb_thread_init inherit the context of their creator) and credited
+ * back when it is closed, whether it goes back to a pool or is freed.
+ *
+ * When the job has a limit, fifos attached to the account with
+ * hb_fifo_set_mem shrink as usage approaches it, so that producers block
+ * instead of queueing more frames.  Pressure starts at
+ * MEM_PRESSURE_START percent of the limit and reaches its maximum at the
+ * limit, where every attached fifo holds a single buffer.
+ */
+#define MEM_PRESSURE_START 75
+
+struct hb_mem_account_s
+{
+    hb_lock_t    * lock;
+    int64_t        bytes;
+    int64_t        peak;
+    int64_t        limit;
+    int64_t        stage[HB_MEM_STAGE_COUNT];
+    volatile int   pressure;    // 0 - 100
+    int            closed;
+};
+
+typedef struct
+{
+    hb_mem_account_t * account;
+    int                stage;
+} mem_context_t;
+
+#if defined( USE_PTHREAD )
+static pthread_key_t  mem_context_key;
+static pthread_once_t mem_context_once = PTHREAD_ONCE_INIT;
+
+static void mem_context_key_init( void )
+{
+    pthread_key_create( &mem_context_key, free );
+}
+
+static mem_context_t * mem_context( int create )
+{
+    mem_context_t * ctx;
+
+    pthread_once( &mem_context_once, mem_context_key_init );
+    ctx = pthread_getspecific( mem_context_key );
+    if( ctx == NULL && create )
+    {
+        ctx = calloc( 1, sizeof( mem_context_t ) );
+        pthread_setspecific( mem_context_key, ctx );
+    }
+    return ctx;
+}
+#else
+static mem_context_t mem_context_global;
+
+static mem_context_t * mem_context( int create )
+{
+    return &mem_context_global;
+}
+#endif
+
+hb_mem_account_t * hb_mem_account_init( int limit_mb )
+{
+    hb_mem_account_t * a = calloc( 1, sizeof( hb_mem_account_t ) );
+
+    a->lock  = hb_lock_init();
+    a->limit = (int64_t)limit_mb * 1024 * 1024;
+
+    return a;
+}
+
+static void mem_account_free( hb_mem_account_t * a )
+{
+    hb_lock_close( &a->lock );
+    free( a );
+}
+
+/*
+ * Buffers charged to the account may outlive the job (e.g. frames held
+ * by the frontend), so the account is only freed once the last of them
+ * has been credited back.
+ */
+void hb_mem_account_close( hb_mem_account_t ** _a )
+{
+    hb_mem_account_t * a = *_a;
+    int                release;
+
+    if( a == NULL )
+        return;
+
+    hb_lock( a->lock );
+    a->closed = 1;
+    release = ( a->bytes <= 0 );
+    hb_unlock( a->lock );
+    if( release )
+    {
+        mem_account_free( a );
+    }
+    *_a = NULL;
+}
+
+static void mem_account_update( hb_mem_account_t * a, int stage, int64_t delta )
+{
+    int release;
+
+    hb_lock( a->lock );
+    a->bytes        += delta;
+    a->stage[stage] += delta;
+    if( a->bytes > a->peak )
+    {
+        a->peak = a->bytes;
+    }
+    if( a->limit > 0 )
+    {
+        int64_t start = a->limit * MEM_PRESSURE_START / 100;
+
+        if( a->bytes <= start )
+            a->pressure = 0;
+        else if( a->bytes >= a->limit )
+            a->pressure = 100;
+        else
+            a->pressure = 100 * ( a->bytes - start ) / ( a->limit - start );
+    }
+    release = ( a->closed && a->bytes <= 0 );
+    hb_unlock( a->lock );
+    if( release )
+    {
+        mem_account_free( a );
+    }
+}
+
+static void mem_charge( hb_buffer_t * b )
+{
+    mem_context_t * ctx = mem_context( 0 );
+
+    if( ctx == NULL || ctx->account == NULL || b->data == NULL )
+        return;
+
+    b->mem       = ctx->account;
+    b->mem_stage = ctx->stage;
+    mem_account_update( b->mem, b->mem_stage, b->alloc );
+}
+
+static void mem_credit( hb_buffer_t * b )
+{
+    if( b->mem == NULL )
+        return;
+
+    mem_account_update( b->mem, b->mem_stage, -(int64_t)b->alloc );
+    b->mem = NULL;
+}
+
+void hb_mem_set_context( hb_mem_account_t * account, int stage )
+{
+    mem_context_t * ctx = mem_context( account != NULL );
+
+    if( ctx != NULL )
+    {
+        ctx->account = account;
+        ctx->stage   = stage;
+    }
+}
+
+void hb_mem_set_stage( int stage )
+{
+    mem_context_t * ctx = mem_context( 0 );
+
+    if( ctx != NULL )
+    {
+        ctx->stage = stage;
+    }
+}
+
+hb_mem_account_t * hb_mem_get_account( void )
+{
+    mem_context_t * ctx = mem_context( 0 );
+
+    return ctx != NULL ? ctx->account : NULL;
+}
+
+int hb_mem_get_stage( void )
+{
+    mem_context_t * ctx = mem_context( 0 );
+
+    return ctx != NULL ? ctx->stage : HB_MEM_STAGE_OTHER;
+}
+
+void hb_mem_get_state( hb_mem_account_t * a, hb_state_t * state )
+{
+    int ii;
+
+    if( a == NULL )
+        return;
+
+    hb_lock( a->lock );
+    state->param.working.mem_bytes = a->bytes;
+    state->param.working.mem_peak  = a->peak;
+    state->param.working.mem_limit = a->limit;
+    for( ii = 0; ii < HB_MEM_STAGE_COUNT; ii++ )
+    {
+        state->param.working.mem_stage[ii] = a->stage[ii];
+    }
+    hb_unlock( a->lock );
+}
+
 void hb_buffer_pool_init( void )
 {
     buffers.lock = hb_lock_init();
@@ -282,6 +513,28 @@ void hb_buffer_pool_free( void )
     hb_unlock(buffers.lock);
 }
 
+/* Fills the buffer pool stats of a working state */
+void hb_buffer_pool_get_state( hb_state_t * state )
+{
+    int64_t idle = 0;
+    int     i;
+
+    for( i = BUFFER_POOL_FIRST; i <= BUFFER_POOL_LAST; ++i )
+    {
+        if( buffers.pool[i] != NULL )
+        {
+            hb_lock( buffers.pool[i]->lock );
+            idle += buffers.pool[i]->bytes;
+            hb_unlock( buffers.pool[i]->lock );
+        }
+    }
+    state->param.working.pool_idle = idle;
+
+    hb_lock( buffers.lock );
+    state->param.working.pool_bytes = buffers.allocated;
+    hb_unlock( buffers.lock );
+}
+
 static hb_fifo_t *size_to_pool( int size )
 {
     int i;
@@ -350,6 +603,7 @@ hb_buffer_t * hb_buffer_init_internal( int size , int needsMapped )
             b->cl.last_event      = last_event;
             b->cl.buffer_location = loc;
 
+            mem_charge( b );
             return( b );
         }
     }
@@ -406,6 +660,7 @@ hb_buffer_t * hb_buffer_init_internal( int size , int needsMapped )
         hb_lock(buffers.lock);
         buffers.allocated += b->alloc;
         hb_unlock(buffers.lock);
+        mem_charge( b );
     }
     b->s.start = AV_NOPTS_VALUE;
     b->s.stop = AV_NOPTS_VALUE;
@@ -430,6 +685,11 @@ void hb_buffer_realloc( hb_buffer_t * b, int size )
         hb_lock(buffers.lock);
         buffers.allocated += size - orig;
         hb_unlock(buffers.lock);
+
+        if( b->mem != NULL )
+            mem_account_update( b->mem, b->mem_stage, size - orig );
+        else
+            mem_charge( b );
     }
 }
 
@@ -603,6 +863,10 @@ void hb_buffer_swap_copy( hb_buffer_t *src, hb_buffer_t *dst )
     int      size  = dst->size;
     int      alloc = dst->alloc;
 
+    // the charge follows the data
+    hb_mem_account_t * mem = dst->mem;
+    int          mem_stage = dst->mem_stage;
+
     /* OpenCL */
     cl_mem buffer       = dst->cl.buffer;
     cl_event last_event = dst->cl.last_event;
@@ -613,6 +877,8 @@ void hb_buffer_swap_copy( hb_buffer_t *src, hb_buffer_t *dst )
     src->data  = data;
     src->size  = size;
     src->alloc = alloc;
+    src->mem       = mem;
+    src->mem_stage = mem_stage;
 
     /* OpenCL */
     src->cl.buffer          = buffer;
@@ -635,6 +901,8 @@ void hb_buffer_close( hb_buffer_t ** _b )
         // Close any attached subtitle buffers
         hb_buffer_close( &b->sub );
 
+        mem_credit( b );
+
         if( buffer_pool && b->data && !hb_fifo_is_full( buffer_pool ) )
         {
             hb_fifo_push_head( buffer_pool, b );
@@ -681,6 +949,111 @@ void hb_buffer_move_subs( hb_buffer_t * dst, hb_buffer_t * src )
 
 }
 
+/*
+ * Effective capacity of the fifo, from the full capacity down to
+ * a single buffer as the memory pressure of its job rises.
+ */
+static uint32_t fifo_capacity( hb_fifo_t * f )
+{
+    int pressure = f->mem != NULL ? f->mem->pressure : 0;
+
+    return f->capacity - ( f->capacity - 1 ) * pressure / 100;
+}
+
+static int fifo_full( hb_fifo_t * f )
+{
+    if( f->size >= fifo_capacity( f ) )
+        return 1;
+
+    // A single buffer larger than max_bytes still gets through
+    return f->max_bytes && f->size > 0 && f->bytes >= f->max_bytes;
+}
+
+/* Is there room for another buffer now that the fifo shrank or drained? */
+static int fifo_wake_full( hb_fifo_t * f )
+{
+    uint32_t capacity = fifo_capacity( f );
+
+    if( f->max_bytes && f->bytes >= f->max_bytes )
+        return 0;
+    if( f->max_bytes && f->size < capacity )
+        return 1;
+    return f->size <= capacity - MIN( f->thresh, capacity );
+}
+
+/*
+ * Adjusts the capacity of an adaptive fifo from what happened since the
+ * last adjustment.  When both the producer found the fifo full and the
+ * consumer found it empty, one side runs in bursts (e.g. an encoder that
+ * takes a lookahead's worth of frames at once) and a deeper queue lets
+ * the other keep going, so the fifo grows.  When the producer never had
+ * to wait and the fifo never came close to full, the extra room only
+ * holds memory, so it shrinks towards what was used.
+ *
+ * Called with the fifo locked, on the consumer side.
+ */
+static void fifo_adapt( hb_fifo_t * f )
+{
+    uint64_t now;
+    uint32_t capacity = f->capacity;
+
+    if( f->max_capacity == 0 || ( ++f->gets & 15 ) )
+        return;
+
+    now = hb_get_date();
+    if( f->adapt_date == 0 )
+    {
+        f->adapt_date = now;
+        return;
+    }
+    if( now < f->adapt_date + FIFO_ADAPT_INTERVAL )
+        return;
+
+    if( f->full_waits && f->empty_waits )
+    {
+        capacity = MIN( f->max_capacity, capacity + capacity / 2 + 1 );
+    }
+    else if( !f->full_waits && f->peak < capacity / 2 )
+    {
+        capacity = MAX( f->min_capacity, ( capacity + f->peak ) / 2 );
+    }
+    if( capacity != f->capacity )
+    {
+        hb_deep_log( 3, "fifo %p: capacity %u -> %u (full %d empty %d peak %u)",
+                     f, f->capacity, capacity, f->full_waits, f->empty_waits,
+                     f->peak );
+        f->capacity = capacity;
+        if( f->wait_full && fifo_wake_full( f ) )
+        {
+            f->wait_full = 0;
+            hb_cond_signal( f->cond_full );
+        }
+    }
+    f->full_waits  = 0;
+    f->empty_waits = 0;
+    f->peak        = f->size;
+    f->adapt_date  = now;
+}
+
+/* Bookkeeping for buffers entering and leaving the fifo */
+static void fifo_added( hb_fifo_t * f, hb_buffer_t * b )
+{
+    for( ; b != NULL; b = b->next )
+    {
+        f->bytes += b->alloc;
+    }
+    if( f->size > f->peak )
+    {
+        f->peak = f->size;
+    }
+}
+
+static void fifo_removed( hb_fifo_t * f, hb_buffer_t * b )
+{
+    f->bytes = ( f->size > 0 && f->bytes > b->alloc ) ? f->bytes - b->alloc : 0;
+    fifo_adapt( f );
+}
+
 hb_fifo_t * hb_fifo_init( int capacity, int thresh )
 {
     hb_fifo_t * f;
@@ -699,6 +1072,84 @@ hb_fifo_t * hb_fifo_init( int capacity, int thresh )
     return f;
 }
 
+/*
+ * Makes the fifo signal cond, under lock, after a push to it while it was
+ * empty or a get from it while it was full.  Lets a thread wait on several
+ * fifos at once.  Must be set before the fifo is used.
+ */
+void hb_fifo_set_wake( hb_fifo_t * f, hb_lock_t * lock, hb_cond_t * cond )
+{
+    f->wake_lock = lock;
+    f->wake_cond = cond;
+}
+
+/*
+ * Called without f->lock held, the waker takes its own lock.  Only a fifo
+ * that stops being empty or full can make a waiter ready.
+ */
+static void fifo_wake( hb_fifo_t * f, int wake )
+{
+    if( wake && f->wake_cond != NULL )
+    {
+        hb_lock( f->wake_lock );
+        hb_cond_signal( f->wake_cond );
+        hb_unlock( f->wake_lock );
+    }
+}
+
+/*
+ * Bounds the fifo by the bytes it holds as well as by its capacity.
+ * 0 removes the bound.
+ */
+void hb_fifo_set_max_bytes( hb_fifo_t * f, uint64_t max_bytes )
+{
+    if( f == NULL )
+        return;
+
+    hb_lock( f->lock );
+    f->max_bytes = max_bytes;
+    hb_unlock( f->lock );
+}
+
+/*
+ * Lets the capacity of the fifo move between min_capacity and
+ * max_capacity depending on how its producer and consumer wait on
+ * each other, see fifo_adapt.
+ */
+void hb_fifo_set_adaptive( hb_fifo_t * f, int min_capacity, int max_capacity )
+{
+    if( f == NULL )
+        return;
+
+    hb_lock( f->lock );
+    f->min_capacity = MAX( 1, min_capacity );
+    f->max_capacity = MAX( f->min_capacity, max_capacity );
+    f->capacity     = MIN( MAX( f->capacity, f->min_capacity ),
+                           f->max_capacity );
+    hb_unlock( f->lock );
+}
+
+int hb_fifo_capacity( hb_fifo_t * f )
+{
+    int ret;
+
+    hb_lock( f->lock );
+    ret = fifo_capacity( f );
+    hb_unlock( f->lock );
+
+    return ret;
+}
+
+void hb_fifo_set_mem( hb_fifo_t * f, hb_mem_account_t * mem )
+{
+    if( f == NULL )
+        return;
+
+    hb_lock( f->lock );
+    f->mem = mem;
+    hb_unlock( f->lock );
+}
+
 int hb_fifo_size_bytes( hb_fifo_t * f )
 {
     int ret = 0;
@@ -732,7 +1183,7 @@ int hb_fifo_is_full( hb_fifo_t * f )
     int ret;
 
     hb_lock( f->lock );
-    ret = ( f->size >= f->capacity );
+    ret = fifo_full( f );
     hb_unlock( f->lock );
 
     return ret;
@@ -743,7 +1194,7 @@ float hb_fifo_percent_full( hb_fifo_t * f )
     float ret;
 
     hb_lock( f->lock );
-    ret = f->size / f->capacity;
+    ret = f->size / fifo_capacity( f );
     hb_unlock( f->lock );
 
     return ret;
@@ -754,11 +1205,13 @@ float hb_fifo_percent_full( hb_fifo_t * f )
 hb_buffer_t * hb_fifo_get_wait( hb_fifo_t * f )
 {
     hb_buffer_t * b;
+    int           wake;
 
     hb_lock( f->lock );
     if( f->size < 1 )
     {
         f->wait_empty = 1;
+        f->empty_waits++;
         hb_cond_timedwait( f->cond_empty, f->lock, FIFO_TIMEOUT );
         if( f->size < 1 )
         {
@@ -766,16 +1219,19 @@ hb_buffer_t * hb_fifo_get_wait( hb_fifo_t * f )
             return NULL;
         }
     }
+    wake      = fifo_full( f );
     b         = f->first;
     f->first  = b->next;
     b->next   = NULL;
     f->size  -= 1;
-    if( f->wait_full && f->size == f->capacity - f->thresh )
+    fifo_removed( f, b );
+    if( f->wait_full && fifo_wake_full( f ) )
     {
         f->wait_full = 0;
         hb_cond_signal( f->cond_full );
     }
     hb_unlock( f->lock );
+    fifo_wake( f, wake );
 
     return b;
 }
@@ -784,6 +1240,7 @@ hb_buffer_t * hb_fifo_get_wait( hb_fifo_t * f )
 hb_buffer_t * hb_fifo_get( hb_fifo_t * f )
 {
     hb_buffer_t * b;
+    int           wake;
 
     hb_lock( f->lock );
     if( f->size < 1 )
@@ -791,16 +1248,19 @@ hb_buffer_t * hb_fifo_get( hb_fifo_t * f )
         hb_unlock( f->lock );
         return NULL;
     }
+    wake      = fifo_full( f );
     b         = f->first;
     f->first  = b->next;
     b->next   = NULL;
     f->size  -= 1;
-    if( f->wait_full && f->size == f->capacity - f->thresh )
+    fifo_removed( f, b );
+    if( f->wait_full && fifo_wake_full( f ) )
     {
         f->wait_full = 0;
         hb_cond_signal( f->cond_full );
     }
     hb_unlock( f->lock );
+    fifo_wake( f, wake );
 
     return b;
 }
@@ -867,12 +1327,13 @@ int hb_fifo_full_wait( hb_fifo_t * f )
     int result;
 
     hb_lock( f->lock );
-    if( f->size >= f->capacity )
+    if( fifo_full( f ) )
     {
         f->wait_full = 1;
+        f->full_waits++;
         hb_cond_timedwait( f->cond_full, f->lock, FIFO_TIMEOUT );
     }
-    result = ( f->size < f->capacity );
+    result = !fifo_full( f );
     hb_unlock( f->lock );
     return result;
 }
@@ -881,17 +1342,21 @@ int hb_fifo_full_wait( hb_fifo_t * f )
 // blocking until the FIFO has space available.
 void hb_fifo_push_wait( hb_fifo_t * f, hb_buffer_t * b )
 {
+    int wake;
+
     if( !b )
     {
         return;
     }
 
     hb_lock( f->lock );
-    if( f->size >= f->capacity )
+    if( fifo_full( f ) )
     {
         f->wait_full = 1;
+        f->full_waits++;
         hb_cond_timedwait( f->cond_full, f->lock, FIFO_TIMEOUT );
     }
+    wake = f->size == 0;
     if( f->size > 0 )
     {
         f->last->next = b;
@@ -907,23 +1372,28 @@ void hb_fifo_push_wait( hb_fifo_t * f, hb_buffer_t * b )
         f->size += 1;
         f->last  = f->last->next;
     }
+    fifo_added( f, b );
     if( f->wait_empty && f->size >= 1 )
     {
         f->wait_empty = 0;
         hb_cond_signal( f->cond_empty );
     }
     hb_unlock( f->lock );
+    fifo_wake( f, wake );
 }
 
 // Appends the specified packet list to the end of the specified FIFO.
 void hb_fifo_push( hb_fifo_t * f, hb_buffer_t * b )
 {
+    int wake;
+
     if( !b )
     {
         return;
     }
 
     hb_lock( f->lock );
+    wake = f->size == 0;
     if( f->size > 0 )
     {
         f->last->next = b;
@@ -939,12 +1409,14 @@ void hb_fifo_push( hb_fifo_t * f, hb_buffer_t * b )
         f->size += 1;
         f->last  = f->last->next;
     }
+    fifo_added( f, b );
     if( f->wait_empty && f->size >= 1 )
     {
         f->wait_empty = 0;
         hb_cond_signal( f->cond_empty );
     }
     hb_unlock( f->lock );
+    fifo_wake( f, wake );
 }
 
 // Prepends the specified packet list to the start of the specified FIFO.
@@ -952,6 +1424,7 @@ void hb_fifo_push_head( hb_fifo_t * f, hb_buffer_t * b )
 {
     hb_buffer_t * tmp;
     uint32_t      size = 0;
+    int           wake;
 
     if( !b )
     {
@@ -959,6 +1432,10 @@ void hb_fifo_push_head( hb_fifo_t * f, hb_buffer_t * b )
     }
 
     hb_lock( f->lock );
+    wake = f->size == 0;
+
+    // Before b is linked to the rest of the fifo
+    fifo_added( f, b );
 
     /*
      * If there are a chain of buffers prepend the lot
@@ -983,6 +1460,7 @@ void hb_fifo_push_head( hb_fifo_t * f, hb_buffer_t * b )
     f->size += ( size + 1 );
 
     hb_unlock( f->lock );
+    fifo_wake( f, wake );
 }
 
 // Pushes a list of packets onto the specified FIFO as a single element.
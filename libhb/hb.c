@@ -25,6 +25,23 @@
 #endif
 #endif
 
+#define PREVIEW_CACHE_SIZE 4
+
+/* Stages of a preview kept between hb_get_preview calls, so that a
+   change of crop or size doesn't read and deinterlace the frame again */
+typedef struct
+{
+    int                 title;      // title->index, 0 if the entry is free
+    int                 picture;
+    int                 last_used;
+    hb_buffer_t       * in;         // as read by hb_read_preview
+    hb_buffer_t       * deint;      // in, deinterlaced.  NULL until needed
+
+    /* Last image rendered from this preview and what it was rendered with */
+    hb_buffer_t       * rgb;
+    int                 rgb_key[9];
+} hb_preview_cache_t;
+
 struct hb_handle_s
 {
     int            id;
@@ -43,11 +60,26 @@ struct hb_handle_s
     /* DVD/file scan thread */
     hb_title_set_t title_set;
     hb_thread_t  * scan_thread;
+    int            fast_probe;
+    int            join_segments;
+    int            seek_index;
+    int            preview_count;   // of the latest scan, for previews
+    int            store_previews;  // decoded by hb_scan_previews
+    char         * thumb_prefix;    // see hb_scan_set_thumbnails
+    int            thumb_width;
+
+    /* hb_get_preview state */
+    hb_lock_t          * preview_lock;
+    hb_preview_cache_t   preview_cache[PREVIEW_CACHE_SIZE];
+    int                  preview_uses;
+    struct SwsContext  * preview_sws;
+    int                  preview_sws_key[4];
 
     /* The thread which processes the jobs. Others threads are launched
        from this one (see work.c) */
     hb_list_t    * jobs;
     hb_job_t     * current_job;
+    int            parallel_programs; // see hb_set_parallel_programs
     int            job_count;
     int            job_count_permanent;
     volatile int   work_die;
@@ -422,6 +454,8 @@ hb_handle_t * hb_init( int verbose, int update_check )
 
     h->pause_lock = hb_lock_init();
 
+    h->preview_lock = hb_lock_init();
+
     h->interjob = calloc( sizeof( hb_interjob_t ), 1 );
 
     /* Start library thread */
@@ -494,6 +528,8 @@ hb_handle_t * hb_init_dl( int verbose, int update_check )
 
     h->pause_lock = hb_lock_init();
 
+    h->preview_lock = hb_lock_init();
+
     /* Start library thread */
     hb_log( "hb_init: starting libhb thread" );
     h->die         = 0;
@@ -536,6 +572,28 @@ int hb_check_update( hb_handle_t * h, char ** version )
     return h->build;
 }
 
+static void preview_cache_flush( hb_handle_t * h )
+{
+    int i;
+
+    hb_lock( h->preview_lock );
+    for( i = 0; i < PREVIEW_CACHE_SIZE; i++ )
+    {
+        hb_preview_cache_t * pc = &h->preview_cache[i];
+
+        hb_buffer_close( &pc->in );
+        hb_buffer_close( &pc->deint );
+        hb_buffer_close( &pc->rgb );
+        memset( pc, 0, sizeof( *pc ) );
+    }
+    if( h->preview_sws != NULL )
+    {
+        sws_freeContext( h->preview_sws );
+        h->preview_sws = NULL;
+    }
+    hb_unlock( h->preview_lock );
+}
+
 /**
  * Deletes current previews associated with titles
  * @param h Handle to hb_handle_t
@@ -549,6 +607,8 @@ void hb_remove_previews( hb_handle_t * h )
     DIR           * dir;
     struct dirent * entry;
 
+    preview_cache_flush( h );
+
     memset( dirname, 0, 1024 );
     hb_get_temporary_directory( dirname );
     dir = opendir( dirname );
@@ -617,10 +677,97 @@ void hb_scan( hb_handle_t * h, const char * path, int title_index,
     hb_qsv_info_print();
 #endif
 
+    h->preview_count  = preview_count;
+    h->store_previews = store_previews;
+
     hb_log( "hb_scan: path=%s, title_index=%d", path, title_index );
     h->scan_thread = hb_scan_init( h, &h->scan_die, path, title_index, 
                                    &h->title_set, preview_count, 
-                                   store_previews, min_duration );
+                                   store_previews, min_duration,
+                                   h->fast_probe, h->join_segments,
+                                   h->seek_index );
+}
+
+/**
+ * Makes the following scans set up MKV and MP4 titles from their
+ * container headers, without decoding any preview.
+ * @param h Handle to hb_handle_t
+ * @param enable 1 to probe fast, 0 to decode previews while scanning.
+ */
+void hb_scan_set_fast_probe( hb_handle_t * h, int enable )
+{
+    h->fast_probe = enable;
+}
+
+/**
+ * Makes the following scans read a transport stream whose file name ends
+ * in a number together with the files numbered after it, as one source.
+ * For captures that were split into several files.
+ * @param h Handle to hb_handle_t
+ * @param enable 1 to join segments, 0 to read the file alone.
+ */
+void hb_scan_set_join_segments( hb_handle_t * h, int enable )
+{
+    h->join_segments = enable;
+}
+
+/**
+ * Makes the following scans index the keyframes of MPEG transport and
+ * program streams, or load the index from its .hbidx sidecar.  The index
+ * is kept with the title for its previews and encodes.
+ * @param h Handle to hb_handle_t
+ * @param enable 1 to index, 0 to seek by file position.
+ */
+void hb_scan_set_seek_index( hb_handle_t * h, int enable )
+{
+    h->seek_index = enable;
+}
+
+/**
+ * Makes the following scans tile the previews they decode into thumbnail
+ * sprite sheets, with a WebVTT index for scrubbing previews.  The files
+ * are named <prefix>-<title>.vtt and <prefix>-<title>-<sheet>.jpg.
+ * @param h Handle to hb_handle_t
+ * @param prefix Path and base name of the files, NULL to turn it off.
+ * @param width Width of a thumbnail in pixels.
+ */
+void hb_scan_set_thumbnails( hb_handle_t * h, const char * prefix, int width )
+{
+    free( h->thumb_prefix );
+    h->thumb_prefix = prefix != NULL ? strdup( prefix ) : NULL;
+    h->thumb_width  = width;
+}
+
+const char * hb_scan_thumbnails( hb_handle_t * h, int * width )
+{
+    *width = h->thumb_width;
+    return h->thumb_prefix;
+}
+
+/**
+ * Decodes the previews of a title that a fast probe left out, which also
+ * sets its autocrop and interlace detection.  Does nothing for titles
+ * that already have them.  Blocks until the previews are decoded.
+ * @param h Handle to hb_handle_t
+ * @param title Title of the latest scan.
+ * @return 0 if no preview could be decoded.
+ */
+int hb_scan_previews( hb_handle_t * h, hb_title_t * title )
+{
+    int ret;
+
+    if( !( title->flags & HBTF_PREVIEWS_PENDING ) )
+    {
+        return 1;
+    }
+    ret = hb_scan_decode_previews( h, title, h->preview_count,
+                                   h->store_previews );
+#if defined(HB_TITLE_JOBS)
+    // The title's job was set up with the probed values.  Callers such as
+    // hb_get_preview_region may hold it, so it is updated, not replaced.
+    hb_job_update_video( title->job );
+#endif
+    return ret;
 }
 
 /**
@@ -729,89 +876,205 @@ hb_buffer_t * hb_read_preview( hb_handle_t * h, int title_idx, int preview )
     return buf;
 }
 
-/**
- * Create preview image of desired title a index of picture.
- * @param h Handle to hb_handle_t.
- * @param title Handle to hb_title_t of desired title.
- * @param picture Index in title.
- * @param buffer Handle to buffer were image will be drawn.
- */
-void hb_get_preview( hb_handle_t * h, hb_job_t * job, int picture,
-                     uint8_t * buffer )
+/* Returns the cache entry of a preview, reading it on a miss in place of
+   the least recently used entry.  Called with preview_lock held. */
+static hb_preview_cache_t * preview_cache_get( hb_handle_t * h,
+                                               hb_title_t * title,
+                                               int picture )
 {
-    hb_title_t         * title = job->title;
-    char                 filename[1024];
-    hb_buffer_t        * in_buf, * deint_buf = NULL, * preview_buf;
-    uint8_t            * pen;
-    uint32_t             swsflags;
-    AVPicture            pic_in, pic_preview, pic_deint, pic_crop;
-    struct SwsContext  * context;
+    hb_preview_cache_t * pc = NULL;
     int                  i;
-    int                  preview_size;
 
-    swsflags = SWS_LANCZOS | SWS_ACCURATE_RND;
+    for( i = 0; i < PREVIEW_CACHE_SIZE; i++ )
+    {
+        hb_preview_cache_t * entry = &h->preview_cache[i];
 
-    preview_buf = hb_frame_buffer_init( AV_PIX_FMT_RGB32,
-                                        job->width, job->height );
-    hb_avpicture_fill( &pic_preview, preview_buf );
+        if( entry->title == title->index && entry->picture == picture )
+        {
+            pc = entry;
+            break;
+        }
+        if( pc == NULL || entry->last_used < pc->last_used )
+        {
+            pc = entry;
+        }
+    }
+    if( pc->title != title->index || pc->picture != picture )
+    {
+        hb_buffer_close( &pc->in );
+        hb_buffer_close( &pc->deint );
+        hb_buffer_close( &pc->rgb );
+        memset( pc, 0, sizeof( *pc ) );
 
-    // Allocate the AVPicture frames and fill in
+        pc->in = hb_read_preview( h, title->index, picture );
+        if( pc->in == NULL )
+        {
+            return NULL;
+        }
+        pc->title   = title->index;
+        pc->picture = picture;
+    }
+    pc->last_used = ++h->preview_uses;
 
-    memset( filename, 0, 1024 );
+    return pc;
+}
 
-    in_buf = hb_read_preview( h, title->index, picture );
-    if ( in_buf == NULL )
+/**
+ * Renders part of a preview image of the job.
+ * The rectangle x, y, width, height is in the job's output frame
+ * (job->width by job->height) and is scaled straight from the source to
+ * out_width by out_height, so a thumbnail or a zoomed in detail costs
+ * no more than its own size.
+ * The decoded and deinterlaced frames of the last few previews are kept,
+ * cropping only changes where the scaler reads from, and an unchanged
+ * request is served from the last image.
+ * @param h Handle to hb_handle_t.
+ * @param job Handle to hb_job_t holding the title, crop and output size.
+ * @param picture Index in title.
+ * @param x Left edge of the rectangle.
+ * @param y Top edge of the rectangle.
+ * @param width Width of the rectangle.
+ * @param height Height of the rectangle.
+ * @param buffer Where the out_width by out_height RGB32 image is written.
+ * @param out_width Width of the image.
+ * @param out_height Height of the image.
+ * @return 0 on success, -1 if the preview couldn't be rendered.
+ */
+int hb_get_preview_region( hb_handle_t * h, hb_job_t * job, int picture,
+                           int x, int y, int width, int height,
+                           uint8_t * buffer, int out_width, int out_height )
+{
+    hb_title_t         * title = job->title;
+    hb_preview_cache_t * pc;
+    hb_buffer_t        * src_buf;
+    uint8_t            * pen;
+    AVPicture            pic_src, pic_preview, pic_crop;
+    int                  crop_width, crop_height;
+    int                  src_x, src_y, src_w, src_h;
+    int                  i, key[9];
+
+    // May update the crop and size of the title's job
+    hb_scan_previews( h, title );
+
+    crop_width  = title->width  - ( job->crop[2] + job->crop[3] );
+    crop_height = title->height - ( job->crop[0] + job->crop[1] );
+    if( crop_width <= 0 || crop_height <= 0 ||
+        job->width <= 0 || job->height <= 0 ||
+        x < 0 || y < 0 || width <= 0 || height <= 0 ||
+        x + width > job->width || y + height > job->height ||
+        out_width <= 0 || out_height <= 0 )
     {
-        return;
+        hb_error( "hb_get_preview_region: invalid region" );
+        return -1;
     }
 
-    hb_avpicture_fill( &pic_in, in_buf );
-
-    if( job->deinterlace )
+    hb_lock( h->preview_lock );
+    pc = preview_cache_get( h, title, picture );
+    if( pc == NULL )
     {
-        // Deinterlace and crop
-        deint_buf = hb_frame_buffer_init( AV_PIX_FMT_YUV420P,
-                                          title->width, title->height );
-        hb_deinterlace(deint_buf, in_buf);
-        hb_avpicture_fill( &pic_deint, deint_buf );
-
-        av_picture_crop( &pic_crop, &pic_deint, AV_PIX_FMT_YUV420P,
-                job->crop[0], job->crop[2] );
+        hb_unlock( h->preview_lock );
+        return -1;
     }
-    else
+
+    key[0] = !!job->deinterlace;
+    key[1] = job->crop[0];
+    key[2] = job->crop[2];
+    key[3] = crop_width;
+    key[4] = crop_height;
+    // The part of the source the rectangle maps to, on chroma boundaries
+    src_x  = ( (int64_t)x * crop_width / job->width ) & ~1;
+    src_y  = ( (int64_t)y * crop_height / job->height ) & ~1;
+    src_w  = ( (int64_t)( x + width ) * crop_width + job->width - 1 ) /
+             job->width;
+    src_h  = ( (int64_t)( y + height ) * crop_height + job->height - 1 ) /
+             job->height;
+    src_w  = MIN( ( src_w + 1 ) & ~1, crop_width )  - src_x;
+    src_h  = MIN( ( src_h + 1 ) & ~1, crop_height ) - src_y;
+    key[5] = src_x;
+    key[6] = src_y;
+    key[7] = src_w;
+    key[8] = src_h;
+
+    if( pc->rgb == NULL || memcmp( key, pc->rgb_key, sizeof( key ) ) ||
+        pc->rgb->f.width != out_width || pc->rgb->f.height != out_height )
     {
-        // Crop
-        av_picture_crop( &pic_crop, &pic_in, AV_PIX_FMT_YUV420P, job->crop[0], job->crop[2] );
-    }
+        src_buf = pc->in;
+        if( job->deinterlace )
+        {
+            if( pc->deint == NULL )
+            {
+                pc->deint = hb_frame_buffer_init( AV_PIX_FMT_YUV420P,
+                                                  title->width,
+                                                  title->height );
+                hb_deinterlace( pc->deint, pc->in );
+            }
+            src_buf = pc->deint;
+        }
+        hb_avpicture_fill( &pic_src, src_buf );
+        av_picture_crop( &pic_crop, &pic_src, AV_PIX_FMT_YUV420P,
+                         job->crop[0] + src_y, job->crop[2] + src_x );
 
-    // Get scaling context
-    context = hb_sws_get_context(title->width  - (job->crop[2] + job->crop[3]),
-                             title->height - (job->crop[0] + job->crop[1]),
-                             AV_PIX_FMT_YUV420P,
-                             job->width, job->height, AV_PIX_FMT_RGB32,
-                             swsflags);
+        if( pc->rgb == NULL ||
+            pc->rgb->f.width != out_width || pc->rgb->f.height != out_height )
+        {
+            hb_buffer_close( &pc->rgb );
+            pc->rgb = hb_frame_buffer_init( AV_PIX_FMT_RGB32,
+                                            out_width, out_height );
+        }
+        hb_avpicture_fill( &pic_preview, pc->rgb );
 
-    // Scale
-    sws_scale(context,
-              (const uint8_t* const *)pic_crop.data, pic_crop.linesize,
-              0, title->height - (job->crop[0] + job->crop[1]),
-              pic_preview.data, pic_preview.linesize);
+        if( h->preview_sws == NULL ||
+            h->preview_sws_key[0] != src_w ||
+            h->preview_sws_key[1] != src_h ||
+            h->preview_sws_key[2] != out_width ||
+            h->preview_sws_key[3] != out_height )
+        {
+            if( h->preview_sws != NULL )
+            {
+                sws_freeContext( h->preview_sws );
+            }
+            h->preview_sws = hb_sws_get_context( src_w, src_h,
+                                                 AV_PIX_FMT_YUV420P,
+                                                 out_width, out_height,
+                                                 AV_PIX_FMT_RGB32,
+                                                 SWS_LANCZOS |
+                                                 SWS_ACCURATE_RND );
+            h->preview_sws_key[0] = src_w;
+            h->preview_sws_key[1] = src_h;
+            h->preview_sws_key[2] = out_width;
+            h->preview_sws_key[3] = out_height;
+        }
 
-    // Free context
-    sws_freeContext( context );
+        sws_scale( h->preview_sws,
+                   (const uint8_t* const *)pic_crop.data, pic_crop.linesize,
+                   0, src_h, pic_preview.data, pic_preview.linesize );
+        memcpy( pc->rgb_key, key, sizeof( key ) );
+    }
 
-    preview_size = pic_preview.linesize[0];
     pen = buffer;
-    for( i = 0; i < job->height; i++ )
+    for( i = 0; i < out_height; i++ )
     {
-        memcpy( pen, pic_preview.data[0] + preview_size * i, 4 * job->width );
-        pen += 4 * job->width;
+        memcpy( pen, pc->rgb->plane[0].data + pc->rgb->plane[0].stride * i,
+                4 * out_width );
+        pen += 4 * out_width;
     }
+    hb_unlock( h->preview_lock );
 
-    // Clean up
-    hb_buffer_close( &in_buf );
-    hb_buffer_close( &deint_buf );
-    hb_buffer_close( &preview_buf );
+    return 0;
+}
+
+/**
+ * Create preview image of desired title a index of picture.
+ * @param h Handle to hb_handle_t.
+ * @param title Handle to hb_title_t of desired title.
+ * @param picture Index in title.
+ * @param buffer Handle to buffer were image will be drawn.
+ */
+void hb_get_preview( hb_handle_t * h, hb_job_t * job, int picture,
+                     uint8_t * buffer )
+{
+    hb_get_preview_region( h, job, picture, 0, 0, job->width, job->height,
+                           buffer, job->width, job->height );
 }
 
  /**
@@ -1326,6 +1589,23 @@ hb_job_t * hb_current_job( hb_handle_t * h )
     return( h->current_job );
 }
 
+/**
+ * Lets the work thread encode queued jobs of programs of the same MPEG
+ * transport stream at the same time, so the source is read once for all
+ * of them.  Only consecutive single pass jobs are run together.
+ * @param h Handle to hb_handle_t.
+ * @param count Most jobs to run at once, 1 to run them one by one.
+ */
+void hb_set_parallel_programs( hb_handle_t * h, int count )
+{
+    h->parallel_programs = count;
+}
+
+int hb_get_parallel_programs( hb_handle_t * h )
+{
+    return h->parallel_programs;
+}
+
 /**
  * Adds a job to the job list.
  * @param h Handle to hb_handle_t.
@@ -1340,13 +1620,12 @@ void hb_add( hb_handle_t * h, hb_job_t * job )
     char            audio_lang[4];
 
     /* Copy the job */
-    job_copy        = calloc( sizeof( hb_job_t ), 1 );
-    memcpy( job_copy, job, sizeof( hb_job_t ) );
+    job_copy = hb_job_copy( job );
 
     /* If we're doing Foreign Audio Search, copy all subtitles matching the
      * first audio track language we find in the audio list.
      *
-     * Otherwise, copy all subtitles found in the input job (which can be
+     * Otherwise, keep all subtitles found in the input job (which can be
      * manually selected by the user, or added after the Foreign Audio
      * Search pass). */
     memset( audio_lang, 0, sizeof( audio_lang ) );
@@ -1369,7 +1648,11 @@ void hb_add( hb_handle_t * h, hb_job_t * job )
          * If doing a subtitle scan then add all the matching subtitles for this
          * language.
          */
-        job_copy->list_subtitle = hb_list_init();
+        while( ( subtitle = hb_list_item( job_copy->list_subtitle, 0 ) ) )
+        {
+            hb_list_rem( job_copy->list_subtitle, subtitle );
+            hb_subtitle_close( &subtitle );
+        }
     
         for( i = 0; i < hb_list_count( job->title->list_subtitle ); i++ )
         {
@@ -1387,36 +1670,10 @@ void hb_add( hb_handle_t * h, hb_job_t * job )
             }
         }
     }
-    else
-    {
-        /* Copy all subtitles from the input job to title_copy/job_copy. */
-        job_copy->list_subtitle = hb_subtitle_list_copy( job->list_subtitle );
-    }
-
-    job_copy->list_chapter = hb_chapter_list_copy( job->list_chapter );
-    job_copy->list_audio = hb_audio_list_copy( job->list_audio );
-    job_copy->list_attachment = hb_attachment_list_copy( job->list_attachment );
-    job_copy->metadata = hb_metadata_copy( job->metadata );
-
-    if (job->encoder_preset != NULL)
-        job_copy->encoder_preset = strdup(job->encoder_preset);
-    if (job->encoder_tune != NULL)
-        job_copy->encoder_tune = strdup(job->encoder_tune);
-    if (job->encoder_options != NULL)
-        job_copy->encoder_options = strdup(job->encoder_options);
-    if (job->encoder_profile != NULL)
-        job_copy->encoder_profile = strdup(job->encoder_profile);
-    if (job->encoder_level != NULL)
-        job_copy->encoder_level = strdup(job->encoder_level);
-    if (job->file != NULL)
-        job_copy->file = strdup(job->file);
 
     job_copy->h     = h;
     job_copy->pause = h->pause_lock;
 
-    /* Copy the job filter list */
-    job_copy->list_filter = hb_filter_list_copy( job->list_filter );
-
     /* Add the job to the list */
     hb_list_add( h->jobs, job_copy );
     h->job_count = hb_count(h);
@@ -1463,6 +1720,13 @@ void hb_start( hb_handle_t * h )
     p.minutes   = -1;
     p.seconds   = -1;
     p.sequence_id = 0;
+    p.mem_bytes = 0;
+    p.mem_peak  = 0;
+    p.mem_limit = 0;
+    memset( p.mem_stage, 0, sizeof( p.mem_stage ) );
+    memset( p.queue_depth, 0, sizeof( p.queue_depth ) );
+    p.pool_bytes = 0;
+    p.pool_idle  = 0;
 #undef p
     hb_unlock( h->state_lock );
 
@@ -1597,10 +1861,13 @@ void hb_close( hb_handle_t ** _h )
     hb_list_close( &h->jobs );
     hb_lock_close( &h->state_lock );
     hb_lock_close( &h->pause_lock );
+    preview_cache_flush( h );
+    hb_lock_close( &h->preview_lock );
 
     hb_system_sleep_opaque_close(&h->system_sleep_opaque);
 
     free( h->interjob );
+    free( h->thumb_prefix );
 
     free( h );
     *_h = NULL;
@@ -1632,6 +1899,9 @@ int hb_global_init()
     /* HB work objects */
     hb_register(&hb_muxer);
     hb_register(&hb_reader);
+    hb_register(&hb_spool_write);
+    hb_register(&hb_spool_read);
+    hb_register(&hb_tee);
     hb_register(&hb_sync_video);
     hb_register(&hb_sync_audio);
     hb_register(&hb_decavcodecv);
@@ -49,6 +49,23 @@ void          hb_scan( hb_handle_t *, const char * path,
                        int title_index, int preview_count,
                        int store_previews, uint64_t min_duration );
 void          hb_scan_stop( hb_handle_t * );
+/* Set up MKV and MP4 titles from their container headers alone.  Their
+   previews, autocrop and interlace detection are left for
+   hb_scan_previews, which hb_job_init_by_index and hb_get_preview call. */
+void          hb_scan_set_fast_probe( hb_handle_t *, int enable );
+/* Read a transport stream named like rec_001.ts together with
+   rec_002.ts, rec_003.ts, ... as one source. */
+void          hb_scan_set_join_segments( hb_handle_t *, int enable );
+/* Build (or load) a keyframe seek index of transport and program streams
+   while scanning and keep it in a <file>.hbidx sidecar. */
+void          hb_scan_set_seek_index( hb_handle_t *, int enable );
+/* Tile the previews decoded by the following scans into JPEG sprite
+   sheets of thumbnails width pixels wide, with a WebVTT index, named
+   <prefix>-<title>.vtt and <prefix>-<title>-<sheet>.jpg.  The number of
+   thumbnails is the preview count.  NULL prefix turns it off. */
+void          hb_scan_set_thumbnails( hb_handle_t *, const char * prefix,
+                                      int width );
+int           hb_scan_previews( hb_handle_t *, hb_title_t * );
 uint64_t      hb_first_duration( hb_handle_t * );
 
 /* hb_get_titles()
@@ -71,6 +88,14 @@ int           hb_save_preview( hb_handle_t * h, int title, int preview,
 hb_buffer_t * hb_read_preview( hb_handle_t * h, int title_idx, int preview );
 void          hb_get_preview( hb_handle_t *, hb_job_t *, int,
                               uint8_t * );
+/* hb_get_preview_region()
+   Renders the rectangle x, y, width, height of the job's output frame as
+   an out_width x out_height RGB32 image, e.g. a thumbnail or a zoomed in
+   detail.  Returns 0 on success. */
+int           hb_get_preview_region( hb_handle_t *, hb_job_t *, int picture,
+                                     int x, int y, int width, int height,
+                                     uint8_t * buffer,
+                                     int out_width, int out_height );
 void          hb_set_size( hb_job_t *, double ratio, int pixels );
 void          hb_set_anamorphic_size( hb_job_t *,
                 int *output_width, int *output_height,
@@ -84,11 +109,21 @@ int           hb_count( hb_handle_t * );
 hb_job_t *    hb_job( hb_handle_t *, int );
 void          hb_add( hb_handle_t *, hb_job_t * );
 void          hb_rem( hb_handle_t *, hb_job_t * );
+/* Encode up to count consecutive jobs of programs of the same transport
+   stream at once, reading the source a single time for all of them. */
+void          hb_set_parallel_programs( hb_handle_t *, int count );
 
 hb_job_t *    hb_job_init_by_index( hb_handle_t *h, int title_index );
 hb_job_t *    hb_job_init( hb_title_t * title );
 void          hb_job_reset( hb_job_t * job );
 void          hb_job_close( hb_job_t ** job );
+hb_job_t *    hb_job_copy( const hb_job_t * job );
+
+/* Resolves the settings the job would be encoded with (geometry, filter
+   chain, audio and subtitle tracks, encoder options) without reading the
+   source or starting any thread.  Returns a copy of the job holding them,
+   to be freed with hb_job_close, or NULL if the job can't be encoded. */
+hb_job_t *    hb_job_validate( hb_job_t * job );
 
 void          hb_start( hb_handle_t * );
 void          hb_pause( hb_handle_t * );
@@ -107,6 +142,7 @@ typedef struct hb_interjob_s
     uint64_t total_time;   /* real length in 90kHz ticks (i.e. seconds / 90000) */
     int vrate;             /* actual measured output vrate from 1st pass */
     int vrate_base;        /* actual measured output vrate_base from 1st pass */
+    int spool_frames;      /* number of frames spooled by 1st pass */
 
     hb_subtitle_t *select_subtitle; /* foreign language scan subtitle */
 } hb_interjob_t;
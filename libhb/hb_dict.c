@@ -10,6 +10,74 @@
 #include "hb.h"
 #include "hb_dict.h"
 
+/*
+ * Entries are kept in insertion order in objects, which is what
+ * hb_dict_next walks.  index is an open addressing hash table (linear
+ * probing) of object positions + 1, so that lookups don't have to compare
+ * the key with every entry.  Unset entries stay in objects with a NULL key
+ * until the array fills up and is compacted, so that unsetting doesn't
+ * move the entries that follow (and their index slots) around.
+ *
+ * The index has at least twice as many slots as objects has entries, so
+ * it never gets more than half full.
+ */
+#define HB_DICT_INDEX_EMPTY    0
+#define HB_DICT_INDEX_DELETED -1
+
+static unsigned int dict_hash( const char * key )
+{
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    while( *key )
+    {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Returns the index slot of key, or -1 if key isn't in the dictionary
+static int dict_find( hb_dict_t * dict, const char * key )
+{
+    int i = dict_hash( key ) & dict->index_mask;
+    while( dict->index[i] != HB_DICT_INDEX_EMPTY )
+    {
+        if( dict->index[i] > 0 &&
+            !strcmp( key, dict->objects[dict->index[i] - 1].key ) )
+            return i;
+        i = ( i + 1 ) & dict->index_mask;
+    }
+    return -1;
+}
+
+static void dict_index_add( hb_dict_t * dict, int object )
+{
+    int i = dict_hash( dict->objects[object].key ) & dict->index_mask;
+    while( dict->index[i] > 0 )
+        i = ( i + 1 ) & dict->index_mask;
+    dict->index[i] = object + 1;
+}
+
+// (Re)builds the index for the current objects array
+static int dict_index_build( hb_dict_t * dict )
+{
+    int i, size = 16;
+    while( size < 2 * dict->alloc )
+        size *= 2;
+    int * index = calloc( size, sizeof( int ) );
+    if( !index )
+    {
+        hb_log( "ERROR: could not allocate hb_dict_t index" );
+        return -1;
+    }
+    free( dict->index );
+    dict->index = index;
+    dict->index_mask = size - 1;
+    for( i = 0; i < dict->count; i++ )
+        dict_index_add( dict, i );
+    return 0;
+}
+
 hb_dict_t * hb_dict_init( int alloc )
 {
     hb_dict_t * dict = NULL;
@@ -19,7 +87,12 @@ hb_dict_t * hb_dict_init( int alloc )
         hb_log( "ERROR: could not allocate hb_dict_t" );
         return NULL;
     }
+    if( alloc < 1 )
+        alloc = 1;
     dict->count = 0;
+    dict->deleted = 0;
+    dict->index = NULL;
+    dict->index_mask = 0;
     dict->objects = malloc( alloc * sizeof( hb_dict_entry_t ) );
     if( !dict->objects )
     {
@@ -29,6 +102,12 @@ hb_dict_t * hb_dict_init( int alloc )
     else
     {
         dict->alloc = alloc;
+        if( dict_index_build( dict ) )
+        {
+            free( dict->objects );
+            dict->objects = NULL;
+            dict->alloc = 0;
+        }
     }
     return dict;
 }
@@ -54,6 +133,7 @@ void hb_dict_free( hb_dict_t ** dict_ptr )
             }
             free( dict->objects );
         }
+        free( dict->index );
         free( *dict_ptr );
         *dict_ptr = NULL;
     }
@@ -67,7 +147,7 @@ void hb_dict_set( hb_dict_t ** dict_ptr, const char * key, const char * value )
         hb_log( "hb_dict_set: NULL dictionary" );
         return;
     }
-    if( !key || !strlen( key ) )
+    if( !key || !strlen( key ) || !dict->objects )
         return;
     hb_dict_entry_t * entry = hb_dict_get( dict, key );
     if( entry )
@@ -89,27 +169,38 @@ void hb_dict_set( hb_dict_t ** dict_ptr, const char * key, const char * value )
     {
         if( dict->alloc <= dict->count )
         {
-            hb_dict_entry_t * tmp = NULL;
-            tmp = malloc( ( 2 * dict->alloc ) * sizeof( hb_dict_entry_t ) );
-            if( !tmp )
+            if( dict->deleted )
             {
-                hb_log( "ERROR: could not realloc hb_dict_t objects" );
-                return;
+                // Drop the unset entries rather than growing
+                int i, j;
+                for( i = j = 0; i < dict->count; i++ )
+                    if( dict->objects[i].key )
+                        dict->objects[j++] = dict->objects[i];
+                dict->count = j;
+                dict->deleted = 0;
             }
-            if( dict->objects )
+            else
             {
-                if( dict->count )
-                    memcpy( tmp, dict->objects, dict->count * sizeof( hb_dict_entry_t ) );
-                free( dict->objects );
+                hb_dict_entry_t * tmp = NULL;
+                tmp = realloc( dict->objects,
+                               ( 2 * dict->alloc ) * sizeof( hb_dict_entry_t ) );
+                if( !tmp )
+                {
+                    hb_log( "ERROR: could not realloc hb_dict_t objects" );
+                    return;
+                }
+                dict->objects = tmp;
+                dict->alloc *= 2;
             }
-            dict->objects = tmp;
-            dict->alloc *= 2;
+            if( dict_index_build( dict ) )
+                return;
         }
         dict->objects[dict->count].key = strdup( key );
         if( value && strlen( value ) )
             dict->objects[dict->count].value = strdup( value );
         else
             dict->objects[dict->count].value = NULL;
+        dict_index_add( dict, dict->count );
         dict->count++;
     }
 }
@@ -119,39 +210,39 @@ void hb_dict_unset( hb_dict_t ** dict_ptr, const char * key )
     hb_dict_t * dict = *dict_ptr;
     if( !dict || !dict->objects || !key || !strlen( key ) )
         return;
-    int i;
-    for( i = 0; i < dict->count; i++ )
-        if( !strcmp( key, dict->objects[i].key ) )
-        {
-            free( dict->objects[i].key );
-            if( dict->objects[i].value )
-                free( dict->objects[i].value );
-            if( i != --dict->count )
-                memmove( &dict->objects[i], &dict->objects[i+1],
-                         sizeof( hb_dict_entry_t ) * ( dict->count - i ) );
-        }
+    int i = dict_find( dict, key );
+    if( i < 0 )
+        return;
+    hb_dict_entry_t * entry = &dict->objects[dict->index[i] - 1];
+    free( entry->key );
+    if( entry->value )
+        free( entry->value );
+    entry->key = NULL;
+    entry->value = NULL;
+    dict->index[i] = HB_DICT_INDEX_DELETED;
+    dict->deleted++;
 }
 
 hb_dict_entry_t * hb_dict_get( hb_dict_t * dict, const char * key )
 {
     if( !dict || !dict->objects || !key || !strlen( key ) )
         return NULL;
-    int i;
-    for( i = 0; i < dict->count; i++ )
-        if( !strcmp( key, dict->objects[i].key ) )
-            return &dict->objects[i];
-    return NULL;
+    int i = dict_find( dict, key );
+    if( i < 0 )
+        return NULL;
+    return &dict->objects[dict->index[i] - 1];
 }
 
 hb_dict_entry_t * hb_dict_next( hb_dict_t * dict, hb_dict_entry_t * previous )
 {
     if( dict == NULL || dict->objects == NULL || !dict->count )
         return NULL;
-    if( previous == NULL )
-        return &dict->objects[0];
-    unsigned int prev_index = previous - dict->objects;
-    if( prev_index + 1 < dict->count )
-            return &dict->objects[prev_index+1];
+    int i = previous == NULL ? 0 : previous - dict->objects + 1;
+    // Skip unset entries
+    while( i < dict->count && dict->objects[i].key == NULL )
+        i++;
+    if( i < dict->count )
+        return &dict->objects[i];
     return NULL;
 }
 
@@ -201,28 +292,28 @@ hb_dict_t * hb_encopts_to_dict( const char * encopts, int encoder )
 
 char * hb_dict_to_encopts( hb_dict_t * dict )
 {
-    int first_opt = 1;
-    char *tmp, *encopts_tmp, *encopts = NULL;
+    size_t size = 0;
+    char *encopts, *cur;
     hb_dict_entry_t * entry = NULL;
+    // Size the string first rather than appending to it an option at a time
     while( ( entry = hb_dict_next( dict, entry ) ) )
     {
-        tmp = hb_strdup_printf( "%s%s%s%s",
-                                first_opt    ? "" : ":",
-                                entry->key,
-                                entry->value ? "=" : "",
-                                entry->value ? entry->value : "" );
-        if( tmp )
-        {
-            encopts_tmp = hb_strncat_dup( encopts, tmp, strlen( tmp ) );
-            if( encopts_tmp )
-            {
-                if( encopts )
-                    free( encopts );
-                encopts = encopts_tmp;
-            }
-            first_opt = 0;
-            free( tmp );
-        }
+        size += strlen( entry->key ) + 1;
+        if( entry->value )
+            size += strlen( entry->value ) + 1;
+    }
+    if( !size )
+        return NULL;
+    encopts = cur = malloc( size );
+    if( !encopts )
+        return NULL;
+    while( ( entry = hb_dict_next( dict, entry ) ) )
+    {
+        cur += sprintf( cur, "%s%s%s%s",
+                        cur == encopts ? "" : ":",
+                        entry->key,
+                        entry->value ? "=" : "",
+                        entry->value ? entry->value : "" );
     }
     return encopts;
 }
@@ -47,8 +47,11 @@ struct hb_dict_entry_s
 struct hb_dict_s
 {
     int alloc;
-    int count;
+    int count;      // entries in objects, including unset ones
+    int deleted;    // unset entries, their key is NULL
     hb_dict_entry_t * objects;
+    int * index;    // hash table of objects positions + 1
+    int index_mask;
 };
 
 #endif // !defined(HB_DICT_H)
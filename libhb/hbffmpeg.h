@@ -27,6 +27,7 @@ int  hb_avcodec_close(AVCodecContext *);
 
 uint64_t hb_ff_mixdown_xlat(int hb_mixdown, int *downmix_mode);
 void     hb_ff_set_sample_fmt(AVCodecContext *, AVCodec *, enum AVSampleFormat);
+void     hb_ff_color_info(AVCodecContext *, hb_work_info_t *);
 
 struct SwsContext*
 hb_sws_get_context(int srcW, int srcH, enum AVPixelFormat srcFormat,
@@ -34,6 +34,7 @@ void hb_list_empty( hb_list_t ** );
 
 hb_title_t * hb_title_init( char * dvd, int index );
 void         hb_title_close( hb_title_t ** );
+void         hb_job_update_video( hb_job_t * job );
 
 /***********************************************************************
  * hb.c
@@ -95,6 +96,11 @@ struct hb_buffer_s
     #define HB_FRAME_REF      0xF0
         uint8_t       frametype;
         uint16_t      flags;
+
+        // Video frames: statistics from the frame analysis filter
+        float         complexity;   // mean luma gradient
+        float         motion;       // gamma weighted SSE vs previous frame
+        uint8_t       scenecut;     // first frame of a new scene
     } s;
 
     struct format
@@ -147,10 +153,15 @@ struct hb_buffer_s
     // Packets in a list:
     //   the next packet in the list
     hb_buffer_t * next;
+
+    // Job and stage that allocated the data, see hb_mem_set_context
+    hb_mem_account_t * mem;
+    int                mem_stage;
 };
 
 void hb_buffer_pool_init( void );
 void hb_buffer_pool_free( void );
+void hb_buffer_pool_get_state( hb_state_t * );
 
 hb_buffer_t * hb_buffer_init( int size );
 hb_buffer_t * hb_frame_buffer_init( int pix_fmt, int w, int h);
@@ -182,6 +193,21 @@ void          hb_fifo_push_list_element( hb_fifo_t *fifo, hb_buffer_t *buffer_li
 hb_buffer_t * hb_fifo_get_list_element( hb_fifo_t *fifo );
 void          hb_fifo_close( hb_fifo_t ** );
 void          hb_fifo_flush( hb_fifo_t * f );
+void          hb_fifo_set_mem( hb_fifo_t * f, hb_mem_account_t * mem );
+void          hb_fifo_set_max_bytes( hb_fifo_t * f, uint64_t max_bytes );
+void          hb_fifo_set_wake( hb_fifo_t * f, hb_lock_t * lock, hb_cond_t * cond );
+void          hb_fifo_set_adaptive( hb_fifo_t * f, int min_capacity, int max_capacity );
+int           hb_fifo_capacity( hb_fifo_t * f );
+
+/* Per-job memory accounting */
+hb_mem_account_t * hb_mem_account_init( int limit_mb );
+void               hb_mem_account_close( hb_mem_account_t ** );
+void               hb_mem_get_state( hb_mem_account_t *, hb_state_t * );
+void               hb_work_get_queue_state( hb_job_t *, hb_state_t * );
+void               hb_mem_set_context( hb_mem_account_t *, int stage );
+void               hb_mem_set_stage( int stage );
+hb_mem_account_t * hb_mem_get_account( void );
+int                hb_mem_get_stage( void );
 
 static inline int hb_image_stride( int pix_fmt, int width, int plane )
 {
@@ -248,20 +274,83 @@ hb_thread_t * hb_update_init( int * build, char * version );
 hb_thread_t * hb_scan_init( hb_handle_t *, volatile int * die, 
                             const char * path, int title_index, 
                             hb_title_set_t * title_set, int preview_count, 
-                            int store_previews, uint64_t min_duration );
+                            int store_previews, uint64_t min_duration,
+                            int fast_probe, int join_segments,
+                            int seek_index );
+int           hb_scan_decode_previews( hb_handle_t *, hb_title_t * title,
+                                       int preview_count,
+                                       int store_previews );
+const char  * hb_scan_thumbnails( hb_handle_t *, int * width );
 hb_thread_t * hb_work_init( hb_list_t * jobs,
                             volatile int * die, hb_error_code * error, hb_job_t ** job );
+int           hb_get_parallel_programs( hb_handle_t * );
+void          hb_copy_chapter( hb_buffer_t * dst, hb_buffer_t * src );
 void ReadLoop( void * _w );
 hb_work_object_t * hb_muxer_init( hb_job_t * );
 hb_work_object_t * hb_get_work( int );
 hb_work_object_t * hb_codec_decoder( int );
 hb_work_object_t * hb_codec_encoder( int );
 
+/***********************************************************************
+ * thumbnails.c
+ **********************************************************************/
+typedef struct hb_thumbnails_s hb_thumbnails_t;
+
+hb_thumbnails_t * hb_thumbnails_init( const char * prefix, int title,
+                                      int count, int width );
+void hb_thumbnails_add( hb_thumbnails_t * t, hb_buffer_t * picture,
+                        hb_work_info_t * info, double position );
+int  hb_thumbnails_write( hb_thumbnails_t * t, int64_t duration );
+void hb_thumbnails_close( hb_thumbnails_t ** t );
+
 /***********************************************************************
  * sync.c
  **********************************************************************/
 hb_work_object_t * hb_sync_init( hb_job_t * job );
 
+/***********************************************************************
+ * spool.c
+ **********************************************************************/
+int hb_spool_available( hb_job_t * job );
+
+/***********************************************************************
+ * tee.c
+ **********************************************************************/
+hb_work_object_t * hb_tee_init( hb_fifo_t * fifo_in, hb_fifo_t * fifo_out );
+void hb_tee_add_output( hb_work_object_t * w, hb_fifo_t * fifo );
+
+/***********************************************************************
+ * workpool.c
+ **********************************************************************/
+typedef struct hb_work_pool_s hb_work_pool_t;
+
+hb_work_pool_t * hb_work_pool_init( volatile int * done );
+void hb_work_pool_add( hb_work_pool_t * pool, hb_work_object_t * w );
+int  hb_work_pool_start( hb_work_pool_t * pool, hb_job_t * job,
+                         int thread_count );
+void hb_work_pool_close( hb_work_pool_t ** pool );
+
+/***********************************************************************
+ * checkpoint.c
+ **********************************************************************/
+hb_checkpoint_t * hb_checkpoint_init( hb_job_t * job );
+int64_t hb_checkpoint_resume( hb_checkpoint_t * cp );
+int     hb_checkpoint_segments( hb_checkpoint_t * cp );
+char  * hb_checkpoint_segment( hb_checkpoint_t * cp );
+void    hb_checkpoint_chapter( hb_checkpoint_t * cp, int chapter, int64_t pts );
+void    hb_checkpoint_done( hb_checkpoint_t * cp, int64_t start, int64_t stop );
+int     hb_checkpoint_stitch( hb_checkpoint_t * cp, hb_job_t * job,
+                              int64_t start, int64_t stop );
+void    hb_checkpoint_close( hb_checkpoint_t ** cp );
+
+/***********************************************************************
+ * analyze.c
+ **********************************************************************/
+void  hb_motion_gamma_lut( unsigned gamma_lut[256] );
+float hb_motion_metric( const unsigned * gamma_lut,
+                        hb_buffer_t * a, hb_buffer_t * b );
+int   hb_analyze_enabled( hb_job_t * job );
+
 /***********************************************************************
  * mpegdemux.c
  **********************************************************************/
@@ -295,7 +384,7 @@ typedef struct hb_batch_s hb_batch_t;
 hb_batch_t  * hb_batch_init( char * path );
 void          hb_batch_close( hb_batch_t ** _d );
 int           hb_batch_title_count( hb_batch_t * d );
-hb_title_t  * hb_batch_title_scan( hb_batch_t * d, int t );
+hb_title_t  * hb_batch_title_scan( hb_batch_t * d, int t, uint32_t flags );
 
 /***********************************************************************
  * dvd.c
@@ -332,16 +421,35 @@ void          hb_bd_close( hb_bd_t ** _d );
 void          hb_bd_set_angle( hb_bd_t * d, int angle );
 int           hb_bd_main_feature( hb_bd_t * d, hb_list_t * list_title );
 
+typedef struct hb_read_ahead_s hb_read_ahead_t;
+typedef int           hb_read_ahead_chapter_f( void * source );
+typedef hb_buffer_t * hb_read_ahead_read_f( void * source );
+
+hb_read_ahead_t * hb_read_ahead_init( hb_read_ahead_chapter_f * chapter,
+                                      hb_read_ahead_read_f * read,
+                                      void * source, int window,
+                                      int stop_chapter, volatile int * die );
+hb_buffer_t     * hb_read_ahead_read( hb_read_ahead_t *, int * chapter );
+void              hb_read_ahead_close( hb_read_ahead_t ** );
+
 hb_stream_t * hb_bd_stream_open( hb_title_t *title );
 void hb_ts_stream_reset(hb_stream_t *stream);
 hb_stream_t * hb_stream_open( char * path, hb_title_t *title, int scan );
 void		 hb_stream_close( hb_stream_t ** );
 hb_title_t * hb_stream_title_scan( hb_stream_t *, hb_title_t *);
+int          hb_stream_ts_programs( hb_stream_t *, int * programs, int max );
+int          hb_stream_probe_video( hb_stream_t *, hb_work_info_t * );
+int          hb_stream_probe_audio( hb_stream_t *, hb_audio_t *,
+                                    hb_work_info_t * );
 hb_buffer_t * hb_stream_read( hb_stream_t * );
 int          hb_stream_seek( hb_stream_t *, float );
 int          hb_stream_seek_ts( hb_stream_t * stream, int64_t ts );
 int          hb_stream_seek_chapter( hb_stream_t *, int );
 int          hb_stream_chapter( hb_stream_t * );
+void         hb_stream_index_close( hb_stream_index_t ** );
+hb_stream_share_t * hb_stream_share_init( int jobs );
+void         hb_stream_share_attach( hb_stream_t *, hb_stream_share_t ** );
+void         hb_stream_share_close( hb_stream_share_t ** );
 
 hb_buffer_t * hb_ts_decode_pkt( hb_stream_t *stream, const uint8_t * pkt );
 
@@ -426,7 +534,10 @@ enum
     WORK_ENCAVCODEC_AUDIO,
     WORK_MUX,
     WORK_READER,
-    WORK_DECPGSSUB
+    WORK_DECPGSSUB,
+    WORK_SPOOL_WRITE,
+    WORK_SPOOL_READ,
+    WORK_TEE
 };
 
 extern hb_filter_object_t hb_filter_detelecine;
@@ -438,6 +549,7 @@ extern hb_filter_object_t hb_filter_rotate;
 extern hb_filter_object_t hb_filter_crop_scale;
 extern hb_filter_object_t hb_filter_render_sub;
 extern hb_filter_object_t hb_filter_vfr;
+extern hb_filter_object_t hb_filter_analyze;
 
 #ifdef USE_QSV
 extern hb_filter_object_t hb_filter_qsv;
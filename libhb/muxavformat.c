@@ -1302,6 +1302,8 @@ static int avformatEnd(hb_mux_object_t *m)
     avio_close(m->oc->pb);
     avformat_free_context(m->oc);
     m->oc = NULL;
+    free(m->tracks);
+    m->tracks = NULL;
 
     return 0;
 }
@@ -56,6 +56,10 @@ typedef struct
     hb_bitvec_t     * allRdy;     // valid bits in rdy (audio & video tracks)
     hb_track_t     ** track;      // tracks to mux 'max_tracks' elements
     int               buffered_size;
+    hb_checkpoint_t * cp;         // write the output in segments
+    int64_t           segment_start;
+    int64_t           segment_stop;
+    int               mp4_optimize; // of the job, for the stitched file
 } hb_mux_t;
 
 struct hb_work_private_s
@@ -345,10 +349,140 @@ static void OutputTrackChunk( hb_mux_t *mux, int tk, hb_mux_object_t *m )
         buf = mf_pull( mux, tk );
         track->frames += 1;
         track->bytes  += buf->size;
+        if ( mux->cp && tk == 0 )
+        {
+            // the container muxer may shift the timestamps
+            if ( buf->s.new_chap )
+            {
+                hb_checkpoint_chapter( mux->cp, buf->s.new_chap, buf->s.start );
+            }
+            if ( mux->segment_start < 0 )
+            {
+                mux->segment_start = buf->s.start;
+            }
+            mux->segment_stop = MAX( mux->segment_stop, buf->s.stop );
+        }
         m->mux( m, track->mux_data, buf );
     }
 }
 
+static hb_mux_object_t * mux_object_init( hb_job_t * job )
+{
+    switch( job->mux )
+    {
+#ifdef USE_MP4V2
+    case HB_MUX_MP4V2:
+        return hb_mux_mp4_init( job );
+#endif
+#ifdef USE_LIBMKV
+    case HB_MUX_LIBMKV:
+        return hb_mux_mkv_init( job );
+#endif
+#ifdef USE_AVFORMAT
+    case HB_MUX_AV_MP4:
+    case HB_MUX_AV_MKV:
+        return hb_mux_avformat_init( job );
+#endif
+    default:
+        hb_error( "No muxer selected, exiting" );
+        return NULL;
+    }
+}
+
+// Creates the container muxer, creates the file and writes headers.
+// When checkpointing, the file is the current segment.
+static hb_mux_object_t * mux_object_open( hb_mux_t * mux, hb_job_t * job )
+{
+    char * file = job->file;
+
+    mux->m = mux_object_init( job );
+    if ( mux->m == NULL )
+    {
+        return NULL;
+    }
+    if ( mux->cp )
+    {
+        job->file = hb_checkpoint_segment( mux->cp );
+    }
+    mux->m->init( mux->m );
+    job->file = file;
+
+    return mux->m;
+}
+
+static int mux_is_keyframe( hb_job_t * job, hb_buffer_t * buf )
+{
+    // same test the container muxers use for their sync samples
+    if ( ( job->vcodec & HB_VCODEC_H264_MASK ) ||
+         ( job->vcodec & HB_VCODEC_FFMPEG_MASK ) )
+    {
+        return buf->s.frametype == HB_FRAME_IDR;
+    }
+    return !!( buf->s.frametype & HB_FRAME_KEY );
+}
+
+// Starts a new segment if the next video frame is a keyframe and the
+// current segment is long enough. Everything that comes before the
+// keyframe goes to the segment being closed.
+static int mux_checkpoint( hb_mux_t * mux, hb_job_t * job )
+{
+    hb_buffer_t * buf = mf_peek( mux->track[0] );
+    hb_audio_t  * audio;
+    hb_subtitle_t * subtitle;
+    double        pts;
+    int           i, t;
+
+    if ( buf == NULL || buf->s.start >= mux->pts || mux->segment_start < 0 ||
+         buf->s.start - mux->segment_start < job->checkpoint * 90000LL ||
+         !mux_is_keyframe( job, buf ) )
+    {
+        return 0;
+    }
+
+    pts = mux->pts;
+    mux->pts = buf->s.start;
+    for ( i = 0; i < mux->ntracks; ++i )
+    {
+        OutputTrackChunk( mux, i, mux->m );
+    }
+    mux->pts = pts;
+
+    mux->m->end( mux->m );
+    free( mux->m );
+    for ( i = 0; i < mux->ntracks; ++i )
+    {
+        free( mux->track[i]->mux_data );
+        mux->track[i]->mux_data = NULL;
+    }
+    hb_checkpoint_done( mux->cp, mux->segment_start, buf->s.start );
+    mux->segment_start = buf->s.start;
+
+    if ( mux_object_open( mux, job ) == NULL || *job->die )
+    {
+        *job->done_error = HB_ERROR_INIT;
+        *job->die = 1;
+        return -1;
+    }
+
+    // the new muxer has new track data, in hb_muxer_init's track order
+    t = 0;
+    mux->track[t++]->mux_data = job->mux_data;
+    for ( i = 0; i < hb_list_count( job->list_audio ); i++ )
+    {
+        audio = hb_list_item( job->list_audio, i );
+        mux->track[t++]->mux_data = audio->priv.mux_data;
+    }
+    for ( i = 0; i < hb_list_count( job->list_subtitle ); i++ )
+    {
+        subtitle = hb_list_item( job->list_subtitle, i );
+        if ( subtitle->config.dest == PASSTHRUSUB )
+        {
+            mux->track[t++]->mux_data = subtitle->mux_data;
+        }
+    }
+    return 0;
+}
+
 static int muxWork( hb_work_object_t * w, hb_buffer_t ** buf_in,
                      hb_buffer_t ** buf_out )
 {
@@ -401,6 +535,13 @@ static int muxWork( hb_work_object_t * w, hb_buffer_t ** buf_in,
            (hb_bitvec_cmp(mux->eof, mux->allEof)))
     {
         hb_bitvec_zero(more);
+        if ( mux->cp && mux_checkpoint( mux, job ) < 0 )
+        {
+            mux->done = 1;
+            hb_bitvec_free(&more);
+            hb_unlock( mux->mutex );
+            return HB_WORK_DONE;
+        }
         for ( i = 0; i < mux->ntracks; ++i )
         {
             track = mux->track[i];
@@ -485,6 +626,21 @@ void muxClose( hb_work_object_t * w )
             free( mux->m );
         }
 
+        if( mux->cp )
+        {
+            job->mp4_optimize = mux->mp4_optimize;
+            if( *job->die )
+            {
+                hb_log( "mux: job stopped, run it again to resume from the "
+                        "last checkpoint" );
+            }
+            else if( hb_checkpoint_stitch( mux->cp, job, mux->segment_start,
+                                           mux->segment_stop ) )
+            {
+                *job->done_error = HB_ERROR_UNKNOWN;
+            }
+        }
+
         // we're all done muxing -- print final stats and cleanup.
         if( job->pass == 0 || job->pass == 2 )
         {
@@ -612,35 +768,26 @@ hb_work_object_t * hb_muxer_init( hb_job_t * job )
     /* Get a real muxer */
     if( job->pass == 0 || job->pass == 2)
     {
-        switch( job->mux )
+        mux->cp = job->checkpoint_state;
+        mux->segment_start = -1;
+        if( mux->cp )
         {
-#ifdef USE_MP4V2
-        case HB_MUX_MP4V2:
-            mux->m = hb_mux_mp4_init( job );
-            break;
-#endif
-#ifdef USE_LIBMKV
-        case HB_MUX_LIBMKV:
-            mux->m = hb_mux_mkv_init( job );
-            break;
-#endif
-#ifdef USE_AVFORMAT
-        case HB_MUX_AV_MP4:
-        case HB_MUX_AV_MKV:
-            mux->m = hb_mux_avformat_init( job );
-            break;
-#endif
-        default:
-            hb_error( "No muxer selected, exiting" );
+            // Segments are rewritten when they get stitched, so only the
+            // stitched file needs optimizing.  The muxers look at the
+            // flag until they are closed.
+            mux->mp4_optimize = job->mp4_optimize;
+            job->mp4_optimize = 0;
+        }
+        if( mux_object_open( mux, job ) == NULL )
+        {
+            if( mux->cp )
+            {
+                job->mp4_optimize = mux->mp4_optimize;
+            }
             *job->done_error = HB_ERROR_INIT;
             *job->die = 1;
             return NULL;
         }
-        /* Create file, write headers */
-        if( mux->m )
-        {
-            mux->m->init( mux->m );
-        }
     }
 
     /* Initialize the work objects that will receive fifo data */
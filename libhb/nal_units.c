@@ -49,28 +49,110 @@ size_t hb_nal_unit_write_isomp4(uint8_t *buf,
     return sizeof(length) + nal_unit_size;
 }
 
-uint8_t* hb_annexb_find_next_nalu(const uint8_t *start, size_t *size)
+/*
+ * Returns a pointer to the first two consecutive zero bytes in the data,
+ * or end if there are none.
+ *
+ * Start codes and emulation prevention sequences both begin with two zero
+ * bytes, which are rare in coded data, so the data is read 8 bytes at a
+ * time and only words that hold a zero byte are looked at byte by byte.
+ */
+static const uint8_t* find_zero_pair(const uint8_t *buf, const uint8_t *end)
 {
-    uint8_t *nal = NULL;
-    uint8_t *buf = (uint8_t*)start;
-    uint8_t *end = (uint8_t*)start + *size;
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t high = 0x8080808080808080ULL;
+    uint64_t word;
+    int i;
 
-    /* Look for an Annex B start code prefix (3-byte sequence == 1) */
-    while (end - buf > 3)
+    while (end - buf > 8)
     {
-        if (!buf[0] && !buf[1] && buf[2] == 1)
+        memcpy(&word, buf, sizeof(word));
+        if ((word - ones) & ~word & high)
         {
-            nal = (buf += 3); // NAL unit begins after start code
-            break;
+            for (i = 0; i < 8; i++)
+            {
+                if (!buf[i] && !buf[i + 1])
+                {
+                    return buf + i;
+                }
+            }
+        }
+        buf += 8;
+    }
+    while (end - buf > 1)
+    {
+        if (!buf[0] && !buf[1])
+        {
+            return buf;
         }
         buf++;
     }
 
-    if (nal == NULL)
+    return end;
+}
+
+const uint8_t* hb_annexb_find_startcode(const uint8_t *start, const uint8_t *end)
+{
+    const uint8_t *buf = find_zero_pair(start, end);
+
+    while (end - buf > 2)
+    {
+        if (buf[2] == 1)
+        {
+            return buf;
+        }
+        // 00 00 00 may still end a start code, anything else can't
+        buf = find_zero_pair(buf + (buf[2] ? 3 : 1), end);
+    }
+
+    return end;
+}
+
+size_t hb_nal_unit_unescape(uint8_t *dst, const uint8_t *src, const size_t size)
+{
+    const uint8_t *end = src + size;
+    const uint8_t *buf = find_zero_pair(src, end);
+    uint8_t *out = dst;
+
+    while (end - buf > 2)
+    {
+        if (buf[2] == 1)
+        {
+            // next start code
+            end = buf;
+            break;
+        }
+        if (buf[2] == 3)
+        {
+            // keep the zero bytes, drop the emulation prevention byte
+            memcpy(out, src, buf + 2 - src);
+            out += buf + 2 - src;
+            src  = buf + 3;
+            buf  = find_zero_pair(src, end);
+            continue;
+        }
+        buf = find_zero_pair(buf + (buf[2] ? 3 : 1), end);
+    }
+    memcpy(out, src, end - src);
+    out += end - src;
+
+    return out - dst;
+}
+
+uint8_t* hb_annexb_find_next_nalu(const uint8_t *start, size_t *size)
+{
+    const uint8_t *nal;
+    const uint8_t *buf;
+    const uint8_t *end = start + *size;
+
+    /* Look for an Annex B start code prefix (3-byte sequence == 1) */
+    buf = hb_annexb_find_startcode(start, end);
+    if (end - buf <= 3)
     {
         *size = 0;
         return NULL;
     }
+    nal = buf + 3; // NAL unit begins after start code
 
     /*
      * Start code prefix found, look for the next one to determine the size
@@ -79,18 +161,19 @@ uint8_t* hb_annexb_find_next_nalu(const uint8_t *start, size_t *size)
      * sequence == 0 too (start code emulation prevention will prevent such a
      * sequence from occurring outside of a start code prefix)
      */
+    buf = find_zero_pair(nal, end);
     while (end - buf > 3)
     {
-        if (!buf[0] && !buf[1] && (!buf[2] || buf[2] == 1))
+        if (buf[2] <= 1)
         {
             end = buf;
             break;
         }
-        buf++;
+        buf = find_zero_pair(buf + 3, end);
     }
 
     *size = end - nal;
-    return  nal;
+    return (uint8_t*)nal;
 }
 
 hb_buffer_t* hb_nal_bitstream_annexb_to_mp4(const uint8_t *data,
@@ -100,18 +183,12 @@ hb_buffer_t* hb_nal_bitstream_annexb_to_mp4(const uint8_t *data,
     uint8_t *buf, *end;
     size_t out_size, buf_size;
 
-    out_size = 0;
-    buf_size = size;
-    buf      = (uint8_t*)data;
-    end      = (uint8_t*)data + size;
-
-    while ((buf = hb_annexb_find_next_nalu(buf, &buf_size)) != NULL)
-    {
-        out_size += hb_nal_unit_write_isomp4(NULL, buf, buf_size);
-        buf_size  = end - buf;
-    }
-
-    out = hb_buffer_init(out_size);
+    /*
+     * Each NAL unit loses a start code prefix of 3 bytes or more and gains
+     * a 4-byte length, so the output is at most a third larger than the
+     * input; write it in one pass and trim the size afterwards.
+     */
+    out = hb_buffer_init(size + size / 3);
     if (out == NULL)
     {
         hb_error("hb_nal_bitstream_annexb_to_mp4: hb_buffer_init failed");
@@ -126,8 +203,10 @@ hb_buffer_t* hb_nal_bitstream_annexb_to_mp4(const uint8_t *data,
     while ((buf = hb_annexb_find_next_nalu(buf, &buf_size)) != NULL)
     {
         out_size += hb_nal_unit_write_isomp4(out->data + out_size, buf, buf_size);
+        buf      += buf_size; // the next start code, if any, is right here
         buf_size  = end - buf;
     }
+    out->size = out_size;
 
     return out;
 }
@@ -155,25 +234,19 @@ hb_buffer_t* hb_nal_bitstream_mp4_to_annexb(const uint8_t *data,
     uint8_t *buf, *end;
     size_t out_size, nal_size;
 
-    out_size = 0;
-    buf      = (uint8_t*)data;
-    end      = (uint8_t*)data + size;
-
-    while (end - buf > nal_length_size)
+    if (nal_length_size < 1 || nal_length_size > 4)
     {
-        buf += mp4_nal_unit_length(buf, nal_length_size, &nal_size);
-        if (end - buf < nal_size)
-        {
-            hb_log("hb_nal_bitstream_mp4_to_annexb: truncated bitstream"
-                   " (remaining: %lu, expected: %lu)", end - buf, nal_size);
-            return NULL;
-        }
-
-        out_size += hb_nal_unit_write_annexb(NULL, buf, nal_size);
-        buf      += nal_size;
+        hb_log("hb_nal_bitstream_mp4_to_annexb: invalid NAL length size %d",
+               nal_length_size);
+        return NULL;
     }
 
-    out = hb_buffer_init(out_size);
+    /*
+     * Each NAL unit's length field becomes a 4-byte start code, and there
+     * can't be more NAL units than length fields fit in the input.
+     */
+    out = hb_buffer_init(size + size / nal_length_size *
+                         (sizeof(hb_annexb_startcode) - nal_length_size));
     if (out == NULL)
     {
         hb_error("hb_nal_bitstream_mp4_to_annexb: hb_buffer_init failed");
@@ -186,10 +259,19 @@ hb_buffer_t* hb_nal_bitstream_mp4_to_annexb(const uint8_t *data,
 
     while (end - buf > nal_length_size)
     {
-        buf      += mp4_nal_unit_length(buf, nal_length_size, &nal_size);
+        buf += mp4_nal_unit_length(buf, nal_length_size, &nal_size);
+        if (end - buf < nal_size)
+        {
+            hb_log("hb_nal_bitstream_mp4_to_annexb: truncated bitstream"
+                   " (remaining: %lu, expected: %lu)", end - buf, nal_size);
+            hb_buffer_close(&out);
+            return NULL;
+        }
+
         out_size += hb_nal_unit_write_annexb(out->data + out_size, buf, nal_size);
         buf      += nal_size;
     }
+    out->size = out_size;
 
     return out;
 }
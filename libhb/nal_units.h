@@ -30,6 +30,21 @@
 size_t hb_nal_unit_write_annexb(uint8_t *buf, const uint8_t *nal_unit, const size_t nal_unit_size);
 size_t hb_nal_unit_write_isomp4(uint8_t *buf, const uint8_t *nal_unit, const size_t nal_unit_size);
 
+/*
+ * Returns a pointer to the first Annex B start code prefix (3-byte
+ * sequence == 1) in the provided data buffer, or end if there is none.
+ */
+const uint8_t* hb_annexb_find_startcode(const uint8_t *start, const uint8_t *end);
+
+/*
+ * Copy a NAL unit to dst, up to the next start code prefix if any,
+ * removing the emulation prevention bytes from its payload.
+ * Returns the amount (in bytes) of data written to dst.
+ *
+ * Note: dst must be at least size bytes large.
+ */
+size_t hb_nal_unit_unescape(uint8_t *dst, const uint8_t *src, const size_t size);
+
 /*
  * Search the provided data buffer for NAL units in Annex B format.
  *
@@ -194,6 +194,33 @@ uint64_t hb_get_time_us()
 #endif
 }
 
+/************************************************************************
+ * hb_get_rss()
+ ************************************************************************
+ * Resident memory of the process in bytes, -1 where it isn't known.
+ ***********************************************************************/
+int64_t hb_get_rss()
+{
+#if defined( SYS_LINUX )
+    FILE * file;
+    long   pages = -1;
+
+    if( ( file = fopen( "/proc/self/statm", "r" ) ) == NULL )
+    {
+        return -1;
+    }
+    if( fscanf( file, "%*d %ld", &pages ) != 1 )
+    {
+        pages = -1;
+    }
+    fclose( file );
+
+    return pages < 0 ? -1 : (int64_t)pages * sysconf( _SC_PAGESIZE );
+#else
+    return -1;
+#endif
+}
+
 /************************************************************************
  * hb_snooze()
  ************************************************************************
@@ -678,6 +705,10 @@ struct hb_thread_s
     hb_lock_t     * lock;
     int             exited;
 
+    /* Memory accounting context inherited from the creator */
+    hb_mem_account_t * mem;
+    int                mem_stage;
+
 #if defined( SYS_BEOS )
     thread_id       thread;
 #elif USE_PTHREAD
@@ -734,6 +765,8 @@ static void attribute_align_thread hb_thread_func( void * _t )
     signal( SIGINT, SIG_IGN );
 #endif
 
+    hb_mem_set_context( t->mem, t->mem_stage );
+
     /* Start the actual routine */
     t->function( t->arg );
 
@@ -764,6 +797,9 @@ hb_thread_t * hb_thread_init( const char * name, void (* function)(void *),
 
     t->lock     = hb_lock_init();
 
+    t->mem       = hb_mem_get_account();
+    t->mem_stage = hb_mem_get_stage();
+
     /* Create and start the thread */
 #if defined( SYS_BEOS )
     t->thread = spawn_thread( (thread_func) hb_thread_func,
@@ -46,6 +46,8 @@ const char* hb_get_cpu_platform_name();
 uint64_t hb_get_date();
 // provide time in us
 uint64_t hb_get_time_us();
+// resident memory of the process in bytes, -1 if unknown
+int64_t  hb_get_rss();
 
 void     hb_snooze( int delay );
 int      hb_platform_init();
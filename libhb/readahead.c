@@ -0,0 +1,202 @@
+/* readahead.c
+
+   Copyright (c) 2003-2014 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*
+ * Asynchronous read-ahead for DVD and Blu-ray sources.
+ *
+ * A thread runs the source's read routine ahead of the reader and queues
+ * up to a window's worth of data, so the latency of an optical drive or
+ * of an image on network storage is hidden from demux and decode.  The
+ * source's own state machine does the reading, so the read-ahead follows
+ * it across cell, clip and chapter boundaries.
+ *
+ * The chapter is queried before each read, as the reader would do, and
+ * handed out with the data that follows it.  Reading stops at the first
+ * block past stop_chapter or at the end of the title.
+ */
+
+#include "hb.h"
+
+#define READ_AHEAD_MIN_UNIT 2048    // smallest read, a DVD block
+#define READ_AHEAD_TIMEOUT  200     // ms
+
+typedef struct
+{
+    hb_buffer_t * buf;
+    int           chapter;
+} read_ahead_entry_t;
+
+struct hb_read_ahead_s
+{
+    hb_read_ahead_chapter_f * chapter;
+    hb_read_ahead_read_f    * read;
+    void                    * source;
+    int                       stop_chapter;
+    volatile int            * die;
+
+    hb_lock_t               * lock;
+    hb_cond_t               * cond_data;
+    hb_cond_t               * cond_space;
+    read_ahead_entry_t      * ring;
+    int                       ring_size;
+    int                       first;
+    int                       count;
+    int64_t                   bytes;
+    int64_t                   window;
+    int                       eof;      // last entry has been queued
+    int                       stop;
+    int                       reads;
+    int                       underruns; // reads that had to wait
+
+    hb_thread_t             * thread;
+};
+
+static void read_ahead_loop( void * );
+
+static int64_t buffer_bytes( hb_buffer_t * b )
+{
+    int64_t bytes = 0;
+
+    for( ; b != NULL; b = b->next )
+    {
+        bytes += b->size;
+    }
+    return bytes;
+}
+
+/*
+ * window is in KiB.  Must be called from the thread that would otherwise
+ * read the source, after any seek.
+ */
+hb_read_ahead_t * hb_read_ahead_init( hb_read_ahead_chapter_f * chapter,
+                                      hb_read_ahead_read_f * read,
+                                      void * source, int window,
+                                      int stop_chapter, volatile int * die )
+{
+    hb_read_ahead_t * ra = calloc( 1, sizeof( hb_read_ahead_t ) );
+
+    ra->chapter      = chapter;
+    ra->read         = read;
+    ra->source       = source;
+    ra->stop_chapter = stop_chapter;
+    ra->die          = die;
+    ra->window       = (int64_t)window * 1024;
+    ra->ring_size    = ra->window / READ_AHEAD_MIN_UNIT + 1;
+    ra->ring         = calloc( ra->ring_size, sizeof( read_ahead_entry_t ) );
+    ra->lock         = hb_lock_init();
+    ra->cond_data    = hb_cond_init();
+    ra->cond_space   = hb_cond_init();
+
+    ra->thread = hb_thread_init( "read-ahead", read_ahead_loop, ra,
+                                 HB_NORMAL_PRIORITY );
+    hb_log( "reader: reading ahead up to %d KiB", window );
+
+    return ra;
+}
+
+static void read_ahead_loop( void * _ra )
+{
+    hb_read_ahead_t * ra = _ra;
+    hb_buffer_t     * buf;
+    int               chapter, last;
+
+    do
+    {
+        hb_lock( ra->lock );
+        while( !ra->stop && ( ra->count == ra->ring_size ||
+                              ra->bytes >= ra->window ) )
+        {
+            hb_cond_wait( ra->cond_space, ra->lock );
+        }
+        hb_unlock( ra->lock );
+        if( ra->stop )
+            break;
+
+        buf     = NULL;
+        chapter = ra->chapter( ra->source );
+        if( chapter >= 0 && chapter <= ra->stop_chapter )
+        {
+            buf = ra->read( ra->source );
+        }
+        last = ( buf == NULL );
+
+        hb_lock( ra->lock );
+        ra->ring[( ra->first + ra->count ) % ra->ring_size] =
+            (read_ahead_entry_t){ buf, chapter };
+        ra->count++;
+        ra->bytes += buffer_bytes( buf );
+        ra->eof    = last;
+        hb_cond_signal( ra->cond_data );
+        hb_unlock( ra->lock );
+    } while( !last );
+}
+
+/*
+ * Returns the next buffer read from the source and, in *chapter, the
+ * chapter the source was at before reading it.  NULL at the end of the
+ * data; *chapter then tells why reading stopped.  Also returns NULL,
+ * with an in range chapter, if *die gets set while waiting.
+ */
+hb_buffer_t * hb_read_ahead_read( hb_read_ahead_t * ra, int * chapter )
+{
+    read_ahead_entry_t entry = { NULL, ra->stop_chapter };
+
+    hb_lock( ra->lock );
+    if( ra->count == 0 && !ra->eof && ra->reads > 0 )
+    {
+        ra->underruns++;
+    }
+    while( ra->count == 0 && !ra->eof && !*ra->die )
+    {
+        hb_cond_timedwait( ra->cond_data, ra->lock, READ_AHEAD_TIMEOUT );
+    }
+    if( ra->count > 0 )
+    {
+        entry = ra->ring[ra->first];
+        ra->first = ( ra->first + 1 ) % ra->ring_size;
+        ra->count--;
+        ra->reads++;
+        ra->bytes -= buffer_bytes( entry.buf );
+        hb_cond_signal( ra->cond_space );
+    }
+    hb_unlock( ra->lock );
+
+    *chapter = entry.chapter;
+    return entry.buf;
+}
+
+void hb_read_ahead_close( hb_read_ahead_t ** _ra )
+{
+    hb_read_ahead_t * ra = *_ra;
+
+    if( ra == NULL )
+        return;
+
+    hb_lock( ra->lock );
+    ra->stop = 1;
+    hb_cond_broadcast( ra->cond_space );
+    hb_unlock( ra->lock );
+    hb_thread_close( &ra->thread );
+
+    while( ra->count > 0 )
+    {
+        hb_buffer_close( &ra->ring[ra->first].buf );
+        ra->first = ( ra->first + 1 ) % ra->ring_size;
+        ra->count--;
+    }
+    hb_log( "reader: read-ahead ran dry %d time(s) in %d reads",
+            ra->underruns, ra->reads );
+
+    hb_cond_close( &ra->cond_data );
+    hb_cond_close( &ra->cond_space );
+    hb_lock_close( &ra->lock );
+    free( ra->ring );
+    free( ra );
+    *_ra = NULL;
+}
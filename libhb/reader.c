@@ -42,6 +42,7 @@ struct hb_work_private_s
     hb_bd_t      * bd;
     hb_dvd_t     * dvd;
     hb_stream_t  * stream;
+    hb_read_ahead_t * read_ahead;
 
     stream_timing_t *stream_timing;
     int64_t        scr_offset;
@@ -64,6 +65,8 @@ struct hb_work_private_s
  **********************************************************************/
 static hb_fifo_t ** GetFifoForId( hb_work_private_t * r, int id );
 static void UpdateState( hb_work_private_t  * r, int64_t start);
+static int source_chapter( void * _r );
+static hb_buffer_t * source_read( void * _r );
 
 /***********************************************************************
  * hb_reader_init
@@ -87,6 +90,8 @@ static int hb_reader_open( hb_work_private_t * r )
     {
         if ( !( r->stream = hb_stream_open( r->title->path, r->title, 0 ) ) )
             return 1;
+        // read with the jobs of the other programs of the source
+        hb_stream_share_attach( r->stream, &r->job->stream_share );
     }
     else
     {
@@ -356,6 +361,8 @@ void ReadLoop( void * _w )
     int            chapter_end = r->job->chapter_end;
     uint8_t        done = 0;
 
+    hb_mem_set_stage( HB_MEM_STAGE_READER );
+
     if (r->bd)
     {
         if( !hb_bd_start( r->bd, r->title ) )
@@ -482,14 +489,20 @@ void ReadLoop( void * _w )
 
     list  = hb_list_init();
 
+    if ( ( r->bd || r->dvd ) && r->job->read_ahead > 0 )
+    {
+        r->read_ahead = hb_read_ahead_init( source_chapter, source_read, r,
+                                            r->job->read_ahead, chapter_end,
+                                            r->die );
+    }
+
     while(!*r->die && !r->job->done && !done)
     {
-        if (r->bd)
-            chapter = hb_bd_chapter( r->bd );
-        else if (r->dvd)
-            chapter = hb_dvd_chapter( r->dvd );
-        else if (r->stream)
-            chapter = hb_stream_chapter( r->stream );
+        buf = NULL;
+        if (r->read_ahead)
+            buf = hb_read_ahead_read( r->read_ahead, &chapter );
+        else
+            chapter = source_chapter( r );
 
         if( chapter < 0 )
         {
@@ -500,29 +513,18 @@ void ReadLoop( void * _w )
         {
             hb_log( "reader: end of chapter %d (media %d) reached at media chapter %d",
                     r->job->chapter_end, chapter_end, chapter );
+            hb_buffer_close( &buf );
             break;
         }
 
-        if (r->bd)
+        if (!r->read_ahead)
+            buf = source_read( r );
+        if (buf == NULL)
         {
-          if( (buf = hb_bd_read( r->bd )) == NULL )
-          {
-              break;
-          }
-        }
-        else if (r->dvd)
-        {
-          if( (buf = hb_dvd_read( r->dvd )) == NULL )
-          {
-              break;
-          }
+            break;
         }
-        else if (r->stream)
+        if (r->stream)
         {
-          if ( (buf = hb_stream_read( r->stream )) == NULL )
-          {
-            break;
-          }
           if ( r->start_found == 2 )
           {
             // We will inspect the timestamps of each frame in sync
@@ -706,6 +708,7 @@ void ReadLoop( void * _w )
     }
 
     hb_list_empty( &list );
+    hb_read_ahead_close( &r->read_ahead );
 
     hb_log( "reader: done. %d scr changes", r->demux.scr_changes );
     if ( r->demux.dts_drops )
@@ -714,6 +717,33 @@ void ReadLoop( void * _w )
     }
 }
 
+/* Current chapter of the source, -1 past the end of the title */
+static int source_chapter( void * _r )
+{
+    hb_work_private_t * r = _r;
+
+    if (r->bd)
+        return hb_bd_chapter( r->bd );
+    else if (r->dvd)
+        return hb_dvd_chapter( r->dvd );
+    else if (r->stream)
+        return hb_stream_chapter( r->stream );
+    return -1;
+}
+
+static hb_buffer_t * source_read( void * _r )
+{
+    hb_work_private_t * r = _r;
+
+    if (r->bd)
+        return hb_bd_read( r->bd );
+    else if (r->dvd)
+        return hb_dvd_read( r->dvd );
+    else if (r->stream)
+        return hb_stream_read( r->stream );
+    return NULL;
+}
+
 static void UpdateState( hb_work_private_t  * r, int64_t start)
 {
     hb_state_t state;
@@ -763,6 +793,7 @@ static void UpdateState( hb_work_private_t  * r, int64_t start)
         p.seconds  = -1;
     }
 #undef p
+    hb_mem_get_state( r->job->mem, &state );
 
     hb_set_state( r->job->h, &state );
 }
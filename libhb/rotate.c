@@ -65,6 +65,83 @@ typedef struct rotate_thread_arg_s {
     int segment;
 } rotate_thread_arg_t;
 
+/*
+ * Transposes (rotate 90) are done in square tiles so that the source rows
+ * touched by a tile stay in cache while the tile's output rows are
+ * written.  Rather than walking a whole source column for every output row.
+ */
+#define ROTATE_TILE 32
+
+/*
+ * rotate one segment of a plane, i.e. output rows [dst_start, dst_stop)
+ */
+static void rotate_plane( int mode, uint8_t * dst, int dst_stride,
+                          const uint8_t * src, int src_stride,
+                          int src_w, int src_h, int dst_w,
+                          int dst_start, int dst_stop )
+{
+    int x, y;
+
+    if( !( mode & 4 ) )
+    {
+        // Flips only, output row y comes from a single source row
+        for( y = dst_start; y < dst_stop; y++ )
+        {
+            const uint8_t * s;
+            uint8_t * d = dst + y * dst_stride;
+
+            s = src + ( mode & 1 ? src_h - y - 1 : y ) * src_stride;
+            if( mode & 2 )
+            {
+                for( x = 0; x < src_w; x++ )
+                {
+                    d[x] = s[src_w - x - 1];
+                }
+            }
+            else
+            {
+                memcpy( d, s, src_w );
+            }
+        }
+        return;
+    }
+
+    /*
+     * Rotate 90 clockwise, after the optional flips.  Output pixel (x, y)
+     * comes from source column sx(y) and row sy(x), with
+     *   sx(y) = mode & 2 ? src_w - y - 1 : y
+     *   sy(x) = mode & 1 ? x : src_h - x - 1
+     * so moving along an output row steps through the source by
+     * +/- src_stride, and moving down an output column steps by +/- 1.
+     */
+    int x_step = mode & 1 ? src_stride : -src_stride;
+    int y_step = mode & 2 ? -1 : 1;
+    const uint8_t * origin = src + ( mode & 1 ? 0 : ( src_h - 1 ) * src_stride ) +
+                                   ( mode & 2 ? src_w - 1 : 0 );
+    int tx, ty;
+
+    for( ty = dst_start; ty < dst_stop; ty += ROTATE_TILE )
+    {
+        int ty_stop = ty + ROTATE_TILE < dst_stop ? ty + ROTATE_TILE : dst_stop;
+
+        for( tx = 0; tx < dst_w; tx += ROTATE_TILE )
+        {
+            int tx_stop = tx + ROTATE_TILE < dst_w ? tx + ROTATE_TILE : dst_w;
+
+            for( y = ty; y < ty_stop; y++ )
+            {
+                const uint8_t * s = origin + y * y_step + tx * x_step;
+                uint8_t * d = dst + y * dst_stride;
+
+                for( x = tx; x < tx_stop; x++, s += x_step )
+                {
+                    d[x] = *s;
+                }
+            }
+        }
+    }
+}
+
 /*
  * rotate this segment of all three planes in a single thread.
  */
@@ -76,10 +153,8 @@ void rotate_filter_thread( void *thread_args_v )
     int plane;
     int segment, segment_start, segment_stop;
     rotate_thread_arg_t *thread_args = thread_args_v;
-    uint8_t *dst;
     hb_buffer_t *dst_buf;
     hb_buffer_t *src_buf;
-    int y;
 
 
     pv = thread_args->pv;
@@ -113,19 +188,14 @@ void rotate_filter_thread( void *thread_args_v )
         
         /*
          * Process all three planes, but only this segment of it.
+         * Segments are bands of output rows so that every thread
+         * writes to its own region of the destination.
          */
         dst_buf = rotate_work->dst;
         src_buf = rotate_work->src;
         for( plane = 0; plane < 3; plane++)
         {
-            int dst_stride, src_stride;
-
-            dst = dst_buf->plane[plane].data;
-            dst_stride = dst_buf->plane[plane].stride;
-            src_stride = src_buf->plane[plane].stride;
-
-            int h = src_buf->plane[plane].height;
-            int w = src_buf->plane[plane].width;
+            int h = dst_buf->plane[plane].height;
             segment_start = ( h / pv->cpu_count ) * segment;
             if( segment == pv->cpu_count - 1 )
             {
@@ -137,39 +207,15 @@ void rotate_filter_thread( void *thread_args_v )
                 segment_stop = ( h / pv->cpu_count ) * ( segment + 1 );
             }
 
-            for( y = segment_start; y < segment_stop; y++ )
-            {
-                uint8_t * cur;
-                int x, xo, yo;
-
-                cur = &src_buf->plane[plane].data[y * src_stride];
-                for( x = 0; x < w; x++)
-                {
-                    if( pv->mode & 1 )
-                    {
-                        yo = h - y - 1;
-                    }
-                    else
-                    {
-                        yo = y;
-                    }
-                    if( pv->mode & 2 )
-                    {
-                        xo = w - x - 1;
-                    }
-                    else
-                    {
-                        xo = x;
-                    }
-                    if( pv->mode & 4 ) // Rotate 90 clockwise
-                    {
-                        int tmp = xo;
-                        xo = h - yo - 1;
-                        yo = tmp;
-                    }
-                    dst[yo*dst_stride + xo] = cur[x];
-                }
-            }
+            rotate_plane( pv->mode,
+                          dst_buf->plane[plane].data,
+                          dst_buf->plane[plane].stride,
+                          src_buf->plane[plane].data,
+                          src_buf->plane[plane].stride,
+                          src_buf->plane[plane].width,
+                          src_buf->plane[plane].height,
+                          dst_buf->plane[plane].width,
+                          segment_start, segment_stop );
         }
 
 report_completion:
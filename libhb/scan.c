@@ -30,24 +30,59 @@ typedef struct
 
     uint64_t       min_title_duration;
 
+    int            batch_worker;    // scanning one of several files at once
+    int            fast_probe;      // trust the container, see FastProbe
+    int            deferred;        // previews of a fast probed title,
+                                    // decoded after the scan
+    int            join_segments;   // see HBTF_JOIN_SEGMENTS
+    int            seek_index;      // see HBTF_SEEK_INDEX
+    int            program_count;   // titles are programs of a stream,
+                                    // each read from its own hb_stream_t
+
 } hb_scan_t;
 
+/*
+ * Files of a batch are scanned by up to this many threads at once.
+ * Scanning is mostly waiting for I/O and decoding a few frames, so more
+ * threads than cpus still pay off on slow storage.
+ */
+#define BATCH_SCAN_THREADS_MAX 8
+
+#define HB_MAX_PROGRAMS 32      // programs of a transport stream as titles
+
+typedef struct
+{
+    hb_scan_t    * data;
+    hb_lock_t    * lock;
+    hb_title_t  ** titles;      // indexed by position in the batch
+    int            count;
+    int            next;        // next file to claim
+    int            done;        // files scanned so far
+} batch_scan_t;
+
 static void ScanFunc( void * );
+static int  ScanBatch( hb_scan_t * data );
+static void ScanPrograms( hb_scan_t * data, int * programs, int count );
+static int  ScanTitle( hb_scan_t * data, hb_title_t * title );
+static int  FastProbe( hb_scan_t * data, hb_title_t * title );
 static int  DecodePreviews( hb_scan_t *, hb_title_t * title );
+static void SetVideoInfo( hb_title_t * title, hb_work_info_t * vid_info );
+static void SetAudioInfo( hb_audio_t * audio, hb_work_info_t * info );
 static void LookForAudio( hb_title_t * title, hb_buffer_t * b );
 static int  AllAudioOK( hb_title_t * title );
 static void UpdateState1(hb_scan_t *scan, int title);
 static void UpdateState2(hb_scan_t *scan, int title);
 static void UpdateState3(hb_scan_t *scan, int preview);
+static void UpdateStateBatch(hb_scan_t *scan, int done, int count);
 
-static const char *aspect_to_string( double aspect )
+// arstr must hold 32 chars, previews of batch files are decoded in parallel
+static const char *aspect_to_string( double aspect, char *arstr )
 {
     switch ( (int)(aspect * 9.) )
     {
         case 9 * 4 / 3:    return "4:3";
         case 9 * 16 / 9:   return "16:9";
     }
-    static char arstr[32];
     sprintf( arstr, aspect >= 1.? "%.2f:1" : "1:%.2f", aspect );
     return arstr;
 }
@@ -55,7 +90,9 @@ static const char *aspect_to_string( double aspect )
 hb_thread_t * hb_scan_init( hb_handle_t * handle, volatile int * die,
                             const char * path, int title_index, 
                             hb_title_set_t * title_set, int preview_count, 
-                            int store_previews, uint64_t min_duration )
+                            int store_previews, uint64_t min_duration,
+                            int fast_probe, int join_segments,
+                            int seek_index )
 {
     hb_scan_t * data = calloc( sizeof( hb_scan_t ), 1 );
 
@@ -68,6 +105,9 @@ hb_thread_t * hb_scan_init( hb_handle_t * handle, volatile int * die,
     data->preview_count  = preview_count;
     data->store_previews = store_previews;
     data->min_title_duration = min_duration;
+    data->fast_probe     = fast_probe;
+    data->join_segments  = join_segments;
+    data->seek_index     = seek_index;
     
     return hb_thread_init( "scan", ScanFunc, data, HB_NORMAL_PRIORITY );
 }
@@ -78,6 +118,7 @@ static void ScanFunc( void * _data )
     hb_title_t * title;
     int          i;
     int          feature = 0;
+    int          scanned = 0;   // titles have been completely scanned
 
     data->bd = NULL;
     data->dvd = NULL;
@@ -139,12 +180,17 @@ static void ScanFunc( void * _data )
         if( data->title_index )
         {
             /* Scan this title only */
-            title = hb_batch_title_scan( data->batch, data->title_index );
+            title = hb_batch_title_scan( data->batch, data->title_index,
+                                         data->seek_index ? HBTF_SEEK_INDEX : 0 );
             if ( title )
             {
                 hb_list_add( data->title_set->list_title, title );
             }
         }
+        else if( ScanBatch( data ) )
+        {
+            scanned = 1;
+        }
         else
         {
             /* Scan all titles */
@@ -153,7 +199,8 @@ static void ScanFunc( void * _data )
                 hb_title_t * title;
 
                 UpdateState1(data, i + 1);
-                title = hb_batch_title_scan( data->batch, i + 1 );
+                title = hb_batch_title_scan( data->batch, i + 1,
+                                             data->seek_index ? HBTF_SEEK_INDEX : 0 );
                 if ( title != NULL )
                 {
                     hb_list_add( data->title_set->list_title, title );
@@ -163,13 +210,33 @@ static void ScanFunc( void * _data )
     }
     else
     {
+        int title_index = data->title_index;
+        int programs[HB_MAX_PROGRAMS];
+        int count;
+
         data->title_index = 1;
         hb_title_t * title = hb_title_init( data->path, data->title_index );
+        if ( data->join_segments )
+            title->flags |= HBTF_JOIN_SEGMENTS;
+        if ( data->seek_index )
+            title->flags |= HBTF_SEEK_INDEX;
         if ( (data->stream = hb_stream_open( data->path, title, 1 ) ) != NULL )
         {
-            title = hb_stream_title_scan( data->stream, title );
-            if ( title )
-                hb_list_add( data->title_set->list_title, title );
+            count = hb_stream_ts_programs( data->stream, programs,
+                                           HB_MAX_PROGRAMS );
+            if ( count > 1 )
+            {
+                hb_title_close( &title );
+                hb_stream_close( &data->stream );
+                data->title_index = title_index;
+                ScanPrograms( data, programs, count );
+            }
+            else
+            {
+                title = hb_stream_title_scan( data->stream, title );
+                if ( title )
+                    hb_list_add( data->title_set->list_title, title );
+            }
         }
         else
         {
@@ -179,11 +246,8 @@ static void ScanFunc( void * _data )
         }
     }
 
-    for( i = 0; i < hb_list_count( data->title_set->list_title ); )
+    for( i = 0; !scanned && i < hb_list_count( data->title_set->list_title ); )
     {
-        int j;
-        hb_audio_t * audio;
-
         if ( *data->die )
         {
             goto finish;
@@ -192,63 +256,18 @@ static void ScanFunc( void * _data )
 
         UpdateState2(data, i + 1);
 
-        /* Decode previews */
-        /* this will also detect more AC3 / DTS information */
-        if( !DecodePreviews( data, title ) )
+        if( !ScanTitle( data, title ) )
         {
-            /* TODO: free things */
             hb_list_rem( data->title_set->list_title, title );
-            for( j = 0; j < hb_list_count( title->list_audio ); j++)
-            {
-                audio = hb_list_item( title->list_audio, j );
-                if ( audio->priv.scan_cache )
-                {
-                    hb_fifo_flush( audio->priv.scan_cache );
-                    hb_fifo_close( &audio->priv.scan_cache );
-                }
-            }
             hb_title_close( &title );
             continue;
         }
-
-        /* Make sure we found audio rates and bitrates */
-        for( j = 0; j < hb_list_count( title->list_audio ); )
-        {
-            audio = hb_list_item( title->list_audio, j );
-            if ( audio->priv.scan_cache )
-            {
-                hb_fifo_flush( audio->priv.scan_cache );
-                hb_fifo_close( &audio->priv.scan_cache );
-            }
-            if( !audio->config.in.bitrate )
-            {
-                hb_log( "scan: removing audio 0x%x because no bitrate found",
-                        audio->id );
-                hb_list_rem( title->list_audio, audio );
-                free( audio );
-                continue;
-            }
-            j++;
-        }
-
-        if ( data->dvd || data->bd )
-        {
-            // The subtitle width and height needs to be set to the 
-            // title widht and height for DVDs.  title width and
-            // height don't get set until we decode previews, so
-            // we can't set subtitle width/height till we get here.
-            for( j = 0; j < hb_list_count( title->list_subtitle ); j++ )
-            {
-                hb_subtitle_t *subtitle = hb_list_item( title->list_subtitle, j );
-                if ( subtitle->source == VOBSUB || subtitle->source == PGSSUB )
-                {
-                    subtitle->width = title->width;
-                    subtitle->height = title->height;
-                }
-            }
-        }
         i++;
     }
+    if ( *data->die )
+    {
+        goto finish;
+    }
 
     data->title_set->feature = feature;
 
@@ -286,6 +305,324 @@ finish:
     hb_buffer_pool_free();
 }
 
+/***********************************************************************
+ * ScanPrograms
+ ***********************************************************************
+ * Makes a title of each program of a multi-program transport stream.
+ * Each title reads the stream for its own program, so DecodePreviews
+ * opens a stream per title like it does for batches.
+ **********************************************************************/
+static void ScanPrograms( hb_scan_t * data, int * programs, int count )
+{
+    hb_title_t  * title;
+    hb_stream_t * stream;
+    int           i;
+
+    hb_log( "scan: transport stream has %d programs", count );
+    data->program_count = count;
+    for( i = 0; i < count && !*data->die; i++ )
+    {
+        if( data->title_index && data->title_index != i + 1 )
+        {
+            continue;
+        }
+        UpdateState1( data, i + 1 );
+
+        title = hb_title_init( data->path, i + 1 );
+        title->ts_program = programs[i];
+        if( data->join_segments )
+        {
+            title->flags |= HBTF_JOIN_SEGMENTS;
+        }
+        if( data->seek_index )
+        {
+            title->flags |= HBTF_SEEK_INDEX;
+        }
+        stream = hb_stream_open( data->path, title, 1 );
+        if( stream == NULL )
+        {
+            // hb_stream_open logged why
+            hb_log( "scan: program %d could not be opened, skipped",
+                    programs[i] );
+            hb_title_close( &title );
+            continue;
+        }
+        hb_log( "scan: title %d is program %d", i + 1, programs[i] );
+        title = hb_stream_title_scan( stream, title );
+        hb_stream_close( &stream );
+        if( title != NULL )
+        {
+            hb_list_add( data->title_set->list_title, title );
+        }
+    }
+}
+
+/***********************************************************************
+ * ScanTitle
+ ***********************************************************************
+ * Decodes the previews of a title and drops the audio tracks they
+ * didn't identify.  Returns 0 if the title is unusable, it must then
+ * be closed by the caller.
+ **********************************************************************/
+static int ScanTitle( hb_scan_t * data, hb_title_t * title )
+{
+    int j;
+    hb_audio_t * audio;
+
+    if( data->fast_probe && FastProbe( data, title ) )
+    {
+        /* Crop, comb detection and previews wait for hb_scan_previews */
+        title->flags |= HBTF_PREVIEWS_PENDING;
+    }
+    /* Decode previews */
+    /* this will also detect more AC3 / DTS information */
+    else if( !DecodePreviews( data, title ) )
+    {
+        /* TODO: free things */
+        for( j = 0; j < hb_list_count( title->list_audio ); j++)
+        {
+            audio = hb_list_item( title->list_audio, j );
+            if ( audio->priv.scan_cache )
+            {
+                hb_fifo_flush( audio->priv.scan_cache );
+                hb_fifo_close( &audio->priv.scan_cache );
+            }
+        }
+        return 0;
+    }
+
+    /* Make sure we found audio rates and bitrates */
+    for( j = 0; j < hb_list_count( title->list_audio ); )
+    {
+        audio = hb_list_item( title->list_audio, j );
+        if ( audio->priv.scan_cache )
+        {
+            hb_fifo_flush( audio->priv.scan_cache );
+            hb_fifo_close( &audio->priv.scan_cache );
+        }
+        if( !audio->config.in.bitrate )
+        {
+            hb_log( "scan: removing audio 0x%x because no bitrate found",
+                    audio->id );
+            hb_list_rem( title->list_audio, audio );
+            free( audio );
+            continue;
+        }
+        j++;
+    }
+
+    if ( data->dvd || data->bd )
+    {
+        // The subtitle width and height needs to be set to the 
+        // title widht and height for DVDs.  title width and
+        // height don't get set until we decode previews, so
+        // we can't set subtitle width/height till we get here.
+        for( j = 0; j < hb_list_count( title->list_subtitle ); j++ )
+        {
+            hb_subtitle_t *subtitle = hb_list_item( title->list_subtitle, j );
+            if ( subtitle->source == VOBSUB || subtitle->source == PGSSUB )
+            {
+                subtitle->width = title->width;
+                subtitle->height = title->height;
+            }
+        }
+    }
+    return 1;
+}
+
+static void ScanBatchLoop( void * _batch_scan )
+{
+    batch_scan_t * bs = _batch_scan;
+    hb_scan_t      data;
+    hb_title_t   * title;
+    int            i;
+
+    // Each file gets its own stream, the rest is shared read-only
+    data = *bs->data;
+    data.stream = NULL;
+    data.batch_worker = 1;
+
+    while ( !*data.die )
+    {
+        hb_lock( bs->lock );
+        i = bs->next++;
+        hb_unlock( bs->lock );
+        if ( i >= bs->count )
+        {
+            break;
+        }
+
+        title = hb_batch_title_scan( data.batch, i + 1,
+                                     data.seek_index ? HBTF_SEEK_INDEX : 0 );
+        if ( title != NULL && !ScanTitle( &data, title ) )
+        {
+            hb_title_close( &title );
+        }
+        bs->titles[i] = title;
+
+        hb_lock( bs->lock );
+        bs->done++;
+        UpdateStateBatch( &data, bs->done, bs->count );
+        hb_unlock( bs->lock );
+    }
+}
+
+/***********************************************************************
+ * ScanBatch
+ ***********************************************************************
+ * Scans the files of a batch on several threads.  Titles are added to
+ * the title set in the order of the files, whatever order they finish
+ * in.  Returns 0 if the batch is better scanned serially.
+ **********************************************************************/
+static int ScanBatch( hb_scan_t * data )
+{
+    batch_scan_t    bs;
+    hb_thread_t  ** threads;
+    int             i, thread_count;
+
+    memset( &bs, 0, sizeof( bs ) );
+    bs.count = hb_batch_title_count( data->batch );
+    thread_count = MIN( MIN( hb_get_cpu_count(), BATCH_SCAN_THREADS_MAX ),
+                        bs.count );
+    if ( thread_count < 2 )
+    {
+        return 0;
+    }
+
+    bs.data   = data;
+    bs.lock   = hb_lock_init();
+    bs.titles = calloc( bs.count, sizeof( hb_title_t * ) );
+    threads   = calloc( thread_count, sizeof( hb_thread_t * ) );
+
+    hb_log( "scan: scanning %d files on %d threads", bs.count, thread_count );
+    UpdateStateBatch( data, 0, bs.count );
+    for ( i = 0; i < thread_count; i++ )
+    {
+        threads[i] = hb_thread_init( "batch scan", ScanBatchLoop, &bs,
+                                     HB_NORMAL_PRIORITY );
+    }
+    for ( i = 0; i < thread_count; i++ )
+    {
+        hb_thread_close( &threads[i] );
+    }
+
+    for ( i = 0; i < bs.count; i++ )
+    {
+        if ( bs.titles[i] != NULL )
+        {
+            hb_list_add( data->title_set->list_title, bs.titles[i] );
+        }
+    }
+
+    free( threads );
+    free( bs.titles );
+    hb_lock_close( &bs.lock );
+
+    return 1;
+}
+
+/***********************************************************************
+ * FastProbe
+ ***********************************************************************
+ * Sets up a title from what its container says about the tracks,
+ * without decoding any previews.  Only done for containers that are
+ * trusted to tell everything (see hb_stream_probe_video).  Returns 0 if
+ * the previews must be decoded.
+ **********************************************************************/
+static int FastProbe( hb_scan_t * data, hb_title_t * title )
+{
+    hb_stream_t    * stream = data->stream;
+    hb_work_info_t   vid_info, * aud_info;
+    int              i, count, ok;
+    char             arstr[32];
+
+    if( title->type != HB_FF_STREAM_TYPE )
+    {
+        return 0;
+    }
+    if( data->batch )
+    {
+        stream = hb_stream_open( title->path, title, 1 );
+    }
+    if( stream == NULL )
+    {
+        return 0;
+    }
+
+    count    = hb_list_count( title->list_audio );
+    aud_info = calloc( count + 1, sizeof( hb_work_info_t ) );
+    ok       = hb_stream_probe_video( stream, &vid_info );
+    for( i = 0; ok && i < count; i++ )
+    {
+        ok = hb_stream_probe_audio( stream,
+                                    hb_list_item( title->list_audio, i ),
+                                    &aud_info[i] );
+    }
+    if( data->batch )
+    {
+        hb_stream_close( &stream );
+    }
+
+    if( ok )
+    {
+        SetVideoInfo( title, &vid_info );
+        for( i = 0; i < count; i++ )
+        {
+            SetAudioInfo( hb_list_item( title->list_audio, i ), &aud_info[i] );
+        }
+        hb_log( "scan: probed title %d from %s headers, %dx%d, %.3f fps, "
+                "aspect %s, PAR %d:%d", title->index, title->container_name,
+                title->width, title->height,
+                (float) title->rate / (float) title->rate_base,
+                aspect_to_string( title->aspect, arstr ),
+                title->pixel_aspect_width, title->pixel_aspect_height );
+    }
+    free( aud_info );
+
+    return ok;
+}
+
+/***********************************************************************
+ * hb_scan_decode_previews
+ ***********************************************************************
+ * Decodes the previews a fast probe left out, which also gives the
+ * title its autocrop and interlace detection.  Runs in the caller's
+ * thread.  Returns 0 if no preview could be decoded.
+ **********************************************************************/
+int hb_scan_decode_previews( hb_handle_t * h, hb_title_t * title,
+                             int preview_count, int store_previews )
+{
+    hb_scan_t    data;
+    volatile int die = 0;
+    int          npreviews;
+
+    if( !( title->flags & HBTF_PREVIEWS_PENDING ) )
+    {
+        return 1;
+    }
+
+    memset( &data, 0, sizeof( data ) );
+    data.h              = h;
+    data.die            = &die;
+    data.path           = title->path;
+    data.title_index    = title->index;
+    data.preview_count  = preview_count;
+    data.store_previews = store_previews;
+    data.deferred       = 1;
+
+    // Only ever tried once, a failure leaves the probed values in place
+    title->flags &= ~HBTF_PREVIEWS_PENDING;
+    data.stream = hb_stream_open( title->path, title, 1 );
+    if( data.stream == NULL )
+    {
+        return 0;
+    }
+    npreviews = DecodePreviews( &data, title );
+    hb_stream_close( &data.stream );
+
+    return npreviews;
+}
+
 // -----------------------------------------------
 // stuff related to cropping
 
@@ -486,8 +823,12 @@ static int DecodePreviews( hb_scan_t * data, hb_title_t * title )
     int pulldown_count = 0;
     int doubled_frame_count = 0;
     int interlaced_preview_count = 0;
+    char arstr[32];
     info_list_t * info_list = calloc( data->preview_count+1, sizeof(*info_list) );
     crop_record_t *crops = crop_record_init( data->preview_count );
+    hb_thumbnails_t * thumbs;
+    const char * thumb_prefix;
+    int thumb_width;
 
     list_es  = hb_list_init();
 
@@ -511,7 +852,7 @@ static int DecodePreviews( hb_scan_t * data, hb_title_t * title )
         title->angle_count = hb_dvd_angle_count( data->dvd );
         hb_log( "scan: title angle(s) %d", title->angle_count );
     }
-    else if (data->batch)
+    else if (data->batch || data->program_count)
     {
         data->stream = hb_stream_open( title->path, title, 1 );
     }
@@ -526,9 +867,14 @@ static int DecodePreviews( hb_scan_t * data, hb_title_t * title )
     vid_decoder->title = title;
     vid_decoder->init( vid_decoder, NULL );
 
+    thumb_prefix = hb_scan_thumbnails( data->h, &thumb_width );
+    thumbs = hb_thumbnails_init( thumb_prefix, title->index,
+                                 data->preview_count, thumb_width );
+
     for( i = 0; i < data->preview_count; i++ )
     {
         int j;
+        double position;
 
         UpdateState3(data, i + 1);
 
@@ -536,8 +882,10 @@ static int DecodePreviews( hb_scan_t * data, hb_title_t * title )
         {
             free( info_list );
             crop_record_free( crops );
+            hb_thumbnails_close( &thumbs );
             return 0;
         }
+        position = (double) ( i + 1 ) / ( data->preview_count + 1.0 );
         if (data->bd)
         {
             if( !hb_bd_seek( data->bd, (float) ( i + 1 ) / ( data->preview_count + 1.0 ) ) )
@@ -560,6 +908,7 @@ static int DecodePreviews( hb_scan_t * data, hb_title_t * title )
              *
              * Also, seeking to position 0 loses the palette of avi files
              * so skip initial seek */
+            position = (double) i / ( data->preview_count + 1.0 );
             if (i != 0)
             {
                 if (!hb_stream_seek(data->stream,
@@ -710,6 +1059,7 @@ static int DecodePreviews( hb_scan_t * data, hb_title_t * title )
         {
             hb_save_preview( data->h, title->index, i, vid_buf );
         }
+        hb_thumbnails_add( thumbs, vid_buf, &vid_info, position );
 
         /* Detect black borders */
 
@@ -802,7 +1152,7 @@ skip_preview:
     vid_decoder->close( vid_decoder );
     free( vid_decoder );
 
-    if ( data->batch && data->stream )
+    if ( ( data->batch || data->program_count ) && data->stream )
     {
         hb_stream_close( &data->stream );
     }
@@ -814,28 +1164,9 @@ skip_preview:
         most_common_info( info_list, &vid_info );
 
         title->has_resolution_change = has_resolution_change( info_list );
-        if ( title->video_codec_name == NULL )
-        {
-            title->video_codec_name = strdup( vid_info.name );
-        }
-        title->width = vid_info.width;
-        title->height = vid_info.height;
+        SetVideoInfo( title, &vid_info );
         if ( vid_info.rate && vid_info.rate_base )
         {
-            // if the frame rate is very close to one of our "common" framerates,
-            // assume it actually is said frame rate; e.g. some 24000/1001 sources
-            // may have a rate_base of 1126124 (instead of 1126125)
-            const hb_rate_t *video_framerate = NULL;
-            while ((video_framerate = hb_video_framerate_get_next(video_framerate)) != NULL)
-            {
-                if (is_close_to(vid_info.rate_base, video_framerate->rate, 100))
-                {
-                    vid_info.rate_base = video_framerate->rate;
-                    break;
-                }
-            }
-            title->rate = vid_info.rate;
-            title->rate_base = vid_info.rate_base;
             if( vid_info.rate_base == 900900 )
             {
                 if( npreviews >= 4 && pulldown_count >= npreviews / 4 )
@@ -859,44 +1190,6 @@ skip_preview:
                 hb_deep_log( 2, "Repeat frames detected, setting fps to %.3f", (float)title->rate / title->rate_base );
             }
         }
-        title->video_bitrate = vid_info.bitrate;
-
-        if( vid_info.pixel_aspect_width && vid_info.pixel_aspect_height )
-        {
-            title->pixel_aspect_width = vid_info.pixel_aspect_width;
-            title->pixel_aspect_height = vid_info.pixel_aspect_height;
-        }
-        title->color_prim = vid_info.color_prim;
-        title->color_transfer = vid_info.color_transfer;
-        title->color_matrix = vid_info.color_matrix;
-
-        title->video_decode_support = vid_info.video_decode_support;
-
-        // TODO: check video dimensions
-        title->opencl_support = !!hb_opencl_available();
-
-        // compute the aspect ratio based on the storage dimensions and the
-        // pixel aspect ratio (if supplied) or just storage dimensions if no PAR.
-        title->aspect = (double)title->width / (double)title->height;
-        title->aspect *= (double)title->pixel_aspect_width /
-                         (double)title->pixel_aspect_height;
-
-        // For unknown reasons some French PAL DVDs put the original
-        // content's aspect ratio into the mpeg PAR even though it's
-        // the wrong PAR for the DVD. Apparently they rely on the fact
-        // that DVD players ignore the content PAR and just use the
-        // aspect ratio from the DVD metadata. So, if the aspect computed
-        // from the PAR is different from the container's aspect we use
-        // the container's aspect & recompute the PAR from it.
-        if( title->container_aspect && (int)(title->aspect * 9) != (int)(title->container_aspect * 9) )
-        {
-            hb_log("scan: content PAR gives wrong aspect %.2f; "
-                   "using container aspect %.2f", title->aspect,
-                   title->container_aspect );
-            title->aspect = title->container_aspect;
-            hb_reduce( &title->pixel_aspect_width, &title->pixel_aspect_height,
-                       (int)(title->aspect * title->height + 0.5), title->width );
-        }
 
         // don't try to crop unless we got at least 3 previews
         if ( crops->n > 2 )
@@ -920,7 +1213,7 @@ skip_preview:
                 npreviews, title->width, title->height, (float) title->rate /
                 (float) title->rate_base,
                 title->crop[0], title->crop[1], title->crop[2], title->crop[3],
-                aspect_to_string( title->aspect ), title->pixel_aspect_width,
+                aspect_to_string( title->aspect, arstr ), title->pixel_aspect_width,
                 title->pixel_aspect_height );
 
         if( interlaced_preview_count >= ( npreviews / 2 ) )
@@ -933,7 +1226,9 @@ skip_preview:
         {
             title->detected_interlacing = 0;
         }
+        hb_thumbnails_write( thumbs, title->duration );
     }
+    hb_thumbnails_close( &thumbs );
     crop_record_free( crops );
     free( info_list );
 
@@ -951,6 +1246,76 @@ skip_preview:
     return npreviews;
 }
 
+/*
+ * Sets the video parameters of a title from the info of its video
+ * decoder, or of its container for a fast probe.  vid_info->rate_base
+ * is snapped to the common frame rate it is close to.
+ */
+static void SetVideoInfo( hb_title_t * title, hb_work_info_t * vid_info )
+{
+    if ( title->video_codec_name == NULL )
+    {
+        title->video_codec_name = strdup( vid_info->name );
+    }
+    title->width = vid_info->width;
+    title->height = vid_info->height;
+    if ( vid_info->rate && vid_info->rate_base )
+    {
+        // if the frame rate is very close to one of our "common" framerates,
+        // assume it actually is said frame rate; e.g. some 24000/1001 sources
+        // may have a rate_base of 1126124 (instead of 1126125)
+        const hb_rate_t *video_framerate = NULL;
+        while ((video_framerate = hb_video_framerate_get_next(video_framerate)) != NULL)
+        {
+            if (is_close_to(vid_info->rate_base, video_framerate->rate, 100))
+            {
+                vid_info->rate_base = video_framerate->rate;
+                break;
+            }
+        }
+        title->rate = vid_info->rate;
+        title->rate_base = vid_info->rate_base;
+    }
+    title->video_bitrate = vid_info->bitrate;
+
+    if( vid_info->pixel_aspect_width && vid_info->pixel_aspect_height )
+    {
+        title->pixel_aspect_width = vid_info->pixel_aspect_width;
+        title->pixel_aspect_height = vid_info->pixel_aspect_height;
+    }
+    title->color_prim = vid_info->color_prim;
+    title->color_transfer = vid_info->color_transfer;
+    title->color_matrix = vid_info->color_matrix;
+
+    title->video_decode_support = vid_info->video_decode_support;
+
+    // TODO: check video dimensions
+    title->opencl_support = !!hb_opencl_available();
+
+    // compute the aspect ratio based on the storage dimensions and the
+    // pixel aspect ratio (if supplied) or just storage dimensions if no PAR.
+    title->aspect = (double)title->width / (double)title->height;
+    title->aspect *= (double)title->pixel_aspect_width /
+                     (double)title->pixel_aspect_height;
+
+    // For unknown reasons some French PAL DVDs put the original
+    // content's aspect ratio into the mpeg PAR even though it's
+    // the wrong PAR for the DVD. Apparently they rely on the fact
+    // that DVD players ignore the content PAR and just use the
+    // aspect ratio from the DVD metadata. So, if the aspect computed
+    // from the PAR is different from the container's aspect we use
+    // the container's aspect & recompute the PAR from it.
+    if( title->container_aspect && (int)(title->aspect * 9) != (int)(title->container_aspect * 9) )
+    {
+        hb_log("scan: content PAR gives wrong aspect %.2f; "
+               "using container aspect %.2f", title->aspect,
+               title->container_aspect );
+        title->aspect = title->container_aspect;
+        hb_reduce( &title->pixel_aspect_width, &title->pixel_aspect_height,
+                   (int)(title->aspect * title->height + 0.5), title->width );
+    }
+}
+
 /*
  * This routine is called for every frame from a non-video elementary stream.
  * These are a mix of audio & subtitle streams, some of which we want & some
@@ -1032,15 +1397,42 @@ static void LookForAudio( hb_title_t * title, hb_buffer_t * b )
     hb_fifo_flush( audio->priv.scan_cache );
     hb_fifo_close( &audio->priv.scan_cache );
 
-    audio->config.in.samplerate = info.rate;
-    audio->config.in.samples_per_frame = info.samples_per_frame;
-    audio->config.in.bitrate = info.bitrate;
-    audio->config.in.matrix_encoding = info.matrix_encoding;
-    audio->config.in.channel_layout = info.channel_layout;
-    audio->config.in.channel_map = info.channel_map;
-    audio->config.in.version = info.version;
-    audio->config.in.flags = info.flags;
-    audio->config.in.mode = info.mode;
+    SetAudioInfo( audio, &info );
+
+    free( w );
+    return;
+
+    // We get here if there's no hope of finding info on an audio bitstream,
+    // either because we don't have a decoder (or a decoder with a bitstream
+    // info proc) or because the decoder's info proc said that the stream
+    // wasn't something it could handle. Delete the item from the title's
+    // audio list so we won't keep reading packets while trying to get its
+    // bitstream info.
+ drop_audio:
+    if ( w )
+        free( w );
+
+    hb_fifo_flush( audio->priv.scan_cache );
+    hb_fifo_close( &audio->priv.scan_cache );
+    hb_list_rem( title->list_audio, audio );
+    return;
+}
+
+/*
+ * Sets the input parameters and the description of an audio track from
+ * the bitstream info of its decoder, or of its container for a fast probe.
+ */
+static void SetAudioInfo( hb_audio_t * audio, hb_work_info_t * info )
+{
+    audio->config.in.samplerate = info->rate;
+    audio->config.in.samples_per_frame = info->samples_per_frame;
+    audio->config.in.bitrate = info->bitrate;
+    audio->config.in.matrix_encoding = info->matrix_encoding;
+    audio->config.in.channel_layout = info->channel_layout;
+    audio->config.in.channel_map = info->channel_map;
+    audio->config.in.version = info->version;
+    audio->config.in.flags = info->flags;
+    audio->config.in.mode = info->mode;
 
     // now that we have all the info, set the audio description
     const char *codec_name = NULL;
@@ -1049,9 +1441,9 @@ static void LookForAudio( hb_title_t * title, hb_buffer_t * b )
         AVCodec *codec = avcodec_find_decoder(audio->config.in.codec_param);
         if (codec != NULL)
         {
-            if (info.profile != FF_PROFILE_UNKNOWN)
+            if (info->profile != FF_PROFILE_UNKNOWN)
             {
-                codec_name = av_get_profile_name(codec, info.profile);
+                codec_name = av_get_profile_name(codec, info->profile);
             }
             if (codec_name == NULL)
             {
@@ -1196,26 +1588,8 @@ static void LookForAudio( hb_title_t * title, hb_buffer_t * b )
     }
 
     hb_log( "scan: audio 0x%x: %s, rate=%dHz, bitrate=%d %s", audio->id,
-            info.name, audio->config.in.samplerate, audio->config.in.bitrate,
+            info->name, audio->config.in.samplerate, audio->config.in.bitrate,
             audio->config.lang.description );
- 
-    free( w );
-    return;
-
-    // We get here if there's no hope of finding info on an audio bitstream,
-    // either because we don't have a decoder (or a decoder with a bitstream
-    // info proc) or because the decoder's info proc said that the stream
-    // wasn't something it could handle. Delete the item from the title's
-    // audio list so we won't keep reading packets while trying to get its
-    // bitstream info.
- drop_audio:
-    if ( w )
-        free( w );
-
-    hb_fifo_flush( audio->priv.scan_cache );
-    hb_fifo_close( &audio->priv.scan_cache );
-    hb_list_rem( title->list_audio, audio );
-    return;
 }
 
 /*
@@ -1249,6 +1623,7 @@ static void UpdateState1(hb_scan_t *scan, int title)
     p.title_count = scan->dvd ? hb_dvd_title_count( scan->dvd ) :
                     scan->bd ? hb_bd_title_count( scan->bd ) :
                     scan->batch ? hb_batch_title_count( scan->batch ) :
+                    scan->program_count ? scan->program_count :
                                hb_list_count(scan->title_set->list_title);
     p.preview_cur = 0;
     p.preview_count = 1;
@@ -1278,10 +1653,32 @@ static void UpdateState2(hb_scan_t *scan, int title)
     hb_set_state(scan->h, &state);
 }
 
+static void UpdateStateBatch(hb_scan_t *scan, int done, int count)
+{
+    hb_state_t state;
+
+#define p state.param.scanning
+    /* Update the UI */
+    state.state   = HB_STATE_SCANNING;
+    p.title_cur   = MIN(done + 1, count);
+    p.title_count = count;
+    p.preview_cur = 0;
+    p.preview_count = scan->preview_count;
+    p.progress = (float)done / count;
+#undef p
+
+    hb_set_state(scan->h, &state);
+}
+
 static void UpdateState3(hb_scan_t *scan, int preview)
 {
     hb_state_t state;
 
+    // Progress of parallel batch scans is counted in files, previews
+    // decoded after the scan don't report any
+    if (scan->batch_worker || scan->deferred)
+        return;
+
     hb_get_state2(scan->h, &state);
 #define p state.param.scanning
     p.preview_cur = preview;
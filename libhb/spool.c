@@ -0,0 +1,496 @@
+/* spool.c
+
+   Copyright (c) 2003-2014 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*
+ * Frame spool for two-pass encodes.
+ *
+ * During the first pass, the spool writer sits between the end of the
+ * filter chain and the video encoder and records every frame the encoder
+ * sees to a temporary file.  During the second pass, the spool reader
+ * replaces the filter chain and feeds the encoder from that file, so the
+ * (potentially very expensive) filters only run once.
+ *
+ * The source is still read, decoded and synced in the second pass since
+ * audio and subtitle timing is derived from the video stream.  The reader
+ * uses the synced frames only as a clock and discards them.
+ */
+
+#include "hb.h"
+#include <zlib.h>
+
+#define SPOOL_MAGIC 0x48425350 // "HBSP"
+
+typedef struct
+{
+    uint32_t magic;
+    int32_t  fmt;
+    int32_t  width;
+    int32_t  height;
+    int64_t  start;
+    int64_t  stop;
+    double   duration;
+    int32_t  new_chap;
+    int32_t  frametype;
+    int32_t  flags;
+    float    complexity;
+    float    motion;
+    int32_t  scenecut;
+    int32_t  size;      // size of the payload that follows this header
+    int32_t  raw_size;  // size of the packed picture
+    int32_t  deflated;  // payload is deflated, else the packed picture
+} spool_frame_t;
+
+struct hb_work_private_s
+{
+    hb_job_t    * job;
+    FILE        * file;
+    char          filename[1024];
+    int           compress;
+    int           frames;
+    int           eof;
+
+    uint8_t     * pack;
+    int           pack_size;
+    uint8_t     * zbuf;
+    uLong         zbuf_size;
+
+    // Next spooled frame, read ahead of the sync clock
+    hb_buffer_t * next;
+};
+
+static int  spoolWriteInit( hb_work_object_t *, hb_job_t * );
+static int  spoolWriteWork( hb_work_object_t *, hb_buffer_t **, hb_buffer_t ** );
+static void spoolWriteClose( hb_work_object_t * );
+static int  spoolReadInit( hb_work_object_t *, hb_job_t * );
+static int  spoolReadWork( hb_work_object_t *, hb_buffer_t **, hb_buffer_t ** );
+static void spoolReadClose( hb_work_object_t * );
+
+hb_work_object_t hb_spool_write =
+{
+    WORK_SPOOL_WRITE,
+    "Frame spool writer",
+    spoolWriteInit,
+    spoolWriteWork,
+    spoolWriteClose
+};
+
+hb_work_object_t hb_spool_read =
+{
+    WORK_SPOOL_READ,
+    "Frame spool reader",
+    spoolReadInit,
+    spoolReadWork,
+    spoolReadClose
+};
+
+static void spool_filename( hb_job_t * job, char name[1024] )
+{
+    hb_get_tempory_filename( job->h, name, "%d_spool_%d",
+                             hb_get_instance_id( job->h ),
+                             job->sequence_id & 0xFFFFFF );
+}
+
+/*
+ * Returns non-zero when the first pass of this job left a complete
+ * frame spool behind that the second pass can encode from.
+ */
+int hb_spool_available( hb_job_t * job )
+{
+    hb_interjob_t * interjob = hb_interjob_get( job->h );
+    char            filename[1024];
+    hb_stat_t       st;
+
+    if ( ( job->sequence_id & 0xFFFFFF ) != ( interjob->last_job & 0xFFFFFF ) ||
+         interjob->spool_frames <= 0 )
+    {
+        return 0;
+    }
+    spool_filename( job, filename );
+    return hb_stat( filename, &st ) == 0;
+}
+
+static int plane_count( hb_buffer_t * buf )
+{
+    int pp;
+
+    for ( pp = 0; pp < 4 && buf->plane[pp].data != NULL; pp++ );
+    return pp;
+}
+
+/***********************************************************************
+ * Writer
+ **********************************************************************/
+static int spoolWriteInit( hb_work_object_t * w, hb_job_t * job )
+{
+    hb_work_private_t * pv;
+    hb_interjob_t     * interjob = hb_interjob_get( job->h );
+
+    pv              = calloc( 1, sizeof( hb_work_private_t ) );
+    w->private_data = pv;
+    pv->job         = job;
+    pv->compress    = job->pass_spool == HB_SPOOL_DEFLATE;
+
+    interjob->spool_frames = 0;
+
+    spool_filename( job, pv->filename );
+    pv->file = hb_fopen( pv->filename, "wb" );
+    if ( pv->file == NULL )
+    {
+        // Not fatal, pass 2 will simply run the filters again
+        hb_log( "spool: failed to create %s, frame spool disabled",
+                pv->filename );
+        return 0;
+    }
+    hb_log( "spool: spooling first pass frames to %s (%s)",
+            pv->filename, pv->compress ? "deflate" : "raw" );
+
+    return 0;
+}
+
+static int spool_write_frame( hb_work_private_t * pv, hb_buffer_t * buf )
+{
+    spool_frame_t hdr;
+    uint8_t     * dst;
+    int           pp, yy, size = 0;
+
+    for ( pp = 0; pp < plane_count( buf ); pp++ )
+    {
+        size += buf->plane[pp].width * buf->plane[pp].height;
+    }
+
+    memset( &hdr, 0, sizeof( hdr ) );
+    hdr.magic     = SPOOL_MAGIC;
+    hdr.fmt       = buf->f.fmt;
+    hdr.width     = buf->f.width;
+    hdr.height    = buf->f.height;
+    hdr.start     = buf->s.start;
+    hdr.stop      = buf->s.stop;
+    hdr.duration  = buf->s.duration;
+    hdr.new_chap  = buf->s.new_chap;
+    hdr.frametype = buf->s.frametype;
+    hdr.flags     = buf->s.flags;
+    hdr.complexity = buf->s.complexity;
+    hdr.motion     = buf->s.motion;
+    hdr.scenecut   = buf->s.scenecut;
+    hdr.raw_size  = size;
+
+    if ( !pv->compress )
+    {
+        // Write rows straight out of the frame, no intermediate copy
+        hdr.size = size;
+        if ( fwrite( &hdr, sizeof( hdr ), 1, pv->file ) != 1 )
+            return -1;
+        for ( pp = 0; pp < plane_count( buf ); pp++ )
+        {
+            uint8_t * data = buf->plane[pp].data;
+            for ( yy = 0; yy < buf->plane[pp].height; yy++ )
+            {
+                if ( fwrite( data, buf->plane[pp].width, 1, pv->file ) != 1 )
+                    return -1;
+                data += buf->plane[pp].stride;
+            }
+        }
+        return 0;
+    }
+
+    if ( size > pv->pack_size )
+    {
+        free( pv->pack );
+        free( pv->zbuf );
+        pv->pack_size = size;
+        pv->pack      = malloc( size );
+        pv->zbuf_size = compressBound( size );
+        pv->zbuf      = malloc( pv->zbuf_size );
+        if ( pv->pack == NULL || pv->zbuf == NULL )
+            return -1;
+    }
+    dst = pv->pack;
+    for ( pp = 0; pp < plane_count( buf ); pp++ )
+    {
+        uint8_t * data = buf->plane[pp].data;
+        for ( yy = 0; yy < buf->plane[pp].height; yy++ )
+        {
+            memcpy( dst, data, buf->plane[pp].width );
+            dst  += buf->plane[pp].width;
+            data += buf->plane[pp].stride;
+        }
+    }
+
+    uLongf zsize = pv->zbuf_size;
+    if ( compress2( pv->zbuf, &zsize, pv->pack, size, Z_BEST_SPEED ) != Z_OK )
+        return -1;
+
+    if ( zsize >= size )
+    {
+        // Didn't shrink (noise), keep the packed picture
+        hdr.size = size;
+        if ( fwrite( &hdr, sizeof( hdr ), 1, pv->file ) != 1 ||
+             fwrite( pv->pack, size, 1, pv->file ) != 1 )
+        {
+            return -1;
+        }
+        return 0;
+    }
+
+    hdr.size     = zsize;
+    hdr.deflated = 1;
+    if ( fwrite( &hdr, sizeof( hdr ), 1, pv->file ) != 1 ||
+         fwrite( pv->zbuf, zsize, 1, pv->file ) != 1 )
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static int spoolWriteWork( hb_work_object_t * w, hb_buffer_t ** buf_in,
+                           hb_buffer_t ** buf_out )
+{
+    hb_work_private_t * pv = w->private_data;
+    hb_buffer_t       * in = *buf_in;
+
+    *buf_in  = NULL;
+    *buf_out = in;
+
+    if ( in->size <= 0 )
+    {
+        /* EOF on input stream - send it downstream & say that we're done */
+        pv->eof = 1;
+        return HB_WORK_DONE;
+    }
+
+    if ( pv->file != NULL )
+    {
+        if ( spool_write_frame( pv, in ) < 0 )
+        {
+            hb_error( "spool: write to %s failed, frame spool disabled",
+                      pv->filename );
+            fclose( pv->file );
+            pv->file = NULL;
+            unlink( pv->filename );
+        }
+        else
+        {
+            pv->frames++;
+        }
+    }
+
+    return HB_WORK_OK;
+}
+
+static void spoolWriteClose( hb_work_object_t * w )
+{
+    hb_work_private_t * pv = w->private_data;
+
+    if ( pv == NULL )
+        return;
+
+    if ( pv->file != NULL )
+    {
+        hb_interjob_t * interjob = hb_interjob_get( pv->job->h );
+        int             err      = fclose( pv->file );
+
+        if ( pv->eof && !err )
+        {
+            interjob->spool_frames = pv->frames;
+            hb_log( "spool: %d frames spooled for second pass", pv->frames );
+        }
+        else
+        {
+            // An incomplete spool must not be used by the second pass
+            unlink( pv->filename );
+        }
+    }
+    free( pv->pack );
+    free( pv->zbuf );
+    free( pv );
+    w->private_data = NULL;
+}
+
+/***********************************************************************
+ * Reader
+ **********************************************************************/
+static int spoolReadInit( hb_work_object_t * w, hb_job_t * job )
+{
+    hb_work_private_t * pv;
+
+    pv              = calloc( 1, sizeof( hb_work_private_t ) );
+    w->private_data = pv;
+    pv->job         = job;
+
+    spool_filename( job, pv->filename );
+    pv->file = hb_fopen( pv->filename, "rb" );
+    if ( pv->file == NULL )
+    {
+        hb_error( "spool: failed to open %s", pv->filename );
+        return 1;
+    }
+    hb_log( "spool: encoding second pass from %s", pv->filename );
+
+    return 0;
+}
+
+static hb_buffer_t * spool_read_frame( hb_work_private_t * pv )
+{
+    spool_frame_t hdr;
+    hb_buffer_t * buf;
+    uint8_t     * src = NULL;
+    int           pp, yy;
+
+    if ( pv->eof )
+        return NULL;
+
+    if ( fread( &hdr, sizeof( hdr ), 1, pv->file ) != 1 )
+    {
+        pv->eof = 1;
+        return NULL;
+    }
+    if ( hdr.magic != SPOOL_MAGIC )
+    {
+        hb_error( "spool: corrupt frame header in %s", pv->filename );
+        pv->eof = 1;
+        return NULL;
+    }
+
+    buf = hb_frame_buffer_init( hdr.fmt, hdr.width, hdr.height );
+    if ( buf == NULL )
+    {
+        pv->eof = 1;
+        return NULL;
+    }
+    buf->s.start     = hdr.start;
+    buf->s.stop      = hdr.stop;
+    buf->s.duration  = hdr.duration;
+    buf->s.new_chap  = hdr.new_chap;
+    buf->s.frametype = hdr.frametype;
+    buf->s.flags     = hdr.flags;
+    buf->s.complexity = hdr.complexity;
+    buf->s.motion     = hdr.motion;
+    buf->s.scenecut   = hdr.scenecut;
+
+    if ( hdr.deflated )
+    {
+        if ( hdr.raw_size > pv->pack_size )
+        {
+            free( pv->pack );
+            pv->pack_size = hdr.raw_size;
+            pv->pack      = malloc( pv->pack_size );
+        }
+        if ( hdr.size > pv->zbuf_size )
+        {
+            free( pv->zbuf );
+            pv->zbuf_size = hdr.size;
+            pv->zbuf      = malloc( pv->zbuf_size );
+        }
+        uLongf size = hdr.raw_size;
+        if ( pv->pack == NULL || pv->zbuf == NULL ||
+             fread( pv->zbuf, hdr.size, 1, pv->file ) != 1 ||
+             uncompress( pv->pack, &size, pv->zbuf, hdr.size ) != Z_OK )
+        {
+            goto fail;
+        }
+        src = pv->pack;
+    }
+
+    for ( pp = 0; pp < plane_count( buf ); pp++ )
+    {
+        uint8_t * data = buf->plane[pp].data;
+        for ( yy = 0; yy < buf->plane[pp].height; yy++ )
+        {
+            if ( src != NULL )
+            {
+                memcpy( data, src, buf->plane[pp].width );
+                src += buf->plane[pp].width;
+            }
+            else if ( fread( data, buf->plane[pp].width, 1, pv->file ) != 1 )
+            {
+                goto fail;
+            }
+            data += buf->plane[pp].stride;
+        }
+    }
+    pv->frames++;
+    return buf;
+
+fail:
+    hb_error( "spool: read from %s failed", pv->filename );
+    hb_buffer_close( &buf );
+    pv->eof = 1;
+    return NULL;
+}
+
+// Pushes a spooled frame to the encoder, honoring fifo backpressure
+static void spool_push( hb_work_object_t * w, hb_buffer_t * buf )
+{
+    while ( !*w->done )
+    {
+        if ( hb_fifo_full_wait( w->fifo_out ) )
+        {
+            hb_fifo_push( w->fifo_out, buf );
+            return;
+        }
+    }
+    hb_buffer_close( &buf );
+}
+
+static int spoolReadWork( hb_work_object_t * w, hb_buffer_t ** buf_in,
+                          hb_buffer_t ** buf_out )
+{
+    hb_work_private_t * pv = w->private_data;
+    hb_buffer_t       * in = *buf_in;
+
+    if ( in->size <= 0 )
+    {
+        // Drain the spool, then pass the EOF downstream
+        if ( pv->next == NULL )
+            pv->next = spool_read_frame( pv );
+        while ( pv->next != NULL && !*w->done )
+        {
+            spool_push( w, pv->next );
+            pv->next = spool_read_frame( pv );
+        }
+        *buf_in  = NULL;
+        *buf_out = in;
+        return HB_WORK_DONE;
+    }
+
+    // The synced source frame is only used to pace the spool so that
+    // video doesn't run ahead of the audio tracks in the muxer.
+    for ( ;; )
+    {
+        if ( pv->next == NULL )
+            pv->next = spool_read_frame( pv );
+        if ( pv->next == NULL || pv->next->s.start > in->s.start || *w->done )
+            break;
+        spool_push( w, pv->next );
+        pv->next = NULL;
+    }
+    *buf_out = NULL;
+
+    return HB_WORK_OK;
+}
+
+static void spoolReadClose( hb_work_object_t * w )
+{
+    hb_work_private_t * pv = w->private_data;
+
+    if ( pv == NULL )
+        return;
+
+    if ( pv->file != NULL )
+    {
+        hb_log( "spool: %d frames read from spool", pv->frames );
+        fclose( pv->file );
+        unlink( pv->filename );
+    }
+    hb_buffer_close( &pv->next );
+    free( pv->pack );
+    free( pv->zbuf );
+    free( pv );
+    w->private_data = NULL;
+}
@@ -14,6 +14,7 @@
 #include "hb.h"
 #include "hbffmpeg.h"
 #include "lang.h"
+#include "nal_units.h"
 #include "libbluray/bluray.h"
 #include "vadxva2.h"
 
@@ -111,8 +112,58 @@ typedef enum {
 #define MAX_PS_PROBE_SIZE (5*1024*1024)
 #define kMaxNumberPMTStreams 32
 
+typedef struct
+{
+    int64_t pts;    /* PTS of the random access point */
+    int64_t pos;    /* offset of the TS packet or PS pack that holds it */
+    int64_t time;   /* time since start of stream, across discontinuities */
+} hb_index_entry_t;
+
+struct hb_stream_index_s
+{
+    int               count;
+    int               alloc;
+    int64_t           duration;
+    int               ts_flags; /* of the stream, found while building */
+    hb_index_entry_t *entry;
+};
+
 typedef struct {
-    hb_buffer_t *buf;
+    char    *path;
+    int64_t  start;         // offset of the segment in the joined stream
+    int64_t  size;
+} hb_stream_segment_t;
+
+/*
+ * A window over a transport stream that the jobs encoding its programs
+ * read together, so it comes off the disk once.  The oldest chunks are
+ * dropped when every stream reading it is past them.
+ */
+#define SHARE_CHUNK  (1024 * 1024)
+#define SHARE_WINDOW 64             // chunks held at most
+
+struct hb_stream_share_s
+{
+    hb_lock_t   *lock;
+    hb_cond_t   *cond;
+    int          ref;           // tickets and attached streams
+    int          pending;       // tickets not attached or closed yet
+    hb_list_t   *list_stream;   // attached streams
+    off_t        size;          // of the source, -1 until known
+    int64_t      first;         // oldest chunk held
+    int          count;         // chunks held, from first
+    int          reading;       // a stream is reading chunk first + count
+    int          eof;           // chunk first + count is past the end
+    uint8_t     *chunk[SHARE_WINDOW]; // chunk n is in chunk[n % SHARE_WINDOW]
+    int          len[SHARE_WINDOW];
+};
+
+typedef struct {
+    hb_buffer_t *buf;           // PES header, plus the pcr in effect when
+                                // the PES started
+    hb_buffer_t *payload;       // PES payload, handed out as the output
+    int          pes_size;      // bytes of the current PES so far
+    int          payload_hint;  // payload size of the previous PES
     hb_buffer_t *extra_buf;
     int8_t  skipbad;
     int8_t  continuity;
@@ -194,9 +245,21 @@ struct hb_stream_s
 #define         TS_HAS_PCR  (1 << 0)    // at least one PCR seen
 #define         TS_HAS_RAP  (1 << 1)    // Random Access Point bit seen
 #define         TS_HAS_RSEI (1 << 2)    // "Restart point" SEI seen
+    hb_stream_index_t *index;   // keyframe seek index, owned by the title,
+                                // NULL if not enabled
 
     char    *path;
     FILE    *file_handle;
+    hb_stream_segment_t *segment; // consecutive files read as one stream,
+    int     segment_count;        // 0 if there is a single file
+    int     segment_cur;          // segment open in file_handle
+    int     ts_program;           // TS program to demux, 0 for the first
+                                  // one that has video
+    hb_stream_share_t *share;     // window shared with other programs'
+    off_t   share_pos;            // streams, NULL when reading alone
+    int64_t share_chunk;          // chunk of share_data, which we hold
+    const uint8_t *share_data;
+    int     share_len;
     hb_stream_type_t hb_stream_type;
     hb_title_t *title;
 
@@ -250,7 +313,12 @@ typedef struct
  * Local prototypes
  **********************************************************************/
 static void hb_stream_duration(hb_stream_t *stream, hb_title_t *inTitle);
+static void hb_stream_index_init( hb_stream_t *stream );
 static off_t align_to_next_packet(hb_stream_t *stream);
+static size_t stream_read( hb_stream_t *stream, void *buf, size_t size );
+static int stream_seek( hb_stream_t *stream, off_t pos, int whence );
+static off_t stream_tell( hb_stream_t *stream );
+static void share_detach( hb_stream_t *stream );
 static int64_t pes_timestamp( const uint8_t *pes );
 
 static int hb_ts_stream_init(hb_stream_t *stream);
@@ -544,7 +612,7 @@ static int hb_stream_check_for_ps(hb_stream_t *stream)
     uint8_t sc_buf[4];
     int pos = 0;
 
-    fseek(stream->file_handle, 0, SEEK_SET);
+    stream_seek(stream, 0, SEEK_SET);
 
     // program streams should start with a PACK then some other mpeg start
     // code (usually a SYS but that might be missing if we only have a clip).
@@ -552,7 +620,7 @@ static int hb_stream_check_for_ps(hb_stream_t *stream)
     {
         int offset;
 
-        if ( fread(buf, 1, sizeof(buf), stream->file_handle) != sizeof(buf) )
+        if ( stream_read(stream, buf, sizeof(buf)) != sizeof(buf) )
             return 0;
 
         for ( offset = 0; offset < 8*1024-27; ++offset )
@@ -582,23 +650,23 @@ static int hb_stream_check_for_ps(hb_stream_t *stream)
                 data_len = (b[4] << 8) + b[5];
                 if ( data_len && sid > 0xba && sid < 0xf9 )
                 {
-                    prev = ftell( stream->file_handle );
+                    prev = stream_tell( stream );
                     pos = prev - ( sizeof(buf) - offset );
                     pos += pes_offset + 6 + data_len;
-                    fseek( stream->file_handle, pos, SEEK_SET );
-                    if ( fread(sc_buf, 1, 4, stream->file_handle) != 4 )
+                    stream_seek( stream, pos, SEEK_SET );
+                    if ( stream_read(stream, sc_buf, 4) != 4 )
                         return 0;
                     if (sc_buf[0] == 0x00 && sc_buf[1] == 0x00 &&
                         sc_buf[2] == 0x01)
                     {
                         return 1;
                     }
-                    fseek( stream->file_handle, prev, SEEK_SET );
+                    stream_seek( stream, prev, SEEK_SET );
                 }
             }
         }
-        fseek( stream->file_handle, -27, SEEK_CUR );
-        pos = ftell( stream->file_handle );
+        stream_seek( stream, -27, SEEK_CUR );
+        pos = stream_tell( stream );
     }
     return 0;
 }
@@ -607,7 +675,7 @@ static int hb_stream_get_type(hb_stream_t *stream)
 {
     uint8_t buf[2048*4];
 
-    if ( fread(buf, 1, sizeof(buf), stream->file_handle) == sizeof(buf) )
+    if ( stream_read(stream, buf, sizeof(buf)) == sizeof(buf) )
     {
 #ifdef USE_HWD
         if ( hb_gui_use_hwd_flag == 1 )
@@ -660,6 +728,7 @@ static void hb_stream_delete_dynamic( hb_stream_t *d )
             if (d->ts.list[i].buf)
             {
                 hb_buffer_close(&(d->ts.list[i].buf));
+                hb_buffer_close(&(d->ts.list[i].payload));
                 hb_buffer_close(&(d->ts.list[i].extra_buf));
                 d->ts.list[i].buf = NULL;
                 d->ts.list[i].extra_buf = NULL;
@@ -668,9 +737,28 @@ static void hb_stream_delete_dynamic( hb_stream_t *d )
     }
 }
 
+static void stream_segments_close( hb_stream_t *d )
+{
+    int ii;
+
+    for ( ii = 0; ii < d->segment_count; ii++ )
+    {
+        free( d->segment[ii].path );
+    }
+    free( d->segment );
+    d->segment = NULL;
+    d->segment_count = 0;
+    d->segment_cur = 0;
+}
+
 static void hb_stream_delete( hb_stream_t *d )
 {
+    if ( d->share != NULL )
+    {
+        share_detach( d );
+    }
     hb_stream_delete_dynamic( d );
+    stream_segments_close( d );
     free( d->ts.list );
     free( d->pes.list );
     free( d->path );
@@ -813,6 +901,456 @@ static void prune_streams(hb_stream_t *d)
  ***********************************************************************
  *
  **********************************************************************/
+/*
+ * Returns the path of the file that follows 'path' in a set of numbered
+ * segments (rec_001.ts, rec_002.ts, ... or VDR's 00001.ts, 00002.ts, ...),
+ * made by incrementing the last number in the file name, not counting the
+ * extension.  The number keeps its width.  NULL if the name has no number
+ * or it would need to widen.
+ */
+static char * next_segment_path( const char *path )
+{
+    const char *name = strrchr( path, '/' );
+#if defined( SYS_MINGW )
+    const char *bs = strrchr( path, '\\' );
+    if ( bs != NULL && ( name == NULL || bs > name ) )
+        name = bs;
+#endif
+    char *next = strdup( path );
+    char *base = next + ( name != NULL ? name - path + 1 : 0 );
+    char *ext = strrchr( base, '.' );
+    char *p = ( ext != NULL ? ext : next + strlen( next ) ) - 1;
+
+    while ( p >= base && !isdigit( *p ) )
+        p--;
+    while ( p >= base && *p == '9' )
+        *p-- = '0';
+    if ( p < base || !isdigit( *p ) )
+    {
+        free( next );
+        return NULL;
+    }
+    (*p)++;
+    return next;
+}
+
+/*
+ * Makes the stream span the file it was opened with and the numbered
+ * segments that follow it, for captures that were split into several
+ * files.  Must be called before anything is read.
+ */
+static void stream_segments_init( hb_stream_t *stream )
+{
+    hb_stat_t st;
+    char *path = strdup( stream->path );
+    int64_t start = 0;
+    int alloc = 0;
+
+    while ( path != NULL && hb_stat( path, &st ) == 0 && S_ISREG( st.st_mode ) )
+    {
+        if ( stream->segment_count == alloc )
+        {
+            alloc = alloc ? alloc * 2 : 8;
+            stream->segment = realloc( stream->segment,
+                                       alloc * sizeof( hb_stream_segment_t ) );
+        }
+        stream->segment[stream->segment_count].path  = path;
+        stream->segment[stream->segment_count].start = start;
+        stream->segment[stream->segment_count].size  = st.st_size;
+        stream->segment_count++;
+        start += st.st_size;
+        path = next_segment_path( path );
+    }
+    free( path );
+
+    if ( stream->segment_count < 2 )
+    {
+        stream_segments_close( stream );
+        return;
+    }
+    hb_log( "stream: joining %d segments, %"PRId64" bytes, last %s",
+            stream->segment_count, start,
+            stream->segment[stream->segment_count - 1].path );
+}
+
+static int segment_open( hb_stream_t *stream, int idx )
+{
+    FILE *f;
+
+    if ( idx == stream->segment_cur )
+        return 0;
+
+    f = hb_fopen( stream->segment[idx].path, "rb" );
+    if ( f == NULL )
+    {
+        hb_log( "stream: can't open segment %s", stream->segment[idx].path );
+        return -1;
+    }
+    fclose( stream->file_handle );
+    stream->file_handle = f;
+    stream->segment_cur = idx;
+    return 0;
+}
+
+/*
+ * File access of transport and program streams.  Positions are in the
+ * joined segments when the stream has several, see stream_segments_init.
+ * Transport streams that share their reads go through share_read instead,
+ * see stream_read.
+ */
+static size_t file_read( hb_stream_t *stream, void *buf, size_t size )
+{
+    size_t len = fread( buf, 1, size, stream->file_handle );
+
+    while ( len < size && !ferror( stream->file_handle ) &&
+            stream->segment_cur + 1 < stream->segment_count )
+    {
+        if ( segment_open( stream, stream->segment_cur + 1 ) )
+            break;
+        len += fread( (uint8_t*)buf + len, 1, size - len, stream->file_handle );
+    }
+    return len;
+}
+
+static off_t file_tell( hb_stream_t *stream )
+{
+    off_t pos = ftello( stream->file_handle );
+
+    if ( stream->segment_count && pos >= 0 )
+        pos += stream->segment[stream->segment_cur].start;
+    return pos;
+}
+
+static int file_seek( hb_stream_t *stream, off_t pos, int whence )
+{
+    int ii;
+
+    if ( !stream->segment_count )
+        return fseeko( stream->file_handle, pos, whence );
+
+    if ( whence == SEEK_CUR )
+    {
+        pos += file_tell( stream );
+    }
+    else if ( whence == SEEK_END )
+    {
+        ii = stream->segment_count - 1;
+        pos += stream->segment[ii].start + stream->segment[ii].size;
+    }
+    if ( pos < 0 )
+        return -1;
+
+    // the segment that holds pos, or the last one past the end
+    for ( ii = stream->segment_count - 1;
+          ii > 0 && pos < stream->segment[ii].start; ii-- )
+    {
+    }
+    if ( segment_open( stream, ii ) )
+        return -1;
+    return fseeko( stream->file_handle, pos - stream->segment[ii].start,
+                   SEEK_SET );
+}
+
+/*
+ * Drop the chunks that every attached stream is done with.  The one
+ * before a stream's chunk is kept too, align_to_next_packet may back up
+ * into it.  Nothing is dropped while some job hasn't attached yet.
+ * Called with the lock held.
+ */
+static void share_release( hb_stream_share_t *share )
+{
+    hb_stream_t *stream;
+    int64_t keep = INT64_MAX;
+    int ii;
+
+    if ( share->pending > 0 || hb_list_count( share->list_stream ) == 0 )
+        return;
+
+    for ( ii = 0; ii < hb_list_count( share->list_stream ); ii++ )
+    {
+        stream = hb_list_item( share->list_stream, ii );
+        if ( stream->share_chunk - 1 < keep )
+            keep = stream->share_chunk - 1;
+    }
+    if ( share->count > 0 && share->first < keep )
+    {
+        while ( share->count > 0 && share->first < keep )
+        {
+            share->first++;
+            share->count--;
+        }
+        hb_cond_broadcast( share->cond );
+    }
+    if ( share->count == 0 && share->first < keep + 1 )
+    {
+        // every stream seeked past the chunks in between
+        share->first = keep + 1;
+        share->eof = 0;
+    }
+}
+
+static void share_free( hb_stream_share_t *share )
+{
+    int ii;
+
+    for ( ii = 0; ii < SHARE_WINDOW; ii++ )
+    {
+        free( share->chunk[ii] );
+    }
+    hb_list_close( &share->list_stream );
+    hb_cond_close( &share->cond );
+    hb_lock_close( &share->lock );
+    free( share );
+}
+
+/*
+ * Stop reading through the window.  The stream's file position is left
+ * where its last chunk read put it, see share_read.
+ */
+static void share_detach( hb_stream_t *stream )
+{
+    hb_stream_share_t *share = stream->share;
+    int ref;
+
+    hb_lock( share->lock );
+    hb_list_rem( share->list_stream, stream );
+    ref = --share->ref;
+    share_release( share );
+    hb_cond_broadcast( share->cond );
+    hb_unlock( share->lock );
+    if ( ref == 0 )
+    {
+        share_free( share );
+    }
+    stream->share = NULL;
+    stream->share_data = NULL;
+}
+
+/*
+ * Point the stream at chunk 'chunk' of the window, reading it from the
+ * file if it is the next one.  Returns 1 past the end of the source and
+ * -1 if the chunk was dropped already or is too far ahead, the stream
+ * then reads the file by itself.
+ */
+static int share_get( hb_stream_t *stream, int64_t chunk )
+{
+    hb_stream_share_t *share = stream->share;
+    int slot = chunk % SHARE_WINDOW;
+    uint8_t *data;
+    size_t len;
+
+    hb_lock( share->lock );
+    stream->share_data = NULL;
+    stream->share_chunk = chunk;
+    while ( 1 )
+    {
+        if ( chunk < share->first || chunk > share->first + share->count )
+        {
+            hb_unlock( share->lock );
+            hb_log( "stream: %s left the shared window @ %"PRId64,
+                    stream->path, (int64_t)stream->share_pos );
+            share_detach( stream );
+            return -1;
+        }
+        if ( chunk < share->first + share->count )
+        {
+            stream->share_data = share->chunk[slot];
+            stream->share_len = share->len[slot];
+            share_release( share );
+            hb_unlock( share->lock );
+            return 0;
+        }
+        if ( share->eof )
+        {
+            share_release( share );
+            hb_unlock( share->lock );
+            return 1;
+        }
+        share_release( share );
+        if ( share->reading || share->count == SHARE_WINDOW )
+        {
+            // another stream is reading it or the slowest one is
+            // SHARE_WINDOW chunks behind
+            hb_cond_wait( share->cond, share->lock );
+            continue;
+        }
+
+        share->reading = 1;
+        if ( share->chunk[slot] == NULL )
+        {
+            share->chunk[slot] = malloc( SHARE_CHUNK );
+        }
+        data = share->chunk[slot];
+        hb_unlock( share->lock );
+
+        len = 0;
+        if ( data != NULL && !file_seek( stream, chunk * SHARE_CHUNK, SEEK_SET ) )
+        {
+            len = file_read( stream, data, SHARE_CHUNK );
+        }
+
+        hb_lock( share->lock );
+        share->reading = 0;
+        if ( len > 0 )
+        {
+            share->len[slot] = len;
+            share->count++;
+        }
+        if ( len < SHARE_CHUNK )
+        {
+            share->eof = 1;
+        }
+        hb_cond_broadcast( share->cond );
+    }
+}
+
+static size_t share_read( hb_stream_t *stream, uint8_t *buf, size_t size )
+{
+    size_t len = 0, n;
+    int64_t chunk;
+    int off;
+
+    while ( len < size )
+    {
+        chunk = stream->share_pos / SHARE_CHUNK;
+        if ( chunk != stream->share_chunk || stream->share_data == NULL )
+        {
+            int ret = share_get( stream, chunk );
+            if ( ret < 0 )
+            {
+                file_seek( stream, stream->share_pos, SEEK_SET );
+                return len + file_read( stream, buf + len, size - len );
+            }
+            if ( ret > 0 )
+            {
+                break;
+            }
+        }
+        off = stream->share_pos - chunk * SHARE_CHUNK;
+        if ( off >= stream->share_len )
+        {
+            break;
+        }
+        n = MIN( size - len, (size_t)( stream->share_len - off ) );
+        memcpy( buf + len, stream->share_data + off, n );
+        len += n;
+        stream->share_pos += n;
+    }
+    return len;
+}
+
+static size_t stream_read( hb_stream_t *stream, void *buf, size_t size )
+{
+    if ( stream->share != NULL )
+        return share_read( stream, buf, size );
+    return file_read( stream, buf, size );
+}
+
+static off_t stream_tell( hb_stream_t *stream )
+{
+    if ( stream->share != NULL )
+        return stream->share_pos;
+    return file_tell( stream );
+}
+
+static int stream_seek( hb_stream_t *stream, off_t pos, int whence )
+{
+    if ( stream->share == NULL )
+        return file_seek( stream, pos, whence );
+
+    // checked by the next read, see share_get
+    if ( whence == SEEK_CUR )
+        pos += stream->share_pos;
+    else if ( whence == SEEK_END )
+        pos += stream->share->size;
+    if ( pos < 0 )
+        return -1;
+    stream->share_pos = pos;
+    return 0;
+}
+
+/*
+ * A window for 'jobs' jobs that read the same transport stream.  Each of
+ * them gets a ticket to the window (hb_job_t.stream_share) that is either
+ * attached to its stream or closed.
+ */
+hb_stream_share_t * hb_stream_share_init( int jobs )
+{
+    hb_stream_share_t *share = calloc( sizeof( hb_stream_share_t ), 1 );
+
+    if ( share == NULL )
+        return NULL;
+    share->lock = hb_lock_init();
+    share->cond = hb_cond_init();
+    share->list_stream = hb_list_init();
+    share->ref = jobs;
+    share->pending = jobs;
+    share->size = -1;
+    return share;
+}
+
+/*
+ * Read the stream through the window of the ticket, which is used up.
+ * Only transport streams share their reads, others just give up the
+ * ticket.
+ */
+void hb_stream_share_attach( hb_stream_t *stream, hb_stream_share_t **_share )
+{
+    hb_stream_share_t *share = *_share;
+    off_t pos;
+
+    if ( share == NULL )
+        return;
+    if ( stream->hb_stream_type != transport )
+    {
+        hb_stream_share_close( _share );
+        return;
+    }
+    *_share = NULL;
+
+    pos = file_tell( stream );
+    hb_lock( share->lock );
+    if ( share->size < 0 )
+    {
+        file_seek( stream, 0, SEEK_END );
+        share->size = file_tell( stream );
+        file_seek( stream, pos, SEEK_SET );
+    }
+    stream->share = share;
+    stream->share_pos = pos;
+    stream->share_chunk = pos / SHARE_CHUNK;
+    stream->share_data = NULL;
+    hb_list_add( share->list_stream, stream );
+    share->pending--;
+    share_release( share );
+    hb_unlock( share->lock );
+}
+
+/*
+ * Give up a ticket that wasn't attached, when the job failed before
+ * opening its stream.
+ */
+void hb_stream_share_close( hb_stream_share_t **_share )
+{
+    hb_stream_share_t *share = *_share;
+    int ref;
+
+    if ( share == NULL )
+        return;
+    *_share = NULL;
+
+    hb_lock( share->lock );
+    share->pending--;
+    ref = --share->ref;
+    share_release( share );
+    hb_cond_broadcast( share->cond );
+    hb_unlock( share->lock );
+    if ( ref == 0 )
+    {
+        share_free( share );
+    }
+}
+
 hb_stream_t * hb_stream_open( char *path, hb_title_t *title, int scan )
 {
     FILE *f = hb_fopen(path, "rb");
@@ -845,12 +1383,34 @@ hb_stream_t * hb_stream_open( char *path, hb_title_t *title, int scan )
     d->path = strdup( path );
     if (d->path != NULL )
     {
+        if ( title )
+        {
+            d->ts_program = title->ts_program;
+            if ( title->flags & HBTF_JOIN_SEGMENTS )
+            {
+                stream_segments_init( d );
+            }
+        }
         if ( hb_stream_get_type( d ) != 0 )
         {
+            if ( d->hb_stream_type != transport && d->segment_count )
+            {
+                // only transport streams are read through stream_read
+                hb_log( "hb_stream_open: not a transport stream, "
+                        "not joining segments" );
+                stream_seek( d, 0, SEEK_SET );
+                stream_segments_close( d );
+            }
             if( !scan )
             {
                 prune_streams( d );
             }
+            if ( title && title->seek_index )
+            {
+                // built when the title was scanned
+                d->index = title->seek_index;
+                d->ts_flags |= d->index->ts_flags;
+            }
             // reset to beginning of file and reset some stream 
             // state information
             hb_stream_seek( d, 0. );
@@ -858,7 +1418,8 @@ hb_stream_t * hb_stream_open( char *path, hb_title_t *title, int scan )
         }
         fclose( d->file_handle );
         d->file_handle = NULL;
-        if ( ffmpeg_open( d, title, scan ) )
+        // a program of a transport stream that has no video
+        if ( !d->ts_program && ffmpeg_open( d, title, scan ) )
         {
             return d;
         }
@@ -871,6 +1432,7 @@ hb_stream_t * hb_stream_open( char *path, hb_title_t *title, int scan )
     {
         free( d->path );
     }
+    stream_segments_close( d );
     hb_log( "hb_stream_open: open %s failed", path );
     free( d );
     return NULL;
@@ -1083,6 +1645,10 @@ hb_title_t * hb_stream_title_scan(hb_stream_t *stream, hb_title_t * title)
         title->demuxer = HB_PS_DEMUXER;
     }
 
+    // The duration comes from the seek index when there is one
+    hb_stream_index_init( stream );
+    hb_stream_seek( stream, 0. );
+
     // IDRs will be search for in hb_stream_duration
     stream->has_IDRs = 0;
     hb_stream_duration(stream, title);
@@ -1140,7 +1706,7 @@ static const uint8_t *next_packet( hb_stream_t *stream )
 
     while ( 1 )
     {
-        if ( fread(stream->ts.packet, 1, stream->packetsize, stream->file_handle) !=
+        if ( stream_read(stream, stream->ts.packet, stream->packetsize) !=
              stream->packetsize )
         {
             return NULL;
@@ -1150,7 +1716,7 @@ static const uint8_t *next_packet( hb_stream_t *stream )
             return buf;
         }
         // lost sync - back up to where we started then try to re-establish.
-        off_t pos = ftello(stream->file_handle) - stream->packetsize;
+        off_t pos = stream_tell(stream) - stream->packetsize;
         off_t pos2 = align_to_next_packet(stream);
         if ( pos2 == 0 )
         {
@@ -1192,34 +1758,30 @@ static void skip_to_next_pack( hb_stream_t *src_stream )
 static void CreateDecodedNAL( uint8_t **dst, int *dst_len,
                               const uint8_t *src, int src_len )
 {
-    const uint8_t *end = &src[src_len];
     uint8_t *d = malloc( src_len );
 
     *dst = d;
+    *dst_len = d ? hb_nal_unit_unescape( d, src, src_len ) : 0;
+}
 
-    if( d )
+/*
+ * Returns a pointer to the byte that follows the next start code prefix
+ * found at or after p, or NULL if there is none.  The buffer is read as if
+ * it were preceded by two zero bytes, so a start code that was split from
+ * the previous packet is still found.
+ */
+static const uint8_t * next_start_code( const uint8_t *buf, const uint8_t *p,
+                                        const uint8_t *end )
+{
+    if ( p == buf )
     {
-        while( src < end )
-        {
-            if( src < end - 3 && src[0] == 0x00 && src[1] == 0x00 &&
-                src[2] == 0x01 )
-            {
-                // Next start code found
-                break;
-            }
-            if( src < end - 3 && src[0] == 0x00 && src[1] == 0x00 &&
-                src[2] == 0x03 )
-            {
-                *d++ = 0x00;
-                *d++ = 0x00;
-
-                src += 3;
-                continue;
-            }
-            *d++ = *src++;
-        }
+        if ( end - p > 1 && p[0] == 0x01 )
+            return p + 1;
+        if ( end - p > 2 && p[0] == 0x00 && p[1] == 0x01 )
+            return p + 2;
     }
-    *dst_len = d - *dst;
+    p = hb_annexb_find_startcode( p, end );
+    return end - p > 3 ? p + 3 : NULL;
 }
 
 static int isRecoveryPoint( const uint8_t *buf, int len )
@@ -1265,8 +1827,8 @@ static int isIframe( hb_stream_t *stream, const uint8_t *buf, int len )
     // For mpeg2: look for a gop start or i-frame picture start
     // for h.264: look for idr nal type or a slice header for an i-frame
     // for vc1:   look for a Sequence header
-    int ii;
-    uint32_t strid = 0;
+    const uint8_t *end = buf + len;
+    const uint8_t *sc = buf;
 
 
     int vid = pes_index_of_video( stream );
@@ -1276,32 +1838,28 @@ static int isIframe( hb_stream_t *stream, const uint8_t *buf, int len )
          pes->codec_param == AV_CODEC_ID_MPEG2VIDEO )
     {
         // This section of the code handles MPEG-1 and MPEG-2 video streams
-        for (ii = 0; ii < len; ii++)
+        while ( ( sc = next_start_code( buf, sc, end ) ) != NULL )
         {
-            strid = (strid << 8) | buf[ii];
-            if ( ( strid >> 8 ) == 1 )
+            // we found a start code
+            uint8_t id = sc[0];
+            switch ( id )
             {
-                // we found a start code
-                uint8_t id = strid;
-                switch ( id )
-                {
-                    case 0xB8: // group_start_code (GOP header)
-                    case 0xB3: // sequence_header code
-                        return 1;
+                case 0xB8: // group_start_code (GOP header)
+                case 0xB3: // sequence_header code
+                    return 1;
 
-                    case 0x00: // picture_start_code
-                        // picture_header, let's see if it's an I-frame
-                        if (ii < len - 3)
+                case 0x00: // picture_start_code
+                    // picture_header, let's see if it's an I-frame
+                    if (end - sc > 3)
+                    {
+                        // check if picture_coding_type == 1
+                        if ((sc[2] & (0x7 << 3)) == (1 << 3))
                         {
-                            // check if picture_coding_type == 1
-                            if ((buf[ii+2] & (0x7 << 3)) == (1 << 3))
-                            {
-                                // found an I-frame picture
-                                return 1;
-                            }
+                            // found an I-frame picture
+                            return 1;
                         }
-                        break;
-                }
+                    }
+                    break;
             }
         }
         // didn't find an I-frame
@@ -1310,31 +1868,27 @@ static int isIframe( hb_stream_t *stream, const uint8_t *buf, int len )
     if ( pes->stream_type == 0x1b || pes->codec_param == AV_CODEC_ID_H264 )
     {
         // we have an h.264 stream
-        for (ii = 0; ii < len; ii++)
+        while ( ( sc = next_start_code( buf, sc, end ) ) != NULL )
         {
-            strid = (strid << 8) | buf[ii];
-            if ( ( strid >> 8 ) == 1 )
+            // we found a start code - remove the ref_idc from the nal type
+            uint8_t nal_type = sc[0] & 0x1f;
+            if ( nal_type == 0x01 )
             {
-                // we found a start code - remove the ref_idc from the nal type
-                uint8_t nal_type = strid & 0x1f;
-                if ( nal_type == 0x01 )
-                {
-                    // Found slice and no recovery point
-                    return 0;
-                }
-                if ( nal_type == 0x05 )
-                {
-                    // h.264 IDR picture start
-                    return 1;
-                }
-                else if ( nal_type == 0x06 )
+                // Found slice and no recovery point
+                return 0;
+            }
+            if ( nal_type == 0x05 )
+            {
+                // h.264 IDR picture start
+                return 1;
+            }
+            else if ( nal_type == 0x06 )
+            {
+                int off = sc + 1 - buf;
+                int recovery_frames = isRecoveryPoint( buf+off, len-off );
+                if ( recovery_frames )
                 {
-                    int off = ii + 1;
-                    int recovery_frames = isRecoveryPoint( buf+off, len-off );
-                    if ( recovery_frames )
-                    {
-                        return recovery_frames;
-                    }
+                    return recovery_frames;
                 }
             }
         }
@@ -1344,10 +1898,9 @@ static int isIframe( hb_stream_t *stream, const uint8_t *buf, int len )
     if ( pes->stream_type == 0xea || pes->codec_param == AV_CODEC_ID_VC1 )
     {
         // we have an vc1 stream
-        for (ii = 0; ii < len; ii++)
+        while ( ( sc = next_start_code( buf, sc, end ) ) != NULL )
         {
-            strid = (strid << 8) | buf[ii];
-            if ( strid == 0x10f )
+            if ( sc[0] == 0x0f )
             {
                 // the ffmpeg vc1 decoder requires a seq hdr code in the first
                 // frame.
@@ -1374,116 +1927,456 @@ static int ts_isIframe( hb_stream_t *stream, const uint8_t *buf, int adapt_len )
  */
 static const uint8_t *hb_ts_stream_getPEStype(hb_stream_t *stream, uint32_t pid, int *out_adapt_len)
 {
-    int npack = 300000; // max packets to read
+    int npack = 300000; // max packets to read
+
+    while (--npack >= 0)
+    {
+        const uint8_t *buf = next_packet( stream );
+        if ( buf == NULL )
+        {
+            hb_log("hb_ts_stream_getPEStype: EOF while searching for PID 0x%x", pid);
+            return 0;
+        }
+
+        // while we're reading the stream, check if it has valid PCRs
+        // and/or random access points.
+        uint32_t pack_pid = ( (buf[1] & 0x1f) << 8 ) | buf[2];
+        if ( pack_pid == stream->pmt_info.PCR_PID )
+        {
+            if ( ( buf[5] & 0x10 ) &&
+                 ( ( ( buf[3] & 0x30 ) == 0x20 ) ||
+                   ( ( buf[3] & 0x30 ) == 0x30 && buf[4] > 6 ) ) )
+            {
+                stream->ts_flags |= TS_HAS_PCR;
+            }
+        }
+        if ( buf[5] & 0x40 )
+        {
+            stream->ts_flags |= TS_HAS_RAP;
+        }
+
+        /*
+         * The PES header is only in TS packets with 'start' set so we check
+         * that first then check for the right PID.
+         */
+        if ((buf[1] & 0x40) == 0 || pack_pid != pid )
+        {
+            // not a start packet or not the pid we want
+            continue;
+        }
+
+        int adapt_len = 0;
+        /* skip over the TS hdr to return a pointer to the PES hdr */
+        switch (buf[3] & 0x30)
+        {
+            case 0x00: // illegal
+            case 0x20: // fill packet
+                continue;
+
+            case 0x30: // adaptation
+                adapt_len = buf[4] + 1;
+                if (adapt_len > 184)
+                {
+                    hb_log("hb_ts_stream_getPEStype: invalid adaptation field length %d for PID 0x%x", buf[4], pid);
+                    continue;
+                }
+                break;
+        }
+        /* PES hdr has to begin with an mpeg start code */
+        if (buf[adapt_len+4] == 0x00 && buf[adapt_len+5] == 0x00 && buf[adapt_len+6] == 0x01)
+        {
+            *out_adapt_len = adapt_len;
+            return buf;
+        }
+    }
+
+    /* didn't find it */
+    return 0;
+}
+
+static hb_buffer_t * hb_ps_stream_getVideo(
+    hb_stream_t *stream,
+    hb_pes_info_t *pi)
+{
+    hb_buffer_t *buf  = hb_buffer_init(HB_DVD_READ_BUFFER_SIZE);
+    hb_pes_info_t pes_info;
+    // how many blocks we read while searching for a video PES header
+    int blksleft = 2048;
+
+    while (--blksleft >= 0)
+    {
+        buf->size = 0;
+        int len = hb_ps_read_packet( stream, buf );
+        if ( len == 0 )
+        {
+            // EOF
+            break;
+        }
+        if ( !hb_parse_ps( stream, buf->data, buf->size, &pes_info ) )
+            continue;
+
+        int idx;
+        if ( pes_info.stream_id == 0xbd )
+        {
+            idx = index_of_ps_stream( stream, pes_info.stream_id,
+                                      pes_info.bd_substream_id );
+        }
+        else
+        {
+            idx = index_of_ps_stream( stream, pes_info.stream_id,
+                                      pes_info.stream_id_ext );
+        }
+        if ( stream->pes.list[idx].stream_kind == V )
+        {
+            if ( pes_info.pts != AV_NOPTS_VALUE )
+            {
+                *pi = pes_info;
+                return buf;
+            }
+        }
+    }
+    hb_buffer_close( &buf );
+    return NULL;
+}
+
+/***********************************************************************
+ * Seek index
+ ***********************************************************************
+ *
+ * Optional table of the file offset and PTS of every video random
+ * access point of a transport or program stream.  It is built by reading
+ * the whole file once when the title is scanned and kept on the title,
+ * which the streams of its previews and encodes share.  It is also saved
+ * in a sidecar next to the source (<path>.hbidx) so that later scans can
+ * load it.  With an index, seeks land
+ * exactly on a keyframe and the title duration is measured rather than
+ * estimated from a handful of samples.
+ *
+ **********************************************************************/
+#define INDEX_MAGIC    0x48424958  // "HBIX"
+#define INDEX_VERSION  1
+#define INDEX_GAP      (90000LL * 10) // bigger PTS jumps are discontinuities
+
+typedef struct
+{
+    int32_t magic;
+    int32_t version;
+    int64_t file_size;
+    int64_t file_mtime;
+    int64_t duration;
+    int32_t count;
+    int32_t packetsize;
+    int32_t ts_flags;
+    int32_t reserved;
+} hb_index_header_t;
+
+void hb_stream_index_close( hb_stream_index_t **_index )
+{
+    hb_stream_index_t *index = *_index;
+
+    if ( index != NULL )
+    {
+        free( index->entry );
+        free( index );
+    }
+    *_index = NULL;
+}
+
+/*
+ * Tracks the stream time of the video PES packets in file order.  PTS
+ * discontinuities (splices, wrap) start a new segment that continues
+ * where the previous one ended.
+ */
+typedef struct
+{
+    int64_t last_pts;
+    int64_t seg_start;
+    int64_t seg_offset;
+    int64_t time_max;
+} index_clock_t;
+
+static int64_t index_clock( index_clock_t *clk, int64_t pts )
+{
+    int64_t time;
+
+    if ( clk->last_pts == AV_NOPTS_VALUE ||
+         pts - clk->last_pts > INDEX_GAP || clk->last_pts - pts > INDEX_GAP )
+    {
+        clk->seg_start  = pts;
+        clk->seg_offset = clk->time_max;
+    }
+    clk->last_pts = pts;
+    time = pts - clk->seg_start + clk->seg_offset;
+    if ( time > clk->time_max )
+    {
+        clk->time_max = time;
+    }
+    return time;
+}
+
+static void index_add( hb_stream_index_t *index, int64_t pts, int64_t pos,
+                       int64_t time )
+{
+    // keep the table sorted by time, B-frame reordering can't
+    // move a keyframe before the previous one
+    if ( index->count > 0 && time < index->entry[index->count - 1].time )
+        return;
+
+    if ( index->count == index->alloc )
+    {
+        index->alloc = index->alloc ? index->alloc * 2 : 1024;
+        index->entry = realloc( index->entry,
+                                index->alloc * sizeof( hb_index_entry_t ) );
+    }
+    index->entry[index->count].pts  = pts;
+    index->entry[index->count].pos  = pos;
+    index->entry[index->count].time = time;
+    index->count++;
+}
+
+static hb_stream_index_t * index_build( hb_stream_t *stream )
+{
+    hb_stream_index_t *index = calloc( 1, sizeof( hb_stream_index_t ) );
+    index_clock_t clk = { AV_NOPTS_VALUE, 0, 0, 0 };
+
+    stream_seek( stream, 0, SEEK_SET );
+    if ( stream->hb_stream_type == transport )
+    {
+        const uint8_t *buf;
+        int adapt_len;
+        int pid = stream->ts.list[ts_index_of_video(stream)].pid;
+
+        align_to_next_packet( stream );
+        while ( ( buf = hb_ts_stream_getPEStype( stream, pid, &adapt_len ) ) )
+        {
+            const uint8_t *pes = buf + 4 + adapt_len;
+            int64_t pts, time;
+
+            if ( adapt_len + 4 + 14 > 188 || ( pes[7] >> 7 ) != 1 )
+                continue;
+
+            pts = pes_timestamp( pes + 9 );
+            time = index_clock( &clk, pts );
+            if ( ts_isIframe( stream, buf, adapt_len ) )
+            {
+                index_add( index, pts, stream_tell( stream ) -
+                                       stream->packetsize, time );
+            }
+        }
+    }
+    else
+    {
+        hb_buffer_t *buf = hb_buffer_init( HB_DVD_READ_BUFFER_SIZE );
+        hb_pes_info_t pes_info;
+        int64_t pack_pos = 0;
+
+        skip_to_next_pack( stream );
+        while ( 1 )
+        {
+            int64_t pos = stream_tell( stream );
+            int idx;
+
+            buf->size = 0;
+            if ( hb_ps_read_packet( stream, buf ) == 0 )
+                break;
+            if ( buf->size >= 4 && buf->data[3] == 0xba )
+            {
+                pack_pos = pos;
+                continue;
+            }
+            if ( !hb_parse_ps( stream, buf->data, buf->size, &pes_info ) )
+                continue;
+            if ( pes_info.stream_id == 0xbd )
+            {
+                idx = index_of_ps_stream( stream, pes_info.stream_id,
+                                          pes_info.bd_substream_id );
+            }
+            else
+            {
+                idx = index_of_ps_stream( stream, pes_info.stream_id,
+                                          pes_info.stream_id_ext );
+            }
+            if ( idx < 0 || stream->pes.list[idx].stream_kind != V ||
+                 pes_info.pts == AV_NOPTS_VALUE )
+                continue;
+
+            int64_t time = index_clock( &clk, pes_info.pts );
+            if ( isIframe( stream, buf->data, buf->size ) )
+            {
+                index_add( index, pes_info.pts, pack_pos, time );
+            }
+        }
+        hb_buffer_close( &buf );
+    }
+    index->duration = clk.time_max;
+    index->ts_flags = stream->ts_flags;
+
+    return index;
+}
+
+static char * index_path( hb_stream_t *stream )
+{
+    char *path = malloc( strlen( stream->path ) + 32 );
+
+    // joined segments and each program of a stream get their own index
+    sprintf( path, "%s%s", stream->path,
+             stream->segment_count ? ".joined" : "" );
+    if ( stream->ts_program )
+        sprintf( path + strlen( path ), ".p%d", stream->ts_program );
+    strcat( path, ".hbidx" );
+    return path;
+}
+
+static hb_stream_index_t * index_load( hb_stream_t *stream, hb_stat_t *st )
+{
+    hb_stream_index_t *index = NULL;
+    hb_index_header_t hdr;
+    char *path = index_path( stream );
+    FILE *file = hb_fopen( path, "rb" );
 
-    while (--npack >= 0)
-    {
-        const uint8_t *buf = next_packet( stream );
-        if ( buf == NULL )
-        {
-            hb_log("hb_ts_stream_getPEStype: EOF while searching for PID 0x%x", pid);
-            return 0;
-        }
+    free( path );
+    if ( file == NULL )
+        return NULL;
 
-        // while we're reading the stream, check if it has valid PCRs
-        // and/or random access points.
-        uint32_t pack_pid = ( (buf[1] & 0x1f) << 8 ) | buf[2];
-        if ( pack_pid == stream->pmt_info.PCR_PID )
+    if ( fread( &hdr, sizeof( hdr ), 1, file ) == 1 &&
+         hdr.magic      == INDEX_MAGIC &&
+         hdr.version    == INDEX_VERSION &&
+         hdr.file_size  == (int64_t)st->st_size &&
+         hdr.file_mtime == (int64_t)st->st_mtime &&
+         hdr.packetsize == stream->packetsize &&
+         hdr.count      >= 0 )
+    {
+        index = calloc( 1, sizeof( hb_stream_index_t ) );
+        index->count = index->alloc = hdr.count;
+        index->duration = hdr.duration;
+        index->ts_flags = hdr.ts_flags;
+        index->entry = malloc( ( hdr.count + 1 ) * sizeof( hb_index_entry_t ) );
+        if ( fread( index->entry, sizeof( hb_index_entry_t ), hdr.count,
+                    file ) != (size_t)hdr.count )
         {
-            if ( ( buf[5] & 0x10 ) &&
-                 ( ( ( buf[3] & 0x30 ) == 0x20 ) ||
-                   ( ( buf[3] & 0x30 ) == 0x30 && buf[4] > 6 ) ) )
-            {
-                stream->ts_flags |= TS_HAS_PCR;
-            }
+            hb_stream_index_close( &index );
         }
-        if ( buf[5] & 0x40 )
+        else
         {
-            stream->ts_flags |= TS_HAS_RAP;
+            // characteristics found while the index was built
+            stream->ts_flags |= index->ts_flags;
         }
+    }
+    fclose( file );
 
-        /*
-         * The PES header is only in TS packets with 'start' set so we check
-         * that first then check for the right PID.
-         */
-        if ((buf[1] & 0x40) == 0 || pack_pid != pid )
-        {
-            // not a start packet or not the pid we want
-            continue;
-        }
+    return index;
+}
 
-        int adapt_len = 0;
-        /* skip over the TS hdr to return a pointer to the PES hdr */
-        switch (buf[3] & 0x30)
-        {
-            case 0x00: // illegal
-            case 0x20: // fill packet
-                continue;
+static void index_save( hb_stream_t *stream, hb_stream_index_t *index,
+                        hb_stat_t *st )
+{
+    hb_index_header_t hdr;
+    char *path = index_path( stream );
+    FILE *file = hb_fopen( path, "wb" );
+    int ok;
 
-            case 0x30: // adaptation
-                adapt_len = buf[4] + 1;
-                if (adapt_len > 184)
-                {
-                    hb_log("hb_ts_stream_getPEStype: invalid adaptation field length %d for PID 0x%x", buf[4], pid);
-                    continue;
-                }
-                break;
-        }
-        /* PES hdr has to begin with an mpeg start code */
-        if (buf[adapt_len+4] == 0x00 && buf[adapt_len+5] == 0x00 && buf[adapt_len+6] == 0x01)
-        {
-            *out_adapt_len = adapt_len;
-            return buf;
-        }
+    if ( file == NULL )
+    {
+        // read-only source, the index only lives as long as the stream
+        hb_deep_log( 2, "stream: can't write seek index %s", path );
+        free( path );
+        return;
     }
 
-    /* didn't find it */
-    return 0;
+    memset( &hdr, 0, sizeof( hdr ) );
+    hdr.magic      = INDEX_MAGIC;
+    hdr.version    = INDEX_VERSION;
+    hdr.file_size  = st->st_size;
+    hdr.file_mtime = st->st_mtime;
+    hdr.duration   = index->duration;
+    hdr.count      = index->count;
+    hdr.packetsize = stream->packetsize;
+    hdr.ts_flags   = stream->ts_flags;
+
+    ok = fwrite( &hdr, sizeof( hdr ), 1, file ) == 1 &&
+         fwrite( index->entry, sizeof( hb_index_entry_t ), index->count,
+                 file ) == (size_t)index->count;
+    if ( fclose( file ) != 0 || !ok )
+    {
+        hb_log( "stream: failed to write seek index %s", path );
+        remove( path );
+    }
+    free( path );
 }
 
-static hb_buffer_t * hb_ps_stream_getVideo(
-    hb_stream_t *stream,
-    hb_pes_info_t *pi)
+/*
+ * Loads the seek index of the stream from its sidecar or builds it, and
+ * keeps it on the title, whose later streams reuse it.
+ * Leaves the file position undefined, callers must seek afterwards.
+ */
+static void hb_stream_index_init( hb_stream_t *stream )
 {
-    hb_buffer_t *buf  = hb_buffer_init(HB_DVD_READ_BUFFER_SIZE);
-    hb_pes_info_t pes_info;
-    // how many blocks we read while searching for a video PES header
-    int blksleft = 2048;
+    hb_title_t *title = stream->title;
+    hb_stat_t st;
+
+    if ( title == NULL || !( title->flags & HBTF_SEEK_INDEX ) ||
+         stream->index != NULL ||
+         ( stream->hb_stream_type != transport &&
+           stream->hb_stream_type != program ) ||
+         pes_index_of_video( stream ) < 0 ||
+         ( stream->hb_stream_type == transport &&
+           ts_index_of_video( stream ) < 0 ) ||
+         hb_stat( stream->path, &st ) )
+    {
+        return;
+    }
+    if ( stream->segment_count )
+    {
+        // the index is only valid for the same set of segments
+        hb_stream_segment_t *last = &stream->segment[stream->segment_count - 1];
+        st.st_size = last->start + last->size;
+    }
 
-    while (--blksleft >= 0)
+    stream->index = index_load( stream, &st );
+    if ( stream->index != NULL )
     {
-        buf->size = 0;
-        int len = hb_ps_read_packet( stream, buf );
-        if ( len == 0 )
-        {
-            // EOF
-            break;
-        }
-        if ( !hb_parse_ps( stream, buf->data, buf->size, &pes_info ) )
-            continue;
+        hb_log( "stream: loaded seek index, %d keyframes", stream->index->count );
+        title->seek_index = stream->index;
+        return;
+    }
 
-        int idx;
-        if ( pes_info.stream_id == 0xbd )
-        {
-            idx = index_of_ps_stream( stream, pes_info.stream_id,
-                                      pes_info.bd_substream_id );
-        }
+    uint64_t start = hb_get_date();
+    stream->index = index_build( stream );
+    hb_log( "stream: built seek index, %d keyframes in %.1f s",
+            stream->index->count, ( hb_get_date() - start ) / 1000. );
+    index_save( stream, stream->index, &st );
+    title->seek_index = stream->index;
+}
+
+/* Seeks to the last keyframe at or before 'time' (since start of stream) */
+static int index_seek( hb_stream_t *stream, int64_t time )
+{
+    hb_stream_index_t *index = stream->index;
+    int lo = 0, hi = index->count - 1;
+
+    while ( lo < hi )
+    {
+        int mid = ( lo + hi + 1 ) / 2;
+        if ( index->entry[mid].time <= time )
+            lo = mid;
         else
-        {
-            idx = index_of_ps_stream( stream, pes_info.stream_id,
-                                      pes_info.stream_id_ext );
-        }
-        if ( stream->pes.list[idx].stream_kind == V )
-        {
-            if ( pes_info.pts != AV_NOPTS_VALUE )
-            {
-                *pi = pes_info;
-                return buf;
-            }
-        }
+            hi = mid - 1;
     }
-    hb_buffer_close( &buf );
-    return NULL;
+    if ( stream_seek( stream, index->entry[lo].pos, SEEK_SET ) )
+    {
+        return 0;
+    }
+    if ( stream->hb_stream_type == transport )
+    {
+        // the index points at a packet boundary, no need to resync
+        hb_ts_stream_reset( stream );
+    }
+    else
+    {
+        hb_ps_stream_reset( stream );
+        skip_to_next_pack( stream );
+    }
+    return 1;
 }
 
 /***********************************************************************
@@ -1529,7 +2422,7 @@ static struct pts_pos hb_sample_pts(hb_stream_t *stream, uint64_t fpos)
     {
         const uint8_t *buf;
         int adapt_len;
-        fseeko( stream->file_handle, fpos, SEEK_SET );
+        stream_seek( stream, fpos, SEEK_SET );
         align_to_next_packet( stream );
         int pid = stream->ts.list[ts_index_of_video(stream)].pid;
         buf = hb_ts_stream_getPEStype( stream, pid, &adapt_len );
@@ -1557,7 +2450,7 @@ static struct pts_pos hb_sample_pts(hb_stream_t *stream, uint64_t fpos)
                 ++stream->has_IDRs;
             }
         }
-        pp.pos = ftello(stream->file_handle);
+        pp.pos = stream_tell(stream);
         if ( !stream->has_IDRs )
         {
             // Scan a little more to see if we will stumble upon one
@@ -1582,7 +2475,7 @@ static struct pts_pos hb_sample_pts(hb_stream_t *stream, uint64_t fpos)
 
         // round address down to nearest dvd sector start
         fpos &=~ ( HB_DVD_READ_BUFFER_SIZE - 1 );
-        fseeko( stream->file_handle, fpos, SEEK_SET );
+        stream_seek( stream, fpos, SEEK_SET );
         if ( stream->hb_stream_type == program )
         {
             skip_to_next_pack( stream );
@@ -1627,7 +2520,7 @@ static struct pts_pos hb_sample_pts(hb_stream_t *stream, uint64_t fpos)
         }
 
         pp.pts = pes_info.pts;
-        pp.pos = ftello(stream->file_handle);
+        pp.pos = stream_tell(stream);
     }
     return pp;
 }
@@ -1687,8 +2580,22 @@ static void hb_stream_duration(hb_stream_t *stream, hb_title_t *inTitle)
     struct pts_pos *pp = ptspos;
     int i;
 
-    fseeko(stream->file_handle, 0, SEEK_END);
-    uint64_t fsize = ftello(stream->file_handle);
+    if ( stream->index != NULL )
+    {
+        // The index has seen every video frame, no need to estimate
+        uint64_t dur = stream->index->duration;
+        stream->has_IDRs = MIN( stream->index->count, 255 );
+        inTitle->duration = dur;
+        dur /= 90000;
+        inTitle->hours    = dur / 3600;
+        inTitle->minutes  = ( dur % 3600 ) / 60;
+        inTitle->seconds  = dur % 60;
+        stream_seek(stream, 0, SEEK_SET);
+        return;
+    }
+
+    stream_seek(stream, 0, SEEK_END);
+    uint64_t fsize = stream_tell(stream);
     uint64_t fincr = fsize / NDURSAMPLES;
     uint64_t fpos = fincr / 2;
     for ( i = NDURSAMPLES; --i >= 0; fpos += fincr )
@@ -1702,7 +2609,7 @@ static void hb_stream_duration(hb_stream_t *stream, hb_title_t *inTitle)
     inTitle->minutes  = ( dur % 3600 ) / 60;
     inTitle->seconds  = dur % 60;
 
-    rewind(stream->file_handle);
+    stream_seek(stream, 0, SEEK_SET);
 }
 
 /***********************************************************************
@@ -1795,18 +2702,22 @@ int hb_stream_seek( hb_stream_t * stream, float f )
     {
         return ffmpeg_seek( stream, f );
     }
+    if ( f > 0 && stream->index != NULL && stream->index->count > 0 )
+    {
+        return index_seek( stream, f * stream->index->duration );
+    }
     off_t stream_size, cur_pos, new_pos;
     double pos_ratio = f;
-    cur_pos = ftello( stream->file_handle );
-    fseeko( stream->file_handle, 0, SEEK_END );
-    stream_size = ftello( stream->file_handle );
+    cur_pos = stream_tell( stream );
+    stream_seek( stream, 0, SEEK_END );
+    stream_size = stream_tell( stream );
     new_pos = (off_t) ((double) (stream_size) * pos_ratio);
     new_pos &=~ (HB_DVD_READ_BUFFER_SIZE - 1);
 
-    int r = fseeko( stream->file_handle, new_pos, SEEK_SET );
+    int r = stream_seek( stream, new_pos, SEEK_SET );
     if (r == -1)
     {
-        fseeko( stream->file_handle, cur_pos, SEEK_SET );
+        stream_seek( stream, cur_pos, SEEK_SET );
         return 0;
     }
 
@@ -1842,6 +2753,14 @@ int hb_stream_seek_ts( hb_stream_t * stream, int64_t ts )
     {
         return ffmpeg_seek_ts( stream, ts );
     }
+    if ( stream->index != NULL && stream->index->count > 0 )
+    {
+        // 'ts' is an absolute timestamp of the source (the reader adds
+        // the first one it reads), not relative to the start
+        int64_t time = ts - stream->index->entry[0].pts +
+                       stream->index->entry[0].time;
+        return index_seek( stream, MAX( time, 0 ) ) ? 0 : -1;
+    }
     return -1;
 }
 
@@ -2380,18 +3299,18 @@ static off_t align_to_next_packet(hb_stream_t *stream)
 {
     uint8_t buf[MAX_HOLE];
     off_t pos = 0;
-    off_t start = ftello(stream->file_handle);
+    off_t start = stream_tell(stream);
     off_t orig;
 
     if ( start >= stream->packetsize ) {
         start -= stream->packetsize;
-        fseeko(stream->file_handle, start, SEEK_SET);
+        stream_seek(stream, start, SEEK_SET);
     }
     orig = start;
 
     while (1)
     {
-        if (fread(buf, sizeof(buf), 1, stream->file_handle) == 1)
+        if (stream_read(stream, buf, sizeof(buf)) == sizeof(buf))
         {
             const uint8_t *bp = buf;
             int i;
@@ -2408,15 +3327,15 @@ static off_t align_to_next_packet(hb_stream_t *stream)
                 pos = ( bp - buf ) - stream->packetsize + 188;
                 break;
             }
-            fseeko(stream->file_handle, -8 * stream->packetsize, SEEK_CUR);
-            start = ftello(stream->file_handle);
+            stream_seek(stream, -8 * stream->packetsize, SEEK_CUR);
+            start = stream_tell(stream);
         }
         else
         {
             return 0;
         }
     }
-    fseeko(stream->file_handle, start+pos, SEEK_SET);
+    stream_seek(stream, start+pos, SEEK_SET);
     return start - orig + pos;
 }
 
@@ -3734,7 +4653,7 @@ static void hb_ps_stream_find_streams(hb_stream_t *stream)
     int ii, jj;
     hb_buffer_t *buf  = hb_buffer_init(HB_DVD_READ_BUFFER_SIZE);
 
-    fseeko( stream->file_handle, 0, SEEK_SET );
+    stream_seek( stream, 0, SEEK_SET );
     // Scan beginning of file, then if no program stream map is found
     // seek to 20% and scan again since there's occasionally no
     // audio at the beginning (particularly for vobs).
@@ -4356,14 +5275,15 @@ static int hb_ts_stream_find_pids(hb_stream_t *stream)
     // changes PMTs (and thus video & audio PIDs) when 'programs' change. Since
     // we may have the tail of the previous program at the beginning of this
     // file, take our PMT from the middle of the file.
-    fseeko(stream->file_handle, 0, SEEK_END);
-    uint64_t fsize = ftello(stream->file_handle);
-    fseeko(stream->file_handle, fsize >> 1, SEEK_SET);
+    stream_seek(stream, 0, SEEK_END);
+    uint64_t fsize = stream_tell(stream);
+    stream_seek(stream, fsize >> 1, SEEK_SET);
     align_to_next_packet(stream);
 
     // Read the Transport Stream Packets (188 bytes each) looking at first for PID 0 (the PAT PID), then decode that
     // to find the program map PID and then decode that to get the list of audio and video PIDs
 
+    int pmt_done = 0;
     for (;;)
     {
         const uint8_t *buf = next_packet( stream );
@@ -4402,25 +5322,96 @@ static int hb_ts_stream_find_pids(hb_stream_t *stream)
             // The ideal solution would be to build a title choice popup
             // from the PAT program number details and then select from
             // their - but right now the API's not capable of that.
+            //
+            // Titles made by hb_stream_ts_programs ask for their program.
             if (stream->pat_info[pat_index].program_number != 0 &&
-                pid == stream->pat_info[pat_index].program_map_PID)
+                pid == stream->pat_info[pat_index].program_map_PID &&
+                (stream->ts_program == 0 ||
+                 stream->ts_program == stream->pat_info[pat_index].program_number))
             {
                 if (build_program_map(buf, stream) > 0)
                 {
+                    pmt_done = stream->ts_program != 0;
                     break;
                 }
             }
         }
         // Keep going  until we have a complete set of PIDs
-        if ( ts_index_of_video( stream ) >= 0 )
+        if ( ts_index_of_video( stream ) >= 0 || pmt_done )
           break;
     }
     if ( ts_index_of_video( stream ) < 0 )
+    {
+        if ( stream->ts_program && pmt_done )
+            hb_log( "hb_ts_stream_find_pids - program %d has no video",
+                    stream->ts_program );
+        else if ( stream->ts_program )
+            hb_log( "hb_ts_stream_find_pids - program map of program %d "
+                    "not found", stream->ts_program );
+        else
+            hb_log( "hb_ts_stream_find_pids - no video found" );
         return -1;
+    }
     update_ts_streams( stream, stream->pmt_info.PCR_PID, 0, -1, P, NULL );
     return 0;
 }
 
+#define TS_PROGRAM_PROBE_PACKETS 100000   // ~19 MB
+
+/*
+ * Finds the programs of a transport stream, for a title each.  A program
+ * counts if its PMT shows up within a few MB from the middle of the
+ * stream, where hb_ts_stream_find_pids looks for it too: some recorders
+ * keep the PAT of the whole multiplex but record a single program.
+ * Returns the number of programs, their numbers are put in 'programs'.
+ * Leaves the file position undefined.
+ */
+int hb_stream_ts_programs( hb_stream_t *stream, int *programs, int max )
+{
+    int seen[kMaxNumberPMTStreams] = { 0 };
+    int ii, count = 0, wanted = 0, found = 0;
+
+    if ( stream->hb_stream_type != transport )
+        return 0;
+
+    for ( ii = 0; ii < stream->ts_number_pat_entries; ii++ )
+    {
+        if ( stream->pat_info[ii].program_number != 0 )
+            wanted++;
+    }
+    if ( wanted < 2 )
+        return wanted;
+
+    stream_seek( stream, 0, SEEK_END );
+    stream_seek( stream, stream_tell( stream ) >> 1, SEEK_SET );
+    align_to_next_packet( stream );
+    for ( ii = 0; ii < TS_PROGRAM_PROBE_PACKETS && found < wanted; ii++ )
+    {
+        const uint8_t *buf = next_packet( stream );
+        int pid, jj;
+
+        if ( buf == NULL )
+            break;
+        pid = ( ( buf[1] & 0x1f ) << 8 ) | buf[2];
+        for ( jj = 0; jj < stream->ts_number_pat_entries; jj++ )
+        {
+            if ( !seen[jj] && stream->pat_info[jj].program_number != 0 &&
+                 pid == stream->pat_info[jj].program_map_PID )
+            {
+                seen[jj] = 1;
+                found++;
+            }
+        }
+    }
+
+    for ( ii = 0; ii < stream->ts_number_pat_entries && count < max; ii++ )
+    {
+        if ( seen[ii] )
+            programs[count++] = stream->pat_info[ii].program_number;
+    }
+    return count;
+}
+
 
 // convert a PES PTS or DTS to an int64
 static int64_t pes_timestamp( const uint8_t *buf )
@@ -4440,22 +5431,26 @@ static hb_buffer_t * generate_output_data(hb_stream_t *stream, int curstream)
     hb_buffer_t *buf = NULL, *first = NULL;
     hb_pes_info_t pes_info;
 
-    hb_buffer_t * b = stream->ts.list[curstream].buf;
-    if ( !hb_parse_ps( stream, b->data, b->size, &pes_info ) )
-    {
-        b->size = 0;
-        return NULL;
-    }
+    hb_ts_stream_t * ts = &stream->ts.list[curstream];
+    hb_buffer_t * b = ts->buf;
+    hb_buffer_t * payload = ts->payload;
 
-    uint8_t *tdat = b->data + pes_info.header_len;
-    int size = b->size - pes_info.header_len;
+    int valid = payload != NULL && payload->size > 0 &&
+                hb_parse_ps( stream, b->data, b->size, &pes_info );
 
-    if ( size <= 0 )
+    b->size = 0;
+    ts->pes_size = 0;
+    ts->payload = NULL;
+    if ( !valid )
     {
-        b->size = 0;
+        hb_buffer_close( &payload );
         return NULL;
     }
 
+    uint8_t *tdat = payload->data;
+    int size = payload->size;
+    ts->payload_hint = size;
+
     int pes_idx;
     pes_idx = stream->ts.list[curstream].pes_list;
     if( stream->need_keyframe )
@@ -4469,7 +5464,7 @@ static hb_buffer_t * generate_output_data(hb_stream_t *stream, int curstream)
             // but we'll only wait 255 video frames for an I frame.
             if ( kind != V || ++stream->need_keyframe < 512 )
             {
-                b->size = 0;
+                hb_buffer_close( &payload );
                 return NULL;
             }
         }
@@ -4490,11 +5485,17 @@ static hb_buffer_t * generate_output_data(hb_stream_t *stream, int curstream)
         // we want the whole TS stream including all substreams.
         // DTS-HD is an example of this.
 
+        // The first match gets the assembled payload itself, only
+        // additional substreams need a copy of it.
         if ( first == NULL )
-            first = buf = hb_buffer_init( size );
+        {
+            first = buf = payload;
+            payload = NULL;
+        }
         else
         {
             hb_buffer_t *tmp = hb_buffer_init( size );
+            memcpy( tmp->data, tdat, size );
             buf->next = tmp;
             buf = tmp;
         }
@@ -4547,26 +5548,60 @@ static hb_buffer_t * generate_output_data(hb_stream_t *stream, int curstream)
             buf->s.start = pes_info.pts;
             buf->s.renderOffset = pes_info.dts;
         }
-        memcpy( buf->data, tdat, size );
     }
 
-    b->size = 0;
+    hb_buffer_close( &payload );
     return first;
 }
 
+static void ts_buffer_append( hb_buffer_t *b, const uint8_t *buf, int len )
+{
+    if ( b->size + len > b->alloc )
+    {
+        hb_buffer_realloc( b, MAX( b->alloc * 2, b->size + len ) );
+    }
+    memcpy( b->data + b->size, buf, len );
+    b->size += len;
+}
+
+/*
+ * The PES header is collected in ts->buf.  Once it is complete, the rest of
+ * the PES goes straight into a buffer sized for the whole payload, which
+ * generate_output_data hands out without copying it again.  When the PES
+ * has no length, the payload size of the previous PES is used as a guess.
+ */
 static void hb_ts_stream_append_pkt(hb_stream_t *stream, int idx, const uint8_t *buf, int len)
 {
-    if (stream->ts.list[idx].buf->size + len > stream->ts.list[idx].buf->alloc)
+    hb_ts_stream_t *ts = &stream->ts.list[idx];
+    hb_pes_info_t pes_info;
+    int size;
+
+    ts->pes_size += len;
+    if ( ts->payload != NULL )
     {
-        int size;
+        ts_buffer_append( ts->payload, buf, len );
+        return;
+    }
 
-        size = MAX( stream->ts.list[idx].buf->alloc * 2,
-                    stream->ts.list[idx].buf->size + len);
-        hb_buffer_realloc(stream->ts.list[idx].buf, size);
+    ts_buffer_append( ts->buf, buf, len );
+    if ( !hb_parse_ps( stream, ts->buf->data, ts->buf->size, &pes_info ) )
+    {
+        // header not complete yet
+        return;
+    }
+    size = ts->buf->size - pes_info.header_len;
+    if ( pes_info.packet_len > 0 )
+    {
+        ts->payload = hb_buffer_init( MAX( pes_info.packet_len + 6 -
+                                           pes_info.header_len, size ) );
     }
-    memcpy( stream->ts.list[idx].buf->data + stream->ts.list[idx].buf->size,
-            buf, len);
-    stream->ts.list[idx].buf->size += len;
+    else
+    {
+        ts->payload = hb_buffer_init( MAX( ts->payload_hint, size ) );
+    }
+    ts->payload->size = size;
+    memcpy( ts->payload->data, ts->buf->data + pes_info.header_len, size );
+    ts->buf->size = pes_info.header_len;
 }
 
 /***********************************************************************
@@ -4804,7 +5839,7 @@ hb_buffer_t * hb_ts_decode_pkt( hb_stream_t *stream, const uint8_t * pkt )
         // If we have some data already on this stream, turn it into
         // a program stream packet. Then add the payload for this
         // packet to the current pid's buffer.
-        if ( stream->ts.list[curstream].buf->size )
+        if ( stream->ts.list[curstream].pes_size )
         {
             // we have to ship the old packet before updating the pcr
             // since the packet we've been accumulating is referenced
@@ -4836,7 +5871,7 @@ hb_buffer_t * hb_ts_decode_pkt( hb_stream_t *stream, const uint8_t * pkt )
         // see if we've hit the end of this PES packet
         const uint8_t *pes = stream->ts.list[curstream].buf->data;
         int len = ( pes[4] << 8 ) + pes[5] + 6;
-        if ( len > 6 && stream->ts.list[curstream].buf->size == len &&
+        if ( len > 6 && stream->ts.list[curstream].pes_size == len &&
              pes[0] == 0x00 && pes[1] == 0x00 && pes[2] == 0x01 )
         {
             buf = generate_output_data(stream, curstream);
@@ -4880,6 +5915,8 @@ void hb_ts_stream_reset(hb_stream_t *stream)
     {
         if ( stream->ts.list[i].buf )
             stream->ts.list[i].buf->size = 0;
+        hb_buffer_close( &stream->ts.list[i].payload );
+        stream->ts.list[i].pes_size = 0;
         if ( stream->ts.list[i].extra_buf )
             stream->ts.list[i].extra_buf->size = 0;
         stream->ts.list[i].skipbad = 1;
@@ -5524,6 +6561,149 @@ static hb_title_t *ffmpeg_title_scan( hb_stream_t *stream, hb_title_t *title )
     return title;
 }
 
+/*
+ * Matroska and MP4 carry the geometry, frame rate and audio parameters of
+ * their tracks in headers that libavformat reads when opening the file,
+ * so a title can be set up from them without decoding anything.
+ */
+static int ffmpeg_probe_trusted( hb_stream_t *stream )
+{
+    const char *name;
+
+    if ( stream->hb_stream_type != ffmpeg )
+        return 0;
+
+    name = stream->ffmpeg_ic->iformat->name;
+    return !strncmp( name, "matroska", 8 ) || !strncmp( name, "mov,mp4", 7 );
+}
+
+/*
+ * Fills info with what the container says about the video track, as the
+ * video decoder's info routine would.  Returns 0 if the container isn't
+ * trusted or leaves something out, the previews must be decoded then.
+ */
+int hb_stream_probe_video( hb_stream_t *stream, hb_work_info_t *info )
+{
+    AVStream       *st;
+    AVCodecContext *context;
+    AVCodec        *codec;
+    AVRational      rate, sar;
+
+    memset( info, 0, sizeof(*info) );
+
+    if ( !ffmpeg_probe_trusted( stream ) )
+        return 0;
+
+    st      = stream->ffmpeg_ic->streams[stream->ffmpeg_video_id];
+    context = st->codec;
+    codec   = avcodec_find_decoder( context->codec_id );
+    rate    = st->avg_frame_rate;
+    if ( rate.num <= 0 || rate.den <= 0 )
+    {
+        rate = st->r_frame_rate;
+    }
+    if ( codec == NULL || context->width <= 0 || context->height <= 0 ||
+         rate.num <= 0 || rate.den <= 0 )
+    {
+        return 0;
+    }
+
+    info->name      = codec->name;
+    info->profile   = context->profile;
+    info->level     = context->level;
+    info->bitrate   = context->bit_rate;
+    info->width     = context->width & ~1;
+    info->height    = context->height & ~1;
+    info->rate      = 27000000;
+    info->rate_base = (int64_t)27000000 * rate.den / rate.num;
+
+    sar = st->sample_aspect_ratio;
+    if ( sar.num <= 0 || sar.den <= 0 )
+    {
+        sar = context->sample_aspect_ratio;
+    }
+    info->pixel_aspect_width  = sar.num;
+    info->pixel_aspect_height = sar.den;
+
+    hb_ff_color_info( context, info );
+    info->video_decode_support = HB_DECODE_SUPPORT_SW;
+
+    return 1;
+}
+
+/*
+ * Same as hb_stream_probe_video for an audio track of the title, fills
+ * info as the audio decoder's bsinfo routine would.
+ */
+int hb_stream_probe_audio( hb_stream_t *stream, hb_audio_t *audio,
+                           hb_work_info_t *info )
+{
+    AVCodecContext *context;
+    AVCodec        *codec;
+    int             bps, channels;
+
+    memset( info, 0, sizeof(*info) );
+
+    if ( !ffmpeg_probe_trusted( stream ) ||
+         audio->id >= stream->ffmpeg_ic->nb_streams )
+    {
+        return 0;
+    }
+
+    context = stream->ffmpeg_ic->streams[audio->id]->codec;
+    codec   = avcodec_find_decoder( context->codec_id );
+    if ( codec == NULL || context->sample_rate <= 0 ||
+         context->channels <= 0 || context->frame_size <= 0 )
+    {
+        return 0;
+    }
+
+    info->name              = codec->name;
+    info->profile           = context->profile;
+    info->level             = context->level;
+    info->rate              = context->sample_rate;
+    info->rate_base         = 1;
+    info->samples_per_frame = context->frame_size;
+    info->matrix_encoding   = AV_MATRIX_ENCODING_NONE;
+    info->channel_map       = &hb_libav_chan_map;
+    info->channel_layout    = context->channel_layout;
+    if ( info->channel_layout == 0 )
+    {
+        info->channel_layout = av_get_default_channel_layout( context->channels );
+    }
+
+    // same bitrate as decavcodecaBSInfo gives
+    bps      = av_get_bits_per_sample( context->codec_id );
+    channels = av_get_channel_layout_nb_channels( info->channel_layout );
+    if ( bps > 0 )
+    {
+        info->bitrate = bps * channels * info->rate;
+    }
+    else if ( context->bit_rate > 0 )
+    {
+        info->bitrate = context->bit_rate;
+    }
+    else
+    {
+        info->bitrate = 1;
+    }
+
+    if ( context->codec_id == AV_CODEC_ID_AC3 ||
+         context->codec_id == AV_CODEC_ID_EAC3 )
+    {
+        if ( context->audio_service_type == AV_AUDIO_SERVICE_TYPE_KARAOKE )
+        {
+            info->mode = 7;
+        }
+        else
+        {
+            info->mode = context->audio_service_type;
+        }
+    }
+
+    return 1;
+}
+
 static int64_t av_to_hb_pts( int64_t pts, double conv_factor )
 {
     if ( pts == AV_NOPTS_VALUE )
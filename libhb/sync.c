@@ -44,6 +44,7 @@ typedef struct
     /* Raw */
     SRC_STATE  * state;
     SRC_DATA     data;
+    hb_buffer_t * src_buf;     /* recycled sample rate conversion output */
 
     int          silence_size;
     uint8_t    * silence_buf;
@@ -103,10 +104,11 @@ static int  checkPtsOffset( hb_work_object_t * w );
 static void InitAudio( hb_job_t * job, hb_sync_common_t * common, int i );
 static void InitSubtitle( hb_job_t * job, hb_sync_video_t * sync, int i );
 static void InsertSilence( hb_work_object_t * w, int64_t d );
+static int  ResampleConverter( int quality );
 static void UpdateState( hb_work_object_t * w );
 static void UpdateSearchState( hb_work_object_t * w, int64_t start );
 static hb_buffer_t * OutputAudioFrame( hb_audio_t *audio, hb_buffer_t *buf,
-                                       hb_sync_audio_t *sync );
+                                       hb_sync_audio_t *sync, int silence );
 
 /***********************************************************************
  * hb_work_sync_init
@@ -932,6 +934,7 @@ void syncAudioClose( hb_work_object_t * w )
     {
         src_delete( sync->state );
     }
+    hb_buffer_close( &sync->src_buf );
 
     hb_lock( pv->common->mutex );
     if ( --pv->common->ref == 0 )
@@ -1146,7 +1149,7 @@ static int syncAudioWork( hb_work_object_t * w, hb_buffer_t ** buf_in,
             pv->common->audio_pts_slip += (start - sync->next_start);
             pv->common->video_pts_slip += (start - sync->next_start);
             hb_unlock( pv->common->mutex );
-            *buf_out = OutputAudioFrame( w->audio, buf, sync );
+            *buf_out = OutputAudioFrame( w->audio, buf, sync, 0 );
             return HB_WORK_OK;
         }
         hb_log( "sync: adding %d ms of silence to audio 0x%x"
@@ -1161,7 +1164,7 @@ static int syncAudioWork( hb_work_object_t * w, hb_buffer_t ** buf_in,
      * audio stream and are ready to inject the next input frame into
      * the output stream.
      */
-    *buf_out = OutputAudioFrame( w->audio, buf, sync );
+    *buf_out = OutputAudioFrame( w->audio, buf, sync, 0 );
     return HB_WORK_OK;
 }
 
@@ -1312,7 +1315,7 @@ static void InitAudio( hb_job_t * job, hb_sync_common_t * common, int i )
         {
             /* Not passthru, initialize libsamplerate */
             int error;
-            sync->state = src_new( SRC_SINC_MEDIUM_QUALITY,
+            sync->state = src_new( ResampleConverter( w->audio->config.out.resample_quality ),
                                    hb_mixdown_get_discrete_channel_count( w->audio->config.out.mixdown ),
                                    &error );
             sync->data.end_of_input = 0;
@@ -1324,8 +1327,51 @@ static void InitAudio( hb_job_t * job, hb_sync_common_t * common, int i )
     hb_list_add( job->list_work, w );
 }
 
+static int ResampleConverter( int quality )
+{
+    switch( quality )
+    {
+        case HB_RESAMPLE_BEST:
+            return SRC_SINC_BEST_QUALITY;
+        case HB_RESAMPLE_FAST:
+            return SRC_SINC_FASTEST;
+        case HB_RESAMPLE_LINEAR:
+            return SRC_LINEAR;
+        case HB_RESAMPLE_MEDIUM:
+        default:
+            return SRC_SINC_MEDIUM_QUALITY;
+    }
+}
+
+/*
+ * Scale samples by the track gain, boosting clamps to [-1.0, 1.0].
+ * Single precision and branch free so that the compiler vectorizes it.
+ */
+static void ApplyGain( float * samples, int count, float gain, int clamp )
+{
+    int ii;
+
+    if( clamp )
+    {
+        for( ii = 0; ii < count; ii++ )
+        {
+            float sample = samples[ii] * gain;
+            sample = sample >  1.f ?  1.f : sample;
+            sample = sample < -1.f ? -1.f : sample;
+            samples[ii] = sample;
+        }
+    }
+    else
+    {
+        for( ii = 0; ii < count; ii++ )
+        {
+            samples[ii] *= gain;
+        }
+    }
+}
+
 static hb_buffer_t * OutputAudioFrame( hb_audio_t *audio, hb_buffer_t *buf,
-                                       hb_sync_audio_t *sync )
+                                       hb_sync_audio_t *sync, int silence )
 {
     int64_t start = (int64_t)sync->next_start;
 
@@ -1367,7 +1413,21 @@ static hb_buffer_t * OutputAudioFrame( hb_audio_t *audio, hb_buffer_t *buf,
             sync->data.src_ratio = (double)audio->config.out.samplerate /
                                    (double)audio->config.in.samplerate;
 
-            buf = hb_buffer_init( count_out * sample_size );
+            /* libsamplerate can't convert in place.  Keep the input buffer
+             * and convert the next frame into it instead of allocating. */
+            buf = sync->src_buf;
+            sync->src_buf = NULL;
+            if( buf == NULL || buf->alloc < count_out * sample_size )
+            {
+                hb_buffer_close( &buf );
+                buf = hb_buffer_init( count_out * sample_size );
+            }
+            else
+            {
+                memset( &buf->s, 0, sizeof( buf->s ) );
+                buf->s.renderOffset = AV_NOPTS_VALUE;
+                buf->next = NULL;
+            }
             sync->data.data_in  = (float *) buf_raw->data;
             sync->data.data_out = (float *) buf->data;
             if( src_process( sync->state, &sync->data ) )
@@ -1375,7 +1435,7 @@ static hb_buffer_t * OutputAudioFrame( hb_audio_t *audio, hb_buffer_t *buf,
                 /* XXX If this happens, we're screwed */
                 hb_log( "sync: audio 0x%x src_process failed", audio->id );
             }
-            hb_buffer_close( &buf_raw );
+            sync->src_buf = buf_raw;
 
             if (sync->data.output_frames_gen <= 0)
             {
@@ -1388,37 +1448,10 @@ static hb_buffer_t * OutputAudioFrame( hb_audio_t *audio, hb_buffer_t *buf,
             duration = (double)( sync->data.output_frames_gen * 90000 ) /
                        audio->config.out.samplerate;
         }
-        if( audio->config.out.gain > 0.0 )
+        if( audio->config.out.gain != 0.0 && !silence )
         {
-            int count, ii;
-
-            count  = buf->size / sizeof(float);
-            for ( ii = 0; ii < count; ii++ )
-            {
-                double sample;
-
-                sample = (double)*(((float*)buf->data)+ii);
-                sample *= sync->gain_factor;
-                if (sample > 0)
-                    sample = MIN(sample, 1.0);
-                else
-                    sample = MAX(sample, -1.0);
-                *(((float*)buf->data)+ii) = sample;
-            }
-        }
-        else if( audio->config.out.gain < 0.0 )
-        {
-            int count, ii;
-
-            count  = buf->size / sizeof(float);
-            for ( ii = 0; ii < count; ii++ )
-            {
-                double sample;
-
-                sample = (double)*(((float*)buf->data)+ii);
-                sample *= sync->gain_factor;
-                *(((float*)buf->data)+ii) = sample;
-            }
+            ApplyGain( (float*)buf->data, buf->size / sizeof(float),
+                       sync->gain_factor, audio->config.out.gain > 0.0 );
         }
     }
 
@@ -1489,7 +1522,7 @@ static void InsertSilence( hb_work_object_t * w, int64_t duration )
             fifo = w->audio->priv.fifo_sync;
             duration -= frame_dur;
         }
-        buf = OutputAudioFrame( w->audio, buf, sync );
+        buf = OutputAudioFrame( w->audio, buf, sync, 1 );
         hb_fifo_push( fifo, buf );
     }
 }
@@ -1555,6 +1588,9 @@ static void UpdateState( hb_work_object_t * w )
         p.seconds  = -1;
     }
 #undef p
+    hb_mem_get_state( pv->job->mem, &state );
+    hb_work_get_queue_state( pv->job, &state );
+    hb_buffer_pool_get_state( &state );
 
     hb_set_state( pv->job->h, &state );
 }
@@ -1623,6 +1659,7 @@ static void UpdateSearchState( hb_work_object_t * w, int64_t start )
         p.seconds  = -1;
     }
 #undef p
+    hb_mem_get_state( pv->job->mem, &state );
 
     hb_set_state( pv->job->h, &state );
 }
@@ -21,7 +21,7 @@ taskset_init( taskset_t *ts, int thread_count, size_t arg_size )
     ts->thread_count = thread_count;
     ts->arg_size = arg_size;
     ts->bitmap_elements = ( ts->thread_count + 31 ) / 32;
-    ts->task_threads = malloc( sizeof( hb_thread_t* ) * ts->thread_count );
+    ts->task_threads = calloc( ts->thread_count, sizeof( hb_thread_t* ) );
     if( ts->task_threads == NULL )
         goto fail;
     init_step++;
@@ -209,10 +209,22 @@ taskset_fini( taskset_t *ts )
     bit_nset( ts->task_begin_bitmap, 0, ts->thread_count - 1 );
     hb_cond_broadcast( ts->task_begin );
 
+    /*
+     * Threads that failed to spawn have nothing to report.
+     */
+    for( i = 0; i < ts->thread_count; i++)
+    {
+        if( ts->task_threads[i] == NULL )
+            bit_set( ts->task_complete_bitmap, i );
+    }
+
     /*
      * Wait for all threads to exit.
      */
-    hb_cond_wait( ts->task_complete, ts->task_cond_lock );
+    while ( !allbits_set( ts->task_complete_bitmap, ts->bitmap_elements ) )
+    {
+        hb_cond_wait( ts->task_complete, ts->task_cond_lock );
+    }
     hb_unlock( ts->task_cond_lock );
 
     /*
@@ -220,7 +232,8 @@ taskset_fini( taskset_t *ts )
      */
     for( i = 0; i < ts->thread_count; i++)
     {
-        hb_thread_close( &ts->task_threads[i] );
+        if( ts->task_threads[i] != NULL )
+            hb_thread_close( &ts->task_threads[i] );
     }
     hb_lock_close( &ts->task_cond_lock );
     hb_cond_close( &ts->task_begin );
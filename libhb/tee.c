@@ -0,0 +1,103 @@
+/* tee.c
+
+   Copyright (c) 2003-2014 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*
+ * Tee work object.
+ *
+ * Passes every buffer from fifo_in to fifo_out unchanged and pushes a copy
+ * of it to each additional output.  Used to fork the pipeline after the
+ * shared stages, e.g. to encode several renditions from a single decode.
+ */
+
+#include "hb.h"
+
+struct hb_work_private_s
+{
+    hb_list_t * list_fifo;  // additional outputs
+};
+
+static int  teeInit( hb_work_object_t *, hb_job_t * );
+static int  teeWork( hb_work_object_t *, hb_buffer_t **, hb_buffer_t ** );
+static void teeClose( hb_work_object_t * );
+
+hb_work_object_t hb_tee =
+{
+    WORK_TEE,
+    "Tee",
+    teeInit,
+    teeWork,
+    teeClose
+};
+
+hb_work_object_t * hb_tee_init( hb_fifo_t * fifo_in, hb_fifo_t * fifo_out )
+{
+    hb_work_object_t * w = hb_get_work( WORK_TEE );
+
+    w->private_data = calloc( 1, sizeof( hb_work_private_t ) );
+    w->private_data->list_fifo = hb_list_init();
+    w->fifo_in  = fifo_in;
+    w->fifo_out = fifo_out;
+
+    return w;
+}
+
+void hb_tee_add_output( hb_work_object_t * w, hb_fifo_t * fifo )
+{
+    hb_list_add( w->private_data->list_fifo, fifo );
+}
+
+// teeInit does nothing because the tee has a special initializer
+// that sets up its outputs
+static int teeInit( hb_work_object_t * w, hb_job_t * job )
+{
+    return 0;
+}
+
+static int teeWork( hb_work_object_t * w, hb_buffer_t ** buf_in,
+                    hb_buffer_t ** buf_out )
+{
+    hb_work_private_t * pv = w->private_data;
+    hb_buffer_t       * in = *buf_in;
+    int                 i;
+
+    for( i = 0; i < hb_list_count( pv->list_fifo ); i++ )
+    {
+        hb_fifo_t   * fifo = hb_list_item( pv->list_fifo, i );
+        hb_buffer_t * copy = hb_buffer_dup( in );
+
+        while( !*w->done )
+        {
+            if( hb_fifo_full_wait( fifo ) )
+            {
+                hb_fifo_push( fifo, copy );
+                copy = NULL;
+                break;
+            }
+        }
+        hb_buffer_close( &copy );
+    }
+
+    *buf_in  = NULL;
+    *buf_out = in;
+
+    /* EOF on input stream - it has been sent to every output */
+    return in->size <= 0 ? HB_WORK_DONE : HB_WORK_OK;
+}
+
+static void teeClose( hb_work_object_t * w )
+{
+    hb_work_private_t * pv = w->private_data;
+
+    if( pv == NULL )
+        return;
+
+    hb_list_close( &pv->list_fifo );
+    free( pv );
+    w->private_data = NULL;
+}
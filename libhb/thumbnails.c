@@ -0,0 +1,371 @@
+/* thumbnails.c
+
+   Copyright (c) 2003-2014 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*
+ * Thumbnail sprite sheets.
+ *
+ * The previews that scan decodes are evenly spaced over the title and
+ * each starts at a keyframe, which is what a scrubbing bar needs.  When
+ * thumbnails are enabled, every decoded preview is scaled straight from
+ * the decoder's picture into its tile of a sheet, so the source is not
+ * decoded a second time and no full size copy is made.
+ *
+ * At the end of the title the sheets are written as JPEG images next to
+ * a WebVTT index whose cues point into them with #xywh fragments:
+ *
+ *     <prefix>-<title>.vtt
+ *     <prefix>-<title>-<sheet>.jpg
+ */
+
+#include "hb.h"
+#include "hbffmpeg.h"
+
+#define THUMB_COLUMNS_MAX 10
+#define THUMB_ROWS_MAX    10
+
+typedef struct
+{
+    int     sheet;
+    int     x, y;
+    double  position;   // fraction of the title
+} thumb_tile_t;
+
+struct hb_thumbnails_s
+{
+    char               * prefix;
+    int                  title;
+    int                  count;
+    int                  width;
+    int                  height;    // set by the first picture
+    int                  columns;
+    int                  rows;
+
+    hb_buffer_t       ** sheets;
+    thumb_tile_t       * tiles;
+    int                  added;
+
+    struct SwsContext  * context;
+    int                  src_width;
+    int                  src_height;
+};
+
+/*
+ * Thumbnails of count previews of a title, width pixels wide.  Their
+ * height follows the display aspect of the first picture.
+ */
+hb_thumbnails_t * hb_thumbnails_init( const char * prefix, int title,
+                                      int count, int width )
+{
+    hb_thumbnails_t * t;
+
+    if( prefix == NULL || count <= 0 || width <= 0 )
+    {
+        return NULL;
+    }
+
+    t = calloc( 1, sizeof( hb_thumbnails_t ) );
+    t->prefix  = strdup( prefix );
+    t->title   = title;
+    t->count   = count;
+    t->width   = EVEN( width );
+    t->columns = MIN( count, THUMB_COLUMNS_MAX );
+    t->rows    = MIN( ( count + t->columns - 1 ) / t->columns,
+                      THUMB_ROWS_MAX );
+    t->sheets  = calloc( ( count + t->columns * t->rows - 1 ) /
+                         ( t->columns * t->rows ), sizeof( hb_buffer_t * ) );
+    t->tiles   = calloc( count, sizeof( thumb_tile_t ) );
+
+    return t;
+}
+
+static hb_buffer_t * sheet_init( hb_thumbnails_t * t )
+{
+    hb_buffer_t * sheet;
+    int           pp, yy;
+
+    sheet = hb_frame_buffer_init( AV_PIX_FMT_YUV420P, t->columns * t->width,
+                                  t->rows * t->height );
+    // Black, in the full range the JPEG encoder expects
+    for( pp = 0; pp < 3; pp++ )
+    {
+        for( yy = 0; yy < sheet->plane[pp].height; yy++ )
+        {
+            memset( sheet->plane[pp].data + yy * sheet->plane[pp].stride,
+                    pp ? 128 : 0, sheet->plane[pp].width );
+        }
+    }
+    return sheet;
+}
+
+/*
+ * Adds the next decoded preview, taken at position (a fraction of the
+ * title).  Previews must be added in order.
+ */
+void hb_thumbnails_add( hb_thumbnails_t * t, hb_buffer_t * picture,
+                        hb_work_info_t * info, double position )
+{
+    thumb_tile_t * tile;
+    hb_buffer_t  * sheet;
+    uint8_t      * dst[4];
+    int            dst_stride[4];
+    int            index, pp;
+
+    if( t == NULL || t->added >= t->count )
+    {
+        return;
+    }
+
+    if( t->height == 0 )
+    {
+        double dar = (double)info->width * info->pixel_aspect_width /
+                     ( (double)info->height * info->pixel_aspect_height );
+
+        if( !( dar > 0 ) )
+        {
+            dar = (double)info->width / info->height;
+        }
+        t->height = MAX( EVEN( (int)( t->width / dar + 0.5 ) ), 2 );
+    }
+
+    if( t->context == NULL ||
+        t->src_width  != picture->f.width ||
+        t->src_height != picture->f.height )
+    {
+        if( t->context != NULL )
+        {
+            sws_freeContext( t->context );
+        }
+        // The tiles are small, no need for the preview's lanczos
+        t->context = hb_sws_get_context( picture->f.width, picture->f.height,
+                                         AV_PIX_FMT_YUV420P,
+                                         t->width, t->height,
+                                         AV_PIX_FMT_YUVJ420P,
+                                         SWS_BILINEAR );
+        t->src_width  = picture->f.width;
+        t->src_height = picture->f.height;
+    }
+
+    index = t->added++;
+    tile  = &t->tiles[index];
+    tile->sheet    = index / ( t->columns * t->rows );
+    tile->x        = index % t->columns * t->width;
+    tile->y        = index / t->columns % t->rows * t->height;
+    tile->position = position;
+
+    if( t->sheets[tile->sheet] == NULL )
+    {
+        t->sheets[tile->sheet] = sheet_init( t );
+    }
+    sheet = t->sheets[tile->sheet];
+
+    for( pp = 0; pp < 3; pp++ )
+    {
+        int shift = pp ? 1 : 0;
+
+        dst_stride[pp] = sheet->plane[pp].stride;
+        dst[pp]        = sheet->plane[pp].data +
+                         ( tile->y >> shift ) * dst_stride[pp] +
+                         ( tile->x >> shift );
+    }
+    dst[3]        = NULL;
+    dst_stride[3] = 0;
+
+    uint8_t * src[4] = { picture->plane[0].data, picture->plane[1].data,
+                         picture->plane[2].data, NULL };
+    int src_stride[4] = { picture->plane[0].stride, picture->plane[1].stride,
+                          picture->plane[2].stride, 0 };
+
+    sws_scale( t->context, (const uint8_t* const *)src, src_stride,
+               0, picture->f.height, dst, dst_stride );
+}
+
+static int write_jpeg( hb_buffer_t * sheet, const char * filename )
+{
+    AVCodec        * codec;
+    AVCodecContext * context;
+    AVFrame        * frame;
+    AVPacket         pkt;
+    FILE           * file;
+    int              got_packet = 0, ret = -1;
+
+    codec = avcodec_find_encoder( AV_CODEC_ID_MJPEG );
+    if( codec == NULL )
+    {
+        hb_error( "thumbnails: no JPEG encoder" );
+        return -1;
+    }
+    context = avcodec_alloc_context3( codec );
+    context->width          = sheet->f.width;
+    context->height         = sheet->f.height;
+    context->pix_fmt        = AV_PIX_FMT_YUVJ420P;
+    context->time_base      = (AVRational){ 1, 25 };
+    context->flags         |= CODEC_FLAG_QSCALE;
+    context->global_quality = FF_QP2LAMBDA * 4;
+    if( hb_avcodec_open( context, codec, NULL, 0 ) )
+    {
+        hb_error( "thumbnails: avcodec_open failed" );
+        av_free( context );
+        return -1;
+    }
+
+    frame = av_frame_alloc();
+    frame->data[0]     = sheet->plane[0].data;
+    frame->data[1]     = sheet->plane[1].data;
+    frame->data[2]     = sheet->plane[2].data;
+    frame->linesize[0] = sheet->plane[0].stride;
+    frame->linesize[1] = sheet->plane[1].stride;
+    frame->linesize[2] = sheet->plane[2].stride;
+    frame->quality     = context->global_quality;
+    frame->pts         = 0;
+
+    av_init_packet( &pkt );
+    pkt.data = NULL;
+    pkt.size = 0;
+    if( avcodec_encode_video2( context, &pkt, frame, &got_packet ) < 0 ||
+        !got_packet )
+    {
+        hb_error( "thumbnails: could not encode %s", filename );
+    }
+    else if( ( file = hb_fopen( filename, "wb" ) ) == NULL )
+    {
+        hb_error( "thumbnails: fopen failed (%s)", filename );
+    }
+    else
+    {
+        if( fwrite( pkt.data, pkt.size, 1, file ) == 1 )
+        {
+            ret = 0;
+        }
+        if( fclose( file ) )
+        {
+            ret = -1;
+        }
+        if( ret )
+        {
+            hb_error( "thumbnails: could not write %s", filename );
+        }
+    }
+    if( got_packet )
+    {
+        av_free_packet( &pkt );
+    }
+    av_frame_free( &frame );
+    hb_avcodec_close( context );
+    av_free( context );
+
+    return ret;
+}
+
+static void write_vtt_time( FILE * file, int64_t pts )
+{
+    int64_t ms = pts / 90;
+
+    fprintf( file, "%02"PRId64":%02"PRId64":%02"PRId64".%03"PRId64,
+             ms / 3600000, ms / 60000 % 60, ms / 1000 % 60, ms % 1000 );
+}
+
+/*
+ * Writes the sheets and their WebVTT index.  duration is the title's,
+ * in 90 kHz ticks.  Returns 0 on success.
+ */
+int hb_thumbnails_write( hb_thumbnails_t * t, int64_t duration )
+{
+    FILE * file;
+    char * filename, * name;
+    int    ii, sheets;
+
+    if( t == NULL || t->added == 0 )
+    {
+        return -1;
+    }
+
+    sheets = ( t->added + t->columns * t->rows - 1 ) / ( t->columns * t->rows );
+    for( ii = 0; ii < sheets; ii++ )
+    {
+        filename = hb_strdup_printf( "%s-%d-%02d.jpg", t->prefix, t->title,
+                                     ii + 1 );
+        if( write_jpeg( t->sheets[ii], filename ) )
+        {
+            free( filename );
+            return -1;
+        }
+        free( filename );
+    }
+
+    filename = hb_strdup_printf( "%s-%d.vtt", t->prefix, t->title );
+    file = hb_fopen( filename, "w" );
+    if( file == NULL )
+    {
+        hb_error( "thumbnails: fopen failed (%s)", filename );
+        free( filename );
+        return -1;
+    }
+
+    // The sheets are next to the index, refer to them by name only
+    name = strrchr( t->prefix, '/' );
+#if defined( SYS_MINGW )
+    if( strrchr( t->prefix, '\\' ) > name )
+        name = strrchr( t->prefix, '\\' );
+#endif
+    name = name ? name + 1 : t->prefix;
+
+    fprintf( file, "WEBVTT\n" );
+    for( ii = 0; ii < t->added; ii++ )
+    {
+        thumb_tile_t * tile = &t->tiles[ii];
+        int64_t        start, stop;
+
+        // Each thumbnail stands for the time up to the next one
+        start = ii ? tile->position * duration : 0;
+        stop  = ii + 1 < t->added ? tile[1].position * duration : duration;
+
+        fprintf( file, "\n" );
+        write_vtt_time( file, start );
+        fprintf( file, " --> " );
+        write_vtt_time( file, MAX( stop, start ) );
+        fprintf( file, "\n%s-%d-%02d.jpg#xywh=%d,%d,%d,%d\n",
+                 name, t->title, tile->sheet + 1,
+                 tile->x, tile->y, t->width, t->height );
+    }
+    if( fclose( file ) )
+    {
+        hb_error( "thumbnails: could not write %s", filename );
+        free( filename );
+        return -1;
+    }
+    hb_log( "thumbnails: %d thumbnails of %dx%d in %d sheet(s), index %s",
+            t->added, t->width, t->height, sheets, filename );
+    free( filename );
+
+    return 0;
+}
+
+void hb_thumbnails_close( hb_thumbnails_t ** _t )
+{
+    hb_thumbnails_t * t = *_t;
+    int               ii;
+
+    if( t == NULL )
+        return;
+
+    for( ii = 0; ii < ( t->count + t->columns * t->rows - 1 ) /
+                      ( t->columns * t->rows ); ii++ )
+    {
+        hb_buffer_close( &t->sheets[ii] );
+    }
+    if( t->context != NULL )
+    {
+        sws_freeContext( t->context );
+    }
+    free( t->sheets );
+    free( t->tiles );
+    free( t->prefix );
+    free( t );
+    *_t = NULL;
+}
@@ -62,19 +62,6 @@ hb_filter_object_t hb_filter_vfr =
     .info          = hb_vfr_info,
 };
 
-// Create gamma lookup table.
-// Note that we are creating a scaled integer lookup table that will
-// not cause overflows in sse_block16() below.  This results in
-// small values being truncated to 0 which is ok for this usage.
-static void build_gamma_lut( hb_filter_private_t * pv )
-{
-    int i;
-    for( i = 0; i < 256; i++ )
-    {
-        pv->gamma_lut[i] = 4095 * pow( ( (float)i / (float)255 ), 2.2f );
-    }
-}
-
 // insert buffer 'succ' after buffer chain element 'pred'.
 // caller must guarantee that 'pred' and 'succ' are non-null.
 static hb_buffer_t *insert_buffer_in_chain( 
@@ -88,50 +75,12 @@ static hb_buffer_t *insert_buffer_in_chain(
 
 #define DUP_THRESH_SSE 5.0
 
-// Compute ths sum of squared errors for a 16x16 block
-// Gamma adjusts pixel values so that less visible diffreences
-// count less.
-static inline unsigned sse_block16( hb_filter_private_t *pv, uint8_t *a, uint8_t *b, int stride )
-{
-    int x, y;
-    unsigned sum = 0;
-    int diff;
-    unsigned *g = pv->gamma_lut;
-
-    for( y = 0; y < 16; y++ )
-    {
-        for( x = 0; x < 16; x++ )
-        {
-            diff =  g[a[x]] - g[b[x]];
-            sum += diff * diff;
-        }
-        a += stride;
-        b += stride;
-    }
-    return sum;
-}
-
-// Sum of squared errors.  Computes and sums the SSEs for all
-// 16x16 blocks in the images.  Only checks the Y component.
+// Sum of squared errors of the Y component, see hb_motion_metric()
+// in analyze.c.  Gamma adjusts pixel values so that less visible
+// differences count less.
 static float motion_metric( hb_filter_private_t * pv, hb_buffer_t * a, hb_buffer_t * b )
 {
-    int bw = a->f.width / 16;
-    int bh = a->f.height / 16;
-    int stride = a->plane[0].stride;
-    uint8_t * pa = a->plane[0].data;
-    uint8_t * pb = b->plane[0].data;
-    int x, y;
-    uint64_t sum = 0;
-
-    for( y = 0; y < bh; y++ )
-    {
-        for( x = 0; x < bw; x++ )
-        {
-            sum +=  sse_block16( pv, pa + y * 16 * stride + x * 16,
-                                 pb + y * 16 * stride + x * 16, stride );
-        }
-    }
-    return (float)sum / ( a->f.width * a->f.height );;
+    return hb_motion_metric( pv->gamma_lut, a, b );
 }
 
 // This section of the code implements video frame rate control.
@@ -305,7 +254,7 @@ static int hb_vfr_init(hb_filter_object_t *filter, hb_filter_init_t *init)
 {
     filter->private_data    = calloc(1, sizeof(struct hb_filter_private_s));
     hb_filter_private_t *pv = filter->private_data;
-    build_gamma_lut(pv);
+    hb_motion_gamma_lut(pv->gamma_lut);
 
     pv->cfr              = init->cfr;
     pv->input_vrate = pv->vrate = init->vrate;
@@ -30,6 +30,24 @@ static void work_func();
 static void do_job( hb_job_t *);
 static void work_loop( void * );
 static void filter_loop( void * );
+static int  work_mem_stage( hb_work_object_t * );
+static void reduce_par( hb_job_t * job );
+
+/* An output rendition forked off the end of the filter chain */
+typedef struct
+{
+    hb_job_t           * job;     // copy of the parent job for this output
+    hb_fifo_t          * fifo_in; // filtered frames from the tee
+    hb_filter_object_t * scale;
+    hb_work_object_t   * encoder;
+    hb_work_object_t   * muxer;
+} hb_branch_t;
+
+typedef struct
+{
+    hb_list_t * list_branch;
+    hb_list_t * list_fifo;        // fifos to close with the ladder
+} hb_ladder_t;
 
 #define FIFO_UNBOUNDED 65536
 #define FIFO_UNBOUNDED_WAKE 65535
@@ -40,6 +58,9 @@ static void filter_loop( void * );
 #define FIFO_MINI 4
 #define FIFO_MINI_WAKE 3
 
+// Bytes of uncompressed frames a single fifo may hold
+#define FIFO_FRAME_BYTES (64 * 1024 * 1024)
+
 /**
  * Allocates work object and launches work thread with work_func.
  * @param jobs Handle to hb_list_t.
@@ -62,6 +83,7 @@ static void InitWorkState( hb_handle_t * h )
 {
     hb_state_t state;
 
+    memset( &state, 0, sizeof( state ) );
     state.state = HB_STATE_WORKING;
 #define p state.param.working
     p.progress  = 0.0;
@@ -76,6 +98,92 @@ static void InitWorkState( hb_handle_t * h )
 
 }
 
+/* Whether job can read its source together with lead, or with the jobs
+ * queued after it when lead is NULL.  Only single pass encodes of MPEG
+ * transport streams that don't need the state kept between jobs. */
+static int work_shares_source( hb_job_t * job, hb_job_t * lead )
+{
+    hb_title_t * title = job->title;
+
+    if( job->pass != 0 || job->indepth_scan || job->use_opencl ||
+        job->use_hwd || title->type != HB_STREAM_TYPE ||
+        title->demuxer != HB_TS_DEMUXER ||
+        hb_interjob_get( job->h )->select_subtitle != NULL )
+    {
+        return 0;
+    }
+    return lead == NULL ||
+           ( !strcmp( title->path, lead->title->path ) &&
+             ( title->flags & HBTF_JOIN_SEGMENTS ) ==
+             ( lead->title->flags & HBTF_JOIN_SEGMENTS ) );
+}
+
+static void work_sibling( void * _job )
+{
+    do_job( _job );
+}
+
+/**
+ * Starts the jobs queued after job that encode programs of the same
+ * transport stream, up to hb_get_parallel_programs jobs in all.  They
+ * run next to job and the source is read once for all of them, see
+ * hb_stream_share_init.
+ * @param work Handle work object.
+ * @param job The job about to run in the work thread.
+ * @return The threads of the other jobs, NULL if there are none.
+ */
+static hb_list_t * work_siblings( hb_work_t * work, hb_job_t * job )
+{
+    hb_list_t         * siblings;
+    hb_list_t         * threads;
+    hb_job_t          * sibling;
+    hb_stream_share_t * share;
+    int                 count = hb_get_parallel_programs( job->h );
+    int                 ii;
+
+    if( count < 2 || !work_shares_source( job, NULL ) )
+    {
+        return NULL;
+    }
+
+    siblings = hb_list_init();
+    while( hb_list_count( siblings ) + 1 < count &&
+           ( sibling = hb_list_item( work->jobs, 0 ) ) &&
+           work_shares_source( sibling, job ) )
+    {
+        hb_list_rem( work->jobs, sibling );
+        hb_list_add( siblings, sibling );
+    }
+    count = hb_list_count( siblings ) + 1;
+    share = count > 1 ? hb_stream_share_init( count ) : NULL;
+    if( share == NULL )
+    {
+        // run them one after the other
+        for( ii = hb_list_count( siblings ) - 1; ii >= 0; ii-- )
+        {
+            hb_list_insert( work->jobs, 0, hb_list_item( siblings, ii ) );
+        }
+        hb_list_close( &siblings );
+        return NULL;
+    }
+
+    hb_log( "work: encoding %d programs of %s in one pass", count,
+            job->title->path );
+    job->stream_share = share;
+    threads = hb_list_init();
+    for( ii = 0; ii < count - 1; ii++ )
+    {
+        sibling = hb_list_item( siblings, ii );
+        sibling->die = work->die;
+        sibling->done_error = work->error;
+        sibling->stream_share = share;
+        hb_list_add( threads, hb_thread_init( "work program", work_sibling,
+                                              sibling, HB_LOW_PRIORITY ) );
+    }
+    hb_list_close( &siblings );
+    return threads;
+}
+
 /**
  * Iterates through job list and calls do_job for each job.
  * @param _work Handle work object.
@@ -84,6 +192,8 @@ static void work_func( void * _work )
 {
     hb_work_t  * work = _work;
     hb_job_t   * job;
+    hb_list_t  * siblings;
+    hb_thread_t * thread;
 
     hb_log( "%d job(s) to process", hb_list_count( work->jobs ) );
 
@@ -94,7 +204,17 @@ static void work_func( void * _work )
         job->done_error = work->error;
         *(work->current_job) = job;
         InitWorkState( job->h );
+        siblings = work_siblings( work, job );
         do_job( job );
+        if( siblings != NULL )
+        {
+            while( ( thread = hb_list_item( siblings, 0 ) ) )
+            {
+                hb_list_rem( siblings, thread );
+                hb_thread_close( &thread );
+            }
+            hb_list_close( &siblings );
+        }
         *(work->current_job) = NULL;
     }
 
@@ -210,6 +330,11 @@ void hb_display_job_info(hb_job_t *job)
 
     hb_log( "   + %s", job->file );
 
+    if( job->mem_limit > 0 )
+    {
+        hb_log( "   + memory limit: %d MiB", job->mem_limit );
+    }
+
     hb_log("   + container: %s", hb_container_get_long_name(job->mux));
     switch (job->mux)
     {
@@ -374,6 +499,24 @@ void hb_display_job_info(hb_job_t *job)
                 hb_log( "                analyse=i4x4 (if originally enabled, else analyse=none)" );
                 hb_log( "                subq=2 (if originally greater than 2, else subq unchanged)" );
             }
+            if( job->pass_spool )
+            {
+                hb_log( "     + frame spool: %s",
+                        job->pass_spool == HB_SPOOL_DEFLATE ? "deflate" : "raw" );
+            }
+        }
+
+        for( i = 0; i < hb_list_count( job->list_rendition ); i++ )
+        {
+            hb_rendition_t * rendition = hb_list_item( job->list_rendition, i );
+
+            hb_log( "     + rendition: %s", rendition->file );
+            if( rendition->vbitrate > 0 )
+                hb_log( "       + %d * %d, bitrate: %d kbps",
+                        rendition->width, rendition->height, rendition->vbitrate );
+            else
+                hb_log( "       + %d * %d, quality: %.2f",
+                        rendition->width, rendition->height, rendition->vquality );
         }
 
         if (job->color_matrix_code && (job->vcodec == HB_VCODEC_X264 ||
@@ -504,22 +647,1215 @@ void hb_display_job_info(hb_job_t *job)
                     hb_log("     + compression level: %.2f",
                            audio->config.out.compression_level);
                 }
+                if (audio->config.out.samplerate != audio->config.in.samplerate &&
+                    audio->config.out.resample_quality != HB_RESAMPLE_MEDIUM)
+                {
+                    static const char *quality[] = { "medium", "best", "fast", "linear" };
+                    hb_log("     + resampling: %s",
+                           quality[audio->config.out.resample_quality & 3]);
+                }
+            }
+        }
+    }
+}
+
+/* Corrects framerates when actual duration and frame count numbers are known. */
+void correct_framerate( hb_job_t * job )
+{
+    hb_interjob_t * interjob = hb_interjob_get( job->h );
+
+    if( ( job->sequence_id & 0xFFFFFF ) != ( interjob->last_job & 0xFFFFFF) )
+        return; // Interjob information is for a different encode.
+
+    // compute actual output vrate from first pass
+    interjob->vrate = job->vrate_base * ( (double)interjob->out_frame_count * 90000 / interjob->total_time );
+    interjob->vrate_base = job->vrate_base;
+}
+
+static hb_work_object_t * video_encoder( hb_job_t * job )
+{
+    hb_work_object_t * w = NULL;
+
+    switch( job->vcodec )
+    {
+    case HB_VCODEC_FFMPEG_MPEG4:
+        w = hb_get_work( WORK_ENCAVCODEC );
+        w->codec_param = AV_CODEC_ID_MPEG4;
+        break;
+    case HB_VCODEC_FFMPEG_MPEG2:
+        w = hb_get_work( WORK_ENCAVCODEC );
+        w->codec_param = AV_CODEC_ID_MPEG2VIDEO;
+        break;
+    case HB_VCODEC_FFMPEG_VP8:
+        w = hb_get_work( WORK_ENCAVCODEC );
+        w->codec_param = AV_CODEC_ID_VP8;
+        break;
+    case HB_VCODEC_X264:
+        w = hb_get_work( WORK_ENCX264 );
+        break;
+    case HB_VCODEC_QSV_H264:
+        w = hb_get_work( WORK_ENCQSV );
+        break;
+    case HB_VCODEC_THEORA:
+        w = hb_get_work( WORK_ENCTHEORA );
+        break;
+#ifdef USE_X265
+    case HB_VCODEC_X265:
+        w = hb_get_work( WORK_ENCX265 );
+        break;
+#endif
+    }
+    return w;
+}
+
+/*
+ * Rendition ladder.
+ *
+ * Each rendition of the job forks off the end of the shared filter chain
+ * through a tee and gets its own scaler, video encoder and muxer.  Audio
+ * is encoded once and teed to every muxer.  A branch runs with a shallow
+ * copy of the parent job that differs only in geometry, rate control,
+ * encoder options, output file and fifos.
+ */
+static hb_ladder_t * ladder_init( hb_job_t * job )
+{
+    hb_ladder_t      * ladder = calloc( 1, sizeof( hb_ladder_t ) );
+    hb_fifo_t        * fifo_out;
+    hb_work_object_t * tee;
+    int                i;
+
+    ladder->list_branch = hb_list_init();
+    ladder->list_fifo   = hb_list_init();
+
+    fifo_out = hb_fifo_init( FIFO_MINI, FIFO_MINI_WAKE );
+    hb_fifo_set_mem( fifo_out, job->mem );
+    hb_list_add( ladder->list_fifo, fifo_out );
+    tee = hb_tee_init( job->fifo_render, fifo_out );
+
+    for( i = 0; i < hb_list_count( job->list_rendition ); i++ )
+    {
+        hb_rendition_t   * rendition = hb_list_item( job->list_rendition, i );
+        hb_branch_t      * branch = calloc( 1, sizeof( hb_branch_t ) );
+        hb_job_t         * bj = malloc( sizeof( hb_job_t ) );
+        hb_filter_init_t   init;
+        char               settings[64];
+
+        memcpy( bj, job, sizeof( hb_job_t ) );
+        bj->width = rendition->width & ~1;
+        if( rendition->height > 0 )
+            bj->height = rendition->height & ~1;
+        else
+            bj->height = ( rendition->width * job->height / job->width ) & ~1;
+
+        /* Keep the display aspect of the parent's output when the
+         * rendition's storage size has another shape */
+        if( bj->width * job->height != bj->height * job->width )
+        {
+            int64_t par_width  = job->anamorphic.par_width;
+            int64_t par_height = job->anamorphic.par_height;
+
+            if( par_width <= 0 || par_height <= 0 )
+            {
+                par_width = par_height = 1;
+            }
+            hb_limit_rational64( &par_width, &par_height,
+                                 par_width  * job->width  * bj->height,
+                                 par_height * job->height * bj->width,
+                                 65535 );
+            bj->anamorphic.par_width  = par_width;
+            bj->anamorphic.par_height = par_height;
+            if( !bj->anamorphic.mode && par_width != par_height )
+            {
+                // the encoders only signal the pixel aspect when anamorphic
+                bj->anamorphic.mode = 3;
+            }
+            reduce_par( bj );
+        }
+        if( rendition->vbitrate > 0 )
+        {
+            bj->vbitrate = rendition->vbitrate;
+            bj->vquality = -1.0;
+        }
+        else if( rendition->vquality >= 0 )
+        {
+            bj->vquality = rendition->vquality;
+        }
+        if( rendition->encoder_options != NULL )
+            bj->encoder_options = rendition->encoder_options;
+        bj->file           = rendition->file;
+        bj->fifo_render    = hb_fifo_init( FIFO_MINI, FIFO_MINI_WAKE );
+        bj->fifo_mpeg4     = hb_fifo_init( FIFO_LARGE, FIFO_LARGE_WAKE );
+        hb_fifo_set_mem( bj->fifo_render, job->mem );
+        hb_fifo_set_mem( bj->fifo_mpeg4, job->mem );
+        bj->list_work      = hb_list_init();
+        bj->list_audio     = hb_list_init(); // filled by ladder_start_audio
+        bj->list_subtitle  = hb_list_init();
+        bj->list_rendition = NULL;
+        bj->mux_data       = NULL;
+        memset( &bj->config, 0, sizeof( bj->config ) );
+        branch->job = bj;
+
+        branch->fifo_in = hb_fifo_init( FIFO_MINI, FIFO_MINI_WAKE );
+        hb_fifo_set_mem( branch->fifo_in, job->mem );
+        hb_tee_add_output( tee, branch->fifo_in );
+
+        /* Scale from the output of the shared filter chain */
+        memset( &init, 0, sizeof( init ) );
+        init.job        = bj;
+        init.pix_fmt    = AV_PIX_FMT_YUV420P;
+        init.width      = job->width;
+        init.height     = job->height;
+        init.par_width  = job->anamorphic.par_width;
+        init.par_height = job->anamorphic.par_height;
+        init.vrate      = job->vrate;
+        init.vrate_base = job->vrate_base;
+        init.cfr        = job->cfr;
+        snprintf( settings, sizeof( settings ), "%d:%d:0:0:0:0",
+                  bj->width, bj->height );
+        branch->scale = hb_filter_init( HB_FILTER_CROP_SCALE );
+        branch->scale->settings = strdup( settings );
+        branch->scale->init( branch->scale, &init );
+        branch->scale->fifo_in  = branch->fifo_in;
+        branch->scale->fifo_out = bj->fifo_render;
+
+        branch->encoder = video_encoder( bj );
+        branch->encoder->fifo_in  = bj->fifo_render;
+        branch->encoder->fifo_out = bj->fifo_mpeg4;
+        branch->encoder->config   = &bj->config;
+
+        hb_log( "work: rendition %d, %dx%d -> %s", i + 1,
+                bj->width, bj->height, bj->file );
+        hb_list_add( ladder->list_branch, branch );
+    }
+
+    hb_list_add( job->list_work, tee );
+    job->fifo_render = fifo_out;
+
+    return ladder;
+}
+
+static int ladder_start_video( hb_job_t * job, hb_ladder_t * ladder )
+{
+    int i;
+
+    for( i = 0; i < hb_list_count( ladder->list_branch ); i++ )
+    {
+        hb_branch_t * branch = hb_list_item( ladder->list_branch, i );
+
+        branch->scale->done = &job->done;
+        branch->scale->thread = hb_thread_init( branch->scale->name,
+                                                filter_loop, branch->scale,
+                                                HB_LOW_PRIORITY );
+
+        branch->encoder->done = &job->done;
+        branch->encoder->thread_sleep_interval = 10;
+        if( branch->encoder->init( branch->encoder, branch->job ) )
+        {
+            hb_error( "Failure to initialise thread '%s'",
+                      branch->encoder->name );
+            return 1;
+        }
+        branch->encoder->thread = hb_thread_init( branch->encoder->name,
+                                                  work_loop, branch->encoder,
+                                                  HB_LOW_PRIORITY );
+    }
+    return 0;
+}
+
+/*
+ * Runs after the audio encoders are initialized and before the parent
+ * muxer is created.  The encoders keep writing to the original
+ * audio->priv.fifo_out, which now feeds a tee.
+ */
+static void ladder_start_audio( hb_job_t * job, hb_ladder_t * ladder )
+{
+    int i, j;
+
+    for( i = 0; i < hb_list_count( job->list_audio ); i++ )
+    {
+        hb_audio_t       * audio = hb_list_item( job->list_audio, i );
+        hb_fifo_t        * fifo_mux;
+        hb_work_object_t * tee;
+
+        fifo_mux = hb_fifo_init( FIFO_LARGE, FIFO_LARGE_WAKE );
+        hb_fifo_set_mem( fifo_mux, job->mem );
+        tee = hb_tee_init( audio->priv.fifo_out, fifo_mux );
+        hb_list_add( ladder->list_fifo, audio->priv.fifo_out );
+        audio->priv.fifo_out = fifo_mux;
+
+        for( j = 0; j < hb_list_count( ladder->list_branch ); j++ )
+        {
+            hb_branch_t * branch = hb_list_item( ladder->list_branch, j );
+            hb_audio_t  * copy = malloc( sizeof( hb_audio_t ) );
+
+            memcpy( copy, audio, sizeof( hb_audio_t ) );
+            copy->priv.fifo_out = hb_fifo_init( FIFO_LARGE, FIFO_LARGE_WAKE );
+            hb_fifo_set_mem( copy->priv.fifo_out, job->mem );
+            copy->priv.mux_data = NULL;
+            hb_tee_add_output( tee, copy->priv.fifo_out );
+            hb_list_add( branch->job->list_audio, copy );
+        }
+
+        tee->done = &job->done;
+        tee->thread = hb_thread_init( tee->name, work_loop, tee,
+                                      HB_LOW_PRIORITY );
+        hb_list_add( job->list_work, tee );
+    }
+}
+
+/*
+ * Runs the muxer of a branch like do_job runs the parent's.  Ends when
+ * every track of the branch is muxed or the job dies.
+ */
+static void ladder_mux_loop( void * _branch )
+{
+    hb_branch_t      * branch = _branch;
+    hb_work_object_t * w = branch->muxer;
+    hb_buffer_t      * buf_in;
+
+    hb_mem_set_stage( work_mem_stage( w ) );
+    while( !*branch->job->die && !*w->done && w->status != HB_WORK_DONE )
+    {
+        buf_in = hb_fifo_get_wait( w->fifo_in );
+        if( buf_in == NULL )
+            continue;
+        if( *branch->job->die )
+        {
+            hb_buffer_close( &buf_in );
+            break;
+        }
+        w->status = w->work( w, &buf_in, NULL );
+        if( buf_in )
+        {
+            hb_buffer_close( &buf_in );
+        }
+    }
+}
+
+static int ladder_start_mux( hb_job_t * job, hb_ladder_t * ladder )
+{
+    int i;
+
+    for( i = 0; i < hb_list_count( ladder->list_branch ); i++ )
+    {
+        hb_branch_t * branch = hb_list_item( ladder->list_branch, i );
+
+        branch->muxer = hb_muxer_init( branch->job );
+        if( branch->muxer == NULL )
+        {
+            return 1;
+        }
+        branch->muxer->thread = hb_thread_init( branch->muxer->name,
+                                                ladder_mux_loop, branch,
+                                                HB_NORMAL_PRIORITY );
+    }
+    return 0;
+}
+
+/* Wait for every rendition to finish muxing */
+static void ladder_wait( hb_ladder_t * ladder )
+{
+    int i;
+
+    for( i = 0; i < hb_list_count( ladder->list_branch ); i++ )
+    {
+        hb_branch_t * branch = hb_list_item( ladder->list_branch, i );
+
+        if( branch->muxer != NULL && branch->muxer->thread != NULL )
+        {
+            hb_thread_close( &branch->muxer->thread );
+        }
+    }
+}
+
+static void ladder_close( hb_ladder_t ** _ladder )
+{
+    hb_ladder_t      * ladder = *_ladder;
+    hb_branch_t      * branch;
+    hb_work_object_t * w;
+    hb_audio_t       * audio;
+    hb_fifo_t        * fifo;
+
+    if( ladder == NULL )
+        return;
+
+    while( ( branch = hb_list_item( ladder->list_branch, 0 ) ) )
+    {
+        hb_list_rem( ladder->list_branch, branch );
+
+        if( branch->scale->thread != NULL )
+        {
+            hb_thread_close( &branch->scale->thread );
+        }
+        branch->scale->close( branch->scale );
+        hb_filter_close( &branch->scale );
+
+        if( branch->encoder->thread != NULL )
+        {
+            hb_thread_close( &branch->encoder->thread );
+            branch->encoder->close( branch->encoder );
+        }
+        free( branch->encoder );
+
+        if( branch->muxer != NULL )
+        {
+            if( branch->muxer->thread != NULL )
+            {
+                hb_thread_close( &branch->muxer->thread );
+            }
+            branch->muxer->close( branch->muxer );
+            free( branch->muxer );
+        }
+
+        /* Audio and subtitle mux workers of the branch */
+        while( ( w = hb_list_item( branch->job->list_work, 0 ) ) )
+        {
+            hb_list_rem( branch->job->list_work, w );
+            if( w->thread != NULL )
+            {
+                hb_thread_close( &w->thread );
+                w->close( w );
+            }
+            free( w );
+        }
+        hb_list_close( &branch->job->list_work );
+
+        while( ( audio = hb_list_item( branch->job->list_audio, 0 ) ) )
+        {
+            hb_list_rem( branch->job->list_audio, audio );
+            hb_fifo_close( &audio->priv.fifo_out );
+            free( audio );
+        }
+        hb_list_close( &branch->job->list_audio );
+        hb_list_close( &branch->job->list_subtitle );
+
+        hb_fifo_close( &branch->fifo_in );
+        hb_fifo_close( &branch->job->fifo_render );
+        hb_fifo_close( &branch->job->fifo_mpeg4 );
+        free( branch->job );
+        free( branch );
+    }
+    hb_list_close( &ladder->list_branch );
+
+    while( ( fifo = hb_list_item( ladder->list_fifo, 0 ) ) )
+    {
+        hb_list_rem( ladder->list_fifo, fifo );
+        hb_fifo_close( &fifo );
+    }
+    hb_list_close( &ladder->list_fifo );
+
+    free( ladder );
+    *_ladder = NULL;
+}
+
+/* Pipeline stage that the buffers allocated by a work object count to */
+static int work_mem_stage( hb_work_object_t * w )
+{
+    switch( w->id )
+    {
+        case WORK_READER:
+            return HB_MEM_STAGE_READER;
+        case WORK_DECCC608:
+        case WORK_DECVOBSUB:
+        case WORK_DECSRTSUB:
+        case WORK_DECUTF8SUB:
+        case WORK_DECTX3GSUB:
+        case WORK_DECSSASUB:
+        case WORK_DECPGSSUB:
+        case WORK_DECAVCODEC:
+        case WORK_DECAVCODECV:
+        case WORK_DECLPCM:
+            return HB_MEM_STAGE_DECODE;
+        case WORK_SYNC_VIDEO:
+        case WORK_SYNC_AUDIO:
+            return HB_MEM_STAGE_SYNC;
+        case WORK_RENDER:
+            return HB_MEM_STAGE_FILTER;
+        case WORK_ENCVOBSUB:
+        case WORK_ENCAVCODEC:
+        case WORK_ENCQSV:
+        case WORK_ENCX264:
+        case WORK_ENCX265:
+        case WORK_ENCTHEORA:
+        case WORK_ENCLAME:
+        case WORK_ENCVORBIS:
+        case WORK_ENC_CA_AAC:
+        case WORK_ENC_CA_HAAC:
+        case WORK_ENCAVCODEC_AUDIO:
+            return HB_MEM_STAGE_ENCODE;
+        case WORK_MUX:
+            return HB_MEM_STAGE_MUX;
+        default:
+            return HB_MEM_STAGE_OTHER;
+    }
+}
+
+/*
+ * Lets the bounded fifos of the job shrink under memory pressure.
+ * The raw subtitle fifos are left alone, they must stay effectively
+ * unbounded (see the comment where they are created).
+ */
+static void attach_fifos( hb_job_t * job )
+{
+    hb_audio_t    * audio;
+    hb_subtitle_t * subtitle;
+    int             i;
+
+    if( job->mem_limit <= 0 )
+        return;
+
+    hb_fifo_set_mem( job->fifo_mpeg2, job->mem );
+    hb_fifo_set_mem( job->fifo_raw, job->mem );
+    hb_fifo_set_mem( job->fifo_sync, job->mem );
+    hb_fifo_set_mem( job->fifo_render, job->mem );
+    hb_fifo_set_mem( job->fifo_mpeg4, job->mem );
+
+    for( i = 0; i < hb_list_count( job->list_audio ); i++ )
+    {
+        audio = hb_list_item( job->list_audio, i );
+        hb_fifo_set_mem( audio->priv.fifo_raw, job->mem );
+        hb_fifo_set_mem( audio->priv.fifo_sync, job->mem );
+        hb_fifo_set_mem( audio->priv.fifo_out, job->mem );
+        hb_fifo_set_mem( audio->priv.fifo_in, job->mem );
+    }
+    for( i = 0; i < hb_list_count( job->list_subtitle ); i++ )
+    {
+        subtitle = hb_list_item( job->list_subtitle, i );
+        hb_fifo_set_mem( subtitle->fifo_in, job->mem );
+        hb_fifo_set_mem( subtitle->fifo_sync, job->mem );
+        hb_fifo_set_mem( subtitle->fifo_out, job->mem );
+    }
+    for( i = 0; job->list_filter && i < hb_list_count( job->list_filter ); i++ )
+    {
+        hb_filter_object_t * filter = hb_list_item( job->list_filter, i );
+        hb_fifo_set_mem( filter->fifo_out, job->mem );
+    }
+}
+
+static int fifo_depth( hb_fifo_t * f )
+{
+    return f != NULL ? hb_fifo_size( f ) : 0;
+}
+
+/*
+ * Fills the queue depths of a working state: the buffers that wait in
+ * the fifos feeding each stage of the job.
+ */
+void hb_work_get_queue_state( hb_job_t * job, hb_state_t * state )
+{
+    int           * depth = state->param.working.queue_depth;
+    hb_audio_t    * audio;
+    hb_subtitle_t * subtitle;
+    int             i;
+
+    memset( depth, 0, sizeof( state->param.working.queue_depth ) );
+
+    depth[HB_MEM_STAGE_DECODE] += fifo_depth( job->fifo_mpeg2 );
+    depth[HB_MEM_STAGE_SYNC]   += fifo_depth( job->fifo_raw );
+    depth[HB_MEM_STAGE_FILTER] += fifo_depth( job->fifo_sync );
+    depth[HB_MEM_STAGE_ENCODE] += fifo_depth( job->fifo_render );
+    depth[HB_MEM_STAGE_MUX]    += fifo_depth( job->fifo_mpeg4 );
+
+    // between two filters, the last one feeds fifo_render
+    for( i = 0; job->list_filter && i < hb_list_count( job->list_filter ) - 1; i++ )
+    {
+        hb_filter_object_t * filter = hb_list_item( job->list_filter, i );
+        depth[HB_MEM_STAGE_FILTER] += fifo_depth( filter->fifo_out );
+    }
+    for( i = 0; i < hb_list_count( job->list_audio ); i++ )
+    {
+        audio = hb_list_item( job->list_audio, i );
+        depth[HB_MEM_STAGE_DECODE] += fifo_depth( audio->priv.fifo_in );
+        depth[HB_MEM_STAGE_SYNC]   += fifo_depth( audio->priv.fifo_raw );
+        depth[HB_MEM_STAGE_ENCODE] += fifo_depth( audio->priv.fifo_sync );
+        depth[HB_MEM_STAGE_MUX]    += fifo_depth( audio->priv.fifo_out );
+    }
+    for( i = 0; i < hb_list_count( job->list_subtitle ); i++ )
+    {
+        subtitle = hb_list_item( job->list_subtitle, i );
+        depth[HB_MEM_STAGE_DECODE] += fifo_depth( subtitle->fifo_in );
+        depth[HB_MEM_STAGE_SYNC]   += fifo_depth( subtitle->fifo_raw );
+        depth[HB_MEM_STAGE_MUX]    += fifo_depth( subtitle->fifo_out );
+    }
+}
+
+/* Filters that hold frames back and then release them in bursts */
+static int filter_is_bursty( hb_filter_object_t * filter )
+{
+    switch( filter->id )
+    {
+        case HB_FILTER_DECOMB:
+        case HB_FILTER_DEINTERLACE:
+        case HB_FILTER_DETELECINE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Encoders that take a lookahead's worth of frames before output starts */
+static int encoder_is_bursty( hb_job_t * job )
+{
+    return job->vcodec == HB_VCODEC_X264 || job->vcodec == HB_VCODEC_X265;
+}
+
+/*
+ * Bounds the fifos that carry uncompressed video by bytes as well as by
+ * count, so that a 4K job doesn't queue 16x the memory of an SD job.
+ * Their capacity then adapts to how the stages on either side run (see
+ * hb_fifo_set_adaptive): fifos in front of bursty stages may grow up to
+ * what fits in FIFO_FRAME_BYTES, the others may only shrink.
+ */
+static void size_fifos( hb_job_t * job )
+{
+    hb_filter_object_t * filter, * next;
+    int64_t              frame;
+    int                  deep, i, count;
+
+#ifdef USE_QSV
+    if( hb_qsv_decode_is_enabled( job ) )
+        return;
+#endif
+    if( job->indepth_scan )
+        return;
+
+    frame = (int64_t)MAX( job->title->width * job->title->height,
+                          job->width * job->height ) * 3 / 2;
+    deep  = MIN( MAX( FIFO_FRAME_BYTES / MAX( frame, 1 ), FIFO_MINI ),
+                 FIFO_LARGE );
+
+    hb_fifo_set_max_bytes( job->fifo_raw, FIFO_FRAME_BYTES );
+    hb_fifo_set_adaptive( job->fifo_raw, FIFO_MINI, MIN( deep, FIFO_SMALL ) );
+
+    count  = job->list_filter ? hb_list_count( job->list_filter ) : 0;
+    filter = count ? hb_list_item( job->list_filter, 0 ) : NULL;
+    hb_fifo_set_max_bytes( job->fifo_sync, FIFO_FRAME_BYTES );
+    hb_fifo_set_adaptive( job->fifo_sync, FIFO_MINI,
+                          filter && filter_is_bursty( filter ) ?
+                          deep : MIN( deep, FIFO_SMALL ) );
+
+    for( i = 0; i < count; i++ )
+    {
+        int bursty;
+
+        filter = hb_list_item( job->list_filter, i );
+        next   = i + 1 < count ? hb_list_item( job->list_filter, i + 1 ) : NULL;
+        bursty = next ? filter_is_bursty( next ) : encoder_is_bursty( job );
+
+        hb_fifo_set_max_bytes( filter->fifo_out, FIFO_FRAME_BYTES );
+        hb_fifo_set_adaptive( filter->fifo_out, FIFO_MINI / 2,
+                              bursty ? deep : FIFO_MINI );
+    }
+}
+
+/*
+ * Burn in at most one subtitle track and pass through the rest, as far as
+ * the container and the tracks allow, and add the subtitle renderer if a
+ * track is burned in.
+ */
+static void sanitize_subtitles( hb_job_t * job )
+{
+    hb_subtitle_t * subtitle;
+    uint8_t one_burned = 0;
+    int i;
+
+    for( i = 0; i < hb_list_count( job->list_subtitle ); )
+    {
+        subtitle = hb_list_item( job->list_subtitle, i );
+        if ( subtitle->config.dest == RENDERSUB )
+        {
+            if ( one_burned )
+            {
+                if ( !hb_subtitle_can_pass(subtitle->source, job->mux) )
+                {
+                    hb_log( "More than one subtitle burn-in requested, dropping track %d.", i );
+                    hb_list_rem( job->list_subtitle, subtitle );
+                    free( subtitle );
+                    continue;
+                }
+                else
+                {
+                    hb_log( "More than one subtitle burn-in requested.  Changing track %d to soft subtitle.", i );
+                    subtitle->config.dest = PASSTHRUSUB;
+                }
+            }
+            else if ( !hb_subtitle_can_burn(subtitle->source) )
+            {
+                hb_log( "Subtitle burn-in requested and input track can not be rendered.  Changing track %d to soft subtitle.", i );
+                subtitle->config.dest = PASSTHRUSUB;
+            }
+            else
+            {
+                one_burned = 1;
+            }
+        }
+
+        if ( subtitle->config.dest == PASSTHRUSUB &&
+             !hb_subtitle_can_pass(subtitle->source, job->mux) )
+        {
+            if ( !one_burned )
+            {
+                hb_log( "Subtitle pass-thru requested and input track is not compatible with container.  Changing track %d to burned-in subtitle.", i );
+                subtitle->config.dest = RENDERSUB;
+                subtitle->config.default_track = 0;
+                one_burned = 1;
+            }
+            else
+            {
+                hb_log( "Subtitle pass-thru requested and input track is not compatible with container.  One track already burned, dropping track %d.", i );
+                hb_list_rem( job->list_subtitle, subtitle );
+                free( subtitle );
+                continue;
+            }
+        }
+        /* Adjust output track number, in case we removed one.
+         * Output tracks sadly still need to be in sequential order.
+         * Note: out.track starts at 1, i starts at 0 */
+        subtitle->out_track = ++i;
+    }
+    if (one_burned)
+    {
+        // Add subtitle rendering filter
+        // Note that if the filter is already in the filter chain, this
+        // has no effect. Note also that this means the front-end is
+        // not required to add the subtitle rendering filter since
+        // we will always try to do it here.
+        hb_filter_object_t *filter = hb_filter_init(HB_FILTER_RENDER_SUB);
+        char *filter_settings      = hb_strdup_printf("%d:%d:%d:%d",
+                                                      job->crop[0],
+                                                      job->crop[1],
+                                                      job->crop[2],
+                                                      job->crop[3]);
+        hb_add_filter(job, filter, filter_settings);
+        free(filter_settings);
+    }
+}
+
+/*
+ * Resolve Auto Passthru, drop the tracks that can't be passed through and
+ * replace unset or unsupported encoder settings with ones the encoder
+ * supports.
+ */
+static void sanitize_audio(hb_job_t *job)
+{
+    hb_audio_t *audio;
+    int i;
+
+    // apply Auto Passthru settings
+    hb_autopassthru_apply_settings(job);
+    // sanitize audio settings
+    for (i = 0; i < hb_list_count(job->list_audio);)
+    {
+        audio = hb_list_item(job->list_audio, i);
+        if (audio->config.out.codec == HB_ACODEC_AUTO_PASS)
+        {
+            // Auto Passthru should have been handled above
+            // remove track to avoid a crash
+            hb_log("Auto Passthru error, dropping track %d",
+                   audio->config.out.track);
+            hb_list_rem(job->list_audio, audio);
+            free(audio);
+            continue;
+        }
+        if ((audio->config.out.codec & HB_ACODEC_PASS_FLAG) &&
+            !(audio->config.in.codec &
+              audio->config.out.codec & HB_ACODEC_PASS_MASK))
+        {
+            hb_log("Passthru requested and input codec is not the same as output codec for track %d, dropping track",
+                   audio->config.out.track);
+            hb_list_rem(job->list_audio, audio);
+            free(audio);
+            continue;
+        }
+        /* Adjust output track number, in case we removed one.
+         * Output tracks sadly still need to be in sequential order.
+         * Note: out.track starts at 1, i starts at 0 */
+        audio->config.out.track = ++i;
+    }
+
+    int best_mixdown    = 0;
+    int best_bitrate    = 0;
+    int best_samplerate = 0;
+
+    for (i = 0; i < hb_list_count(job->list_audio); i++)
+    {
+        audio = hb_list_item(job->list_audio, i);
+
+        /* Passthru audio, nothing to sanitize here */
+        if (audio->config.out.codec & HB_ACODEC_PASS_FLAG)
+            continue;
+
+        /* Vorbis language information */
+        if (audio->config.out.codec == HB_ACODEC_VORBIS)
+            audio->priv.config.vorbis.language = audio->config.lang.simple;
+
+        /* sense-check the requested samplerate */
+        if (audio->config.out.samplerate < 0)
+        {
+            // if not specified, set to same as input
+            audio->config.out.samplerate = audio->config.in.samplerate;
+        }
+        best_samplerate =
+            hb_audio_samplerate_get_best(audio->config.out.codec,
+                                         audio->config.out.samplerate,
+                                         NULL);
+        if (best_samplerate != audio->config.out.samplerate)
+        {
+            hb_log("work: sanitizing track %d unsupported samplerate %d Hz to %s kHz",
+                   audio->config.out.track, audio->config.out.samplerate,
+                   hb_audio_samplerate_get_name(best_samplerate));
+            audio->config.out.samplerate = best_samplerate;
+        }
+
+        /* sense-check the requested mixdown */
+        if (audio->config.out.mixdown <= HB_AMIXDOWN_NONE)
+        {
+            /* Mixdown not specified, set the default mixdown */
+            audio->config.out.mixdown =
+                hb_mixdown_get_default(audio->config.out.codec,
+                                       audio->config.in.channel_layout);
+            hb_log("work: mixdown not specified, track %d setting mixdown %s",
+                   audio->config.out.track,
+                   hb_mixdown_get_name(audio->config.out.mixdown));
+        }
+        else
+        {
+            best_mixdown =
+                hb_mixdown_get_best(audio->config.out.codec,
+                                    audio->config.in.channel_layout,
+                                    audio->config.out.mixdown);
+            if (audio->config.out.mixdown != best_mixdown)
+            {
+                /* log the output mixdown */
+                hb_log("work: sanitizing track %d mixdown %s to %s",
+                       audio->config.out.track,
+                       hb_mixdown_get_name(audio->config.out.mixdown),
+                       hb_mixdown_get_name(best_mixdown));
+                audio->config.out.mixdown = best_mixdown;
+            }
+        }
+
+        /* sense-check the requested compression level */
+        if (audio->config.out.compression_level < 0)
+        {
+            audio->config.out.compression_level =
+                hb_audio_compression_get_default(audio->config.out.codec);
+            if (audio->config.out.compression_level >= 0)
+            {
+                hb_log("work: compression level not specified, track %d setting compression level %.2f",
+                       audio->config.out.track,
+                       audio->config.out.compression_level);
+            }
+        }
+        else
+        {
+            float best_compression =
+                hb_audio_compression_get_best(audio->config.out.codec,
+                                              audio->config.out.compression_level);
+            if (best_compression != audio->config.out.compression_level)
+            {
+                if (best_compression == -1)
+                {
+                    hb_log("work: track %d, compression level not supported by codec",
+                           audio->config.out.track);
+                }
+                else
+                {
+                    hb_log("work: sanitizing track %d compression level %.2f to %.2f",
+                           audio->config.out.track,
+                           audio->config.out.compression_level,
+                           best_compression);
+                }
+                audio->config.out.compression_level = best_compression;
+            }
+        }
+
+        /* sense-check the requested quality */
+        if (audio->config.out.quality != HB_INVALID_AUDIO_QUALITY)
+        {
+            float best_quality =
+                hb_audio_quality_get_best(audio->config.out.codec,
+                                          audio->config.out.quality);
+            if (best_quality != audio->config.out.quality)
+            {
+                if (best_quality == HB_INVALID_AUDIO_QUALITY)
+                {
+                    hb_log("work: track %d, quality mode not supported by codec",
+                           audio->config.out.track);
+                }
+                else
+                {
+                    hb_log("work: sanitizing track %d quality %.2f to %.2f",
+                           audio->config.out.track,
+                           audio->config.out.quality, best_quality);
+                }
+                audio->config.out.quality = best_quality;
+            }
+        }
+
+        /* sense-check the requested bitrate */
+        if (audio->config.out.quality == HB_INVALID_AUDIO_QUALITY)
+        {
+            if (audio->config.out.bitrate <= 0)
+            {
+                /* Bitrate not specified, set the default bitrate */
+                audio->config.out.bitrate =
+                    hb_audio_bitrate_get_default(audio->config.out.codec,
+                                                 audio->config.out.samplerate,
+                                                 audio->config.out.mixdown);
+                if (audio->config.out.bitrate > 0)
+                {
+                    hb_log("work: bitrate not specified, track %d setting bitrate %d Kbps",
+                           audio->config.out.track,
+                           audio->config.out.bitrate);
+                }
+            }
+            else
+            {
+                best_bitrate =
+                    hb_audio_bitrate_get_best(audio->config.out.codec,
+                                              audio->config.out.bitrate,
+                                              audio->config.out.samplerate,
+                                              audio->config.out.mixdown);
+                if (best_bitrate > 0 &&
+                    best_bitrate != audio->config.out.bitrate)
+                {
+                    /* log the output bitrate */
+                    hb_log("work: sanitizing track %d bitrate %d to %d Kbps",
+                           audio->config.out.track,
+                           audio->config.out.bitrate, best_bitrate);
+                }
+                audio->config.out.bitrate = best_bitrate;
+            }
+        }
+
+        /* sense-check the requested dither */
+        if (hb_audio_dither_is_supported(audio->config.out.codec))
+        {
+            if (audio->config.out.dither_method ==
+                hb_audio_dither_get_default())
+            {
+                /* "auto", enable with default settings */
+                audio->config.out.dither_method =
+                    hb_audio_dither_get_default_method();
+            }
+        }
+        else if (audio->config.out.dither_method !=
+                 hb_audio_dither_get_default())
+        {
+            /* specific dither requested but dithering not supported */
+            hb_log("work: track %d, dithering not supported by codec",
+                   audio->config.out.track);
+        }
+    }
+}
+
+static void reduce_par( hb_job_t * job )
+{
+    if( job->anamorphic.mode )
+    {
+        /* While x264 is smart enough to reduce fractions on its own, libavcodec and
+         * the MacGUI need some help with the math, so lose superfluous factors. */
+        hb_reduce( &job->anamorphic.par_width, &job->anamorphic.par_height,
+                    job->anamorphic.par_width,  job->anamorphic.par_height );
+        if( job->vcodec & HB_VCODEC_FFMPEG_MASK )
+        {
+            /* Just to make working with ffmpeg even more fun,
+             * lavc's MPEG-4 encoder can't handle PAR values >= 255,
+             * even though AVRational does. Adjusting downwards
+             * distorts the display aspect slightly, but such is life. */
+            while( ( job->anamorphic.par_width  & ~0xFF ) ||
+                   ( job->anamorphic.par_height & ~0xFF ) )
+            {
+                job->anamorphic.par_width  >>= 1;
+                job->anamorphic.par_height >>= 1;
+                hb_reduce( &job->anamorphic.par_width, &job->anamorphic.par_height,
+                            job->anamorphic.par_width,  job->anamorphic.par_height );
+            }
+        }
+    }
+}
+
+/*
+ * What the init of the filters that change the picture geometry or the
+ * frame rate does to init, without initializing them (which may start
+ * threads).  Has to follow hb_crop_scale_init, hb_rotate_init and
+ * hb_vfr_init.
+ */
+static void filter_geometry( hb_filter_object_t * filter,
+                             hb_filter_init_t * init )
+{
+    switch( filter->id )
+    {
+        case HB_FILTER_CROP_SCALE:
+        {
+            int width  = init->width - ( init->crop[2] + init->crop[3] );
+            int height = init->height - ( init->crop[0] + init->crop[1] );
+
+            if( filter->settings )
+            {
+                sscanf( filter->settings, "%d:%d:%d:%d:%d:%d",
+                        &width, &height, &init->crop[0], &init->crop[1],
+                        &init->crop[2], &init->crop[3] );
+            }
+            init->width  = width;
+            init->height = height;
+        } break;
+
+        case HB_FILTER_ROTATE:
+        {
+            int mode = 3, tmp;
+
+            if( filter->settings )
+            {
+                sscanf( filter->settings, "%d", &mode );
+            }
+            if( mode & 4 )
+            {
+                tmp = init->width;
+                init->width = init->height;
+                init->height = tmp;
+                tmp = init->par_width;
+                init->par_width = init->par_height;
+                init->par_height = tmp;
+            }
+        } break;
+
+        case HB_FILTER_VFR:
+        {
+            int cfr = init->cfr, vrate = init->vrate;
+            int vrate_base = init->vrate_base;
+
+            if( filter->settings )
+            {
+                sscanf( filter->settings, "%d:%d:%d",
+                        &cfr, &vrate, &vrate_base );
+            }
+            if( cfr != 2 || (double)init->vrate / init->vrate_base >
+                            (double)vrate / vrate_base )
+            {
+                init->vrate = vrate;
+                init->vrate_base = vrate_base;
+            }
+            init->cfr = cfr;
+        } break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * Dry run of the setup do_job does before it starts reading.  Works on a
+ * copy of the job and leaves the source alone; filters and encoders are
+ * not initialized, only their settings are checked.
+ * @param job Handle to hb_job_t.
+ * @return The resolved copy of the job, or NULL if it can't be encoded.
+ */
+hb_job_t * hb_job_validate( hb_job_t * job )
+{
+    hb_title_t       * title;
+    hb_job_t         * v;
+    hb_audio_t       * audio;
+    hb_work_object_t * w;
+    int                i, errors = 0;
+
+    if( job == NULL || job->title == NULL )
+        return NULL;
+    title = job->title;
+    v = hb_job_copy( job );
+
+    if( title->video_codec == WORK_NONE )
+    {
+        hb_log( "validate: no video decoder for title %d", title->index );
+        errors++;
+    }
+    if( v->file == NULL || !*v->file )
+    {
+        hb_log( "validate: no output file" );
+        errors++;
+    }
+    if( hb_container_get_name( v->mux ) == NULL )
+    {
+        hb_log( "validate: invalid container %#x", v->mux );
+        errors++;
+    }
+    if( !v->pts_to_stop && !v->frame_to_stop &&
+        ( v->chapter_start < 1 || v->chapter_end < v->chapter_start ||
+          v->chapter_end > hb_list_count( title->list_chapter ) ) )
+    {
+        hb_log( "validate: invalid chapter range %d to %d",
+                v->chapter_start, v->chapter_end );
+        errors++;
+    }
+
+    if( !v->indepth_scan )
+    {
+        sanitize_subtitles( v );
+    }
+
+    // Same as the filter initialization in do_job
+    if( v->list_filter && hb_list_count( v->list_filter ) )
+    {
+        hb_filter_init_t init;
+
+        memset( &init, 0, sizeof( init ) );
+        init.job = v;
+        init.pix_fmt = AV_PIX_FMT_YUV420P;
+        init.width = title->width;
+        init.height = title->height;
+        init.par_width = v->anamorphic.par_width;
+        init.par_height = v->anamorphic.par_height;
+        memcpy(init.crop, title->crop, sizeof(int[4]));
+        init.vrate_base = title->rate_base;
+        init.vrate = title->rate;
+        init.cfr = 0;
+        for( i = 0; i < hb_list_count( v->list_filter ); i++ )
+        {
+            filter_geometry( hb_list_item( v->list_filter, i ), &init );
+        }
+        v->width = init.width;
+        v->height = init.height;
+        v->anamorphic.par_width = init.par_width;
+        v->anamorphic.par_height = init.par_height;
+        memcpy(v->crop, init.crop, sizeof(int[4]));
+        v->vrate_base = init.vrate_base;
+        v->vrate = init.vrate;
+        v->cfr = init.cfr;
+    }
+    reduce_par( v );
+    if( v->width <= 0 || v->height <= 0 )
+    {
+        hb_log( "validate: invalid output size %dx%d", v->width, v->height );
+        errors++;
+    }
+
+    if( ( w = video_encoder( v ) ) == NULL )
+    {
+        hb_log( "validate: invalid video encoder %#x", v->vcodec );
+        errors++;
+    }
+    free( w );
+    if( v->vcodec == HB_VCODEC_X264 )
+    {
+        if( hb_x264_param_check( v->encoder_preset, v->encoder_tune,
+                                 v->encoder_options, v->encoder_profile,
+                                 v->encoder_level, v->width, v->height ) )
+        {
+            errors++;
+        }
+        else
+        {
+            // The options that differ from the preset and tune
+            char * options;
+            options = hb_x264_param_unparse( v->encoder_preset,
+                                             v->encoder_tune,
+                                             v->encoder_options,
+                                             v->encoder_profile,
+                                             v->encoder_level,
+                                             v->width, v->height );
+            free( v->encoder_options );
+            v->encoder_options = options;
+        }
+    }
+
+    if( !v->indepth_scan )
+    {
+        sanitize_audio( v );
+        for( i = 0; i < hb_list_count( v->list_audio ); i++ )
+        {
+            audio = hb_list_item( v->list_audio, i );
+            if( ( w = hb_codec_decoder( audio->config.in.codec ) ) == NULL )
+            {
+                hb_log( "validate: track %d, invalid input codec %d",
+                        audio->config.out.track, audio->config.in.codec );
+                errors++;
+            }
+            free( w );
+            if( audio->config.out.codec & HB_ACODEC_PASS_FLAG )
+                continue;
+            if( ( w = hb_codec_encoder( audio->config.out.codec ) ) == NULL )
+            {
+                hb_log( "validate: track %d, invalid audio codec %#x",
+                        audio->config.out.track, audio->config.out.codec );
+                errors++;
             }
+            free( w );
         }
     }
+
+    if( v->chapter_markers && v->chapter_start == v->chapter_end )
+    {
+        v->chapter_markers = 0;
+    }
+
+    if( errors )
+    {
+        hb_job_close( &v );
+        return NULL;
+    }
+    return v;
 }
 
-/* Corrects framerates when actual duration and frame count numbers are known. */
-void correct_framerate( hb_job_t * job )
+/*
+ * Sets the job up to write its output in checkpointed segments and, if
+ * an earlier run of the job left segments behind, to start where they
+ * end.
+ */
+static void checkpoint_setup( hb_job_t * job, int renditions )
 {
-    hb_interjob_t * interjob = hb_interjob_get( job->h );
+    hb_chapter_t * chapter;
+    int64_t        resume, start = 0;
+    int            i;
 
-    if( ( job->sequence_id & 0xFFFFFF ) != ( interjob->last_job & 0xFFFFFF) )
-        return; // Interjob information is for a different encode.
+    if( job->pass != 0 || renditions || job->start_at_preview ||
+        job->frame_to_start || job->frame_to_stop )
+    {
+        hb_log( "work: checkpoints require a single pass, single rendition "
+                "encode that isn't frame based, ignoring" );
+        return;
+    }
+    if( !( job->mux & HB_MUX_MASK_AV ) )
+    {
+        // the segments are joined with libavformat, which would not
+        // write the same file as mp4v2 or libmkv
+        hb_log( "work: checkpoints require the libavformat muxers "
+                "(av_mp4, av_mkv), ignoring" );
+        return;
+    }
+    job->checkpoint_state = hb_checkpoint_init( job );
+    if( job->checkpoint_state == NULL )
+    {
+        return;
+    }
+    resume = hb_checkpoint_resume( job->checkpoint_state );
+    if( resume <= 0 )
+    {
+        return;
+    }
 
-    // compute actual output vrate from first pass
-    interjob->vrate = job->vrate_base * ( (double)interjob->out_frame_count * 90000 / interjob->total_time );
-    interjob->vrate_base = job->vrate_base;
+    // Checkpoints are output times, pts_to_start counts from the start
+    // of the title
+    if( job->pts_to_start )
+    {
+        start = job->pts_to_start;
+    }
+    else
+    {
+        for( i = 0; i < job->chapter_start - 1; i++ )
+        {
+            chapter = hb_list_item( job->list_chapter, i );
+            start += chapter->duration;
+        }
+    }
+    job->pts_to_start = start + resume;
+    if( job->pts_to_stop )
+    {
+        job->pts_to_stop = MAX( job->pts_to_stop - resume, 1 );
+    }
+    hb_log( "work: resuming after %d checkpointed segment(s), at %.3f s",
+            hb_checkpoint_segments( job->checkpoint_state ),
+            (double)resume / 90000. );
 }
 
 /**
@@ -550,6 +1886,11 @@ static void do_job(hb_job_t *job)
     unsigned int subtitle_forced_id   = 0;
     unsigned int subtitle_forced_hits = 0;
     unsigned int subtitle_hit         = 0;
+    int spool_write = 0, spool_read = 0;
+    hb_fifo_t *fifo_spool = NULL;
+    int renditions = 0;
+    hb_ladder_t *ladder = NULL;
+    hb_work_pool_t *audio_pool = NULL;
 
     title = job->title;
     interjob = hb_interjob_get( job->h );
@@ -561,6 +1902,11 @@ static void do_job(hb_job_t *job)
 
     job->list_work = hb_list_init();
 
+    /* Buffers allocated by this thread and the ones it starts count
+     * against the job from here on */
+    job->mem = hb_mem_account_init( job->mem_limit );
+    hb_mem_set_context( job->mem, HB_MEM_STAGE_OTHER );
+
     /* OpenCL */
     if (job->use_opencl && (hb_ocl_init() || hb_init_opencl_run_env(0, NULL, "-I.")))
     {
@@ -637,78 +1983,7 @@ static void do_job(hb_job_t *job)
 
     if ( !job->indepth_scan )
     {
-        // Sanitize subtitles
-        uint8_t one_burned = 0;
-        for( i = 0; i < hb_list_count( job->list_subtitle ); )
-        {
-            subtitle = hb_list_item( job->list_subtitle, i );
-            if ( subtitle->config.dest == RENDERSUB )
-            {
-                if ( one_burned )
-                {
-                    if ( !hb_subtitle_can_pass(subtitle->source, job->mux) )
-                    {
-                        hb_log( "More than one subtitle burn-in requested, dropping track %d.", i );
-                        hb_list_rem( job->list_subtitle, subtitle );
-                        free( subtitle );
-                        continue;
-                    }
-                    else
-                    {
-                        hb_log( "More than one subtitle burn-in requested.  Changing track %d to soft subtitle.", i );
-                        subtitle->config.dest = PASSTHRUSUB;
-                    }
-                }
-                else if ( !hb_subtitle_can_burn(subtitle->source) )
-                {
-                    hb_log( "Subtitle burn-in requested and input track can not be rendered.  Changing track %d to soft subtitle.", i );
-                    subtitle->config.dest = PASSTHRUSUB;
-                }
-                else
-                {
-                    one_burned = 1;
-                }
-            }
-
-            if ( subtitle->config.dest == PASSTHRUSUB &&
-                 !hb_subtitle_can_pass(subtitle->source, job->mux) )
-            {
-                if ( !one_burned )
-                {
-                    hb_log( "Subtitle pass-thru requested and input track is not compatible with container.  Changing track %d to burned-in subtitle.", i );
-                    subtitle->config.dest = RENDERSUB;
-                    subtitle->config.default_track = 0;
-                    one_burned = 1;
-                }
-                else
-                {
-                    hb_log( "Subtitle pass-thru requested and input track is not compatible with container.  One track already burned, dropping track %d.", i );
-                    hb_list_rem( job->list_subtitle, subtitle );
-                    free( subtitle );
-                    continue;
-                }
-            }
-            /* Adjust output track number, in case we removed one.
-             * Output tracks sadly still need to be in sequential order.
-             * Note: out.track starts at 1, i starts at 0 */
-            subtitle->out_track = ++i;
-        }
-        if (one_burned)
-        {
-            // Add subtitle rendering filter
-            // Note that if the filter is already in the filter chain, this
-            // has no effect. Note also that this means the front-end is
-            // not required to add the subtitle rendering filter since
-            // we will always try to do it here.
-            hb_filter_object_t *filter = hb_filter_init(HB_FILTER_RENDER_SUB);
-            char *filter_settings      = hb_strdup_printf("%d:%d:%d:%d",
-                                                          job->crop[0],
-                                                          job->crop[1],
-                                                          job->crop[2],
-                                                          job->crop[3]);
-            hb_add_filter(job, filter, filter_settings);
-            free(filter_settings);
-        }
+        sanitize_subtitles( job );
     }
 
 #ifdef USE_QSV
@@ -730,6 +2005,7 @@ static void do_job(hb_job_t *job)
                 {
                     // validated, CPU-based filters
                     case HB_FILTER_ROTATE:
+                    case HB_FILTER_ANALYZE:
                     case HB_FILTER_RENDER_SUB:
                         encode_only = 1;
                         break;
@@ -822,6 +2098,7 @@ static void do_job(hb_job_t *job)
 
                     // then, validated filters
                     case HB_FILTER_ROTATE: // TODO: use Media SDK for this
+                    case HB_FILTER_ANALYZE:
                     case HB_FILTER_RENDER_SUB:
                         num_cpu_filters++;
                         break;
@@ -911,28 +2188,7 @@ static void do_job(hb_job_t *job)
         job->cfr = init.cfr;
     }
 
-    if( job->anamorphic.mode )
-    {
-        /* While x264 is smart enough to reduce fractions on its own, libavcodec and
-         * the MacGUI need some help with the math, so lose superfluous factors. */
-        hb_reduce( &job->anamorphic.par_width, &job->anamorphic.par_height,
-                    job->anamorphic.par_width,  job->anamorphic.par_height );
-        if( job->vcodec & HB_VCODEC_FFMPEG_MASK )
-        {
-            /* Just to make working with ffmpeg even more fun,
-             * lavc's MPEG-4 encoder can't handle PAR values >= 255,
-             * even though AVRational does. Adjusting downwards
-             * distorts the display aspect slightly, but such is life. */
-            while( ( job->anamorphic.par_width  & ~0xFF ) ||
-                   ( job->anamorphic.par_height & ~0xFF ) )
-            {
-                job->anamorphic.par_width  >>= 1;
-                job->anamorphic.par_height >>= 1;
-                hb_reduce( &job->anamorphic.par_width, &job->anamorphic.par_height,
-                            job->anamorphic.par_width,  job->anamorphic.par_height );
-            }
-        }
-    }
+    reduce_par( job );
 
 #ifdef USE_QSV
     if (hb_qsv_decode_is_enabled(job))
@@ -951,223 +2207,75 @@ static void do_job(hb_job_t *job)
         job->fifo_sync   = hb_fifo_init( FIFO_SMALL, FIFO_SMALL_WAKE );
         job->fifo_mpeg4  = hb_fifo_init( FIFO_LARGE, FIFO_LARGE_WAKE );
         job->fifo_render = NULL; // Attached to filter chain
-    }
 
-    /* Audio fifos must be initialized before sync */
-    if (!job->indepth_scan)
-    {
-        // apply Auto Passthru settings
-        hb_autopassthru_apply_settings(job);
-        // sanitize audio settings
-        for (i = 0; i < hb_list_count(job->list_audio);)
+        /* Frame spool: pass 1 records the output of the filter chain,
+         * pass 2 encodes from the recording and skips the filters. */
+        if (job->pass_spool && !job->indepth_scan)
         {
-            audio = hb_list_item(job->list_audio, i);
-            if (audio->config.out.codec == HB_ACODEC_AUTO_PASS)
-            {
-                // Auto Passthru should have been handled above
-                // remove track to avoid a crash
-                hb_log("Auto Passthru error, dropping track %d",
-                       audio->config.out.track);
-                hb_list_rem(job->list_audio, audio);
-                free(audio);
-                continue;
-            }
-            if ((audio->config.out.codec & HB_ACODEC_PASS_FLAG) &&
-                !(audio->config.in.codec &
-                  audio->config.out.codec & HB_ACODEC_PASS_MASK))
+            if (job->pass == 1)
             {
-                hb_log("Passthru requested and input codec is not the same as output codec for track %d, dropping track",
-                       audio->config.out.track);
-                hb_list_rem(job->list_audio, audio);
-                free(audio);
-                continue;
+                spool_write = 1;
             }
-            /* Adjust output track number, in case we removed one.
-             * Output tracks sadly still need to be in sequential order.
-             * Note: out.track starts at 1, i starts at 0 */
-            audio->config.out.track = ++i;
-        }
-
-        int best_mixdown    = 0;
-        int best_bitrate    = 0;
-        int best_samplerate = 0;
-
-        for (i = 0; i < hb_list_count(job->list_audio); i++)
-        {
-            audio = hb_list_item(job->list_audio, i);
-
-            /* set up the audio work structures */
-            audio->priv.fifo_raw  = hb_fifo_init(FIFO_SMALL, FIFO_SMALL_WAKE);
-            audio->priv.fifo_sync = hb_fifo_init(FIFO_SMALL, FIFO_SMALL_WAKE);
-            audio->priv.fifo_out  = hb_fifo_init(FIFO_LARGE, FIFO_LARGE_WAKE);
-            audio->priv.fifo_in   = hb_fifo_init(FIFO_LARGE, FIFO_LARGE_WAKE);
-
-            /* Passthru audio, nothing to sanitize here */
-            if (audio->config.out.codec & HB_ACODEC_PASS_FLAG)
-                continue;
-
-            /* Vorbis language information */
-            if (audio->config.out.codec == HB_ACODEC_VORBIS)
-                audio->priv.config.vorbis.language = audio->config.lang.simple;
-
-            /* sense-check the requested samplerate */
-            if (audio->config.out.samplerate < 0)
+            else if (job->pass == 2)
             {
-                // if not specified, set to same as input
-                audio->config.out.samplerate = audio->config.in.samplerate;
+                spool_read = hb_spool_available(job);
+                if (!spool_read)
+                {
+                    hb_log("work: no frame spool from first pass, filtering again");
+                }
             }
-            best_samplerate =
-                hb_audio_samplerate_get_best(audio->config.out.codec,
-                                             audio->config.out.samplerate,
-                                             NULL);
-            if (best_samplerate != audio->config.out.samplerate)
+            if (spool_write || spool_read)
             {
-                hb_log("work: sanitizing track %d unsupported samplerate %d Hz to %s kHz",
-                       audio->config.out.track, audio->config.out.samplerate,
-                       hb_audio_samplerate_get_name(best_samplerate));
-                audio->config.out.samplerate = best_samplerate;
+                fifo_spool = hb_fifo_init( FIFO_MINI, FIFO_MINI_WAKE );
             }
+        }
 
-            /* sense-check the requested mixdown */
-            if (audio->config.out.mixdown <= HB_AMIXDOWN_NONE)
+        /* Additional renditions branch off the end of the filter chain */
+        if (hb_list_count(job->list_rendition) > 0 && !job->indepth_scan)
+        {
+            if (job->pass == 0)
             {
-                /* Mixdown not specified, set the default mixdown */
-                audio->config.out.mixdown =
-                    hb_mixdown_get_default(audio->config.out.codec,
-                                           audio->config.in.channel_layout);
-                hb_log("work: mixdown not specified, track %d setting mixdown %s",
-                       audio->config.out.track,
-                       hb_mixdown_get_name(audio->config.out.mixdown));
+                renditions = 1;
             }
             else
             {
-                best_mixdown =
-                    hb_mixdown_get_best(audio->config.out.codec,
-                                        audio->config.in.channel_layout,
-                                        audio->config.out.mixdown);
-                if (audio->config.out.mixdown != best_mixdown)
-                {
-                    /* log the output mixdown */
-                    hb_log("work: sanitizing track %d mixdown %s to %s",
-                           audio->config.out.track,
-                           hb_mixdown_get_name(audio->config.out.mixdown),
-                           hb_mixdown_get_name(best_mixdown));
-                    audio->config.out.mixdown = best_mixdown;
-                }
+                hb_log("work: renditions require a single pass encode, ignoring");
             }
+        }
+    }
 
-            /* sense-check the requested compression level */
-            if (audio->config.out.compression_level < 0)
-            {
-                audio->config.out.compression_level =
-                    hb_audio_compression_get_default(audio->config.out.codec);
-                if (audio->config.out.compression_level >= 0)
-                {
-                    hb_log("work: compression level not specified, track %d setting compression level %.2f",
-                           audio->config.out.track,
-                           audio->config.out.compression_level);
-                }
-            }
-            else
+    /* The spooled frames already have the burned in subtitles, and
+     * rendersub, the only reader of their fifos, doesn't run.  Drop them
+     * before sync so that they are neither decoded nor queued. */
+    if (spool_read)
+    {
+        for (i = 0; i < hb_list_count(job->list_subtitle); )
+        {
+            subtitle = hb_list_item(job->list_subtitle, i);
+            if (subtitle->config.dest == RENDERSUB)
             {
-                float best_compression =
-                    hb_audio_compression_get_best(audio->config.out.codec,
-                                                  audio->config.out.compression_level);
-                if (best_compression != audio->config.out.compression_level)
-                {
-                    if (best_compression == -1)
-                    {
-                        hb_log("work: track %d, compression level not supported by codec",
-                               audio->config.out.track);
-                    }
-                    else
-                    {
-                        hb_log("work: sanitizing track %d compression level %.2f to %.2f",
-                               audio->config.out.track,
-                               audio->config.out.compression_level,
-                               best_compression);
-                    }
-                    audio->config.out.compression_level = best_compression;
-                }
+                hb_list_rem(job->list_subtitle, subtitle);
+                hb_subtitle_close(&subtitle);
+                continue;
             }
+            i++;
+        }
+    }
 
-            /* sense-check the requested quality */
-            if (audio->config.out.quality != HB_INVALID_AUDIO_QUALITY)
-            {
-                float best_quality =
-                    hb_audio_quality_get_best(audio->config.out.codec,
-                                              audio->config.out.quality);
-                if (best_quality != audio->config.out.quality)
-                {
-                    if (best_quality == HB_INVALID_AUDIO_QUALITY)
-                    {
-                        hb_log("work: track %d, quality mode not supported by codec",
-                               audio->config.out.track);
-                    }
-                    else
-                    {
-                        hb_log("work: sanitizing track %d quality %.2f to %.2f",
-                               audio->config.out.track,
-                               audio->config.out.quality, best_quality);
-                    }
-                    audio->config.out.quality = best_quality;
-                }
-            }
+    /* Audio fifos must be initialized before sync */
+    if (!job->indepth_scan)
+    {
+        sanitize_audio(job);
 
-            /* sense-check the requested bitrate */
-            if (audio->config.out.quality == HB_INVALID_AUDIO_QUALITY)
-            {
-                if (audio->config.out.bitrate <= 0)
-                {
-                    /* Bitrate not specified, set the default bitrate */
-                    audio->config.out.bitrate =
-                        hb_audio_bitrate_get_default(audio->config.out.codec,
-                                                     audio->config.out.samplerate,
-                                                     audio->config.out.mixdown);
-                    if (audio->config.out.bitrate > 0)
-                    {
-                        hb_log("work: bitrate not specified, track %d setting bitrate %d Kbps",
-                               audio->config.out.track,
-                               audio->config.out.bitrate);
-                    }
-                }
-                else
-                {
-                    best_bitrate =
-                        hb_audio_bitrate_get_best(audio->config.out.codec,
-                                                  audio->config.out.bitrate,
-                                                  audio->config.out.samplerate,
-                                                  audio->config.out.mixdown);
-                    if (best_bitrate > 0 &&
-                        best_bitrate != audio->config.out.bitrate)
-                    {
-                        /* log the output bitrate */
-                        hb_log("work: sanitizing track %d bitrate %d to %d Kbps",
-                               audio->config.out.track,
-                               audio->config.out.bitrate, best_bitrate);
-                    }
-                    audio->config.out.bitrate = best_bitrate;
-                }
-            }
+        for (i = 0; i < hb_list_count(job->list_audio); i++)
+        {
+            audio = hb_list_item(job->list_audio, i);
 
-            /* sense-check the requested dither */
-            if (hb_audio_dither_is_supported(audio->config.out.codec))
-            {
-                if (audio->config.out.dither_method ==
-                    hb_audio_dither_get_default())
-                {
-                    /* "auto", enable with default settings */
-                    audio->config.out.dither_method =
-                        hb_audio_dither_get_default_method();
-                }
-            }
-            else if (audio->config.out.dither_method !=
-                     hb_audio_dither_get_default())
-            {
-                /* specific dither requested but dithering not supported */
-                hb_log("work: track %d, dithering not supported by codec",
-                       audio->config.out.track);
-            }
+            /* set up the audio work structures */
+            audio->priv.fifo_raw  = hb_fifo_init(FIFO_SMALL, FIFO_SMALL_WAKE);
+            audio->priv.fifo_sync = hb_fifo_init(FIFO_SMALL, FIFO_SMALL_WAKE);
+            audio->priv.fifo_out  = hb_fifo_init(FIFO_LARGE, FIFO_LARGE_WAKE);
+            audio->priv.fifo_in   = hb_fifo_init(FIFO_LARGE, FIFO_LARGE_WAKE);
         }
     }
 
@@ -1215,7 +2323,16 @@ static void do_job(hb_job_t *job)
     /* Set up the video filter fifo pipeline */
     if( !job->indepth_scan )
     {
-        if( job->list_filter )
+        if( spool_read )
+        {
+            // Filters were already run by the first pass
+            w = hb_get_work( WORK_SPOOL_READ );
+            w->fifo_in  = job->fifo_sync;
+            w->fifo_out = fifo_spool;
+            hb_list_add( job->list_work, w );
+            job->fifo_render = fifo_spool;
+        }
+        else if( job->list_filter )
         {
             int filter_count = hb_list_count( job->list_filter );
             int i;
@@ -1230,6 +2347,15 @@ static void do_job(hb_job_t *job)
                 fifo_in = filter->fifo_out;
             }
             job->fifo_render = fifo_in;
+
+            if( spool_write )
+            {
+                w = hb_get_work( WORK_SPOOL_WRITE );
+                w->fifo_in  = job->fifo_render;
+                w->fifo_out = fifo_spool;
+                hb_list_add( job->list_work, w );
+                job->fifo_render = fifo_spool;
+            }
         }
         else if ( !job->list_filter )
         {
@@ -1237,36 +2363,14 @@ static void do_job(hb_job_t *job)
             job->fifo_render = NULL;
         }
 
-        /* Video encoder */
-        switch( job->vcodec )
+        if( renditions && job->fifo_render )
         {
-        case HB_VCODEC_FFMPEG_MPEG4:
-            w = hb_get_work( WORK_ENCAVCODEC );
-            w->codec_param = AV_CODEC_ID_MPEG4;
-            break;
-        case HB_VCODEC_FFMPEG_MPEG2:
-            w = hb_get_work( WORK_ENCAVCODEC );
-            w->codec_param = AV_CODEC_ID_MPEG2VIDEO;
-            break;
-        case HB_VCODEC_FFMPEG_VP8:
-            w = hb_get_work( WORK_ENCAVCODEC );
-            w->codec_param = AV_CODEC_ID_VP8;
-            break;
-        case HB_VCODEC_X264:
-            w = hb_get_work( WORK_ENCX264 );
-            break;
-        case HB_VCODEC_QSV_H264:
-            w = hb_get_work( WORK_ENCQSV );
-            break;
-        case HB_VCODEC_THEORA:
-            w = hb_get_work( WORK_ENCTHEORA );
-            break;
-#ifdef USE_X265
-        case HB_VCODEC_X265:
-            w = hb_get_work( WORK_ENCX265 );
-            break;
-#endif
+            ladder = ladder_init( job );
         }
+
+        /* Video encoder */
+        w = video_encoder( job );
+
         // Handle case where there are no filters.  
         // This really should never happen.
         if ( job->fifo_render )
@@ -1305,7 +2409,7 @@ static void do_job(hb_job_t *job)
             }
 
             /*
-            * Audio Encoder Thread
+            * Audio Encoder (runs on the audio pool)
             */
             if ( !(audio->config.out.codec & HB_ACODEC_PASS_FLAG ) )
             {
@@ -1325,7 +2429,13 @@ static void do_job(hb_job_t *job)
                 w->config   = &audio->priv.config;
                 w->audio    = audio;
 
-                hb_list_add( job->list_work, w );
+                // Encoders share a pool of threads rather than
+                // getting one each
+                if( audio_pool == NULL )
+                {
+                    audio_pool = hb_work_pool_init( &job->done );
+                }
+                hb_work_pool_add( audio_pool, w );
             }
         }
     }
@@ -1336,9 +2446,17 @@ static void do_job(hb_job_t *job)
         hb_log("work: only 1 chapter, disabling chapter markers");
     }
 
+    if( job->checkpoint > 0 && !job->indepth_scan )
+    {
+        checkpoint_setup( job, renditions );
+    }
+
     /* Display settings */
     hb_display_job_info( job );
 
+    attach_fifos( job );
+    size_fifos( job );
+
     /* Init read & write threads */
     if ( reader->init( reader, job ) )
     {
@@ -1352,7 +2470,7 @@ static void do_job(hb_job_t *job)
 
     job->done = 0;
 
-    if( job->list_filter && !job->indepth_scan )
+    if( job->list_filter && !job->indepth_scan && !spool_read )
     {
         int filter_count = hb_list_count( job->list_filter );
         int i;
@@ -1388,6 +2506,22 @@ static void do_job(hb_job_t *job)
                                     HB_LOW_PRIORITY );
     }
 
+    if( audio_pool != NULL &&
+        hb_work_pool_start( audio_pool, job,
+                            MAX( 1, hb_get_cpu_count() / 2 ) ) )
+    {
+        *job->done_error = HB_ERROR_INIT;
+        *job->die = 1;
+        goto cleanup;
+    }
+
+    if( ladder != NULL && ladder_start_video( job, ladder ) )
+    {
+        *job->done_error = HB_ERROR_INIT;
+        *job->die = 1;
+        goto cleanup;
+    }
+
     if ( job->indepth_scan )
     {
         muxer = NULL;
@@ -1408,14 +2542,26 @@ static void do_job(hb_job_t *job)
         sync->thread = hb_thread_init( sync->name, work_loop, sync,
                                     HB_LOW_PRIORITY );
 
+        if( ladder != NULL )
+        {
+            ladder_start_audio( job, ladder );
+        }
+
         // The muxer requires track information that's set up by the encoder
         // init routines so we have to init the muxer last.
         muxer = hb_muxer_init( job );
         w = muxer;
+
+        if( ladder != NULL && ladder_start_mux( job, ladder ) )
+        {
+            *job->done_error = HB_ERROR_INIT;
+            *job->die = 1;
+        }
     }
 
     hb_buffer_t      * buf_in, * buf_out = NULL;
 
+    hb_mem_set_stage( work_mem_stage( w ) );
     while ( !*job->die && !*w->done && w->status != HB_WORK_DONE )
     {
         buf_in = hb_fifo_get_wait( w->fifo_in );
@@ -1466,6 +2612,11 @@ static void do_job(hb_job_t *job)
     
     hb_log("work: average encoding speed for job is %f fps", state.param.working.rate_avg);
 
+    if( ladder != NULL )
+    {
+        ladder_wait( ladder );
+    }
+
     job->done = 1;
     if( muxer != NULL )
     {
@@ -1518,6 +2669,15 @@ cleanup:
 
     hb_list_close( &job->list_work );
 
+    /* Stop the audio encoders */
+    hb_work_pool_close( &audio_pool );
+
+    /* Close rendition branches */
+    ladder_close( &ladder );
+
+    hb_checkpoint_close( &job->checkpoint_state );
+    hb_stream_share_close( &job->stream_share );
+
     /* Stop the read thread */
     if( reader->thread != NULL )
     {
@@ -1531,6 +2691,7 @@ cleanup:
     hb_fifo_close( &job->fifo_raw );
     hb_fifo_close( &job->fifo_sync );
     hb_fifo_close( &job->fifo_mpeg4 );
+    hb_fifo_close( &fifo_spool );
 
     for( i = 0; i < hb_list_count( job->list_subtitle ); i++ )
     {
@@ -1648,11 +2809,22 @@ cleanup:
     {
         hb_ocl_close();
     }
-    
+
+    if( job->mem != NULL )
+    {
+        hb_state_t mem_state;
+
+        hb_mem_get_state( job->mem, &mem_state );
+        hb_log( "work: peak buffer memory %"PRId64" KiB",
+                mem_state.param.working.mem_peak / 1024 );
+    }
+    hb_mem_set_context( NULL, HB_MEM_STAGE_OTHER );
+    hb_mem_account_close( &job->mem );
+
     hb_job_close( &job );
 }
 
-static inline void copy_chapter( hb_buffer_t * dst, hb_buffer_t * src )
+void hb_copy_chapter( hb_buffer_t * dst, hb_buffer_t * src )
 {
     // Propagate any chapter breaks for the worker if and only if the
     // output frame has the same time stamp as the input frame (any
@@ -1678,6 +2850,7 @@ static void work_loop( void * _w )
     hb_work_object_t * w = _w;
     hb_buffer_t      * buf_in = NULL, * buf_out = NULL;
 
+    hb_mem_set_stage( work_mem_stage( w ) );
     while( !*w->done && w->status != HB_WORK_DONE )
     {
         buf_in = hb_fifo_get_wait( w->fifo_in );
@@ -1696,7 +2869,7 @@ static void work_loop( void * _w )
         buf_out = NULL;
         w->status = w->work( w, &buf_in, &buf_out );
 
-        copy_chapter( buf_out, buf_in );
+        hb_copy_chapter( buf_out, buf_in );
 
         if( buf_in )
         {
@@ -1747,6 +2920,7 @@ static void filter_loop( void * _f )
     hb_filter_object_t * f = _f;
     hb_buffer_t      * buf_in, * buf_out;
 
+    hb_mem_set_stage( HB_MEM_STAGE_FILTER );
     while( !*f->done && f->status != HB_FILTER_DONE )
     {
         buf_in = hb_fifo_get_wait( f->fifo_in );
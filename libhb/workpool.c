@@ -0,0 +1,287 @@
+/* workpool.c
+
+   Copyright (c) 2003-2014 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*
+ * Work object pool.
+ *
+ * Runs several work objects on a shared set of threads instead of one
+ * thread per object.  A thread claims an object that has input (or output
+ * waiting for room downstream), runs a batch of frames through it and then
+ * moves on to the next one.  An object is only ever run by one thread at a
+ * time, so the order of its frames is preserved.
+ *
+ * Used for the audio encoders: a job with many tracks otherwise keeps one
+ * mostly idle thread per track, while the pool lets a slow track use the
+ * cycles the others don't need.
+ *
+ * Idle threads wait on a condition that the fifos of the objects signal
+ * when a buffer is pushed or taken (see hb_fifo_set_wake).
+ */
+
+#include "hb.h"
+
+#define POOL_BATCH      8   // frames per object per dispatch
+#define POOL_TIMEOUT    200 // ms, only so that *done gets noticed
+
+typedef struct
+{
+    hb_work_object_t * w;
+    hb_buffer_t      * pending; // output waiting for room in fifo_out
+    int                busy;    // claimed by a pool thread
+    int                init;    // w->init succeeded
+    int                eof;     // w returned HB_WORK_DONE
+} pool_item_t;
+
+struct hb_work_pool_s
+{
+    hb_lock_t     * lock;
+    hb_cond_t     * cond_work;  // an object may have become ready
+    hb_list_t     * list_item;
+    int             next;       // where the next scan for work starts
+    int             thread_count;
+    hb_thread_t  ** threads;
+    volatile int  * done;
+};
+
+static void pool_loop( void * );
+
+hb_work_pool_t * hb_work_pool_init( volatile int * done )
+{
+    hb_work_pool_t * pool = calloc( 1, sizeof( hb_work_pool_t ) );
+
+    pool->lock      = hb_lock_init();
+    pool->cond_work = hb_cond_init();
+    pool->list_item = hb_list_init();
+    pool->done      = done;
+
+    return pool;
+}
+
+void hb_work_pool_add( hb_work_pool_t * pool, hb_work_object_t * w )
+{
+    pool_item_t * item = calloc( 1, sizeof( pool_item_t ) );
+
+    item->w = w;
+    hb_list_add( pool->list_item, item );
+}
+
+/*
+ * Initializes the work objects of the pool and starts thread_count
+ * threads to run them.  Returns 0 on success, -1 if a work object
+ * failed to initialize (no threads are started in that case).
+ */
+int hb_work_pool_start( hb_work_pool_t * pool, hb_job_t * job,
+                        int thread_count )
+{
+    int i;
+
+    for( i = 0; i < hb_list_count( pool->list_item ); i++ )
+    {
+        pool_item_t * item = hb_list_item( pool->list_item, i );
+
+        item->w->done = pool->done;
+        if( item->w->init( item->w, job ) )
+        {
+            hb_error( "Failure to initialise thread '%s'", item->w->name );
+            return -1;
+        }
+        item->init = 1;
+        hb_fifo_set_wake( item->w->fifo_in, pool->lock, pool->cond_work );
+        if( item->w->fifo_out != NULL )
+        {
+            hb_fifo_set_wake( item->w->fifo_out, pool->lock, pool->cond_work );
+        }
+    }
+
+    thread_count = MIN( thread_count, hb_list_count( pool->list_item ) );
+    if( thread_count < 1 )
+    {
+        return 0;
+    }
+    pool->thread_count = thread_count;
+    pool->threads = calloc( thread_count, sizeof( hb_thread_t * ) );
+    for( i = 0; i < thread_count; i++ )
+    {
+        pool->threads[i] = hb_thread_init( "work pool", pool_loop, pool,
+                                           HB_LOW_PRIORITY );
+    }
+    hb_log( "work: %d work objects on %d pool thread(s)",
+            hb_list_count( pool->list_item ), thread_count );
+
+    return 0;
+}
+
+/* Must be called after *done has been set */
+void hb_work_pool_close( hb_work_pool_t ** _pool )
+{
+    hb_work_pool_t * pool = *_pool;
+    pool_item_t    * item;
+    int              i;
+
+    if( pool == NULL )
+        return;
+
+    hb_lock( pool->lock );
+    hb_cond_broadcast( pool->cond_work );
+    hb_unlock( pool->lock );
+    for( i = 0; i < pool->thread_count; i++ )
+    {
+        hb_thread_close( &pool->threads[i] );
+    }
+    free( pool->threads );
+
+    while( ( item = hb_list_item( pool->list_item, 0 ) ) )
+    {
+        hb_list_rem( pool->list_item, item );
+        if( item->init )
+        {
+            hb_fifo_set_wake( item->w->fifo_in, NULL, NULL );
+            if( item->w->fifo_out != NULL )
+            {
+                hb_fifo_set_wake( item->w->fifo_out, NULL, NULL );
+            }
+        }
+        hb_buffer_close( &item->pending );
+        if( item->init )
+        {
+            item->w->close( item->w );
+        }
+        free( item->w );
+        free( item );
+    }
+    hb_list_close( &pool->list_item );
+    hb_cond_close( &pool->cond_work );
+    hb_lock_close( &pool->lock );
+
+    free( pool );
+    *_pool = NULL;
+}
+
+static int item_ready( pool_item_t * item )
+{
+    hb_work_object_t * w = item->w;
+
+    if( item->pending != NULL )
+    {
+        return !hb_fifo_is_full( w->fifo_out );
+    }
+    return hb_fifo_size( w->fifo_in ) > 0;
+}
+
+/*
+ * Claims the next object that can make progress, round robin.
+ * Called with pool->lock held.
+ */
+static pool_item_t * claim_item( hb_work_pool_t * pool )
+{
+    pool_item_t * item = NULL;
+    int           count, i;
+
+    count = hb_list_count( pool->list_item );
+    for( i = 0; i < count; i++ )
+    {
+        int           index = ( pool->next + i ) % count;
+        pool_item_t * it = hb_list_item( pool->list_item, index );
+
+        if( !it->busy && item_ready( it ) )
+        {
+            it->busy   = 1;
+            pool->next = index + 1;
+            item       = it;
+            break;
+        }
+    }
+
+    return item;
+}
+
+/* Same as the body of work_loop, without ever blocking */
+static void run_item( hb_work_pool_t * pool, pool_item_t * item )
+{
+    hb_work_object_t * w = item->w;
+    hb_buffer_t      * buf_in, * buf_out;
+    int                ii;
+
+    for( ii = 0; ii < POOL_BATCH && !*pool->done; ii++ )
+    {
+        if( item->pending != NULL )
+        {
+            if( hb_fifo_is_full( w->fifo_out ) )
+                break;
+            hb_fifo_push( w->fifo_out, item->pending );
+            item->pending = NULL;
+        }
+
+        buf_in = hb_fifo_get( w->fifo_in );
+        if( buf_in == NULL )
+            break;
+        if( item->eof )
+        {
+            // Consume data till the job completes so that residual
+            // data does not stall the pipeline
+            hb_buffer_close( &buf_in );
+            continue;
+        }
+
+        buf_out = NULL;
+        w->status = w->work( w, &buf_in, &buf_out );
+
+        hb_copy_chapter( buf_out, buf_in );
+        if( buf_in )
+        {
+            hb_buffer_close( &buf_in );
+        }
+        if( buf_out && w->fifo_out == NULL )
+        {
+            hb_buffer_close( &buf_out );
+        }
+        item->pending = buf_out;
+        if( w->status == HB_WORK_DONE )
+        {
+            item->eof = 1;
+        }
+    }
+
+    if( item->pending != NULL && !hb_fifo_is_full( w->fifo_out ) )
+    {
+        hb_fifo_push( w->fifo_out, item->pending );
+        item->pending = NULL;
+    }
+}
+
+static void pool_loop( void * _pool )
+{
+    hb_work_pool_t * pool = _pool;
+    pool_item_t    * item;
+
+    hb_mem_set_stage( HB_MEM_STAGE_ENCODE );
+    hb_lock( pool->lock );
+    while( !*pool->done )
+    {
+        // The fifos signal cond_work under pool->lock, so nothing that
+        // happens between claim_item and the wait gets lost
+        item = claim_item( pool );
+        if( item == NULL )
+        {
+            hb_cond_timedwait( pool->cond_work, pool->lock, POOL_TIMEOUT );
+            continue;
+        }
+        hb_unlock( pool->lock );
+        run_item( pool, item );
+        hb_lock( pool->lock );
+
+        item->busy = 0;
+        // Other threads passed it over while it was busy
+        if( item_ready( item ) )
+        {
+            hb_cond_signal( pool->cond_work );
+        }
+    }
+    hb_unlock( pool->lock );
+}
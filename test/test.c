@@ -45,6 +45,16 @@
 static int    debug       = HB_DEBUG_ALL;
 static int    update      = 0;
 static int    dvdnav      = 1;
+static int    seek_index  = 0;
+static int    fast_scan   = 0;
+static int    join_segments = 0;
+static int    mem_limit   = 0;
+static int    read_ahead  = HB_READ_AHEAD_DEFAULT;
+static int    checkpoint  = 0;
+static char * thumbnails  = NULL;
+static int    thumbnail_width = 160;
+static int    json_fd     = -1;
+static FILE * json        = NULL;
 static char * input       = NULL;
 static char * output      = NULL;
 static char * format      = NULL;
@@ -54,6 +64,8 @@ static int    main_feature = 0;
 static char * native_language = NULL;
 static int    native_dub  = 0;
 static int    twoPass     = 0;
+static int    pass_spool  = HB_SPOOL_NONE;
+static hb_list_t * renditions = NULL;
 static int    deinterlace           = 0;
 static char * deinterlace_opt       = 0;
 static int    deblock               = 0;
@@ -67,6 +79,8 @@ static char * decomb_opt            = 0;
 static int    rotate                = 0;
 static char * rotate_opt            = 0;
 static int    rotate_val            = 0;
+static int    analyze               = 0;
+static char * analyze_opt           = 0;
 static int    grayscale   = 0;
 static int    vcodec      = HB_VCODEC_FFMPEG_MPEG4;
 static hb_list_t * audios = NULL;
@@ -77,6 +91,7 @@ static char * mixdowns    = NULL;
 static char * dynamic_range_compression = NULL;
 static char * audio_gain  = NULL;
 static char ** audio_dither = NULL;
+static int    audio_resample = HB_RESAMPLE_MEDIUM;
 static char ** normalize_mix_level  = NULL;
 static char * atracks     = NULL;
 static char * arates      = NULL;
@@ -247,6 +262,7 @@ int main( int argc, char ** argv )
     hb_global_init();
 
     audios = hb_list_init();
+    renditions = hb_list_init();
 
     // Get utf8 command line if windows
     get_argv_utf8(&argc, &argv);
@@ -258,12 +274,27 @@ int main( int argc, char ** argv )
         return 1;
     }
 
+    if( json_fd >= 0 )
+    {
+        json = json_fd == STDOUT_FILENO ? stdout : fdopen( json_fd, "w" );
+        if( json == NULL )
+        {
+            fprintf( stderr, "cannot write progress to descriptor %d\n",
+                     json_fd );
+            return 1;
+        }
+    }
+
     /* Register our error handler */
     hb_register_error_handler(&hb_cli_error_handler);
 
     /* Init libhb */
     h = hb_init( debug, update );
     hb_dvd_set_dvdnav( dvdnav );
+    hb_scan_set_fast_probe( h, fast_scan );
+    hb_scan_set_join_segments( h, join_segments );
+    hb_scan_set_seek_index( h, seek_index );
+    hb_scan_set_thumbnails( h, thumbnails, thumbnail_width );
 
     /* Show version */
     fprintf( stderr, "%s - %s - %s\n",
@@ -637,6 +668,126 @@ static void apply_loose_crop(int total, int * v1, int * v2, int mod, int max)
     }
 }
 
+/****************************************************************************
+ * JsonEvents:
+ *
+ * With --json-progress, reports the state of libhb as one JSON object per
+ * line: scan progress, the start and end of each job (one per pass),
+ * encoding progress once a second and the result of the encode.
+ ****************************************************************************/
+static void JsonEvents( hb_handle_t * h, hb_state_t * s )
+{
+    static const char * const stage_names[HB_MEM_STAGE_COUNT] =
+    {
+        "other", "reader", "decode", "sync", "filter", "encode", "mux"
+    };
+    static int      last_state    = HB_STATE_IDLE;
+    static int      job_cur       = 0;  // job of the last job_start event
+    static int      sequence_id   = 0;
+    static uint64_t last_progress = 0;
+    uint64_t        now = hb_get_date();
+    int             i;
+
+    switch( s->state )
+    {
+#define p s->param.scanning
+        case HB_STATE_SCANNING:
+            if( now < last_progress + 1000 )
+                break;
+            last_progress = now;
+            fprintf( json, "{\"event\":\"scan_progress\",\"time\":%"PRIu64
+                     ",\"progress\":%.4f,\"title\":%d,\"titles\":%d}\n",
+                     now, p.progress, p.title_cur, p.title_count );
+            break;
+#undef p
+
+        case HB_STATE_SCANDONE:
+            if( last_state == HB_STATE_SCANDONE )
+                break;
+            fprintf( json, "{\"event\":\"scan_done\",\"time\":%"PRIu64
+                     ",\"titles\":%d}\n", now,
+                     hb_list_count( hb_get_titles( h ) ) );
+            last_progress = 0;
+            break;
+
+#define p s->param.working
+        case HB_STATE_SEARCHING:
+        case HB_STATE_WORKING:
+            if( p.job_cur != job_cur || p.sequence_id != sequence_id )
+            {
+                if( job_cur )
+                {
+                    fprintf( json, "{\"event\":\"job_end\",\"time\":%"PRIu64
+                             ",\"job\":%d,\"sequence_id\":%d}\n",
+                             now, job_cur, sequence_id );
+                }
+                job_cur       = p.job_cur;
+                sequence_id   = p.sequence_id;
+                last_progress = 0;
+                fprintf( json, "{\"event\":\"job_start\",\"time\":%"PRIu64
+                         ",\"job\":%d,\"jobs\":%d,\"sequence_id\":%d}\n",
+                         now, p.job_cur, p.job_count, p.sequence_id );
+            }
+            if( now < last_progress + 1000 )
+                break;
+            last_progress = now;
+            fprintf( json, "{\"event\":\"progress\",\"time\":%"PRIu64
+                     ",\"state\":\"%s\",\"job\":%d,\"jobs\":%d,"
+                     "\"progress\":%.4f,\"fps\":%.2f,\"avg_fps\":%.2f,"
+                     "\"eta\":%d,", now,
+                     s->state == HB_STATE_SEARCHING ? "searching" : "working",
+                     p.job_cur, p.job_count, p.progress, p.rate_cur,
+                     p.rate_avg, p.seconds > -1 ?
+                     p.hours * 3600 + p.minutes * 60 + p.seconds : -1 );
+            fprintf( json, "\"queues\":{" );
+            for( i = HB_MEM_STAGE_DECODE; i < HB_MEM_STAGE_COUNT; i++ )
+            {
+                fprintf( json, "%s\"%s\":%d", i > HB_MEM_STAGE_DECODE ? "," : "",
+                         stage_names[i], p.queue_depth[i] );
+            }
+            fprintf( json, "},\"mem\":{\"bytes\":%"PRId64",\"peak\":%"PRId64
+                     ",\"limit\":%"PRId64, p.mem_bytes, p.mem_peak,
+                     p.mem_limit );
+            for( i = 0; i < HB_MEM_STAGE_COUNT; i++ )
+            {
+                fprintf( json, ",\"%s\":%"PRId64, stage_names[i],
+                         p.mem_stage[i] );
+            }
+            fprintf( json, "},\"pool\":{\"bytes\":%"PRId64",\"idle\":%"PRId64
+                     "},\"rss\":%"PRId64"}\n", p.pool_bytes, p.pool_idle,
+                     hb_get_rss() );
+            break;
+#undef p
+
+        case HB_STATE_PAUSED:
+        case HB_STATE_MUXING:
+            if( last_state == s->state )
+                break;
+            fprintf( json, "{\"event\":\"%s\",\"time\":%"PRIu64"}\n",
+                     s->state == HB_STATE_PAUSED ? "paused" : "muxing", now );
+            break;
+
+#define p s->param.workdone
+        case HB_STATE_WORKDONE:
+            if( job_cur )
+            {
+                fprintf( json, "{\"event\":\"job_end\",\"time\":%"PRIu64
+                         ",\"job\":%d,\"sequence_id\":%d}\n",
+                         now, job_cur, sequence_id );
+                job_cur = 0;
+            }
+            fprintf( json, "{\"event\":\"done\",\"time\":%"PRIu64
+                     ",\"result\":\"%s\",\"error\":%d}\n", now,
+                     p.error == HB_ERROR_NONE     ? "done" :
+                     p.error == HB_ERROR_CANCELED ? "canceled" : "failed",
+                     p.error );
+            break;
+#undef p
+    }
+    last_state = s->state;
+    fflush( json );
+}
+
 static int HandleEvents( hb_handle_t * h )
 {
     hb_state_t s;
@@ -645,6 +796,17 @@ static int HandleEvents( hb_handle_t * h )
     int filter_cfr, filter_vrate, filter_vrate_base;
 
     hb_get_state( h, &s );
+    if( json != NULL )
+    {
+        JsonEvents( h, &s );
+
+        /* Progress only goes to the JSON stream */
+        if( s.state & ( HB_STATE_SCANNING | HB_STATE_SEARCHING |
+                        HB_STATE_WORKING | HB_STATE_MUXING ) )
+        {
+            return 0;
+        }
+    }
     switch( s.state )
     {
         case HB_STATE_IDLE:
@@ -751,6 +913,8 @@ static int HandleEvents( hb_handle_t * h )
                 break;
             }
 
+            /* Autocrop and interlace detection of a fast scanned title */
+            hb_scan_previews( h, title );
             PrintTitleInfo( title, title_set->feature );
 
             /* Set job settings */
@@ -1710,6 +1874,11 @@ static int HandleEvents( hb_handle_t * h )
                 filter = hb_filter_init( HB_FILTER_ROTATE );
                 hb_add_filter( job, filter, rotate_opt);
             }
+            if( analyze )
+            {
+                filter = hb_filter_init( HB_FILTER_ANALYZE );
+                hb_add_filter( job, filter, analyze_opt );
+            }
 
 
             if (maxWidth)
@@ -2528,6 +2697,14 @@ static int HandleEvents( hb_handle_t * h )
             }
             /* Audio Dither */
 
+            /* Audio Resampling */
+            for (i = 0; i < num_audio_tracks; i++)
+            {
+                audio = hb_list_audio_config_item(job->list_audio, i);
+                audio->out.resample_quality = audio_resample;
+            }
+            /* Audio Resampling */
+
             /* Audio Mix Normalization */
             i = 0;
             int norm = 0;
@@ -2880,6 +3057,26 @@ static int HandleEvents( hb_handle_t * h )
 
             hb_job_set_file( job, output );
 
+            job->mem_limit = mem_limit;
+            job->read_ahead = read_ahead;
+            job->checkpoint = checkpoint;
+
+            for( i = 0; i < hb_list_count( renditions ); i++ )
+            {
+                char * arg = hb_list_item( renditions, i );
+                int width, height, kbps, pos = 0;
+                hb_rendition_t * rendition;
+
+                sscanf( arg, "%d:%d:%d:%n", &width, &height, &kbps, &pos );
+                rendition = hb_job_add_rendition( job, &arg[pos],
+                                                  width, height );
+                if( rendition != NULL && kbps > 0 )
+                {
+                    rendition->vbitrate = kbps;
+                    rendition->vquality = -1.0;
+                }
+            }
+
             if( color_matrix_code )
             {
                 job->color_matrix_code = color_matrix_code;
@@ -2971,6 +3168,8 @@ static int HandleEvents( hb_handle_t * h )
                     job->fastfirstpass = 0;
                 }
 
+                job->pass_spool = pass_spool;
+
                 hb_add( h, job );
 
                 job->pass = 2;
@@ -3110,6 +3309,13 @@ static void ShowHelp()
     "    -z, --preset-list       See a list of available built-in presets\n"
     "        --no-dvdnav         Do not use dvdnav for reading DVDs\n"
     "    --no-opencl             Disable use of OpenCL\n"
+    "        --mem-limit <MiB>   Cap the memory held in frame and packet buffers\n"
+    "                            by each job. Queues between the stages shrink as\n"
+    "                            the cap is approached (default: no cap)\n"
+    "        --json-progress <fd>\n"
+    "                            Write progress to file descriptor <fd> (1 for\n"
+    "                            stdout) as JSON events, one per line, instead\n"
+    "                            of the progress line\n"
     "\n"
 
     "### Source Options-----------------------------------------------------------\n\n"
@@ -3127,11 +3333,28 @@ static void ShowHelp()
     "        --previews <#:B>    Select how many preview images are generated,\n"
     "                            and whether or not they're stored to disk (0 or 1).\n"
     "                            (default: 10:0)\n"
+    "        --thumbnails <prefix>\n"
+    "                            Tile the previews into JPEG sprite sheets with a\n"
+    "                            WebVTT index, <prefix>-<title>.vtt. Use --previews\n"
+    "                            to set how many thumbnails there are\n"
+    "        --thumbnail-width <px>\n"
+    "                            Width of a thumbnail (default: 160)\n"
     "    --start-at-preview <#>  Start encoding at a given preview.\n"
     "    --start-at    <unit:#>  Start encoding at a given frame, duration (in seconds),\n"
     "                            or pts (on a 90kHz clock)\n"
     "    --stop-at     <unit:#>  Stop encoding at a given frame, duration (in seconds),\n"
-    "                            or pts (on a 90kHz clock)"
+    "                            or pts (on a 90kHz clock)\n"
+    "        --seek-index        Index the keyframes of MPEG transport and program\n"
+    "                            streams for exact seeks and durations. The index\n"
+    "                            is kept next to the source in <input>.hbidx\n"
+    "        --fast-scan         Take the titles of MKV and MP4 files from their\n"
+    "                            headers without decoding previews. Autocrop and\n"
+    "                            interlace detection wait until a title is encoded\n"
+    "        --join-segments     Read a transport stream named like rec_001.ts\n"
+    "                            together with rec_002.ts, rec_003.ts, ... as one\n"
+    "                            source\n"
+    "        --read-ahead <KiB>  How much DVD or Blu-ray data to read ahead of\n"
+    "                            decoding, 0 to read as needed (default: 4096)\n"
     "\n"
 
     "### Destination Options------------------------------------------------------\n\n"
@@ -3157,6 +3380,12 @@ static void ShowHelp()
     "                            of data. Note: breaks pre-iOS iPod compatibility.\n"
     "    -O, --optimize          Optimize mp4 files for HTTP streaming (\"fast start\")\n"
     "    -I, --ipod-atom         Mark mp4 files so 5.5G iPods will accept them\n"
+    "        --checkpoint <sec>  Write the output in segments of at least <sec>\n"
+    "                            seconds and join them at the end. Running the\n"
+    "                            same command again after an interruption\n"
+    "                            resumes from the last complete segment.\n"
+    "                            Only with the libavformat muxers (av_mp4,\n"
+    "                            av_mkv), ignored with mp4v2 and libmkv\n"
     "    -P, --use-opencl        Use OpenCL where applicable\n"
     "    -U, --use-hwd           Use DXVA2 hardware decoding\n"
     "\n"
@@ -3209,6 +3438,15 @@ static void ShowHelp()
     "    -2, --two-pass          Use two-pass mode\n"
     "    -T, --turbo             When using 2-pass use \"turbo\" options on the\n"
     "                            1st pass to improve speed (only works with x264)\n"
+    "        --spool-first-pass  When using 2-pass, keep the filtered frames of\n"
+    "          <raw/deflate>     the 1st pass and encode the 2nd pass from them\n"
+    "                            instead of filtering again. Needs temporary disk\n"
+    "                            space, \"raw\" needs the most (default: deflate)\n"
+    "        --rendition         Also encode the video at another size into\n"
+    "          <W:H:kb/s:file>   another file, sharing decoding, filtering and\n"
+    "                            audio with the main output. Height 0 keeps the\n"
+    "                            aspect ratio, kb/s 0 uses the main rate control.\n"
+    "                            Can be given several times (single pass only)\n"
     "    -r, --rate              Set video framerate (" );
     rate = NULL;
     while ((rate = hb_video_framerate_get_next(rate)) != NULL)
@@ -3377,6 +3615,10 @@ static void ShowHelp()
         }
     }
     fprintf(out,
+    "        --aresample         Sample rate conversion quality for all audio\n"
+    "          <string>          tracks: best, medium (default), fast or linear.\n"
+    "                            Faster settings save CPU when many tracks are\n"
+    "                            resampled at a small cost in quality.\n"
     "    -A, --aname <string>    Audio track name(s),\n"
     "                            Separated by commas for more than one audio track.\n"
     "\n"
@@ -3444,6 +3686,10 @@ if (hb_qsv_available())
      "          <QP:M>            (default 5:2)\n"
      "        --rotate            Flips images axes\n"
      "          <M>               (default 3)\n"
+     "        --analyze           Find scene changes before encoding and place\n"
+     "          <P>               keyframes there instead of letting the encoder\n"
+     "                            search for them. A scene change needs P percent\n"
+     "                            of the picture to change (default 50)\n"
     "    -g, --grayscale         Grayscale encoding\n"
     "\n"
 
@@ -3671,6 +3917,19 @@ static int ParseOptions( int argc, char ** argv )
     #define QSV_BASELINE         295
     #define QSV_ASYNC_DEPTH      296
     #define QSV_IMPLEMENTATION   297
+    #define SPOOL_FIRST_PASS     298
+    #define ANALYZE_FILTER       299
+    #define RENDITION            300
+    #define AUDIO_RESAMPLE       301
+    #define SEEK_INDEX           302
+    #define MEM_LIMIT            303
+    #define READ_AHEAD           304
+    #define FAST_SCAN            305
+    #define JSON_PROGRESS        306
+    #define JOIN_SEGMENTS        307
+    #define CHECKPOINT           308
+    #define THUMBNAILS           309
+    #define THUMBNAIL_WIDTH      310
 
     for( ;; )
     {
@@ -3680,7 +3939,13 @@ static int ParseOptions( int argc, char ** argv )
             { "update",      no_argument,       NULL,    'u' },
             { "verbose",     optional_argument, NULL,    'v' },
             { "no-dvdnav",   no_argument,       NULL,    DVDNAV },
+            { "seek-index",  no_argument,       NULL,    SEEK_INDEX },
+            { "fast-scan",   no_argument,       NULL,    FAST_SCAN },
+            { "join-segments", no_argument,     NULL,    JOIN_SEGMENTS },
             { "no-opencl",   no_argument,       NULL,    NO_OPENCL },
+            { "mem-limit",   required_argument, NULL,    MEM_LIMIT },
+            { "read-ahead",  required_argument, NULL,    READ_AHEAD },
+            { "json-progress", required_argument, NULL,  JSON_PROGRESS },
 
 #ifdef USE_QSV
             { "qsv-baseline",         no_argument,       NULL,        QSV_BASELINE,       },
@@ -3695,6 +3960,7 @@ static int ParseOptions( int argc, char ** argv )
             { "large-file",  no_argument,       NULL,    '4' },
             { "optimize",    no_argument,       NULL,    'O' },
             { "ipod-atom",   no_argument,       NULL,    'I' },
+            { "checkpoint",  required_argument, NULL,    CHECKPOINT },
             { "use-opencl",  no_argument,       NULL,    'P' },
             { "use-hwd",     no_argument,       NULL,    'U' },
 
@@ -3711,6 +3977,7 @@ static int ParseOptions( int argc, char ** argv )
             { "drc",         required_argument, NULL,    'D' },
             { "gain",        required_argument, NULL,    AUDIO_GAIN },
             { "adither",     required_argument, NULL,    AUDIO_DITHER },
+            { "aresample",   required_argument, NULL,    AUDIO_RESAMPLE },
             { "subtitle",    required_argument, NULL,    's' },
             { "subtitle-forced", optional_argument,   NULL,    'F' },
             { "subtitle-burned", optional_argument,   NULL,    SUB_BURNED },
@@ -3733,6 +4000,7 @@ static int ParseOptions( int argc, char ** argv )
             { "decomb",      optional_argument, NULL,    '5' },
             { "grayscale",   no_argument,       NULL,    'g' },
             { "rotate",      optional_argument, NULL,   ROTATE_FILTER },
+            { "analyze",     optional_argument, NULL,   ANALYZE_FILTER },
             { "strict-anamorphic",  no_argument, &anamorphic_mode, 1 },
             { "loose-anamorphic", no_argument, &anamorphic_mode, 2 },
             { "custom-anamorphic", no_argument, &anamorphic_mode, 3 },
@@ -3776,6 +4044,8 @@ static int ParseOptions( int argc, char ** argv )
             { "rate",        required_argument, NULL,    'r' },
             { "arate",       required_argument, NULL,    'R' },
             { "turbo",       no_argument,       NULL,    'T' },
+            { "spool-first-pass", optional_argument, NULL, SPOOL_FIRST_PASS },
+            { "rendition",   required_argument, NULL,    RENDITION },
             { "maxHeight",   required_argument, NULL,    'Y' },
             { "maxWidth",    required_argument, NULL,    'X' },
             { "preset",      required_argument, NULL,    'Z' },
@@ -3784,6 +4054,8 @@ static int ParseOptions( int argc, char ** argv )
             { "aname",       required_argument, NULL,    'A' },
             { "color-matrix",required_argument, NULL,    'M' },
             { "previews",    required_argument, NULL,    PREVIEWS },
+            { "thumbnails",  required_argument, NULL,    THUMBNAILS },
+            { "thumbnail-width", required_argument, NULL, THUMBNAIL_WIDTH },
             { "start-at-preview", required_argument, NULL, START_AT_PREVIEW },
             { "start-at",    required_argument, NULL,    START_AT },
             { "stop-at",    required_argument, NULL,     STOP_AT },
@@ -3840,6 +4112,48 @@ static int ParseOptions( int argc, char ** argv )
             case DVDNAV:
                 dvdnav = 0;
                 break;
+            case SEEK_INDEX:
+                seek_index = 1;
+                break;
+            case FAST_SCAN:
+                fast_scan = 1;
+                break;
+            case JOIN_SEGMENTS:
+                join_segments = 1;
+                break;
+            case JSON_PROGRESS:
+                json_fd = atoi( optarg );
+                if( json_fd < 1 )
+                {
+                    fprintf( stderr, "invalid json-progress descriptor (%s)\n",
+                             optarg );
+                    return -1;
+                }
+                break;
+            case CHECKPOINT:
+                checkpoint = atoi( optarg );
+                if( checkpoint < 0 )
+                {
+                    fprintf( stderr, "invalid checkpoint interval (%s)\n", optarg );
+                    return -1;
+                }
+                break;
+            case READ_AHEAD:
+                read_ahead = atoi( optarg );
+                if( read_ahead < 0 )
+                {
+                    fprintf( stderr, "invalid read-ahead (%s)\n", optarg );
+                    return -1;
+                }
+                break;
+            case MEM_LIMIT:
+                mem_limit = atoi( optarg );
+                if( mem_limit < 0 )
+                {
+                    fprintf( stderr, "invalid memory limit (%s)\n", optarg );
+                    return -1;
+                }
+                break;
 
             case 'f':
                 format = strdup( optarg );
@@ -3957,6 +4271,29 @@ static int ParseOptions( int argc, char ** argv )
                     audio_dither = str_split(optarg, ',');
                 }
                 break;
+            case AUDIO_RESAMPLE:
+                if (!strcasecmp(optarg, "best"))
+                {
+                    audio_resample = HB_RESAMPLE_BEST;
+                }
+                else if (!strcasecmp(optarg, "medium"))
+                {
+                    audio_resample = HB_RESAMPLE_MEDIUM;
+                }
+                else if (!strcasecmp(optarg, "fast"))
+                {
+                    audio_resample = HB_RESAMPLE_FAST;
+                }
+                else if (!strcasecmp(optarg, "linear"))
+                {
+                    audio_resample = HB_RESAMPLE_LINEAR;
+                }
+                else
+                {
+                    fprintf(stderr, "invalid resample quality (%s)\n", optarg);
+                    return -1;
+                }
+                break;
             case NORMALIZE_MIX:
                 if( optarg != NULL )
                 {
@@ -4121,6 +4458,13 @@ static int ParseOptions( int argc, char ** argv )
                 }
                 rotate = 1;
                 break;
+            case ANALYZE_FILTER:
+                if( optarg != NULL )
+                {
+                    analyze_opt = strdup( optarg );
+                }
+                analyze = 1;
+                break;
             case DISPLAY_WIDTH:
                 if( optarg != NULL )
                 {
@@ -4258,6 +4602,35 @@ static int ParseOptions( int argc, char ** argv )
             case 'T':
                 turbo_opts_enabled = 1;
                 break;
+            case SPOOL_FIRST_PASS:
+                if( optarg == NULL || !strcasecmp( optarg, "deflate" ) )
+                {
+                    pass_spool = HB_SPOOL_DEFLATE;
+                }
+                else if( !strcasecmp( optarg, "raw" ) )
+                {
+                    pass_spool = HB_SPOOL_RAW;
+                }
+                else
+                {
+                    fprintf( stderr, "invalid spool mode (%s)\n", optarg );
+                    return -1;
+                }
+                break;
+            case RENDITION:
+            {
+                int width, height, kbps, pos = 0;
+
+                if( sscanf( optarg, "%d:%d:%d:%n",
+                            &width, &height, &kbps, &pos ) < 3 ||
+                    pos == 0 || optarg[pos] == 0 || width <= 0 )
+                {
+                    fprintf( stderr, "invalid rendition (%s), expected "
+                             "<width:height:kb/s:file>\n", optarg );
+                    return -1;
+                }
+                hb_list_add( renditions, strdup( optarg ) );
+            } break;
             case 'Y':
                 maxHeight = atoi( optarg );
                 break;
@@ -4273,6 +4646,17 @@ static int ParseOptions( int argc, char ** argv )
             case PREVIEWS:
                 sscanf( optarg, "%i:%i", &preview_count, &store_previews );
                 break;
+            case THUMBNAILS:
+                thumbnails = strdup( optarg );
+                break;
+            case THUMBNAIL_WIDTH:
+                thumbnail_width = atoi( optarg );
+                if( thumbnail_width < 2 )
+                {
+                    fprintf( stderr, "invalid thumbnail width (%s)\n", optarg );
+                    return -1;
+                }
+                break;
             case START_AT_PREVIEW:
                 start_at_preview = atoi( optarg );
                 break;
@@ -84,6 +84,24 @@ namespace HandBrake.Interop.HbLib
 		[DllImport("hb.dll", EntryPoint = "hb_scan_stop", CallingConvention = CallingConvention.Cdecl)]
 		public static extern void hb_scan_stop(IntPtr hbHandle);
 
+		/// Return Type: void
+		///param0: hb_handle_t*
+		///enable: int
+		[DllImport("hb.dll", EntryPoint = "hb_scan_set_fast_probe", CallingConvention = CallingConvention.Cdecl)]
+		public static extern void hb_scan_set_fast_probe(IntPtr hbHandle, int enable);
+
+		/// Return Type: void
+		///param0: hb_handle_t*
+		///enable: int
+		[DllImport("hb.dll", EntryPoint = "hb_scan_set_join_segments", CallingConvention = CallingConvention.Cdecl)]
+		public static extern void hb_scan_set_join_segments(IntPtr hbHandle, int enable);
+
+		/// Return Type: int
+		///param0: hb_handle_t*
+		///param1: hb_title_t*
+		[DllImport("hb.dll", EntryPoint = "hb_scan_previews", CallingConvention = CallingConvention.Cdecl)]
+		public static extern int hb_scan_previews(IntPtr hbHandle, IntPtr title);
+
 		/// Return Type: hb_list_t*
 		///param0: hb_handle_t*
 		[DllImport("hb.dll", EntryPoint = "hb_get_titles", CallingConvention = CallingConvention.Cdecl)]
@@ -97,6 +115,20 @@ namespace HandBrake.Interop.HbLib
 		[DllImport("hb.dll", EntryPoint = "hb_get_preview", CallingConvention = CallingConvention.Cdecl)]
 		public static extern void hb_get_preview(IntPtr hbHandle, ref hb_job_s title, int preview, IntPtr buffer);
 
+		/// Return Type: int
+		///param0: hb_handle_t*
+		///param1: hb_job_t*
+		///picture: int
+		///x: int
+		///y: int
+		///width: int
+		///height: int
+		///buffer: uint8_t*
+		///out_width: int
+		///out_height: int
+		[DllImport("hb.dll", EntryPoint = "hb_get_preview_region", CallingConvention = CallingConvention.Cdecl)]
+		public static extern int hb_get_preview_region(IntPtr hbHandle, ref hb_job_s job, int preview, int x, int y, int width, int height, IntPtr buffer, int outWidth, int outHeight);
+
 
 		/// Return Type: void
 		///param0: hb_job_t*
@@ -420,6 +452,10 @@ namespace HandBrake.Interop.HbLib
 		[DllImport("hb.dll", EntryPoint = "hb_job_close", CallingConvention = CallingConvention.Cdecl)]
 		public static extern void hb_job_close(IntPtr job);
 
+		///hb_job_t * hb_job_validate( hb_job_t * job );
+		[DllImport("hb.dll", EntryPoint = "hb_job_validate", CallingConvention = CallingConvention.Cdecl)]
+		public static extern IntPtr hb_job_validate(ref hb_job_s job);
+
 		///void hb_job_set_advanced_opts( hb_job_t *job, const char *advanced_opts );
         [DllImport("hb.dll", EntryPoint = "hb_job_set_encoder_options", CallingConvention = CallingConvention.Cdecl)]
         public static extern void hb_job_set_encoder_options(ref hb_job_s job, IntPtr advanced_opts);
@@ -73,6 +73,8 @@ namespace HandBrake.Interop.HbLib
 
 		public int dither_method;
 
+		public int resample_quality;
+
 		public IntPtr name;
 
 		public int delay;
@@ -90,6 +90,9 @@ namespace HandBrake.Interop.HbLib
 
 		public int fastfirstpass;
 
+		/// int
+		public int pass_spool;
+
         public IntPtr encoder_preset;
 
         public IntPtr encoder_tune;
@@ -125,6 +128,8 @@ namespace HandBrake.Interop.HbLib
 
 		public IntPtr list_attachment;
 
+		public IntPtr list_rendition;
+
 		public IntPtr metadata;
 
 		/// int
@@ -179,6 +184,12 @@ namespace HandBrake.Interop.HbLib
 
 		public int use_detelecine;
 
+		public int mem_limit;
+
+		public int read_ahead;
+
+		public int checkpoint;
+
 		public qsv_s qsv;
 
 		// Padding for the part of the struct we don't care about marshaling.
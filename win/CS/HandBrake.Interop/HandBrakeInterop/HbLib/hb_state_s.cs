@@ -78,6 +78,63 @@ namespace HandBrake.Interop.HbLib
 
 		/// int
 		public int sequence_id;
+
+		/// int64_t
+		public long mem_bytes;
+
+		/// int64_t
+		public long mem_peak;
+
+		/// int64_t
+		public long mem_limit;
+
+		/// int64_t
+		public long mem_stage_other;
+
+		/// int64_t
+		public long mem_stage_reader;
+
+		/// int64_t
+		public long mem_stage_decode;
+
+		/// int64_t
+		public long mem_stage_sync;
+
+		/// int64_t
+		public long mem_stage_filter;
+
+		/// int64_t
+		public long mem_stage_encode;
+
+		/// int64_t
+		public long mem_stage_mux;
+
+		/// int
+		public int queue_depth_other;
+
+		/// int
+		public int queue_depth_reader;
+
+		/// int
+		public int queue_depth_decode;
+
+		/// int
+		public int queue_depth_sync;
+
+		/// int
+		public int queue_depth_filter;
+
+		/// int
+		public int queue_depth_encode;
+
+		/// int
+		public int queue_depth_mux;
+
+		/// int64_t
+		public long pool_bytes;
+
+		/// int64_t
+		public long pool_idle;
 	}
 
 	[StructLayout(LayoutKind.Sequential)]
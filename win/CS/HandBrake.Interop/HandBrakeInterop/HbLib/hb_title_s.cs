@@ -57,6 +57,9 @@ namespace HandBrake.Interop.HbLib
 
 		public IntPtr opaque_priv;
 
+		/// hb_stream_index_t*
+		public IntPtr seek_index;
+
 		/// int
 		public int hours;
 
@@ -110,6 +113,9 @@ namespace HandBrake.Interop.HbLib
 
 		public int pcr_pid;
 
+		/// int
+		public int ts_program;
+
 		/// int
 		public int video_id;
 